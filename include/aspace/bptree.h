@@ -0,0 +1,199 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh,
+ * 			Brian Suchy, Peter Dinda
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+/*
+ * B+ Tree --- CARAT Runtime --- allocation map backend
+ *
+ * A wide-fanout B+ tree keyed on allocation address. Leaves keep their
+ * keys in a packed array (separate from the allocation_entry objects), so
+ * a lower bound search touches a handful of cache lines per level, and
+ * leaves are chained so that in-order iteration walks contiguous arrays.
+ *
+ * NOTE --- allocation_entry objects live *inside* the leaves, so a pointer
+ * to an entry is only valid until the next insert/remove on the tree
+ */
+#pragma once
+
+#include <nautilus/nautilus.h>
+#include <aspace/carat.h>
+#include <aspace/slab.h>
+
+
+/*
+ * Geometry --- leaf keys fill 4 cache lines, inner nodes ~8
+ */
+#define CARAT_BPTREE_LEAF_SLOTS 32
+#define CARAT_BPTREE_FANOUT 32
+#define CARAT_BPTREE_MAX_HEIGHT 16
+
+
+typedef struct carat_bptree_leaf_t {
+
+    /*
+     * Sorted keys (allocation addresses) and their entries ---
+     * keys[i] == (uintptr_t) entries[i].pointer
+     */
+    uintptr_t keys[CARAT_BPTREE_LEAF_SLOTS];
+    allocation_entry entries[CARAT_BPTREE_LEAF_SLOTS];
+    uint32_t num_keys;
+
+    /*
+     * Leaf chain for in-order iteration and predecessor lookups
+     */
+    struct carat_bptree_leaf_t *prev;
+    struct carat_bptree_leaf_t *next;
+
+} carat_bptree_leaf;
+
+
+typedef struct carat_bptree_inner_t {
+
+    /*
+     * children[i] holds keys < keys[i] <= children[i + 1]
+     */
+    uintptr_t keys[CARAT_BPTREE_FANOUT - 1];
+    void *children[CARAT_BPTREE_FANOUT];
+    uint32_t num_children;
+
+} carat_bptree_inner;
+
+
+typedef struct carat_bptree_t {
+
+    /*
+     * @height == 0 means @root is a leaf
+     */
+    void *root;
+    uint32_t height;
+    uint64_t size;
+
+    /*
+     * Leftmost leaf --- start of in-order iteration
+     */
+    carat_bptree_leaf *first;
+
+    /*
+     * Node slabs --- destroying the tree releases them in bulk
+     */
+    carat_slab_cache *leaf_slab;
+    carat_slab_cache *inner_slab;
+
+} carat_bptree;
+
+
+/*
+ * Build/teardown
+ */
+carat_bptree *carat_bptree_create(void);
+void carat_bptree_destroy(carat_bptree *tree);
+
+
+/*
+ * Insert a copy of @entry keyed on @entry->pointer --- an existing
+ * entry with the same key is replaced. Returns 0 on success
+ */
+int carat_bptree_insert(carat_bptree *tree, allocation_entry *entry);
+
+
+/*
+ * Build the tree from @num_entries copies of @entries, which must be 
+ * sorted by (distinct) pointer --- bottom up, with no per-entry descent.
+ * Returns -1 (and does nothing) if the tree is not empty
+ */
+int carat_bptree_bulk_load(carat_bptree *tree, allocation_entry *entries, uint64_t num_entries);
+
+
+/*
+ * Remove the entry keyed on @key --- returns 0 on success,
+ * -1 if there is no such entry
+ */
+int carat_bptree_remove(carat_bptree *tree, uintptr_t key);
+
+
+/*
+ * Return the entry with the greatest key <= @key, or NULL
+ */
+allocation_entry *carat_bptree_lower_bound(carat_bptree *tree, uintptr_t key);
+
+
+/*
+ * Return the entry whose allocation contains @addr, or NULL
+ */
+static inline allocation_entry *carat_bptree_find(carat_bptree *tree, uintptr_t addr)
+{
+    allocation_entry *entry = carat_bptree_lower_bound(tree, addr);
+    if (entry && (addr < (((uintptr_t) entry->pointer) + entry->size))) { return entry; }
+
+    return NULL;
+}
+
+
+/*
+ * In-order iteration over the leaf chain
+ */
+typedef struct carat_bptree_iter_t {
+    carat_bptree_leaf *leaf;
+    uint32_t index;
+} carat_bptree_iter;
+
+static inline void carat_bptree_iter_begin(carat_bptree *tree, carat_bptree_iter *it)
+{
+    it->leaf = tree->first;
+    it->index = 0;
+
+    /*
+     * Only an empty root leaf can have no keys
+     */
+    if (it->leaf && !(it->leaf->num_keys)) { it->leaf = NULL; }
+}
+
+static inline int carat_bptree_iter_valid(carat_bptree_iter *it)
+{
+    return it->leaf != NULL;
+}
+
+static inline void carat_bptree_iter_next(carat_bptree_iter *it)
+{
+    it->index++;
+    if (it->index >= it->leaf->num_keys) {
+        it->leaf = it->leaf->next;
+        it->index = 0;
+    }
+}
+
+static inline allocation_entry *carat_bptree_iter_entry(carat_bptree_iter *it)
+{
+    return &(it->leaf->entries[it->index]);
+}
+
+
+/*
+ * Position @it at the entry with the smallest key >= @key (invalid if
+ * there is none) --- for iterating over a range of addresses
+ */
+void carat_bptree_iter_seek(carat_bptree *tree, uintptr_t key, carat_bptree_iter *it);
@@ -107,7 +107,19 @@
  */ 
 #define ONE_MB 1048576
 #define THIRTY_TWO_GB 0x800000000ULL
-#define ESCAPE_WINDOW_SIZE ONE_MB
+#define ESCAPE_WINDOW_BYTES (NAUT_CONFIG_CARAT_ESCAPE_WINDOW_KB * 1024UL)
+#define ESCAPE_WINDOW_SIZE (ESCAPE_WINDOW_BYTES / sizeof(void *))
+#define ESCAPE_BUFFER_MIN_SIZE 16384
+#define ESCAPE_LOG_BLOCK 64 /* escapes per block of the compressed log */
+#define ESCAPE_LOG_MAX_RECORD 10 /* bytes, a 64-bit varint */
+#define ESCAPE_LOG_SLACK 16 /* bytes past the end, so decoding can read whole words */
+#define ESCAPE_LOG_DECODE_CHUNK 1024 /* escapes decoded at a time */
+#define ESCAPE_FILTER_SLOTS 512
+#define ESCAPE_PARALLEL_DRAIN_MIN 4096
+#define CARAT_ESCAPE_DRAIN_SERIAL 0
+#define CARAT_ESCAPE_DRAIN_PARALLEL 1
+#define CARAT_MIGRATION_STOP_WORLD 0
+#define CARAT_MIGRATION_CONCURRENT 1
 
 
 /*
@@ -131,20 +143,108 @@
 /*
  * Typedefs for CARAT data structures
  */ 
-typedef mm_rb_tree_t nk_carat_escape_set;
+typedef struct carat_escape_set_t nk_carat_escape_set;
+#ifdef NAUT_CONFIG_ASPACE_CARAT_ALLOCATION_MAP_BPTREE
+typedef struct carat_bptree_t nk_carat_allocation_map;
+#else
 typedef mm_rb_tree_t nk_carat_allocation_map;
+#endif
+
+
+/*
+ * carat_escape_buffer
+ *
+ * - Per-CPU slice of the escape window
+ * - Only the owning CPU appends to its buffer (with interrupts off), so 
+ *   recording an escape needs no atomics and touches no shared cache lines
+ * - A buffer is drained into the allocation map by its owner when it fills
+ *   up, and all buffers are merged when a move or a defrag needs a complete
+ *   view of the escapes (with the world stopped)
+ */
+typedef struct carat_escape_buffer_t {
+
+    /*
+     * Escapes recorded on this CPU --- @capacity is in escapes for the 
+     * flat window, in bytes of @log for the compressed one
+     */
+#ifdef NAUT_CONFIG_CARAT_COMPRESSED_ESCAPE_LOG
+    /*
+     * Compressed log --- blocks of ESCAPE_LOG_BLOCK escapes, each stored
+     * as a zigzag varint of its distance from the previous one (from 0 
+     * at the start of a block, so blocks decode independently). @blocks
+     * holds the offset of each block in @log, and @decoded is scratch 
+     * for ESCAPE_LOG_DECODE_CHUNK decoded escapes
+     */
+    uint8_t *log;
+    uint64_t log_bytes;
+    uintptr_t last_escape;
+    uint32_t *blocks;
+    void ***decoded;
+#else
+    void ***escapes;
+#endif
+    uint64_t total_escape_entries;
+    uint64_t capacity;
+
+    /*
+     * Set while the owner is draining this buffer --- escapes produced 
+     * by the runtime itself during the drain are not recorded
+     */
+    int draining;
+
+    /*
+     * Lossy, direct-mapped filter of recently processed escape locations
+     * (ESCAPE_FILTER_SLOTS entries), cleared at the start of each drain ---
+     * drops repeated escapes before they reach the escape sets
+     */
+    void ***filter;
+
+} __attribute__((aligned(64))) carat_escape_buffer;
+
+
+/*
+ * carat_escape_record
+ *
+ * - One pending escape set insertion, produced by the lookup phase of a
+ *   parallel drain and applied by the insertion phase
+ * - @key is the escape location, or the offset of the escape within
+ *   @entry when @contained is set
+ */
+typedef struct carat_escape_record_t {
+    struct allocation_entry_t *entry;
+    uintptr_t key;
+    uint32_t contained;
+    uint32_t shard;
+} carat_escape_record;
+
+
+/*
+ * carat_drain_worker
+ *
+ * - Records produced by one worker during a parallel drain, tagged with
+ *   the shard of allocation entries (by entry address) they belong to
+ * - @records holds them as produced, @sorted grouped by shard, where
+ *   shard s is [shard_start[s], shard_start[s + 1])
+ * - The context holds one of these per escape buffer. The arrays are 
+ *   sized by the stopper before the workers run, so the stopped CPUs 
+ *   never allocate
+ */
+typedef struct carat_drain_worker_t {
+    carat_escape_record *records;
+    carat_escape_record *sorted;
+    uint64_t *shard_start;
+    uint64_t count;
+    uint64_t capacity;
+} __attribute__((aligned(64))) carat_drain_worker;
 
 
 /*
  * carat_context
  * 
- * - Main, global context for CARAT in the kernel
- * - Contains the global allocation map, escape window information, and 
+ * - One per CARAT aspace (the kernel's included), built along with it
+ *   and released in one step when it is destroyed
+ * - Contains the aspace's allocation map, escape window information, and 
  *   state from initialization and about stack allocation tracking
- * 
- * NOTE --- this is an ENGINEERING fix --- it is possible that a global
- * context will create more resource pressure, cache misses, and other 
- * underlying inefficiencies than the original design (scattered globals)
  */
 
 typedef struct carat_context_t {
@@ -168,11 +268,57 @@ typedef struct carat_context_t {
      *   void **escape = a; // an escape
      *   void ***escape_window = [escape, escape, escape, ...] // an array of escapes
      * 
-     * - Statistics --- total_escape_entries is a counter helps with batch processing,
-     *                  indicating how many escapes are yet to be processed
+     * - The window is split into one carat_escape_buffer per CPU (indexed by
+     *   CPU id), each with its own counter of escapes yet to be processed
+     * - escape_lock serializes buffer-full drains from different CPUs with
+     *   each other and with the tracking calls (malloc, free, ...), since
+     *   they all update the same allocation map (see CARAT_MAP_LOCK)
      */ 
-    void ***escape_window;
-    uint64_t total_escape_entries;
+    carat_escape_buffer *escape_buffers;
+    uint64_t num_escape_buffers;
+    spinlock_t escape_lock;
+
+
+    /*
+     * Per-worker state of a parallel drain (see carat_escape_drain_mode)
+     */
+    carat_drain_worker *drain_workers;
+
+
+    /*
+     * Migration --- CARAT_MIGRATION_STOP_WORLD moves everything with the
+     * world stopped, CARAT_MIGRATION_CONCURRENT copies while mutators run
+     * and only stops the world for a final handshake, which is abandoned
+     * if it is predicted to take longer than migration_pause_budget (ns)
+     * 
+     * While a concurrent migration is in flight, @migration is published
+     * along with the address range of its sources, and guarded writes into
+     * that range mark the written object dirty (see nk_carat_guard_address)
+     * so that the precopy rounds redo it. Writes the barrier misses are
+     * caught by the handshake, which compares every clean copy
+     */
+    int migration_mode;
+    uint64_t migration_pause_budget;
+    struct carat_migration_t * volatile migration;
+    void * volatile migration_start;
+    void * volatile migration_end;
+    volatile uint64_t migration_barrier_users;
+
+
+    /*
+     * Escape sets (and their tables) are built from this pool --- 
+     * released in bulk along with the context
+     */
+    struct carat_escape_set_pool_t *escape_set_pool;
+
+
+    /*
+     * The aspace whose threads can hold pointers into this context's
+     * allocations --- moves only stop the CPUs running those threads
+     * (see nk_sched_stop_aspace). NULL stops the whole world, which
+     * the kernel's context needs, since every thread runs in it
+     */
+    struct nk_aspace *stop_scope;
 
 
     /*
@@ -220,6 +366,18 @@ typedef struct allocation_entry_t {
      */ 
     nk_carat_escape_set *contained_escapes;
 
+    /*
+     * Saturating count of sampled guards that hit this allocation,
+     * aged by the policies that read it --- see sampling.h
+     */ 
+    uint8_t heat;
+
+    /*
+     * A thread stack grown by the runtime (see _carat_grow_stack) ---
+     * the thread runs on it, so the movers leave it alone
+     */ 
+    uint8_t is_stack;
+
 } allocation_entry;
 
 
@@ -227,13 +385,8 @@ typedef struct allocation_entry_t {
  * ========== Definitions --- Globals for CARAT ========== 
  */ 
 /*
- * Global carat context declaration --- DEPRECATED
- */ 
-extern carat_context global_carat_context;
-
-
-/*
- * "CARAT-ready" bootstrapping flag
+ * "CARAT-ready" bootstrapping flag --- all other state lives 
+ * in the per-aspace contexts
  */ 
 extern int karat_ready;
 
@@ -244,6 +397,15 @@ extern int karat_ready;
 extern void *non_canonical;
 
 
+/*
+ * How escape buffers are merged when the world is stopped, for every
+ * context --- CARAT_ESCAPE_DRAIN_SERIAL or CARAT_ESCAPE_DRAIN_PARALLEL, 
+ * where the stopped CPUs split the lookups and then the escape set 
+ * insertions (sharded by allocation entry) between them
+ */
+extern int carat_escape_drain_mode;
+
+
 
 /*
  * ========== Definitions --- ASpace-related CARAT ========== 
@@ -281,6 +443,13 @@ typedef struct nk_aspace_carat {
     nk_aspace_region_t *initial_blob ;
 
 
+    /*
+     * Bumped by every region removal, move, resize and protection 
+     * change --- invalidates all per-thread permission caches
+     */ 
+    volatile uint64_t permission_epoch ;
+
+
 
     // Your characteristics
     nk_aspace_characteristics_t chars;
@@ -335,8 +504,13 @@ typedef struct {
     uint64_t rb_free_time ;
     uint64_t guard_address_calls ;
     uint64_t guard_address_time ;
+    uint64_t request_permission_time ;
     uint64_t guard_stack_calls ;
     uint64_t guard_stack_time ;
+    uint64_t stack_growths ;
+    uint64_t guard_range_calls ;
+    uint64_t guard_range_time ;
+    uint64_t guard_range_bytes ;
     uint64_t tracking_calls ;
     uint64_t tracking_call_time ;
     uint64_t escape_calls ;
@@ -350,10 +524,94 @@ typedef struct {
     uint64_t memmove_time ;
     uint64_t reinstrument_contained_time ;
     uint64_t process_window_2_time ;
+    uint64_t parallel_drain_calls ;
+    uint64_t parallel_drain_entries ;
+    uint64_t parallel_lookup_time ;
+    uint64_t parallel_insert_time ;
+    uint64_t concurrent_migrations ;
+    uint64_t concurrent_migration_aborts ;
+    uint64_t migration_precopied_bytes ;
+    uint64_t migration_recopied_bytes ;
+    uint64_t migration_unbarriered_recopies ;
+    uint64_t migration_dropped_moves ;
+    uint64_t migration_pause_time ;
+    uint64_t migration_pause_max ;
+    uint64_t migration_pause_overruns ;
+    uint64_t permission_cache_hits ;
+    uint64_t permission_cache_misses ;
+    uint64_t requested_permission_updates ;
+    uint64_t metadata_slabs ;
+
+} __attribute__((aligned(64))) carat_profile ;
+
+/*
+ * One profile per CPU, each only written by its own CPU --- the profile 
+ * shell command adds them up
+ */
+extern carat_profile global_carat_profile[NAUT_CONFIG_MAX_CPUS];
+
+
+/*
+ * Latency histograms --- bucket i counts intervals of [2^(i-1), 2^i) 
+ * cycles (bucket 0 counts empty intervals), and the last bucket also 
+ * takes everything longer. There is one histogram for each timed 
+ * field of carat_profile, with the same name, filled by 
+ * CARAT_PROFILE_COMMIT_TIME
+ */
+#define CARAT_PROFILE_HISTOGRAM_BUCKETS 32
+
+typedef struct {
+    uint64_t buckets[CARAT_PROFILE_HISTOGRAM_BUCKETS];
+} carat_latency_histogram ;
+
+typedef struct {
+
+    carat_latency_histogram rb_malloc_time ;
+    carat_latency_histogram rb_free_time ;
+    carat_latency_histogram guard_address_time ;
+    carat_latency_histogram request_permission_time ;
+    carat_latency_histogram guard_stack_time ;
+    carat_latency_histogram guard_range_time ;
+    carat_latency_histogram tracking_call_time ;
+    carat_latency_histogram escape_call_time ;
+    carat_latency_histogram cleanup_time ;
+    carat_latency_histogram find_entry_time ;
+    carat_latency_histogram patch_escapes_time ;
+    carat_latency_histogram patch_stack_regs_time ;
+    carat_latency_histogram update_entry_time ;
+    carat_latency_histogram memmove_time ;
+    carat_latency_histogram reinstrument_contained_time ;
+
+} __attribute__((aligned(64))) carat_profile_histograms ;
+
+extern carat_profile_histograms global_carat_histograms[NAUT_CONFIG_MAX_CPUS];
+
+static inline void carat_latency_histogram_record(carat_latency_histogram *histogram, uint64_t cycles)
+{
+    uint64_t bucket = (cycles) ? (64 - __builtin_clzl(cycles)) : 0;
+    if (bucket >= CARAT_PROFILE_HISTOGRAM_BUCKETS) { bucket = CARAT_PROFILE_HISTOGRAM_BUCKETS - 1; }
+    histogram->buckets[bucket]++;
+}
+
 
-} carat_profile ;
+/*
+ * Per-CPU escape window costs --- each entry is only written by its 
+ * own CPU with interrupts off, so no atomics are needed
+ */
+typedef struct {
 
-extern carat_profile global_carat_profile;
+    uint64_t append_calls ;
+    uint64_t append_time ;
+    uint64_t drain_calls ;
+    uint64_t drain_time ;
+    uint64_t drained_entries ;
+    uint64_t drained_bytes ;
+    uint64_t filtered_entries ;
+    uint64_t log_entries ; // handed over from per-thread escape logs
+
+} __attribute__((aligned(64))) carat_escape_profile ;
+
+extern carat_escape_profile global_carat_escape_profile[NAUT_CONFIG_MAX_CPUS];
 
 extern int start_carat_profiles;
 
@@ -368,13 +626,19 @@ extern int start_carat_profiles;
 #endif
 
 
+#define CARAT_PROFILE_ACTIVE (CARAT_DO_PROFILE && start_carat_profiles)
+
+#define CARAT_PROFILE_CPU (&(global_carat_profile[my_cpu_id()]))
+
+#define CARAT_PROFILE_CPU_HISTOGRAMS (&(global_carat_histograms[my_cpu_id()]))
+
 #define CARAT_PROFILE_INIT_TIMING_VAR(level) uint64_t _carat_profile_timing_##level = 0
 
 #define CARAT_PROFILE_RESET_TIMING_VAR(do_task, level) \
     if (do_task && start_carat_profiles) { _carat_profile_timing_##level = 0 ; }
 
 #define CARAT_PROFILE_INCR(do_task, field) \
-    if (do_task && start_carat_profiles) { global_carat_profile.field += 1; }
+    if (do_task && start_carat_profiles) { CARAT_PROFILE_CPU->field += 1; }
 
 #define CARAT_PROFILE_START_TIMING(do_task, level) \
     if (do_task && start_carat_profiles) { _carat_profile_timing_##level = rdtsc(); }
@@ -383,7 +647,10 @@ extern int start_carat_profiles;
     if (do_task && start_carat_profiles) { _carat_profile_timing_##level = rdtsc() - _carat_profile_timing_##level; }
 
 #define CARAT_PROFILE_COMMIT_TIME(do_task, field, level) \
-    if (do_task && start_carat_profiles) { global_carat_profile.field += _carat_profile_timing_##level ; }
+    if (do_task && start_carat_profiles) { \
+        CARAT_PROFILE_CPU->field += _carat_profile_timing_##level ; \
+        carat_latency_histogram_record(&(CARAT_PROFILE_CPU_HISTOGRAMS->field), _carat_profile_timing_##level); \
+    }
  
 #define CARAT_PROFILE_STOP_COMMIT_RESET(do_task, field, level) \
     CARAT_PROFILE_STOP_TIMING(do_task, level); \
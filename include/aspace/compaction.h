@@ -0,0 +1,130 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh,
+ * 			Brian Suchy, Peter Dinda
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+
+/*
+ * Compaction --- CARAT Runtime --- background fragmentation tracking
+ *
+ * A kernel daemon periodically walks the allocation map of its aspace,
+ * a bounded slice of entries per stop-the-world resuming from a cursor,
+ * and keeps fragmentation metrics for every region 
+ * (and for allocations outside of any region): free extents between live
+ * allocations (as a log2 histogram), the largest free extent, and live 
+ * bytes over the span the allocations occupy. 
+ * 
+ * When the density of a large enough zone drops below the trigger, the
+ * daemon compacts it incrementally --- each slice moves a batch of the 
+ * highest-addressed allocations of the zone into lower free blocks 
+ * with a single stop-the-world, sized so that the predicted pause stays 
+ * within the policy's slice budget. Only allocations that are whole kmem
+ * blocks are moved, since only those can be reallocated by the kernel.
+ */
+#pragma once
+
+#include <nautilus/nautilus.h>
+#include <nautilus/spinlock.h>
+#include <aspace/carat.h>
+
+
+#define CARAT_COMPACTION_MAX_ZONES 16
+#define CARAT_COMPACTION_MAX_CANDIDATES 128 /* per zone, per scan */
+#define CARAT_COMPACTION_EXTENT_BUCKETS 40 /* log2 bytes */
+#define CARAT_COMPACTION_SLICE_GAP_NS 1000000UL /* mutators run between slices */
+#define CARAT_COMPACTION_SCAN_SLICE 4096 /* allocation map entries per stop, when scanning */
+#define CARAT_COMPACTION_MIN_SPAN (1UL << 20)
+
+
+/*
+ * An allocation the daemon would like to move down
+ */
+typedef struct carat_compaction_candidate_t {
+    void *address;
+    uint64_t size;
+} carat_compaction_candidate;
+
+
+/*
+ * Fragmentation of one region (or of the allocations outside of any
+ * region, when @in_region is 0) as of the last scan
+ */
+typedef struct carat_zone_fragmentation_t {
+
+    void *start;
+    uint64_t length;
+    int in_region;
+
+    uint64_t num_allocations;
+    uint64_t live_bytes;
+    void *span_start;
+    void *span_end;
+
+    /*
+     * Bucket i counts free extents of [2^(i-1), 2^i) bytes
+     */
+    uint64_t num_free_extents;
+    uint64_t largest_free_extent;
+    uint64_t free_extents[CARAT_COMPACTION_EXTENT_BUCKETS];
+
+} carat_zone_fragmentation;
+
+
+/*
+ * Policy --- a zone is compacted when it spans at least @min_span bytes 
+ * and less than @trigger_density percent of its span is live
+ */
+typedef struct carat_compaction_policy_t {
+    uint64_t period; // ns between scans
+    uint64_t slice_budget; // ns, maximum pause per slice
+    uint64_t trigger_density; // percent
+    uint64_t min_span; // bytes
+} carat_compaction_policy;
+
+
+typedef struct carat_compaction_stats_t {
+    uint64_t scans;
+    uint64_t scan_time_max; // ns, longest stop of a scan slice
+    uint64_t triggers;
+    uint64_t slices;
+    uint64_t moves;
+    uint64_t moved_bytes;
+    uint64_t slice_pause_max; // ns
+    uint64_t slice_overruns;
+} carat_compaction_stats;
+
+
+/*
+ * Records the kernel aspace as the daemon's target --- called by nk_carat_init
+ */
+void nk_carat_compaction_init(nk_aspace_t *kernel_aspace);
+
+
+/*
+ * Start/stop the daemon
+ */
+int nk_carat_compaction_start(void);
+void nk_carat_compaction_stop(void);
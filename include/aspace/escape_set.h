@@ -0,0 +1,155 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh,
+ * 			Brian Suchy, Peter Dinda
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+
+/*
+ * Escape Set --- CARAT Runtime --- per allocation_entry escape tracking
+ *
+ * Most allocations have zero, one, or two escapes, so a set starts out with
+ * a few inline slots (no extra allocation) and only switches to an
+ * open-addressing hash table once those are full. Keys are plain words ---
+ * escape locations (void **) for escapes_set, and offsets for
+ * contained_escapes --- so a set never dereferences what it stores.
+ *
+ * Sets and their tables come from a per-context pool (slabs for the sets,
+ * an arena for the tables), so they are released in bulk with the context.
+ */
+#pragma once
+
+#include <nautilus/nautilus.h>
+#include <aspace/slab.h>
+
+
+#define CARAT_ESCAPE_SET_INLINE_SLOTS 4
+#define CARAT_ESCAPE_SET_INITIAL_TABLE 16
+
+
+/*
+ * Marks a free slot in the hash table --- 0 is a valid key
+ * (an escape stored at offset 0 of its container)
+ */
+#define CARAT_ESCAPE_SET_EMPTY ((uintptr_t) -1)
+
+
+typedef struct carat_escape_set_t {
+
+    uint32_t size;
+
+    /*
+     * 0 while the set is inline, otherwise the number of slots
+     * in @table (a power of 2)
+     */
+    uint32_t capacity;
+
+    union {
+        uintptr_t slots[CARAT_ESCAPE_SET_INLINE_SLOTS];
+        uintptr_t *table;
+    };
+
+} carat_escape_set;
+
+
+typedef struct carat_escape_set_pool_t {
+    carat_slab_cache *sets;
+    carat_arena *tables;
+} carat_escape_set_pool;
+
+
+/*
+ * Pool build/teardown --- destroying a pool releases every set 
+ * built from it
+ */
+carat_escape_set_pool *carat_escape_set_pool_create(void);
+void carat_escape_set_pool_destroy(carat_escape_set_pool *pool);
+
+
+/*
+ * Build/teardown
+ */
+carat_escape_set *carat_escape_set_create(carat_escape_set_pool *pool);
+void carat_escape_set_destroy(carat_escape_set_pool *pool, carat_escape_set *set);
+
+
+/*
+ * Add @key to @set --- returns 1 if @key was added, 0 if it was
+ * already present
+ */
+int carat_escape_set_add(carat_escape_set_pool *pool, carat_escape_set *set, uintptr_t key);
+
+
+/*
+ * Bytes held by @set, including the set itself
+ */
+static inline uint64_t carat_escape_set_bytes(carat_escape_set *set)
+{
+    return sizeof(carat_escape_set) + (set->capacity * sizeof(uintptr_t));
+}
+
+
+/*
+ * Iteration --- visits every key once, in no particular order
+ */
+typedef struct carat_escape_set_iter_t {
+    uintptr_t *keys;
+    uint32_t limit;
+    uint32_t index;
+} carat_escape_set_iter;
+
+static inline void _carat_escape_set_iter_skip(carat_escape_set_iter *it)
+{
+    while ((it->index < it->limit) && (it->keys[it->index] == CARAT_ESCAPE_SET_EMPTY)) { it->index++; }
+}
+
+static inline void carat_escape_set_iter_begin(carat_escape_set *set, carat_escape_set_iter *it)
+{
+    it->index = 0;
+    if (set->capacity) {
+        it->keys = set->table;
+        it->limit = set->capacity;
+        _carat_escape_set_iter_skip(it);
+    } else {
+        it->keys = set->slots;
+        it->limit = set->size;
+    }
+}
+
+static inline int carat_escape_set_iter_valid(carat_escape_set_iter *it)
+{
+    return it->index < it->limit;
+}
+
+static inline void carat_escape_set_iter_next(carat_escape_set_iter *it)
+{
+    it->index++;
+    _carat_escape_set_iter_skip(it);
+}
+
+static inline uintptr_t carat_escape_set_iter_key(carat_escape_set_iter *it)
+{
+    return it->keys[it->index];
+}
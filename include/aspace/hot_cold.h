@@ -0,0 +1,85 @@
+/* 
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the 
+ * United States National  Science Foundation and the Department of Energy.  
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national 
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org> 
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh, 
+ * 			Brian Suchy, Peter Dinda 
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+/*
+ * Hot/Cold Segregation --- CARAT Runtime --- packing the working set
+ *
+ * Guard call samples (see sampling.h) bump a saturating heat counter in
+ * each allocation_entry. A kernel daemon periodically walks the map, a 
+ * bounded slice per stop-the-world, draining the samples, aging the 
+ * counters (halving them) and measuring the working set, and picks a
+ * "hot window" --- the aligned window of kmem holding the most hot bytes.
+ * Hot allocations outside the window are moved into it, and cold ones 
+ * (no samples for a few passes) are pushed out of it, with CARAT moves
+ * in bounded stop-the-world batches.
+ *
+ * Working-set density is hot bytes over the bytes of the pages that hold
+ * hot allocations --- what the caches and the TLB actually pay for. The
+ * density at the first pass is kept so the improvement can be reported.
+ */
+#pragma once
+
+#include <nautilus/nautilus.h>
+#include <aspace/carat.h>
+
+
+#define CARAT_HOT_COLD_DEFAULT_PERIOD_MS 200
+#define CARAT_HOT_COLD_DEFAULT_THRESHOLD 4 /* heat */
+#define CARAT_HOT_COLD_DEFAULT_WINDOW (4UL * 1024 * 1024) /* bytes, power of 2 */
+#define CARAT_HOT_COLD_DEFAULT_MAX_MOVES 64 /* per stop-the-world */
+#define CARAT_HOT_COLD_SCAN_SLICE 4096 /* allocation map entries per stop, when scanning */
+#define CARAT_HOT_COLD_SLICE_GAP_NS 1000000UL /* mutators run between scan slices */
+
+
+typedef struct carat_hot_cold_stats_t {
+    uint64_t passes;
+    uint64_t hot_objects;
+    uint64_t hot_bytes;
+    uint64_t hot_pages;
+    uint64_t density; // permille, last pass
+    uint64_t baseline_hot_pages;
+    uint64_t baseline_density; // permille, first pass with hot allocations
+    uint64_t moves_in;
+    uint64_t moves_out;
+    uint64_t moved_bytes;
+    uint64_t pause_max; // ns, moves
+    uint64_t scan_pause_max; // ns, longest stop of a scan slice
+} carat_hot_cold_stats;
+
+
+/*
+ * Records the kernel aspace as the daemon's target --- called by nk_carat_init
+ */
+void nk_carat_hot_cold_init(nk_aspace_t *kernel_aspace);
+
+
+/*
+ * Start/stop the daemon (and heat sampling)
+ */
+int nk_carat_hot_cold_start(void);
+void nk_carat_hot_cold_stop(void);
@@ -0,0 +1,74 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh,
+ * 			Brian Suchy, Peter Dinda
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+
+/*
+ * NUMA Placement --- CARAT Runtime --- access-driven allocation migration
+ *
+ * Guard call samples (see sampling.h) tell us which NUMA domain touches
+ * which allocation. A kernel daemon periodically drains the samples with 
+ * the world stopped, and keeps aged per-domain counts for every sampled 
+ * allocation. Allocations that are mostly touched from a domain other 
+ * than the one holding them are moved into that domain's kmem zone with
+ * CARAT moves, a bounded batch per stop-the-world.
+ */
+#pragma once
+
+#include <nautilus/nautilus.h>
+#include <aspace/carat.h>
+
+
+#define CARAT_NUMA_MAX_DOMAINS 8
+#define CARAT_NUMA_TABLE_SIZE 4096 /* power of 2 */
+
+#define CARAT_NUMA_DEFAULT_PERIOD_MS 100
+#define CARAT_NUMA_DEFAULT_MIN_SAMPLES 8
+#define CARAT_NUMA_DEFAULT_SHARE 75 /* percent of samples from the target domain */
+#define CARAT_NUMA_DEFAULT_MAX_MOVES 64 /* per stop-the-world */
+
+
+typedef struct carat_numa_stats_t {
+    uint64_t passes;
+    uint64_t samples;
+    uint64_t moves;
+    uint64_t moved_bytes;
+    uint64_t pause_max; // ns
+} carat_numa_stats;
+
+
+/*
+ * Records the kernel aspace as the daemon's target --- called by nk_carat_init
+ */
+void nk_carat_numa_init(nk_aspace_t *kernel_aspace);
+
+
+/*
+ * Start/stop the daemon (and its sample consumer)
+ */
+int nk_carat_numa_start(void);
+void nk_carat_numa_stop(void);
@@ -46,6 +46,8 @@
  * Helper, status macros
  */
 #define CARAT_STACK_CHECK 0
+#define CARAT_DEFRAG_BATCH 256
+#define CARAT_MIGRATION_PRECOPY_ROUNDS 4
 
 
 /*
@@ -53,16 +55,51 @@
  */
 
 /*
- * A packaged context for moving an allocation to a target address
+ * One move of a batch --- filled in from the allocation map before
+ * anything is patched (allocation_entry objects may not be stable
+ * across map updates, so the fields are copied out)
  */ 
-struct move_context {
+struct carat_move {
     void *allocation_to_move; // Address to move
     void *allocation_target; // Address to move to 
     uint64_t size; // Size of allocation to move
-    int failed; // Move status
+    nk_carat_escape_set *escapes_set; 
+    nk_carat_escape_set *contained_escapes;
+    uint8_t heat;
+    uint8_t is_stack;
 };
 
 
+/*
+ * A concurrent migration in flight --- published in the context while
+ * objects are being copied with the world running. @moves is sorted by
+ * source, and @dirty[i] is set by the write barrier whenever a guarded
+ * write to the object at @moves[i] is about to happen. @bytes is the
+ * total size of the sources, and @num_dropped counts the moves whose 
+ * source was freed before the handshake
+ */ 
+typedef struct carat_migration_t {
+    struct carat_move *moves;
+    volatile uint8_t *dirty;
+    uint64_t num_moves;
+    uint64_t bytes;
+    uint64_t num_dropped;
+} carat_migration;
+
+
+/*
+ * A relocation requested by a policy (compaction, NUMA placement) --- the
+ * allocation at @address is moved to a new kmem block that lies entirely
+ * within [@target_start, @target_end)
+ */
+typedef struct carat_relocation_t {
+    void *address;
+    uint64_t size;
+    void *target_start;
+    void *target_end;
+} carat_relocation;
+
+
 /*
  * =================== Patching Methods ===================  
  */ 
@@ -88,6 +125,25 @@ int nk_carat_move_allocations(
 );
 
 
+/*
+ * Driver for moving allocations that are already tracked without stopping
+ * the world for the copies --- objects are copied while threads keep running,
+ * guarded writes to them are caught by the write barrier, and a single short
+ * stop-the-world handshake re-copies the dirty objects, checks the others 
+ * against their copies (catching unguarded writes), and patches pointers.
+ * Allocations freed while they were being copied are not moved: their slots
+ * in @allocations_to_move are set to NULL, and the caller keeps their targets.
+ * Returns -1 without moving anything if the handshake cannot be done within
+ * the context's migration pause budget, or if a target overlaps a source
+ */ 
+int nk_carat_move_allocations_concurrent(
+    nk_carat_context *the_context,
+    void **allocations_to_move, 
+    void **allocation_targets, 
+    uint64_t num_moves
+);
+
+
 /*
  * Driver for defragmenting a region using allocation moves
  */
@@ -100,6 +156,23 @@ int nk_carat_move_region(
 );
 
 
+/*
+ * One relocation slice --- with a single stop-the-world, performs up to @max_moves
+ * of @relocations, in order. Relocations whose allocation is no longer tracked 
+ * (with the same size), is a thread stack, is not a whole kmem block, or has
+ * no free block in its target range are skipped. Returns how many relocations were consumed, or -1 
+ * if nothing could be done
+ */
+int nk_carat_relocate_slice(
+    nk_carat_context *the_context,
+    carat_relocation *relocations,
+    uint64_t num_relocations,
+    uint64_t max_moves,
+    uint64_t *moved,
+    uint64_t *moved_bytes
+);
+
+
 /*
  * Upon a move --- "carat_patch_escapes" will iterate through all escapes
  * from @entry (existing at @entry + (an offset)), and update each escaped 
@@ -112,17 +185,54 @@ int _carat_patch_escapes(
 
 void _reinstrument_contained_escapes(allocation_entry *new_entry);
 
+
 /*
- * Upon a move --- "handle_thread" will update each thread's register 
- * and stack state to use @state->allocation_target instead of @state->allocation_to_move
- *
- * TODO --- @state needs to be a type [struct move_alloc_state *]
+ * Batch move engine --- moves @allocations_to_move[i] to @allocation_targets[i]
+ * for all @num_moves moves with a single escape window drain, a single patching
+ * sweep over the escapes of all moved allocations, back to back copies, and a 
+ * single map update/contained escapes pass. Every thread's registers and stack
+ * are patched conservatively, in parallel on the stopped CPUs. The world must be
+ * stopped by the caller and CARAT must be off. Nothing is moved if the plan is invalid (untracked or overlapping
+ * sources, or a target that overlaps a source that has not been copied yet)
+ */ 
+int _carat_move_allocations(
+    nk_carat_context *the_context,
+    void **allocations_to_move, 
+    void **allocation_targets, 
+    uint64_t num_moves
+);
+
+/*
+ * Public movers run their body through _carat_mover_trampoline 
+ * (src/asm/carat_lowlevel.S), which spills the caller's callee-saved 
+ * registers onto the stack, calls @mover with a pointer to them followed
+ * by up to six arguments, and reloads them --- the stack scan starts at
+ * the spill, so pointers the caller keeps in registers are patched too
  */ 
-static void __carat_print_registers (struct nk_regs * r);
-static void _carat_patch_thread_registers(struct nk_thread *t, void *state);
-static void _carat_patch_thread_stack(struct nk_thread *t, void *state);
-static void _carat_patch_thread_registers_stack(struct nk_thread *t, void *state);
+uint64_t _carat_mover_trampoline(void *mover, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6);
 
+#define CARAT_CALL_MOVER(mover, a1, a2, a3, a4, a5, a6) \
+    _carat_mover_trampoline( \
+        ((void *) (mover)), \
+        ((uint64_t) (a1)), ((uint64_t) (a2)), ((uint64_t) (a3)), \
+        ((uint64_t) (a4)), ((uint64_t) (a5)), ((uint64_t) (a6)) \
+    )
+
+
+/*
+ * Stack growth --- moves the current thread's stack to the top of a block
+ * big enough for @stack_frame_size more bytes, using the batch move engine
+ * (so saved frame pointers, pointers to locals from other stacks, and 
+ * tracked escapes into the stack are all patched). Only called through 
+ * _carat_grow_stack_trampoline (src/asm/carat_lowlevel.S), which saves the
+ * callee-saved registers in @saved_registers and switches to the new stack.
+ * Only stacks tracked as stacks (see nk_carat_track_thread_stack) are grown,
+ * and the old one is freed. Returns the distance moved, or 0 (with nothing
+ * done) if the stack cannot be grown from here
+ */ 
+void _carat_grow_stack_trampoline(uint64_t stack_frame_size);
+uint64_t _carat_grow_stack(uint64_t stack_frame_size, void *saved_registers);
+void _carat_grow_stack_done(void);
 
 /*
  * DEPRECATED --- Handled by proper/known use of compiler instrumentation
@@ -0,0 +1,114 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh,
+ * 			Brian Suchy, Peter Dinda
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+
+/*
+ * Permission Cache --- CARAT Runtime --- per-thread software TLB for guards
+ *
+ * Maps addresses to the region that contains them, so that a guard on a
+ * region the thread has touched recently does not walk the region data
+ * structure. Sets are indexed by page, and each way holds a region pointer
+ * (the region is rechecked on every hit, and its current protection is 
+ * used). The whole cache is dropped whenever the owning aspace's permission
+ * epoch moves, which any region removal, move, resize or protection change
+ * does. Lives in struct nk_thread, and is only touched by its own thread.
+ */
+#pragma once
+
+#include <nautilus/naut_types.h>
+
+
+#define CARAT_PERMISSION_CACHE_SETS 16
+#define CARAT_PERMISSION_CACHE_WAYS 4
+#define CARAT_PERMISSION_CACHE_SHIFT 12
+
+#define CARAT_PERMISSION_CACHE_SET(address) \
+    ((((uint64_t) (address)) >> CARAT_PERMISSION_CACHE_SHIFT) & (CARAT_PERMISSION_CACHE_SETS - 1))
+
+
+struct nk_aspace_region;
+
+typedef struct nk_carat_permission_cache {
+    void *owner; // aspace state the entries belong to
+    uint64_t epoch; // owner's epoch when the entries were filled
+    struct nk_aspace_region *ways[CARAT_PERMISSION_CACHE_SETS][CARAT_PERMISSION_CACHE_WAYS];
+    uint8_t victim[CARAT_PERMISSION_CACHE_SETS]; // round-robin replacement
+} nk_carat_permission_cache;
+
+
+/*
+ * Guard descriptor --- the region of the thread's last successful guard,
+ * published for guards that the compiler inlines (ProtectionsInjector, 
+ * -finline-guards). An access to [base, limit) needs no runtime call if
+ * permissions has NK_CARAT_GUARD_READ set for a read, or 
+ * NK_CARAT_GUARD_WRITE set for a write. Only accesses the region has already recorded in its 
+ * requested_permissions are published, so skipping the runtime never 
+ * loses track of them. Lives at NK_CARAT_GUARD_DESCRIPTOR_OFFSET in 
+ * struct nk_thread, which the compiler relies on
+ */
+#define NK_CARAT_GUARD_DESCRIPTOR_OFFSET 40
+#define NK_CARAT_GUARD_READ 1
+#define NK_CARAT_GUARD_WRITE 2
+
+typedef struct nk_carat_guard_descriptor {
+    uint64_t base;
+    uint64_t limit; // 0 when nothing is published
+    uint64_t permissions;
+} nk_carat_guard_descriptor;
+
+
+/*
+ * Escape log --- escapes the compiler appends inline (EscapesHandler, 
+ * -finline-escapes), instead of calling nk_carat_instrument_escapes:
+ *
+ *   slot = next; next += 8;   (one instruction, atomic w.r.t. interrupts)
+ *   if (slot < limit) { *(void **) slot = escape; }
+ *   else { nk_carat_escape_log_full(escape); }
+ *
+ * The entries (NK_CARAT_ESCAPE_LOG_ENTRIES of them, also in struct 
+ * nk_thread) are handed to the runtime when the log fills up, when the
+ * world is stopped for a move, and when the thread exits or leaves its
+ * aspace. Lives at NK_CARAT_ESCAPE_LOG_OFFSET in struct nk_thread, which
+ * the compiler relies on
+ */
+#define NK_CARAT_ESCAPE_LOG_OFFSET 64
+#define NK_CARAT_ESCAPE_LOG_ENTRIES 64
+
+typedef struct nk_carat_escape_log {
+    uint64_t next;  // address of the next entry, may run past limit
+    uint64_t limit; // address past the last entry, 0 until the runtime sets it up
+    void *context;  // CARAT context the logged escapes belong to
+} nk_carat_escape_log;
+
+struct nk_thread;
+
+/*
+ * Hand @t's logged escapes to the runtime and shut its log --- only
+ * called by @t itself
+ */
+void nk_carat_escape_log_release(struct nk_thread *t);
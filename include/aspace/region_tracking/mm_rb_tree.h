@@ -24,6 +24,8 @@ typedef struct rb_tree
     mm_struct_t super;
     mm_rb_node_t * NIL;
     mm_rb_node_t * root;
+
+    struct carat_slab_cache_t * node_slab; // NULL => nodes from malloc
     
     int (*compf)(mm_rb_node_t * n1, mm_rb_node_t * n2);
 } mm_rb_tree_t;
@@ -49,6 +51,9 @@ int rb_comp_escape(mm_rb_node_t * n1, mm_rb_node_t * n2);
 int rb_tree_remove_alloc(mm_struct_t * self, nk_aspace_region_t * region, uint8_t check_flags);
 int rb_tree_remove_escape(mm_struct_t * self, nk_aspace_region_t * region, uint8_t check_flags);
 nk_aspace_region_t * rb_tree_find_allocation_entry_from_addr(mm_struct_t * self, addr_t address);
+mm_rb_node_t * rb_tree_first_allocation_entry_from_addr(mm_rb_tree_t * tree, addr_t address);
+struct allocation_entry_t;
+int rb_tree_build_from_sorted_allocations(mm_rb_tree_t * tree, struct allocation_entry_t * entries, uint64_t num_entries);
     
 
 #endif
@@ -37,6 +37,10 @@
 
 #include <nautilus/nautilus.h>
 #include <aspace/carat.h>
+#include <aspace/escape_set.h>
+#ifdef NAUT_CONFIG_ASPACE_CARAT_ALLOCATION_MAP_BPTREE
+#include <aspace/bptree.h>
+#endif
 
 
 /*
@@ -65,6 +69,8 @@
 #define CHECK_CARAT_READY(c) if (!(c->carat_ready)) { return; }
 #define CARAT_READY_ON(c) c->carat_ready = 1
 #define CARAT_READY_OFF(c) c->carat_ready = 0
+#define CARAT_STOP_WORLD(c) nk_sched_stop_aspace(c->stop_scope)
+#define CARAT_START_WORLD(c) nk_sched_start_aspace(c->stop_scope)
 
 
 #define USE_SKIPLIST 0
@@ -73,9 +79,9 @@
 /* 
  * Interface for "nk_carat_escape_set" --- generic
  */ 
-#define CARAT_ESCAPE_SET_BUILD nk_slist_build(uintptr_t, CARAT_INIT_NUM_GEARS)
+#define CARAT_ESCAPE_SET_BUILD(c) nk_slist_build(uintptr_t, CARAT_INIT_NUM_GEARS)
 #define CARAT_ESCAPE_SET_SIZE(set) (nk_slist_get_size(set) - 2)
-#define CARAT_ESCAPE_SET_ADD(set, key) nk_slist_add(uintptr_t, set, ((uintptr_t) key))
+#define CARAT_ESCAPE_SET_ADD(c, set, key) nk_slist_add(uintptr_t, set, ((uintptr_t) key))
 #define CARAT_ESCAPES_SET_ITERATE(set) \
     nk_slist_node_uintptr_t *iterator; \
     uintptr_t val; \
@@ -125,38 +131,88 @@
  *
  */
 
-#define CARAT_ESCAPE_SET_BUILD mm_rb_tree_create_actual_rb_tree(); 
+#define CARAT_ESCAPE_SET_BUILD(c) carat_escape_set_create((c->escape_set_pool))
 
-#define CARAT_ESCAPE_SET_SETUP(set) \
-    if (1) \
-    { \
-        set->compf = &rb_comp_escape; \
-        set->super.vptr->remove = &rb_tree_remove_escape; \
-    }
+#define CARAT_ESCAPE_SET_SETUP(set) 
+
+#define CARAT_ESCAPE_SET_DESTROY(c, set) carat_escape_set_destroy((c->escape_set_pool), (set))
 
-#define CARAT_ESCAPE_SET_SIZE(set) set->super.size
+#define CARAT_ESCAPE_SET_SIZE(set) (set->size)
 
-#define CARAT_ESCAPE_SET_ADD(set, key) /* typeof(key)=(void **) */ \
-    (mm_insert(&(set->super), ((nk_aspace_region_t *) key))) 
+#define CARAT_ESCAPE_SET_ADD(c, set, key) /* typeof(key)=(void **) */ \
+    (carat_escape_set_add((c->escape_set_pool), (set), ((uintptr_t) key)))
 
 #define CARAT_ESCAPES_SET_ITERATE(set) \
-    mm_rb_node_t *iterator = NULL; \
-    rb_tree_foreach(set, iterator)
+    carat_escape_set_iter iterator; \
+    for (carat_escape_set_iter_begin((set), &iterator); \
+         carat_escape_set_iter_valid(&iterator); \
+         carat_escape_set_iter_next(&iterator))
 
-#define FETCH_ESCAPE_FROM_ITERATOR (((void **) &(iterator->region)))
+#define FETCH_ESCAPE_FROM_ITERATOR ((void **) carat_escape_set_iter_key(&iterator))
 
 
 // ---
 
 
+#ifdef NAUT_CONFIG_ASPACE_CARAT_ALLOCATION_MAP_BPTREE
+
+/*
+ * B+ tree allocation map --- entries are copied into the leaves, so
+ * an allocation_entry pointer fetched from the map is only valid
+ * until the next insert/remove
+ */
+#define CARAT_ALLOCATION_MAP_BUILD carat_bptree_create()
+
+#define CARAT_ALLOCATION_MAP_DESTROY(map) carat_bptree_destroy(map)
+
+#define CARAT_ALLOCATION_MAP_SETUP(map) 
+
+#define CARAT_ALLOCATION_MAP_SIZE(c) (c->allocation_map->size)
+
+#define CARAT_ALLOCATION_MAP_INSERT(c, key) /* typeof(@key)=(allocation_entry *) */ \
+    (carat_bptree_insert((c->allocation_map), (key)))
+
+#define CARAT_ALLOCATION_MAP_REMOVE(c, key) /* @key is a simple pointer, typeof(@key)=void * */ \
+    (carat_bptree_remove((c->allocation_map), ((uintptr_t) key)))
+
+#define CARAT_ALLOCATION_MAP_BULK_LOAD(c, entries, n) /* typeof(@entries)=(allocation_entry *), sorted */ \
+    (carat_bptree_bulk_load((c->allocation_map), (entries), (n)))
+
+#define CARAT_ALLOCATION_MAP_BETTER_LOWER_BOUND(c, key) \
+    (carat_bptree_find((c->allocation_map), ((uintptr_t) key)))
+
+#define CARAT_ALLOCATION_MAP_ITERATE(c) \
+    carat_bptree_iter iterator; \
+    for (carat_bptree_iter_begin((c->allocation_map), &iterator); \
+         carat_bptree_iter_valid(&iterator); \
+         carat_bptree_iter_next(&iterator))
+
+/*
+ * Visits only the entries whose allocation starts in [@start, @start + @len),
+ * in address order --- cost is proportional to the range, not the map
+ */
+#define CARAT_ALLOCATION_MAP_ITERATE_RANGE(c, start, len) \
+    carat_bptree_iter iterator; \
+    for (carat_bptree_iter_seek((c->allocation_map), ((uintptr_t) (start)), &iterator); \
+         carat_bptree_iter_valid(&iterator) \
+         && (((uintptr_t) carat_bptree_iter_entry(&iterator)->pointer) < (((uintptr_t) (start)) + (len))); \
+         carat_bptree_iter_next(&iterator))
+
+#define FETCH_ALLOCATION_ENTRY_FROM_ITERATOR (carat_bptree_iter_entry(&iterator))
+
+#else
+
 #define CARAT_ALLOCATION_MAP_BUILD mm_rb_tree_create_actual_rb_tree()
 
+#define CARAT_ALLOCATION_MAP_DESTROY(map) mm_destory(&(map->super))
+
 #define CARAT_ALLOCATION_MAP_SETUP(map) \
     if (1) \
     { \
         map->compf = &rb_comp_alloc_entry; \
         map->super.vptr->remove = &rb_tree_remove_alloc; \
         map->super.vptr->find_reg_at_addr = &rb_tree_find_allocation_entry_from_addr; \
+        map->node_slab = carat_slab_cache_create(sizeof(mm_rb_node_t)); \
     }
 
 #define CARAT_ALLOCATION_MAP_SIZE(c) (c->allocation_map->super.size)  
@@ -170,6 +226,9 @@
 #define CARAT_ALLOCATION_MAP_REMOVE(c, key) /* @key is a simple pointer, typeof(@key)=void * */ \
     (mm_remove(&(c->allocation_map->super), ((nk_aspace_region_t *) key), 0))
 
+#define CARAT_ALLOCATION_MAP_BULK_LOAD(c, entries, n) /* typeof(@entries)=(allocation_entry *), sorted */ \
+    (rb_tree_build_from_sorted_allocations((c->allocation_map), (entries), (n)))
+
 #define CARAT_ALLOCATION_MAP_BETTER_LOWER_BOUND(c, key) \
     ((allocation_entry *) (mm_find_reg_at_addr(&(c->allocation_map->super), ((addr_t) key))))
 
@@ -177,10 +236,23 @@
     mm_rb_node_t *iterator = NULL; \
     rb_tree_foreach((c->allocation_map), iterator)
 
+/*
+ * Visits only the entries whose allocation starts in [@start, @start + @len),
+ * in address order --- cost is proportional to the range, not the map
+ */
+#define CARAT_ALLOCATION_MAP_ITERATE_RANGE(c, start, len) \
+    mm_rb_node_t *iterator = NULL; \
+    for (iterator = rb_tree_first_allocation_entry_from_addr((c->allocation_map), ((addr_t) (start))); \
+         (iterator != (c->allocation_map)->NIL) \
+         && (((addr_t) (FETCH_ALLOCATION_ENTRY_FROM_ITERATOR)->pointer) < (((addr_t) (start)) + (len))); \
+         iterator = rb_tree_next_smallest((c->allocation_map), iterator))
+
 #define FETCH_ALLOCATION_ENTRY_FROM_ITERATOR (((allocation_entry *) &(iterator->region)))
 
 #endif
 
+#endif
+
 
 /*
  * Setup/constructor for an allocation_entry object
@@ -239,12 +311,27 @@ allocation_entry _carat_create_allocation_entry(void *ptr, uint64_t allocation_s
 /*
  * CARAT context fetchers, setters
  */ 
-#define FETCH_TOTAL_ESCAPES(ctx) (ctx->total_escape_entries)
-#define FETCH_ESCAPE_WINDOW(ctx) (ctx->escape_window)
-#define RESET_ESCAPE_WINDOW(ctx) ctx->total_escape_entries = 0
+#define FETCH_TOTAL_ESCAPES(ctx) (_carat_count_escapes(ctx))
+#define FETCH_ESCAPE_BUFFER(ctx, cpu) (&(ctx->escape_buffers[cpu]))
+#define FETCH_MY_ESCAPE_BUFFER(ctx) FETCH_ESCAPE_BUFFER(ctx, my_cpu_id())
+#ifdef NAUT_CONFIG_CARAT_COMPRESSED_ESCAPE_LOG
+#define RESET_ESCAPE_BUFFER(buf) buf->total_escape_entries = buf->log_bytes = buf->last_escape = 0
+#else
+#define RESET_ESCAPE_BUFFER(buf) buf->total_escape_entries = 0
+#endif
+
+/*
+ * Updates to the allocation map outside of a stopped world --- tracking
+ * calls and buffer-full escape drains, from any CPU --- are serialized 
+ * by escape_lock. Interrupts stay off while it is held, since a drain 
+ * can start in an interrupt handler
+ */ 
+#define CARAT_MAP_LOCK_CONF uint8_t _carat_map_flags
+#define CARAT_MAP_LOCK(ctx) _carat_map_flags = spin_lock_irq_save(&((ctx)->escape_lock))
+#define CARAT_MAP_UNLOCK(ctx) spin_unlock_irq_restore(&((ctx)->escape_lock), _carat_map_flags)
+
 #define ADD_ESCAPE_TO_WINDOW(ctx, addr) \
-    ctx->escape_window[FETCH_TOTAL_ESCAPES(ctx)] = ((void **) addr); \
-    ctx->total_escape_entries++;
+    _carat_append_escape(ctx, ((void **) addr));
 
 
 /*
@@ -294,6 +381,13 @@ void nk_carat_init(void);
 nk_carat_context * initialize_new_carat_context(void);
 
 
+/*
+ * Per-aspace CARAT teardown --- releases the allocation map and
+ * all escape sets in bulk, along with @the_context itself
+ */ 
+void destroy_carat_context(nk_carat_context *the_context);
+
+
 /*
  * Utility for rsp 
  */
@@ -353,6 +447,19 @@ void nk_carat_report_statistics(void);
 void nk_carat_instrument_global(void *address, uint64_t allocation_size, uint64_t global_ID);
 
 
+/*
+ * Instrumentation for globals, in bulk --- the compiler emits a read-only
+ * table with one record per global and a single call to this
+ */
+typedef struct carat_global_record_t {
+    void *address;
+    uint64_t size;
+    uint64_t global_ID;
+} carat_global_record;
+
+void nk_carat_instrument_globals(carat_global_record *globals, uint64_t num_globals);
+
+
 /*
  * Instrumentation for "malloc" --- adding
  */
@@ -377,6 +484,16 @@ void nk_carat_instrument_realloc(void *new_address, uint64_t allocation_size, vo
 void nk_carat_instrument_free(void *address);
 
 
+/*
+ * Thread stacks --- nk_thread_create tracks each stack as a stack (see 
+ * allocation_entry) in the context of the thread's aspace, so escapes into
+ * it are recorded from the start and _carat_grow_stack can move and free
+ * it. nk_thread_destroy untracks it before freeing it
+ */
+void nk_carat_track_thread_stack(nk_thread_t *thread);
+void nk_carat_untrack_thread_stack(nk_thread_t *thread);
+
+
 /*
  * =================== Escapes Handling Methods ===================  
  */ 
@@ -391,11 +508,74 @@ void nk_carat_instrument_escapes(void *escaping_address);
 
 
 /*
- * Batch processing for escapes
+ * Slow path of escapes appended inline to the current thread's escape
+ * log (see aspace/permission_cache.h) --- the log is full or not set up
+ */ 
+void nk_carat_escape_log_full(void *escaping_address);
+
+
+/*
+ * Append an escape to the current CPU's escape buffer, draining
+ * the buffer first if it is full
+ */ 
+void _carat_append_escape(nk_carat_context *the_context, void **escape);
+
+
+/*
+ * Batch processing for escapes --- processes @num_entries escapes 
+ * from @escapes into the allocation map of @the_context. Repeated 
+ * escapes caught by @filter (may be NULL) are skipped --- returns
+ * the number of escapes skipped this way
+ */ 
+uint64_t _carat_process_escapes(
+    nk_carat_context *the_context,
+    void ***escapes,
+    uint64_t num_entries,
+    void ***filter
+);
+
+
+/*
+ * Batch processing for escapes --- merges the escape buffers of all
+ * CPUs into the allocation map. The caller must have stopped the world
+ * (or otherwise guarantee that no CPU is appending)
  */ 
 void _carat_process_escape_window(nk_carat_context *the_context);
 
 
+/*
+ * Number of escapes yet to be processed across all CPUs
+ */ 
+uint64_t _carat_count_escapes(nk_carat_context *the_context);
+
+
+/*
+ * Write barrier for concurrent migration --- marks the object being 
+ * migrated that contains @address as dirty. It runs in the guard, before
+ * the store, and not at all for writes whose guard was elided, so it only
+ * steers the precopy (the handshake compares the clean objects). The 
+ * inline check keeps guarded writes outside of the migrating range to a 
+ * compare
+ */ 
+void _carat_migration_write_barrier(nk_carat_context *the_context, void *address);
+
+#define CARAT_MIGRATION_BARRIER(c, address) \
+    if (((address) >= (c)->migration_start) && ((address) < (c)->migration_end)) { \
+        _carat_migration_write_barrier((c), (address)); \
+    }
+
+
+/*
+ * Same, for every migrating object that overlaps [@start, @end)
+ */ 
+void _carat_migration_write_barrier_range(nk_carat_context *the_context, void *start, void *end);
+
+#define CARAT_MIGRATION_BARRIER_RANGE(c, start, end) \
+    if (((end) > (c)->migration_start) && ((start) < (c)->migration_end)) { \
+        _carat_migration_write_barrier_range((c), (start), (end)); \
+    }
+
+
 /*
  * =================== Protection Handling Methods ===================  
  */ 
@@ -412,6 +592,17 @@ void nk_carat_guard_address(void *memory_address, int is_write, void* aspace);
 void nk_carat_guard_address(void *memory_address, int is_write);
 #endif
 
+/*
+ * Instrumentation for loops --- one check of the whole range 
+ * [@base, @base + @len) that a loop is going to access, instead 
+ * of a guard per access. The range may span adjacent regions
+ */
+#if USER_REGION_CHECK
+void nk_carat_guard_range(void *base, uint64_t len, int is_write, void* aspace);
+#else
+void nk_carat_guard_range(void *base, uint64_t len, int is_write);
+#endif
+
 /*
  * Instrumentation for call instructions
  * Make sure the stack has enough space to grow to support this guarded call instruction. 
@@ -0,0 +1,111 @@
+/* 
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the 
+ * United States National  Science Foundation and the Department of Energy.  
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national 
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org> 
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh, 
+ * 			Brian Suchy, Peter Dinda 
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+/*
+ * Access Sampling --- CARAT Runtime --- which CPU touches which allocation
+ *
+ * Guard calls are sampled per CPU (every Nth guard records the guarded
+ * address in a per-CPU ring). With the world stopped, a policy drains
+ * the rings, which attributes every sample to its allocation: the 
+ * allocation's saturating heat counter is bumped, and every registered 
+ * consumer (e.g. NUMA placement) is handed the entry and the CPU.
+ *
+ * Inline guards (-finline-guards) only call into the runtime on a miss,
+ * so with them, samples are drawn from guard misses.
+ */
+#pragma once
+
+#include <nautilus/nautilus.h>
+#include <aspace/carat.h>
+
+
+#define CARAT_SAMPLES_PER_CPU 512
+#define CARAT_SAMPLE_MAX_CONSUMERS 4
+#define CARAT_SAMPLE_DEFAULT_PERIOD 64 /* guards per sample */
+#define CARAT_HEAT_MAX 255
+
+
+/*
+ * Per-CPU sampler --- only written by its own CPU, drained with the 
+ * world stopped
+ */
+typedef struct carat_sampler_t {
+    uint64_t countdown;
+    uint64_t head;
+    uint64_t tail;
+    void **samples;
+} __attribute__((aligned(64))) carat_sampler;
+
+extern volatile int carat_sampling;
+extern uint64_t carat_sample_period;
+extern carat_sampler carat_samplers[NAUT_CONFIG_MAX_CPUS];
+
+
+/*
+ * Called from the guards --- the countdown is inline, so guards that
+ * are not sampled only pay for a decrement
+ */
+#define CARAT_SAMPLE(address) \
+    if (carat_sampling) { \
+        carat_sampler *_sampler = &(carat_samplers[my_cpu_id()]); \
+        if (!(--(_sampler->countdown))) { \
+            _sampler->countdown = carat_sample_period; \
+            _sampler->samples[(_sampler->head++) % CARAT_SAMPLES_PER_CPU] = (address); \
+        } \
+    }
+
+
+/*
+ * Handed every attributed sample --- the world is stopped. @entry is
+ * only valid for the call, and the consumer must not change the 
+ * allocation map (entries may be stored by value)
+ */
+typedef void (*carat_sample_consumer)(allocation_entry *entry, int cpu, void *state);
+
+
+typedef struct carat_sampling_stats_t {
+    uint64_t drains;
+    uint64_t samples;
+    uint64_t unattributed_samples;
+} carat_sampling_stats;
+
+
+/*
+ * Register/unregister a consumer --- sampling is on while at least one 
+ * consumer is registered. A NULL @consumer only wants heat counters.
+ * Returns -1 if the sample rings cannot be allocated or there is no room
+ */
+int nk_carat_sampling_start(carat_sample_consumer consumer, void *state);
+void nk_carat_sampling_stop(carat_sample_consumer consumer, void *state);
+
+
+/*
+ * Attribute all pending samples --- the world must be stopped and CARAT
+ * must be off (the allocation map is searched)
+ */
+void nk_carat_sampling_drain(nk_carat_context *the_context);
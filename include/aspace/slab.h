@@ -0,0 +1,114 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh,
+ * 			Brian Suchy, Peter Dinda
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+
+/*
+ * Slabs --- CARAT Runtime --- metadata allocation
+ *
+ * CARAT metadata (allocation map nodes, escape sets and their tables) is
+ * small, fixed-size and allocated at the rate the program allocates and
+ * escapes pointers. Instead of going to kmem for each object, a slab cache
+ * carves large slabs into objects and hands them out from per-CPU free 
+ * lists (interrupts off, no lock). Objects freed on a CPU go back to that 
+ * CPU's list. Slabs are never returned one at a time --- destroying a
+ * cache releases all of its slabs at once, so tearing down a structure 
+ * with millions of objects costs O(number of slabs).
+ *
+ * An arena groups slab caches by power-of-2 size class for variably
+ * sized metadata (escape set tables), with anything above the largest
+ * class allocated directly and chained for bulk release.
+ */
+#pragma once
+
+#include <nautilus/nautilus.h>
+#include <nautilus/spinlock.h>
+
+
+#define CARAT_SLAB_MIN_BYTES (64 * 1024)
+#define CARAT_SLAB_MIN_OBJECTS 16
+#define CARAT_SLAB_ALIGN 16
+#define CARAT_SLAB_HEADER CARAT_SLAB_ALIGN /* chains the slabs of a cache */
+
+#define CARAT_ARENA_MIN_SHIFT 7 /* 128 bytes */
+#define CARAT_ARENA_MAX_SHIFT 14 /* 16 KB */
+#define CARAT_ARENA_CLASSES (CARAT_ARENA_MAX_SHIFT - CARAT_ARENA_MIN_SHIFT + 1)
+
+
+typedef struct carat_slab_cpu_t {
+    void *free; // free objects, chained through their first word
+} __attribute__((aligned(64))) carat_slab_cpu;
+
+
+typedef struct carat_slab_cache_t {
+
+    uint64_t object_size;
+    uint64_t objects_per_slab;
+    uint64_t slab_bytes;
+
+    /*
+     * All slabs of the cache, chained through their headers
+     */
+    spinlock_t lock;
+    void *slabs;
+    uint64_t num_slabs;
+
+    carat_slab_cpu *cpus;
+    uint64_t num_cpus;
+
+} carat_slab_cache;
+
+
+typedef struct carat_arena_t {
+
+    carat_slab_cache *classes[CARAT_ARENA_CLASSES];
+
+    /*
+     * Objects above the largest class
+     */
+    spinlock_t lock;
+    struct list_head large;
+
+} carat_arena;
+
+
+/*
+ * Slab caches --- @object_size bytes per object
+ */
+carat_slab_cache *carat_slab_cache_create(uint64_t object_size);
+void carat_slab_cache_destroy(carat_slab_cache *cache);
+void *carat_slab_alloc(carat_slab_cache *cache);
+void carat_slab_free(carat_slab_cache *cache, void *object);
+
+
+/*
+ * Arenas --- @size must be passed back on free
+ */
+carat_arena *carat_arena_create(void);
+void carat_arena_destroy(carat_arena *arena);
+void *carat_arena_alloc(carat_arena *arena, uint64_t size);
+void carat_arena_free(carat_arena *arena, void *object, uint64_t size);
@@ -50,6 +50,9 @@ struct nk_crt_proc_args {
 #define NK_FREE 15
 #define NK_REALLOC 16
 #define NK_ASPACE_PTR 17
+#define NK_CARAT_INSTRUMENT_GLOBALS 18
+#define NK_CARAT_RANGE_PROTECT 19
+#define NK_CARAT_ESCAPE_LOG_FULL 20
 
 
 #ifdef NAUTILUS_EXE
@@ -203,6 +203,23 @@ int nk_sched_stop_world();
 struct nk_thread *nk_sched_get_cur_thread_on_cpu(int cpu);
 int nk_sched_start_world();
 
+// Scoped variant of the above: only the cores currently running
+// threads of the given aspace are stopped - other cores keep running
+// their current thread, but will not switch threads until the aspace
+// is started again, so no thread of the aspace can run meanwhile
+// aspace==NULL is equivalent to a whole world stop
+int nk_sched_stop_aspace(struct nk_aspace *aspace);
+int nk_sched_start_aspace(struct nk_aspace *aspace);
+
+// While the world is stopped, the stopper can put the stopped cores
+// to work: func(cpu,state) is run on every core (including the
+// stopper's) and this returns once all of them have finished
+// For a scoped stop, only the held cores (and the stopper) run func
+// func runs in interrupt context on the stopped cores - it must not
+// block, allocate stacks, or stop/start the world
+// returns 0 on success, -1 if the caller is not the world stopper
+int nk_sched_run_on_stopped_cpus(void (*func)(int cpu, void *state), void *state);
+
 
 // Invoked by interrupt handler wrapper and other code
 // to cause thread context switches
@@ -49,6 +49,9 @@ extern "C" {
 
 #include <nautilus/alloc.h>
 
+// Always included so we get the necessary type
+#include <aspace/permission_cache.h>
+
 typedef uint64_t nk_stack_size_t;
     
 #include <nautilus/scheduler.h>
@@ -194,6 +197,10 @@ struct nk_thread {
                                  /* Always included to reserve this "slot" for asm code */
     nk_signal_task_state *signal_state; /* +32 SHOULD NOT CHANGE POSITION */
                                         /* Always included */
+    nk_carat_guard_descriptor carat_guard; /* +40 SHOULD NOT CHANGE POSITION */
+                                           /* Always included to reserve this "slot" for compiler-inlined guards */
+    nk_carat_escape_log carat_escapes; /* +64 SHOULD NOT CHANGE POSITION */
+                                       /* Always included to reserve this "slot" for compiler-inlined escapes */
 
 #ifdef NAUT_CONFIG_PROCESSES
     struct nk_process *process;       /* Initialized if part of a process */
@@ -251,6 +258,11 @@ struct nk_thread {
     void  *gc_state;
 #endif
 
+#ifdef NAUT_CONFIG_ASPACE_CARAT
+    nk_carat_permission_cache carat_permission_cache;
+    void **carat_escape_entries[NK_CARAT_ESCAPE_LOG_ENTRIES];
+#endif
+
     char name[MAX_THREAD_NAME];
 
     const void * tls[TLS_MAX_KEYS];
@@ -57,6 +57,9 @@
 #include <nautilus/dev.h>
 #ifdef NAUT_CONFIG_ASPACE_CARAT
 #include <aspace/patching.h>
+#include <aspace/compaction.h>
+#include <aspace/numa_placement.h>
+#include <aspace/hot_cold.h>
 #endif
 #ifdef NAUT_CONFIG_PARTITION_SUPPORT
 #include <nautilus/partition.h>
@@ -502,6 +505,18 @@ init (unsigned long mbd,
 
     nk_sched_start();
     
+#ifdef NAUT_CONFIG_CARAT_COMPACTION_DAEMON
+    nk_carat_compaction_start();
+#endif
+
+#ifdef NAUT_CONFIG_CARAT_NUMA_PLACEMENT
+    nk_carat_numa_start();
+#endif
+
+#ifdef NAUT_CONFIG_CARAT_HOT_COLD
+    nk_carat_hot_cold_start();
+#endif
+
 #ifdef NAUT_CONFIG_FIBER_ENABLE
     nk_fiber_init();
     nk_fiber_startup();
@@ -0,0 +1,512 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh,
+ * 			Brian Suchy, Peter Dinda
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <aspace/bptree.h>
+
+
+/*
+ * =================== Search Helpers ===================
+ */
+
+/*
+ * Number of keys in @keys[0 .. @n) that are <= @key
+ */
+NO_CARAT
+static inline uint32_t _upper_bound(uintptr_t *keys, uint32_t n, uintptr_t key)
+{
+    uint32_t lo = 0, hi = n;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) >> 1;
+        if (keys[mid] <= key) { lo = mid + 1; }
+        else { hi = mid; }
+    }
+
+    return lo;
+}
+
+
+/*
+ * Walk from the root to the leaf that should hold @key, recording
+ * the inner nodes and child indices along the way in @path/@slots
+ * (both sized CARAT_BPTREE_MAX_HEIGHT)
+ */
+NO_CARAT
+static carat_bptree_leaf *_descend(
+    carat_bptree *tree,
+    uintptr_t key,
+    carat_bptree_inner **path,
+    uint32_t *slots
+)
+{
+    void *node = tree->root;
+    for (uint32_t level = 0; level < tree->height; level++)
+    {
+        carat_bptree_inner *inner = (carat_bptree_inner *) node;
+        uint32_t slot = _upper_bound(inner->keys, inner->num_children - 1, key);
+
+        if (path) {
+            path[level] = inner;
+            slots[level] = slot;
+        }
+
+        node = inner->children[slot];
+    }
+
+    return (carat_bptree_leaf *) node;
+}
+
+
+NO_CARAT
+static carat_bptree_leaf *_build_leaf(carat_bptree *tree)
+{
+    carat_bptree_leaf *leaf = (carat_bptree_leaf *) carat_slab_alloc(tree->leaf_slab);
+    leaf->num_keys = 0;
+    leaf->prev = leaf->next = NULL;
+    return leaf;
+}
+
+
+NO_CARAT
+static carat_bptree_inner *_build_inner(carat_bptree *tree)
+{
+    carat_bptree_inner *inner = (carat_bptree_inner *) carat_slab_alloc(tree->inner_slab);
+    inner->num_children = 0;
+    return inner;
+}
+
+
+/*
+ * =================== Build/Teardown ===================
+ */
+
+NO_CARAT
+carat_bptree *carat_bptree_create(void)
+{
+    carat_bptree *tree = (carat_bptree *) CARAT_MALLOC(sizeof(carat_bptree));
+
+    tree->leaf_slab = carat_slab_cache_create(sizeof(carat_bptree_leaf));
+    tree->inner_slab = carat_slab_cache_create(sizeof(carat_bptree_inner));
+
+    tree->root = tree->first = _build_leaf(tree);
+    tree->height = 0;
+    tree->size = 0;
+
+    return tree;
+}
+
+
+/*
+ * Nodes are released with their slabs --- no walk over the tree
+ */
+NO_CARAT
+void carat_bptree_destroy(carat_bptree *tree)
+{
+    carat_slab_cache_destroy(tree->leaf_slab);
+    carat_slab_cache_destroy(tree->inner_slab);
+    free(tree);
+}
+
+
+/*
+ * =================== Lookup ===================
+ */
+
+NO_CARAT
+allocation_entry *carat_bptree_lower_bound(carat_bptree *tree, uintptr_t key)
+{
+    carat_bptree_leaf *leaf = _descend(tree, key, NULL, NULL);
+    uint32_t slot = _upper_bound(leaf->keys, leaf->num_keys, key);
+
+    /*
+     * Every key in this leaf is > @key (its minimum was removed after the
+     * separator was chosen) --- the answer is the last key of the previous leaf
+     */
+    if (!slot) {
+        leaf = leaf->prev;
+        if (!leaf) { return NULL; }
+        slot = leaf->num_keys;
+    }
+
+    return &(leaf->entries[slot - 1]);
+}
+
+
+void carat_bptree_iter_seek(carat_bptree *tree, uintptr_t key, carat_bptree_iter *it)
+{
+    carat_bptree_leaf *leaf = _descend(tree, key, NULL, NULL);
+
+
+    /*
+     * First slot with a key >= @key --- past the end of this leaf,
+     * the answer is the first key of the next one
+     */
+    uint32_t slot = (key) ? _upper_bound(leaf->keys, leaf->num_keys, key - 1) : 0;
+    if (slot >= leaf->num_keys) {
+        leaf = leaf->next;
+        slot = 0;
+    }
+
+    it->leaf = (leaf && leaf->num_keys) ? leaf : NULL;
+    it->index = slot;
+
+    return;
+}
+
+
+/*
+ * =================== Insertion ===================
+ */
+
+/*
+ * Insert (@key, @right) into @path[@level], splitting upwards as needed
+ */
+NO_CARAT
+static void _insert_into_parent(
+    carat_bptree *tree,
+    carat_bptree_inner **path,
+    uint32_t *slots,
+    int level,
+    uintptr_t key,
+    void *right
+)
+{
+    /*
+     * Split the root --- the tree grows by one level
+     */
+    if (level < 0)
+    {
+        carat_bptree_inner *new_root = _build_inner(tree);
+        new_root->children[0] = tree->root;
+        new_root->children[1] = right;
+        new_root->keys[0] = key;
+        new_root->num_children = 2;
+
+        tree->root = new_root;
+        tree->height++;
+        if (tree->height >= CARAT_BPTREE_MAX_HEIGHT) {
+            panic("carat_bptree: tree is too tall\n");
+        }
+
+        return;
+    }
+
+
+    carat_bptree_inner *inner = path[level];
+    uint32_t slot = slots[level] + 1; /* @right goes after the child we came from */
+
+    if (inner->num_children < CARAT_BPTREE_FANOUT)
+    {
+        memmove(&(inner->children[slot + 1]), &(inner->children[slot]), (inner->num_children - slot) * sizeof(void *));
+        memmove(&(inner->keys[slot]), &(inner->keys[slot - 1]), (inner->num_children - slot) * sizeof(uintptr_t));
+        inner->children[slot] = right;
+        inner->keys[slot - 1] = key;
+        inner->num_children++;
+        return;
+    }
+
+
+    /*
+     * Full --- build the overfull node in scratch space, then split it
+     */
+    uintptr_t keys[CARAT_BPTREE_FANOUT];
+    void *children[CARAT_BPTREE_FANOUT + 1];
+
+    memcpy(children, inner->children, slot * sizeof(void *));
+    children[slot] = right;
+    memcpy(&(children[slot + 1]), &(inner->children[slot]), (CARAT_BPTREE_FANOUT - slot) * sizeof(void *));
+
+    memcpy(keys, inner->keys, (slot - 1) * sizeof(uintptr_t));
+    keys[slot - 1] = key;
+    memcpy(&(keys[slot]), &(inner->keys[slot - 1]), (CARAT_BPTREE_FANOUT - slot) * sizeof(uintptr_t));
+
+    uint32_t total = CARAT_BPTREE_FANOUT + 1;
+    uint32_t left_count = total / 2;
+    carat_bptree_inner *sibling = _build_inner(tree);
+
+    memcpy(inner->children, children, left_count * sizeof(void *));
+    memcpy(inner->keys, keys, (left_count - 1) * sizeof(uintptr_t));
+    inner->num_children = left_count;
+
+    memcpy(sibling->children, &(children[left_count]), (total - left_count) * sizeof(void *));
+    memcpy(sibling->keys, &(keys[left_count]), (total - left_count - 1) * sizeof(uintptr_t));
+    sibling->num_children = total - left_count;
+
+    _insert_into_parent(tree, path, slots, level - 1, keys[left_count - 1], sibling);
+
+    return;
+}
+
+
+NO_CARAT
+int carat_bptree_insert(carat_bptree *tree, allocation_entry *entry)
+{
+    uintptr_t key = (uintptr_t) entry->pointer;
+    carat_bptree_inner *path[CARAT_BPTREE_MAX_HEIGHT];
+    uint32_t slots[CARAT_BPTREE_MAX_HEIGHT];
+
+    carat_bptree_leaf *leaf = _descend(tree, key, path, slots);
+    uint32_t slot = _upper_bound(leaf->keys, leaf->num_keys, key);
+
+
+    /*
+     * Same key --- replace the stale entry
+     */
+    if (slot && (leaf->keys[slot - 1] == key)) {
+        leaf->entries[slot - 1] = *entry;
+        return 0;
+    }
+
+
+    if (leaf->num_keys < CARAT_BPTREE_LEAF_SLOTS)
+    {
+        uint32_t tail = leaf->num_keys - slot;
+        memmove(&(leaf->keys[slot + 1]), &(leaf->keys[slot]), tail * sizeof(uintptr_t));
+        memmove(&(leaf->entries[slot + 1]), &(leaf->entries[slot]), tail * sizeof(allocation_entry));
+        leaf->keys[slot] = key;
+        leaf->entries[slot] = *entry;
+        leaf->num_keys++;
+        tree->size++;
+        return 0;
+    }
+
+
+    /*
+     * Full leaf --- move the upper half into a new right sibling, then
+     * insert into whichever half @key belongs to
+     */
+    carat_bptree_leaf *sibling = _build_leaf(tree);
+    uint32_t left_count = CARAT_BPTREE_LEAF_SLOTS / 2;
+    uint32_t right_count = CARAT_BPTREE_LEAF_SLOTS - left_count;
+
+    memcpy(sibling->keys, &(leaf->keys[left_count]), right_count * sizeof(uintptr_t));
+    memcpy(sibling->entries, &(leaf->entries[left_count]), right_count * sizeof(allocation_entry));
+    sibling->num_keys = right_count;
+    leaf->num_keys = left_count;
+
+    sibling->next = leaf->next;
+    sibling->prev = leaf;
+    if (leaf->next) { leaf->next->prev = sibling; }
+    leaf->next = sibling;
+
+    carat_bptree_leaf *target = (slot <= left_count) ? leaf : sibling;
+    uint32_t target_slot = (slot <= left_count) ? slot : (slot - left_count);
+    uint32_t tail = target->num_keys - target_slot;
+
+    memmove(&(target->keys[target_slot + 1]), &(target->keys[target_slot]), tail * sizeof(uintptr_t));
+    memmove(&(target->entries[target_slot + 1]), &(target->entries[target_slot]), tail * sizeof(allocation_entry));
+    target->keys[target_slot] = key;
+    target->entries[target_slot] = *entry;
+    target->num_keys++;
+    tree->size++;
+
+    _insert_into_parent(tree, path, slots, ((int) tree->height) - 1, sibling->keys[0], sibling);
+
+    return 0;
+}
+
+
+/*
+ * Leaves and inner nodes built by a bulk load are left a quarter
+ * empty, so the inserts that follow do not split them straight away
+ */
+#define CARAT_BPTREE_BULK_LEAF_FILL ((CARAT_BPTREE_LEAF_SLOTS * 3) / 4)
+#define CARAT_BPTREE_BULK_INNER_FILL ((CARAT_BPTREE_FANOUT * 3) / 4)
+
+NO_CARAT
+int carat_bptree_bulk_load(carat_bptree *tree, allocation_entry *entries, uint64_t num_entries)
+{
+    if (tree->size) { return -1; }
+    if (!num_entries) { return 0; }
+
+
+    /*
+     * Pack the leaves left to right, recording each node and its 
+     * smallest key --- the empty root leaf becomes the first one
+     */
+    uint64_t num_nodes = (num_entries + CARAT_BPTREE_BULK_LEAF_FILL - 1) / CARAT_BPTREE_BULK_LEAF_FILL;
+    void **nodes = (void **) CARAT_MALLOC(num_nodes * sizeof(void *));
+    uintptr_t *mins = (uintptr_t *) CARAT_MALLOC(num_nodes * sizeof(uintptr_t));
+
+    carat_bptree_leaf *prev = NULL;
+    for (uint64_t l = 0; l < num_nodes; l++)
+    {
+        carat_bptree_leaf *leaf = (l) ? _build_leaf(tree) : tree->first;
+        uint64_t first = l * CARAT_BPTREE_BULK_LEAF_FILL;
+        uint64_t count = ((num_entries - first) < CARAT_BPTREE_BULK_LEAF_FILL) ? (num_entries - first) : CARAT_BPTREE_BULK_LEAF_FILL;
+
+        for (uint64_t i = 0; i < count; i++) {
+            leaf->keys[i] = (uintptr_t) entries[first + i].pointer;
+            leaf->entries[i] = entries[first + i];
+        }
+        leaf->num_keys = count;
+
+        leaf->prev = prev;
+        if (prev) { prev->next = leaf; }
+        prev = leaf;
+
+        nodes[l] = leaf;
+        mins[l] = leaf->keys[0];
+    }
+
+
+    /*
+     * Then each inner level over the one below, in place, until a 
+     * single root remains
+     */
+    uint32_t height = 0;
+    while (num_nodes > 1)
+    {
+        uint64_t num_parents = (num_nodes + CARAT_BPTREE_BULK_INNER_FILL - 1) / CARAT_BPTREE_BULK_INNER_FILL;
+
+        for (uint64_t p = 0; p < num_parents; p++)
+        {
+            carat_bptree_inner *inner = _build_inner(tree);
+            uint64_t first = p * CARAT_BPTREE_BULK_INNER_FILL;
+            uint64_t count = ((num_nodes - first) < CARAT_BPTREE_BULK_INNER_FILL) ? (num_nodes - first) : CARAT_BPTREE_BULK_INNER_FILL;
+
+            for (uint64_t c = 0; c < count; c++)
+            {
+                inner->children[c] = nodes[first + c];
+                if (c) { inner->keys[c - 1] = mins[first + c]; }
+            }
+            inner->num_children = count;
+
+            mins[p] = mins[first];
+            nodes[p] = inner;
+        }
+
+        num_nodes = num_parents;
+        if (++height >= CARAT_BPTREE_MAX_HEIGHT) {
+            panic("carat_bptree: tree is too tall\n");
+        }
+    }
+
+    tree->root = nodes[0];
+    tree->height = height;
+    tree->size = num_entries;
+
+    free(nodes);
+    free(mins);
+
+
+    return 0;
+}
+
+
+/*
+ * =================== Removal ===================
+ */
+
+/*
+ * Remove child @slot from @path[@level] --- inner nodes are freed when
+ * they lose their last child, and a root with a single child is collapsed
+ */
+NO_CARAT
+static void _remove_from_parent(
+    carat_bptree *tree,
+    carat_bptree_inner **path,
+    uint32_t *slots,
+    int level
+)
+{
+    carat_bptree_inner *inner = path[level];
+    uint32_t slot = slots[level];
+
+    if (inner->num_children == 1)
+    {
+        /*
+         * Last child gone --- free this node and drop it from its own
+         * parent. This never reaches the root, which always has two or
+         * more children since single-child roots are collapsed below
+         */
+        carat_slab_free(tree->inner_slab, inner);
+        _remove_from_parent(tree, path, slots, level - 1);
+        return;
+    }
+
+    memmove(&(inner->children[slot]), &(inner->children[slot + 1]), (inner->num_children - slot - 1) * sizeof(void *));
+    if (slot) {
+        memmove(&(inner->keys[slot - 1]), &(inner->keys[slot]), (inner->num_children - slot - 1) * sizeof(uintptr_t));
+    } else {
+        memmove(&(inner->keys[0]), &(inner->keys[1]), (inner->num_children - 2) * sizeof(uintptr_t));
+    }
+    inner->num_children--;
+
+
+    /*
+     * Collapse single-child roots
+     */
+    while (tree->height && (((carat_bptree_inner *) tree->root)->num_children == 1))
+    {
+        carat_bptree_inner *old_root = (carat_bptree_inner *) tree->root;
+        tree->root = old_root->children[0];
+        tree->height--;
+        carat_slab_free(tree->inner_slab, old_root);
+    }
+
+    return;
+}
+
+
+NO_CARAT
+int carat_bptree_remove(carat_bptree *tree, uintptr_t key)
+{
+    carat_bptree_inner *path[CARAT_BPTREE_MAX_HEIGHT];
+    uint32_t slots[CARAT_BPTREE_MAX_HEIGHT];
+
+    carat_bptree_leaf *leaf = _descend(tree, key, path, slots);
+    uint32_t slot = _upper_bound(leaf->keys, leaf->num_keys, key);
+
+    if (!slot || (leaf->keys[slot - 1] != key)) { return -1; }
+    slot--;
+
+
+    uint32_t tail = leaf->num_keys - slot - 1;
+    memmove(&(leaf->keys[slot]), &(leaf->keys[slot + 1]), tail * sizeof(uintptr_t));
+    memmove(&(leaf->entries[slot]), &(leaf->entries[slot + 1]), tail * sizeof(allocation_entry));
+    leaf->num_keys--;
+    tree->size--;
+
+
+    /*
+     * Leaves are freed once they are empty rather than merged when they
+     * run low --- deletes never restructure more than one path, and
+     * lookups stay correct since an under-full leaf is still sorted
+     */
+    if (leaf->num_keys || !(tree->height)) { return 0; }
+
+    if (leaf->prev) { leaf->prev->next = leaf->next; }
+    else { tree->first = leaf->next; }
+    if (leaf->next) { leaf->next->prev = leaf->prev; }
+    carat_slab_free(tree->leaf_slab, leaf);
+
+    _remove_from_parent(tree, path, slots, ((int) tree->height) - 1);
+
+
+    return 0;
+}
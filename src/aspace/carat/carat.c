@@ -81,6 +81,59 @@ int CARAT_INVALID(nk_aspace_region_t *region) {
     return region != NULL && region->va_start != region->pa_start;
 }
 
+
+/*
+ * Guard descriptors --- see aspace/permission_cache.h. The compiler
+ * hardcodes where they live in struct nk_thread
+ */ 
+_Static_assert(offsetof(struct nk_thread, carat_guard) == NK_CARAT_GUARD_DESCRIPTOR_OFFSET,
+               "carat_guard must sit at NK_CARAT_GUARD_DESCRIPTOR_OFFSET in struct nk_thread");
+_Static_assert(offsetof(struct nk_thread, carat_escapes) == NK_CARAT_ESCAPE_LOG_OFFSET,
+               "carat_escapes must sit at NK_CARAT_ESCAPE_LOG_OFFSET in struct nk_thread");
+
+static inline void clear_guard_descriptor(nk_thread_t *t)
+{
+    t->carat_guard.limit = 0;
+}
+
+static inline void publish_guard_descriptor(nk_thread_t *t, nk_aspace_region_t *region)
+{
+    uint64_t allowed = 
+        NK_ASPACE_GET_WRITE(region->protect.flags) ? (NK_CARAT_GUARD_READ | NK_CARAT_GUARD_WRITE) :
+        NK_ASPACE_GET_READ(region->protect.flags) ? NK_CARAT_GUARD_READ : 0;
+
+    /*
+     * Keep the descriptor empty while it is rewritten, a guard 
+     * in an interrupt handler on this thread may look at it
+     */ 
+    nk_carat_guard_descriptor *descriptor = &(t->carat_guard);
+    descriptor->limit = 0;
+    __asm__ __volatile__ ("" ::: "memory");
+    descriptor->base = (uint64_t) region->va_start;
+    descriptor->permissions = region->requested_permissions & allowed;
+    __asm__ __volatile__ ("" ::: "memory");
+    descriptor->limit = ((uint64_t) region->va_start) + region->len_bytes;
+}
+
+
+/*
+ * A region was removed, moved, resized or had its protection changed
+ * --- drop every thread's cached region lookups for this aspace, and the
+ * guard descriptors of its threads. Before a region is removed or its
+ * memory released, bump first (so no cached lookup outlives it) and again
+ * once the region tracking is updated (dropping lookups that raced with
+ * the update)
+ */ 
+static void permission_epoch_bump(nk_aspace_carat_t *carat)
+{
+    __sync_fetch_and_add(&(carat->permission_epoch), 1);
+
+    struct list_head *cur;
+    list_for_each(cur, &(carat->threads.thread_node)) {
+        clear_guard_descriptor(list_entry(cur, nk_aspace_carat_thread_t, thread_node)->thread_ptr);
+    }
+}
+
 static int destroy(void *state) {
     nk_aspace_carat_t *carat = (nk_aspace_carat_t *)state;
     ASPACE_LOCK_CONF;
@@ -104,6 +157,8 @@ static int destroy(void *state) {
         free(wrapper_ptr);
     }
 
+    destroy_carat_context(carat->context);
+
     nk_aspace_unregister(carat->aspace);
     ASPACE_UNLOCK(carat);
 
@@ -124,6 +179,7 @@ static int _add_thread_to_carat_aspace_list(
      */ 
     nk_aspace_carat_thread_t * new_thread_wrapper = (nk_aspace_carat_thread_t *) malloc(sizeof(nk_aspace_carat_thread_t));
     new_thread_wrapper->thread_ptr = t;
+    clear_guard_descriptor(t);
 
 
     /*
@@ -185,6 +241,8 @@ static int remove_thread(void *state)
     // }
         nk_aspace_carat_thread_t * wrapper_ptr = list_entry(cur, nk_aspace_carat_thread_t, thread_node);
         if (wrapper_ptr->thread_ptr == t) {
+            clear_guard_descriptor(t);
+            nk_carat_escape_log_release(t);
             list_del(cur);
             free(wrapper_ptr);
             failed = 0; 
@@ -259,7 +317,9 @@ static int remove_region(void *state, nk_aspace_region_t *region)
     }
 
     uint8_t check_flag = VA_CHECK | PA_CHECK | LEN_CHECK | PROTECT_CHECK;
+    permission_epoch_bump(carat);
     int remove_failed = mm_remove(carat->mm, region, check_flag);
+    permission_epoch_bump(carat);
 
     if (remove_failed) {
         DEBUG("Remove region Failed: %s\n", region_buf);
@@ -324,6 +384,7 @@ static int protect_region(void *state, nk_aspace_region_t *region, nk_aspace_pro
      * The protection change is valid
      */
     region->protect = *prot;
+    permission_epoch_bump(carat);
 
     // TODO: remove region with data structure
     ASPACE_UNLOCK(carat);
@@ -409,6 +470,55 @@ static int protection_check(void * state, nk_aspace_region_t * region) {
     return -1;
 }
 
+/*
+ * Per-thread permission cache --- see aspace/permission_cache.h
+ */ 
+static inline nk_aspace_region_t *permission_cache_lookup(
+    nk_carat_permission_cache *cache,
+    nk_aspace_carat_t *carat,
+    uint64_t epoch,
+    void *address
+)
+{
+    if ((cache->owner != carat) || (cache->epoch != epoch)) {
+        memset(cache->ways, 0, sizeof(cache->ways));
+        cache->owner = carat;
+        cache->epoch = epoch;
+        return NULL;
+    }
+
+    nk_aspace_region_t **set = cache->ways[CARAT_PERMISSION_CACHE_SET(address)];
+    for (int i = 0; i < CARAT_PERMISSION_CACHE_WAYS; i++) {
+        nk_aspace_region_t *region = set[i];
+        if (region && (address >= region->va_start) && (address < (region->va_start + region->len_bytes))) {
+            return region;
+        }
+    }
+
+    return NULL;
+}
+
+static inline void permission_cache_fill(
+    nk_carat_permission_cache *cache,
+    uint64_t epoch,
+    void *address,
+    nk_aspace_region_t *region
+)
+{
+    /*
+     * The cache may have been flushed for a newer epoch in the meantime
+     * (e.g., by a guard in an interrupt handler), and @region may be stale
+     */ 
+    if (cache->epoch != epoch) {
+        return;
+    }
+
+    uint64_t index = CARAT_PERMISSION_CACHE_SET(address);
+    cache->ways[index][cache->victim[index]] = region;
+    cache->victim[index] = (cache->victim[index] + 1) % CARAT_PERMISSION_CACHE_WAYS;
+}
+
+
 static int request_permission(void * state, void * address, int is_write) {
 
     /*
@@ -418,6 +528,14 @@ static int request_permission(void * state, void * address, int is_write) {
     nk_aspace_region_t *region;
 
 
+    /*
+     * The epoch must be read before any region is looked at, so that
+     * a concurrent region change is neither cached nor published
+     */ 
+    uint64_t epoch = carat->permission_epoch;
+    __asm__ __volatile__ ("" ::: "memory");
+
+
     /*
      * Set up profiling
      *
@@ -445,9 +563,9 @@ static int request_permission(void * state, void * address, int is_write) {
     /*
      * Check @address against the stack
      */ 
-    if (false
-        || (address >= stack->va_start)
-        || (address < (stack->va_start + stack->len_bytes))) 
+    if (true
+        && (address >= stack->va_start)
+        && (address < (stack->va_start + stack->len_bytes))) 
     {
         region = stack;
         // CARAT_PROFILE_STOP_COMMIT_RESET(0, cache_check_time, 0);
@@ -459,9 +577,9 @@ static int request_permission(void * state, void * address, int is_write) {
      * Check @address against the blob
      */ 
     else if (
-        false
-        || (address < blob->va_start)
-        || (address > (blob->va_start + blob->len_bytes))
+        true
+        && (address >= blob->va_start)
+        && (address < (blob->va_start + blob->len_bytes))
     )
     { 
         region = blob;
@@ -493,13 +611,26 @@ static int request_permission(void * state, void * address, int is_write) {
     
 
     /*
-     * The cached checks have failed --- find the region 
-     * that @address belongs to by walking through the 
-     * region data structure
+     * The cached checks have failed --- try the regions this 
+     * thread has touched recently, then fall back to finding
+     * the region that @address belongs to by walking through
+     * the region data structure (see @epoch above)
      */ 
     // 3 ---
     // CARAT_PROFILE_START_TIMING(0, 0);
-    region = mm_find_reg_at_addr(carat->mm, (addr_t) address);
+    nk_carat_permission_cache *cache = &(FETCH_THREAD->carat_permission_cache);
+
+    region = permission_cache_lookup(cache, carat, epoch, address);
+    if (region) {
+        CARAT_PROFILE_INCR(CARAT_DO_PROFILE, permission_cache_hits);
+    } else {
+        CARAT_PROFILE_INCR(CARAT_DO_PROFILE, permission_cache_misses);
+
+        region = mm_find_reg_at_addr(carat->mm, (addr_t) address);
+        if (region) {
+            permission_cache_fill(cache, epoch, address, region);
+        }
+    }
     // CARAT_PROFILE_STOP_COMMIT_RESET(0, region_find_time, 0);
     // 3 ---
 
@@ -552,9 +683,30 @@ static int request_permission(void * state, void * address, int is_write) {
     /* 
 	 * If the access is valid, we need to store the fact that the region has allowed this access *within* the region
      * When a protection change happens for the region, it will confirm that the outstanding access is still valid.
+     *
+     * Only write when this adds a permission --- every CPU touching a busy region (the 
+     * initial stack, the blob) would otherwise bounce its cache line on every guard. 
+     * The write is atomic so that concurrent first accesses cannot lose each other's bits
  	 */ 
 set_request_permissions:
-    region->requested_permissions |= is_write + 1;
+    if ((region->requested_permissions | (is_write + 1)) != region->requested_permissions) {
+        __sync_fetch_and_or(&(region->requested_permissions), is_write + 1);
+        CARAT_PROFILE_INCR(CARAT_DO_PROFILE, requested_permission_updates);
+    }
+
+    publish_guard_descriptor(FETCH_THREAD, region);
+
+
+    /*
+     * A bump since @epoch was read may have cleared the descriptors 
+     * before we published @region --- which may no longer exist, so 
+     * take it back. The bump updates the epoch before it clears, so
+     * either it sees our descriptor or we see its epoch
+     */ 
+    __sync_synchronize();
+    if (carat->permission_epoch != epoch) {
+        clear_guard_descriptor(FETCH_THREAD);
+    }
 
 
 #if FULL_CARAT
@@ -661,8 +813,10 @@ static int defragment_region(
 
     DEBUG("carat move completed\n");
 
+    permission_epoch_bump(carat);
     mm_remove(carat->mm, cur_region, all_eq_flag );
     mm_insert(carat->mm,  &new_region);
+    permission_epoch_bump(carat);
 
 
     DEBUG("region data structure updated\n");
@@ -737,11 +891,13 @@ static int move_region(void *state, nk_aspace_region_t *cur_region, nk_aspace_re
      * update the region tracking data structure
      * */
 
+    permission_epoch_bump(carat);
     ASPACE_UNLOCK(carat);
     
     int remove_failed = mm_remove(carat->mm, cur_region, all_eq_flag);
 
     ASPACE_LOCK(carat);
+    permission_epoch_bump(carat);
     
     if (remove_failed) {
         DEBUG("Remove region"REGION_FORMAT" Failed\n", REGION(cur_region));
@@ -750,6 +906,7 @@ static int move_region(void *state, nk_aspace_region_t *cur_region, nk_aspace_re
     } 
 
     int insert_failed =  mm_insert(carat->mm, new_region);
+    permission_epoch_bump(carat);
     
     if (insert_failed) {
         DEBUG("Insert region"REGION_FORMAT" Failed\n", REGION(new_region));
@@ -962,6 +1119,7 @@ static int resize_region(void *state, nk_aspace_region_t *region, uint64_t new_s
      * update
      * */
     uint64_t actual_size_for_kmem;
+    permission_epoch_bump(carat);
     CARAT_READY_OFF(carat->context);
     int res = kmem_sys_realloc_in_place(new_region.va_start, new_region.len_bytes, &actual_size_for_kmem);
     CARAT_READY_ON(carat->context);
@@ -977,6 +1135,7 @@ static int resize_region(void *state, nk_aspace_region_t *region, uint64_t new_s
 
     uint8_t check_flag = VA_CHECK | PA_CHECK | PROTECT_CHECK;
     nk_aspace_region_t * target_region = mm_update_region(carat->mm, region, &new_region, check_flag);
+    permission_epoch_bump(carat);
     
 
     if (target_region == NULL){
@@ -1107,6 +1266,14 @@ static struct nk_aspace *create(char *name, nk_aspace_characteristics_t *c)
     
     memset(carat,0,sizeof(*carat));
 
+    /*
+     * Epochs start out distinct per aspace, so that thread caches 
+     * filled for a destroyed aspace never match a new one at the 
+     * same address
+     */ 
+    static uint64_t epoch_seed = 0;
+    carat->permission_epoch = __sync_add_and_fetch(&epoch_seed, 1) << 32;
+
     spinlock_init(&(carat->lock));
     // initialize spinlock for carat
     // carat->lock = (spinlock_t *) malloc(sizeof(spinlock_t));
@@ -1157,6 +1324,12 @@ static struct nk_aspace *create(char *name, nk_aspace_characteristics_t *c)
         return 0;
     }
 
+    /*
+     * Moves in this aspace only need to stop its own threads 
+     * (nk_carat_init widens this for the kernel's)
+     */
+    carat->context->stop_scope = carat->aspace;
+
     DEBUG("carat address space %s configured and initialized at 0x%p (returning 0x%p)\n", name,carat, carat->aspace);
     
     return carat->aspace;
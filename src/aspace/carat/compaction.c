@@ -0,0 +1,565 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh,
+ * 			Brian Suchy, Peter Dinda
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/thread.h>
+#include <nautilus/timer.h>
+#include <nautilus/shell.h>
+#include <aspace/runtime_tables.h>
+#include <aspace/patching.h>
+#include <aspace/compaction.h>
+
+
+#define CARAT_COMPACTION_STACK_SIZE (PAGE_SIZE_4KB * 8)
+
+
+/*
+ * Daemon state --- @zones, @stats and @policy are read by the shell
+ * command under @lock, everything else is only touched by the daemon
+ */
+static struct {
+
+    nk_aspace_carat_t *target;
+    volatile int running;
+    volatile int stop;
+
+    spinlock_t lock;
+    carat_compaction_policy policy;
+    carat_compaction_stats stats;
+    carat_zone_fragmentation zones[CARAT_COMPACTION_MAX_ZONES];
+    uint64_t num_zones;
+
+    /*
+     * Zones being filled by the current scan
+     */
+    carat_zone_fragmentation scan_zones[CARAT_COMPACTION_MAX_ZONES];
+
+    /*
+     * Highest-addressed allocations of each zone, in address order ---
+     * a ring, so only the last CARAT_COMPACTION_MAX_CANDIDATES are kept
+     */
+    carat_compaction_candidate candidates[CARAT_COMPACTION_MAX_ZONES][CARAT_COMPACTION_MAX_CANDIDATES];
+    uint64_t num_seen[CARAT_COMPACTION_MAX_ZONES];
+    carat_relocation relocations[CARAT_COMPACTION_MAX_CANDIDATES];
+
+    /*
+     * Pause model --- ns per moved allocation, learned from past slices
+     */
+    uint64_t ns_per_move;
+
+} compaction = {
+    .policy = {
+        .period = NAUT_CONFIG_CARAT_COMPACTION_PERIOD_MS * 1000000UL,
+        .slice_budget = NAUT_CONFIG_CARAT_COMPACTION_SLICE_BUDGET_US * 1000UL,
+        .trigger_density = NAUT_CONFIG_CARAT_COMPACTION_TRIGGER_DENSITY,
+        .min_span = CARAT_COMPACTION_MIN_SPAN
+    }
+};
+
+#define CARAT_COMPACTION_LEARN(model, sample) (model) = ((model) ? ((((model) * 3) + (sample)) / 4) : (sample))
+
+
+/*
+ * =================== Metrics ===================
+ */
+
+NO_CARAT
+static inline uint64_t _extent_bucket(uint64_t bytes)
+{
+    uint64_t bucket = 64 - __builtin_clzl(bytes);
+    return (bucket < CARAT_COMPACTION_EXTENT_BUCKETS) ? bucket : (CARAT_COMPACTION_EXTENT_BUCKETS - 1);
+}
+
+
+NO_CARAT
+static void _record_free_extent(carat_zone_fragmentation *zone, uint64_t bytes)
+{
+    if (!bytes) { return; }
+
+    zone->num_free_extents++;
+    zone->free_extents[_extent_bucket(bytes)]++;
+    if (bytes > zone->largest_free_extent) { zone->largest_free_extent = bytes; }
+
+    return;
+}
+
+
+/*
+ * Zone holding @address --- its region, or the zone for allocations 
+ * outside of any region. Returns -1 once all zones are in use
+ */
+NO_CARAT
+static int _find_zone(carat_zone_fragmentation *zones, uint64_t *num_zones, void *address)
+{
+    nk_aspace_region_t *region = mm_find_reg_at_addr(compaction.target->mm, (addr_t) address);
+
+    for (int i = 0; i < *num_zones; i++)
+    {
+        if (region ? (zones[i].in_region && (zones[i].start == region->va_start)) : !(zones[i].in_region)) { 
+            return i; 
+        }
+    }
+
+    if (*num_zones == CARAT_COMPACTION_MAX_ZONES) { return -1; }
+
+    int index = (*num_zones)++;
+    carat_zone_fragmentation *zone = &(zones[index]);
+    memset(zone, 0, sizeof(carat_zone_fragmentation));
+    compaction.num_seen[index] = 0;
+
+    if (region) 
+    {
+        zone->in_region = 1;
+        zone->start = region->va_start;
+        zone->length = region->len_bytes;
+        zone->span_end = zone->start; /* leading free extent */
+    }
+
+    return index;
+}
+
+
+/*
+ * Visit at most CARAT_COMPACTION_SCAN_SLICE allocations from @*cursor on,
+ * with the world stopped, adding them to @zones and the candidate rings. 
+ * Advances @*cursor past the last allocation visited. Returns 1 once the
+ * end of the map is reached, 0 if there is more to scan, -1 on failure
+ */
+NO_CARAT
+static int _scan_slice(carat_zone_fragmentation *zones, uint64_t *num_zones, uintptr_t *cursor, uint64_t *pause)
+{
+    nk_carat_context *the_context = compaction.target->context;
+
+    uint64_t start = nk_sched_get_realtime();
+
+    if (!(CARAT_STOP_WORLD(the_context))) { return -1; }
+    CARAT_READY_OFF(the_context);
+
+    int cur = -1;
+    void *cur_end = NULL;
+    uint64_t visited = 0;
+    int done = 1;
+
+    CARAT_ALLOCATION_MAP_ITERATE_RANGE(the_context, *cursor, ~((uintptr_t) 0) - *cursor)
+    {
+        if (visited == CARAT_COMPACTION_SCAN_SLICE) { 
+            done = 0;
+            break; 
+        }
+
+        allocation_entry *the_entry = FETCH_ALLOCATION_ENTRY_FROM_ITERATOR;
+        void *address = the_entry->pointer;
+        uint64_t size = the_entry->size;
+
+        visited++;
+        *cursor = ((uintptr_t) address) + 1;
+
+
+        /*
+         * The map is in address order, so the zone only has to be 
+         * looked up when we leave the current region
+         */
+        if ((cur < 0) || !(zones[cur].in_region) || (address >= cur_end))
+        {
+            cur = _find_zone(zones, num_zones, address);
+            if (cur < 0) { continue; }
+            cur_end = zones[cur].start + zones[cur].length;
+        }
+
+        carat_zone_fragmentation *zone = &(zones[cur]);
+
+        if (!(zone->num_allocations)) { 
+            zone->span_start = address; 
+            if (!(zone->in_region)) { zone->span_end = address; }
+        }
+
+        if (address > zone->span_end) { _record_free_extent(zone, address - zone->span_end); }
+        if ((address + size) > zone->span_end) { zone->span_end = address + size; }
+
+        zone->num_allocations++;
+        zone->live_bytes += size;
+
+        /*
+         * A thread stack still occupies its zone, but is never moved
+         */
+        if (the_entry->is_stack) { continue; }
+
+        carat_compaction_candidate *candidate = 
+            &(compaction.candidates[cur][compaction.num_seen[cur] % CARAT_COMPACTION_MAX_CANDIDATES]);
+        candidate->address = address;
+        candidate->size = size;
+        compaction.num_seen[cur]++;
+    }
+
+    CARAT_READY_ON(the_context);
+    CARAT_START_WORLD(the_context);
+
+    *pause = nk_sched_get_realtime() - start;
+
+    return done;
+}
+
+
+/*
+ * One pass over the allocation map, in slices so that no stop is 
+ * proportional to the size of the map --- fills @zones and the candidate
+ * rings. Mutators run between slices, so the metrics are approximate, 
+ * and the movers check each candidate again anyway. @*pause is the 
+ * longest stop
+ */
+NO_CARAT
+static int _scan(carat_zone_fragmentation *zones, uint64_t *num_zones, uint64_t *pause)
+{
+    uintptr_t cursor = 0;
+    int done = 0;
+
+    *num_zones = 0;
+    *pause = 0;
+
+    while (!done)
+    {
+        if (compaction.stop) { return -1; }
+
+        uint64_t slice_pause;
+        done = _scan_slice(zones, num_zones, &cursor, &slice_pause);
+        if (done < 0) { return -1; }
+
+        if (slice_pause > *pause) { *pause = slice_pause; }
+        if (!done) { nk_sleep(CARAT_COMPACTION_SLICE_GAP_NS); }
+    }
+
+
+    /*
+     * Trailing free extents of regions, and bounds of the 
+     * zone outside of any region
+     */
+    for (int i = 0; i < *num_zones; i++)
+    {
+        carat_zone_fragmentation *zone = &(zones[i]);
+
+        if (zone->in_region) {
+            _record_free_extent(zone, (zone->start + zone->length) - zone->span_end);
+        } else {
+            zone->start = zone->span_start;
+            zone->length = zone->span_end - zone->span_start;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Most fragmented zone past the policy's trigger, or -1
+ */
+NO_CARAT
+static int _pick_zone(carat_zone_fragmentation *zones, uint64_t num_zones, carat_compaction_policy *policy)
+{
+    int best = -1;
+    uint64_t best_density = 101;
+
+    for (int i = 0; i < num_zones; i++)
+    {
+        uint64_t span = zones[i].span_end - zones[i].span_start;
+        if (!(zones[i].num_allocations) || (span < policy->min_span) || !(zones[i].num_free_extents)) { continue; }
+
+        uint64_t density = (zones[i].live_bytes * 100) / span;
+        if ((density < policy->trigger_density) && (density < best_density)) 
+        {
+            best = i;
+            best_density = density;
+        }
+    }
+
+    return best;
+}
+
+
+/*
+ * =================== Compaction ===================
+ */
+
+/*
+ * Move the candidates of @zone down in bounded slices, highest address 
+ * first, until they run out or the daemon is stopped
+ */
+NO_CARAT
+static void _compact_zone(int zone, carat_zone_fragmentation *metrics, carat_compaction_policy *policy)
+{
+    nk_carat_context *the_context = compaction.target->context;
+
+    uint64_t seen = compaction.num_seen[zone];
+    uint64_t num_candidates = (seen < CARAT_COMPACTION_MAX_CANDIDATES) ? seen : CARAT_COMPACTION_MAX_CANDIDATES;
+
+
+    /*
+     * Unroll the ring into descending address order --- each allocation 
+     * may only move into a free block between the start of the zone and 
+     * itself
+     */
+    carat_compaction_candidate *ring = compaction.candidates[zone];
+    carat_relocation *descending = compaction.relocations;
+    for (uint64_t i = 0; i < num_candidates; i++) 
+    {
+        carat_compaction_candidate *candidate = &(ring[(seen - 1 - i) % CARAT_COMPACTION_MAX_CANDIDATES]);
+        descending[i].address = candidate->address;
+        descending[i].size = candidate->size;
+        descending[i].target_start = metrics->start;
+        descending[i].target_end = candidate->address;
+    }
+
+
+    uint64_t next = 0;
+    while ((next < num_candidates) && !(compaction.stop))
+    {
+        /*
+         * Size the slice to the budget --- a single move if nothing 
+         * has been learned yet, or if even one move does not fit
+         */
+        uint64_t max_moves = 1;
+        if (compaction.ns_per_move) { max_moves = policy->slice_budget / compaction.ns_per_move; }
+        if (max_moves < 1) { max_moves = 1; }
+        if (max_moves > CARAT_DEFRAG_BATCH) { max_moves = CARAT_DEFRAG_BATCH; }
+
+        uint64_t moved = 0, moved_bytes = 0;
+        uint64_t start = nk_sched_get_realtime();
+
+        int consumed = nk_carat_relocate_slice(
+            the_context, 
+            &(descending[next]), 
+            num_candidates - next, 
+            max_moves, 
+            &moved, 
+            &moved_bytes
+        );
+
+        uint64_t pause = nk_sched_get_realtime() - start;
+        if (consumed <= 0) { break; }
+        next += consumed;
+
+        if (moved) { CARAT_COMPACTION_LEARN(compaction.ns_per_move, pause / moved); }
+
+        spin_lock(&(compaction.lock));
+        compaction.stats.slices++;
+        compaction.stats.moves += moved;
+        compaction.stats.moved_bytes += moved_bytes;
+        if (pause > compaction.stats.slice_pause_max) { compaction.stats.slice_pause_max = pause; }
+        if (pause > policy->slice_budget) { compaction.stats.slice_overruns++; }
+        spin_unlock(&(compaction.lock));
+
+        nk_sleep(CARAT_COMPACTION_SLICE_GAP_NS);
+    }
+
+    return;
+}
+
+
+NO_CARAT
+static void _compaction_daemon(void *in, void **out)
+{
+    if (nk_thread_name(get_cur_thread(), "(carat-compaction)")) {
+        CARAT_PRINT("CARAT: failed to name compaction daemon\n");
+    }
+
+    carat_zone_fragmentation *zones = compaction.scan_zones;
+    uint64_t num_zones;
+
+    while (!(compaction.stop))
+    {
+        spin_lock(&(compaction.lock));
+        carat_compaction_policy policy = compaction.policy;
+        spin_unlock(&(compaction.lock));
+
+        nk_sleep(policy.period);
+        if (compaction.stop) { break; }
+
+
+        uint64_t scan_time;
+        if (_scan(zones, &num_zones, &scan_time)) { continue; }
+
+        int zone = _pick_zone(zones, num_zones, &policy);
+
+
+        /*
+         * Publish the metrics
+         */
+        spin_lock(&(compaction.lock));
+        memcpy(compaction.zones, zones, num_zones * sizeof(carat_zone_fragmentation));
+        compaction.num_zones = num_zones;
+        compaction.stats.scans++;
+        if (scan_time > compaction.stats.scan_time_max) { compaction.stats.scan_time_max = scan_time; }
+        if (zone >= 0) { compaction.stats.triggers++; }
+        spin_unlock(&(compaction.lock));
+
+
+        if (zone >= 0) { _compact_zone(zone, &(zones[zone]), &policy); }
+    }
+
+    compaction.running = 0;
+
+    return;
+}
+
+
+void nk_carat_compaction_init(nk_aspace_t *kernel_aspace)
+{
+    compaction.target = (nk_aspace_carat_t *) kernel_aspace->state;
+    spinlock_init(&(compaction.lock));
+    return;
+}
+
+
+int nk_carat_compaction_start(void)
+{
+    if (!(compaction.target) || !(__sync_bool_compare_and_swap(&(compaction.running), 0, 1))) { return -1; }
+
+    compaction.stop = 0;
+
+    nk_thread_id_t tid;
+    if (nk_thread_start(_compaction_daemon, 0, 0, 1, CARAT_COMPACTION_STACK_SIZE, &tid, CPU_ANY)) 
+    {
+        compaction.running = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+void nk_carat_compaction_stop(void)
+{
+    compaction.stop = 1;
+    return;
+}
+
+
+/*
+ * =================== Shell ===================
+ */
+
+NO_CARAT
+static void _print_zone(carat_zone_fragmentation *zone)
+{
+    uint64_t span = zone->span_end - zone->span_start;
+
+    nk_vc_printf(
+        "%s %p (%lu bytes): allocations: %lu, live: %lu, span: %lu, density: %lu%%, free extents: %lu, largest: %lu\n",
+        (zone->in_region) ? "region" : "outside regions",
+        zone->start, zone->length,
+        zone->num_allocations, zone->live_bytes, span,
+        (span) ? ((zone->live_bytes * 100) / span) : 100,
+        zone->num_free_extents, zone->largest_free_extent
+    );
+
+    for (int b = 0; b < CARAT_COMPACTION_EXTENT_BUCKETS; b++) {
+        if (zone->free_extents[b]) {
+            nk_vc_printf("    [%lu, %lu): %lu\n", (b) ? (1UL << (b - 1)) : 0, 1UL << b, zone->free_extents[b]);
+        }
+    }
+
+    return;
+}
+
+
+NO_CARAT
+static int handle_carat_compaction(char *buf, void *priv)
+{
+    char what[32];
+    uint64_t value;
+
+    if (sscanf(buf, "carat_compaction %31s %lu", what, &value) == 2)
+    {
+        spin_lock(&(compaction.lock));
+        if (!strcmp(what, "period")) { compaction.policy.period = value * 1000000UL; }
+        else if (!strcmp(what, "pause")) { compaction.policy.slice_budget = value * 1000UL; }
+        else if (!strcmp(what, "trigger")) { compaction.policy.trigger_density = value; }
+        else if (!strcmp(what, "min_span")) { compaction.policy.min_span = value; }
+        else { nk_vc_printf("unknown knob %s\n", what); }
+        spin_unlock(&(compaction.lock));
+    }
+    else if (sscanf(buf, "carat_compaction %31s", what) == 1)
+    {
+        if (!strcmp(what, "start")) { 
+            if (nk_carat_compaction_start()) { nk_vc_printf("cannot start compaction daemon\n"); }
+        } else if (!strcmp(what, "stop")) { 
+            nk_carat_compaction_stop(); 
+        } else {
+            nk_vc_printf("unknown command %s\n", what);
+        }
+    }
+
+
+    /*
+     * Print from a snapshot --- the daemon takes the lock between slices
+     */
+    carat_compaction_policy policy;
+    carat_compaction_stats stats;
+    uint64_t num_zones;
+    carat_zone_fragmentation *zones = (carat_zone_fragmentation *) malloc(sizeof(compaction.zones));
+    if (!zones) { return -1; }
+
+    spin_lock(&(compaction.lock));
+    policy = compaction.policy;
+    stats = compaction.stats;
+    num_zones = compaction.num_zones;
+    memcpy(zones, compaction.zones, num_zones * sizeof(carat_zone_fragmentation));
+    spin_unlock(&(compaction.lock));
+
+    nk_vc_printf(
+        "compaction daemon %s: period: %lu ms, slice pause: %lu us, trigger density: %lu%%, min span: %lu bytes\n",
+        (compaction.running) ? "running" : "stopped",
+        policy.period / 1000000UL,
+        policy.slice_budget / 1000UL,
+        policy.trigger_density,
+        policy.min_span
+    );
+
+    nk_vc_printf(
+        "scans: %lu (max pause %lu ns), triggers: %lu, slices: %lu, moves: %lu (%lu bytes), max slice pause: %lu ns, overruns: %lu\n",
+        stats.scans, stats.scan_time_max,
+        stats.triggers, stats.slices,
+        stats.moves, stats.moved_bytes,
+        stats.slice_pause_max, stats.slice_overruns
+    );
+
+    for (int i = 0; i < num_zones; i++) { _print_zone(&(zones[i])); }
+
+    free(zones);
+
+    return 0;
+}
+
+
+static struct shell_cmd_impl carat_compaction_impl = {
+    .cmd = "carat_compaction",
+    .help_str = "carat_compaction [start | stop | period <ms> | pause <us> | trigger <percent> | min_span <bytes>]",
+    .handler = handle_carat_compaction,
+};
+
+nk_register_shell_cmd(carat_compaction_impl);
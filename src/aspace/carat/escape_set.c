@@ -0,0 +1,183 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh,
+ * 			Brian Suchy, Peter Dinda
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+
+#include <aspace/carat.h>
+#include <aspace/escape_set.h>
+
+
+/*
+ * Fibonacci hashing --- escape locations are 8-byte aligned
+ * and clustered, so mix the high bits down
+ */
+NO_CARAT
+static inline uint32_t _hash(uintptr_t key, uint32_t capacity)
+{
+    uint64_t h = ((uint64_t) key) * 0x9E3779B97F4A7C15ULL;
+    return ((uint32_t) (h >> 32)) & (capacity - 1);
+}
+
+
+/*
+ * Insert @key into a table known not to contain it
+ */
+NO_CARAT
+static inline void _table_place(uintptr_t *table, uint32_t capacity, uintptr_t key)
+{
+    uint32_t slot = _hash(key, capacity);
+    while (table[slot] != CARAT_ESCAPE_SET_EMPTY) { slot = (slot + 1) & (capacity - 1); }
+    table[slot] = key;
+}
+
+
+NO_CARAT
+static uintptr_t *_build_table(carat_escape_set_pool *pool, uint32_t capacity)
+{
+    uintptr_t *table = (uintptr_t *) carat_arena_alloc(pool->tables, capacity * sizeof(uintptr_t));
+    memset(table, 0xff, capacity * sizeof(uintptr_t)); /* CARAT_ESCAPE_SET_EMPTY */
+    return table;
+}
+
+
+/*
+ * Move @set into a table of @capacity slots --- from the inline
+ * slots on the first call, from the old table afterwards
+ */
+NO_CARAT
+static void _resize(carat_escape_set_pool *pool, carat_escape_set *set, uint32_t capacity)
+{
+    uintptr_t *table = _build_table(pool, capacity);
+
+    if (!(set->capacity))
+    {
+        for (uint32_t i = 0; i < set->size; i++) {
+            _table_place(table, capacity, set->slots[i]);
+        }
+    }
+    else
+    {
+        for (uint32_t i = 0; i < set->capacity; i++) {
+            if (set->table[i] != CARAT_ESCAPE_SET_EMPTY) {
+                _table_place(table, capacity, set->table[i]);
+            }
+        }
+
+        carat_arena_free(pool->tables, set->table, set->capacity * sizeof(uintptr_t));
+    }
+
+    set->table = table;
+    set->capacity = capacity;
+
+    return;
+}
+
+
+NO_CARAT
+carat_escape_set_pool *carat_escape_set_pool_create(void)
+{
+    carat_escape_set_pool *pool = (carat_escape_set_pool *) CARAT_MALLOC(sizeof(carat_escape_set_pool));
+    pool->sets = carat_slab_cache_create(sizeof(carat_escape_set));
+    pool->tables = carat_arena_create();
+    return pool;
+}
+
+
+NO_CARAT
+void carat_escape_set_pool_destroy(carat_escape_set_pool *pool)
+{
+    carat_slab_cache_destroy(pool->sets);
+    carat_arena_destroy(pool->tables);
+    free(pool);
+}
+
+
+NO_CARAT
+carat_escape_set *carat_escape_set_create(carat_escape_set_pool *pool)
+{
+    carat_escape_set *set = (carat_escape_set *) carat_slab_alloc(pool->sets);
+    set->size = 0;
+    set->capacity = 0;
+    return set;
+}
+
+
+NO_CARAT
+void carat_escape_set_destroy(carat_escape_set_pool *pool, carat_escape_set *set)
+{
+    if (set->capacity) { carat_arena_free(pool->tables, set->table, set->capacity * sizeof(uintptr_t)); }
+    carat_slab_free(pool->sets, set);
+}
+
+
+NO_CARAT
+int carat_escape_set_add(carat_escape_set_pool *pool, carat_escape_set *set, uintptr_t key)
+{
+    /*
+     * Inline --- linear scan of a few words
+     */
+    if (!(set->capacity))
+    {
+        for (uint32_t i = 0; i < set->size; i++) {
+            if (set->slots[i] == key) { return 0; }
+        }
+
+        if (set->size < CARAT_ESCAPE_SET_INLINE_SLOTS) {
+            set->slots[set->size] = key;
+            set->size++;
+            return 1;
+        }
+
+        _resize(pool, set, CARAT_ESCAPE_SET_INITIAL_TABLE);
+    }
+
+
+    /*
+     * Hash table --- linear probing, kept at most 3/4 full
+     */
+    uint32_t slot = _hash(key, set->capacity);
+    while (set->table[slot] != CARAT_ESCAPE_SET_EMPTY)
+    {
+        if (set->table[slot] == key) { return 0; }
+        slot = (slot + 1) & (set->capacity - 1);
+    }
+
+    if (((set->size + 1) * 4) > (set->capacity * 3))
+    {
+        _resize(pool, set, set->capacity * 2);
+        _table_place(set->table, set->capacity, key);
+    }
+    else
+    {
+        set->table[slot] = key;
+    }
+
+    set->size++;
+
+
+    return 1;
+}
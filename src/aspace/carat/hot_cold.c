@@ -0,0 +1,495 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh,
+ * 			Brian Suchy, Peter Dinda
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/mm.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/thread.h>
+#include <nautilus/timer.h>
+#include <nautilus/shell.h>
+#include <aspace/runtime_tables.h>
+#include <aspace/patching.h>
+#include <aspace/sampling.h>
+#include <aspace/hot_cold.h>
+
+
+#define CARAT_HOT_COLD_STACK_SIZE (PAGE_SIZE_4KB * 4)
+
+
+static struct {
+
+    nk_aspace_carat_t *target;
+    volatile int running;
+    volatile int stop;
+
+    /*
+     * Knobs and stats, read by the shell command
+     */
+    uint64_t period; // ns
+    uint64_t threshold;
+    uint64_t window_size;
+    uint64_t max_moves;
+    carat_hot_cold_stats stats;
+
+
+    /*
+     * Hot window, and where cold allocations are pushed --- the rest
+     * of the window's kmem region (NULL until the first hot pass)
+     */
+    void *hot_start;
+    void *hot_end;
+    void *cold_start;
+    void *cold_end;
+
+
+    /*
+     * Filled by the scan --- cold allocations out first (making room),
+     * then hot allocations in
+     */
+    carat_relocation outs[CARAT_DEFRAG_BATCH];
+    carat_relocation ins[CARAT_DEFRAG_BATCH];
+    uint64_t num_outs;
+    uint64_t num_ins;
+    carat_relocation relocations[CARAT_DEFRAG_BATCH];
+
+
+    /*
+     * Working set measured by the current pass, carried across its slices
+     */
+    struct {
+        uintptr_t cursor;
+        uint64_t hot_objects;
+        uint64_t hot_bytes;
+        uint64_t hot_pages;
+        uint64_t last_page;
+        uint64_t window; // aligned window holding the most hot bytes
+        uint64_t window_bytes;
+        uint64_t best_window;
+        uint64_t best_window_bytes;
+    } pass;
+
+} hot_cold = {
+    .period = CARAT_HOT_COLD_DEFAULT_PERIOD_MS * 1000000UL,
+    .threshold = CARAT_HOT_COLD_DEFAULT_THRESHOLD,
+    .window_size = CARAT_HOT_COLD_DEFAULT_WINDOW,
+    .max_moves = CARAT_HOT_COLD_DEFAULT_MAX_MOVES
+};
+
+
+/*
+ * =================== Hot Window ===================
+ */
+
+/*
+ * Place the hot window at @window (clamped to its kmem region), and push
+ * cold allocations into the larger remainder of that region
+ */
+NO_CARAT
+static void _set_window(void *window)
+{
+    struct mem_region *region = kmem_get_region_by_addr((ulong_t) window);
+    if (!region) { return; }
+
+    void *region_start = (void *) region->base_addr;
+    void *region_end = (void *) (region->base_addr + region->len);
+
+    hot_cold.hot_start = (window < region_start) ? region_start : window;
+    hot_cold.hot_end = ((window + hot_cold.window_size) > region_end) ? region_end : (window + hot_cold.window_size);
+
+    if ((hot_cold.hot_start - region_start) > (region_end - hot_cold.hot_end)) 
+    {
+        hot_cold.cold_start = region_start;
+        hot_cold.cold_end = hot_cold.hot_start;
+    }
+    else
+    {
+        hot_cold.cold_start = hot_cold.hot_end;
+        hot_cold.cold_end = region_end;
+    }
+
+    return;
+}
+
+
+NO_CARAT
+static inline int _in_window(allocation_entry *entry)
+{
+    return (entry->pointer >= hot_cold.hot_start) && ((entry->pointer + entry->size) <= hot_cold.hot_end);
+}
+
+
+/*
+ * =================== Scan ===================
+ */
+
+/*
+ * One slice of a pass over the allocation map, in address order --- 
+ * visits at most CARAT_HOT_COLD_SCAN_SLICE allocations from the pass's
+ * cursor on, measuring the working set, planning relocations and aging
+ * the heat counters. The world must be stopped. Returns 1 once the end
+ * of the map is reached
+ */
+NO_CARAT
+static int _scan_slice(nk_carat_context *the_context)
+{
+    uint64_t max_moves = (hot_cold.max_moves < CARAT_DEFRAG_BATCH) ? hot_cold.max_moves : CARAT_DEFRAG_BATCH;
+    int have_window = (hot_cold.hot_end != NULL);
+    uint64_t visited = 0;
+    uintptr_t start = hot_cold.pass.cursor;
+
+    CARAT_ALLOCATION_MAP_ITERATE_RANGE(the_context, start, ~((uintptr_t) 0) - start)
+    {
+        if (visited == CARAT_HOT_COLD_SCAN_SLICE) { return 0; }
+
+        allocation_entry *the_entry = FETCH_ALLOCATION_ENTRY_FROM_ITERATOR;
+        uint64_t heat = the_entry->heat;
+        the_entry->heat >>= 1;
+
+        visited++;
+        hot_cold.pass.cursor = ((uintptr_t) the_entry->pointer) + 1;
+
+        if (heat < hot_cold.threshold) 
+        {
+            /*
+             * Cold --- not sampled for a few passes
+             */
+            if (!heat && have_window && !(the_entry->is_stack) && _in_window(the_entry) && (hot_cold.num_outs < max_moves))
+            {
+                carat_relocation *out = &(hot_cold.outs[hot_cold.num_outs++]);
+                out->address = the_entry->pointer;
+                out->size = the_entry->size;
+                out->target_start = hot_cold.cold_start;
+                out->target_end = hot_cold.cold_end;
+            }
+
+            continue;
+        }
+
+
+        /*
+         * Hot --- count the pages it adds to the working set
+         */
+        uint64_t first = ((uint64_t) the_entry->pointer) / PAGE_SIZE_4KB;
+        uint64_t last = ((uint64_t) (the_entry->pointer + the_entry->size - 1)) / PAGE_SIZE_4KB;
+        if (hot_cold.pass.hot_objects && (first <= hot_cold.pass.last_page)) { first = hot_cold.pass.last_page + 1; }
+        if (last >= first) { hot_cold.pass.hot_pages += (last - first) + 1; }
+        if (!(hot_cold.pass.hot_objects) || (last > hot_cold.pass.last_page)) { hot_cold.pass.last_page = last; }
+
+        hot_cold.pass.hot_objects++;
+        hot_cold.pass.hot_bytes += the_entry->size;
+
+        uint64_t this_window = ((uint64_t) the_entry->pointer) & ~(hot_cold.window_size - 1);
+        if (this_window != hot_cold.pass.window) 
+        {
+            hot_cold.pass.window = this_window;
+            hot_cold.pass.window_bytes = 0;
+        }
+        hot_cold.pass.window_bytes += the_entry->size;
+        if (hot_cold.pass.window_bytes > hot_cold.pass.best_window_bytes) 
+        {
+            hot_cold.pass.best_window = hot_cold.pass.window;
+            hot_cold.pass.best_window_bytes = hot_cold.pass.window_bytes;
+        }
+
+        if (have_window && !(the_entry->is_stack) && !_in_window(the_entry) && (the_entry->size <= hot_cold.window_size) && (hot_cold.num_ins < max_moves))
+        {
+            carat_relocation *in = &(hot_cold.ins[hot_cold.num_ins++]);
+            in->address = the_entry->pointer;
+            in->size = the_entry->size;
+            in->target_start = hot_cold.hot_start;
+            in->target_end = hot_cold.hot_end;
+        }
+    }
+
+    return 1;
+}
+
+
+/*
+ * One pass over the allocation map, a slice per stop-the-world so that 
+ * no pause is proportional to the size of the map. Heat is drained into
+ * the map at each slice. Mutators run between slices, so the plan is 
+ * approximate --- relocations are checked again when they are made
+ */
+NO_CARAT
+static int _scan(nk_carat_context *the_context)
+{
+    memset(&(hot_cold.pass), 0, sizeof(hot_cold.pass));
+    hot_cold.num_outs = hot_cold.num_ins = 0;
+
+    int done = 0;
+    while (!done)
+    {
+        if (hot_cold.stop) { return -1; }
+
+        uint64_t start = nk_sched_get_realtime();
+
+        if (!(CARAT_STOP_WORLD(the_context))) { return -1; }
+        CARAT_READY_OFF(the_context);
+        nk_carat_sampling_drain(the_context);
+        done = _scan_slice(the_context);
+        CARAT_READY_ON(the_context);
+        CARAT_START_WORLD(the_context);
+
+        uint64_t pause = nk_sched_get_realtime() - start;
+        if (pause > hot_cold.stats.scan_pause_max) { hot_cold.stats.scan_pause_max = pause; }
+
+        if (!done) { nk_sleep(CARAT_HOT_COLD_SLICE_GAP_NS); }
+    }
+
+    if (!(hot_cold.pass.hot_objects)) { return 0; }
+
+
+    /*
+     * Working set density of this pass --- the first pass with hot 
+     * allocations is the baseline
+     */
+    hot_cold.stats.hot_objects = hot_cold.pass.hot_objects;
+    hot_cold.stats.hot_bytes = hot_cold.pass.hot_bytes;
+    hot_cold.stats.hot_pages = hot_cold.pass.hot_pages;
+    hot_cold.stats.density = (hot_cold.pass.hot_bytes * 1000) / (hot_cold.pass.hot_pages * PAGE_SIZE_4KB);
+
+    if (!(hot_cold.stats.baseline_hot_pages))
+    {
+        hot_cold.stats.baseline_hot_pages = hot_cold.pass.hot_pages;
+        hot_cold.stats.baseline_density = hot_cold.stats.density;
+    }
+
+    if (!(hot_cold.hot_end)) { _set_window((void *) hot_cold.pass.best_window); }
+
+    return 0;
+}
+
+
+/*
+ * Cold allocations out, then hot allocations in --- returns how many
+ * relocations are planned
+ */
+NO_CARAT
+static uint64_t _plan(void)
+{
+    uint64_t max_moves = (hot_cold.max_moves < CARAT_DEFRAG_BATCH) ? hot_cold.max_moves : CARAT_DEFRAG_BATCH;
+    uint64_t count = 0;
+
+    for (uint64_t i = 0; (i < hot_cold.num_outs) && (count < max_moves); i++) { hot_cold.relocations[count++] = hot_cold.outs[i]; }
+    for (uint64_t i = 0; (i < hot_cold.num_ins) && (count < max_moves); i++) { hot_cold.relocations[count++] = hot_cold.ins[i]; }
+
+    return count;
+}
+
+
+/*
+ * =================== Daemon ===================
+ */
+
+NO_CARAT
+static void _hot_cold_daemon(void *in, void **out)
+{
+    if (nk_thread_name(get_cur_thread(), "(carat-hotcold)")) {
+        CARAT_PRINT("CARAT: failed to name hot/cold daemon\n");
+    }
+
+    nk_carat_context *the_context = hot_cold.target->context;
+
+    while (!(hot_cold.stop))
+    {
+        nk_sleep(hot_cold.period);
+        if (hot_cold.stop) { break; }
+
+
+        if (_scan(the_context)) { continue; }
+
+
+        /*
+         * Move, one bounded batch per stop-the-world
+         */
+        uint64_t count = _plan();
+        uint64_t num_outs = (hot_cold.num_outs < count) ? hot_cold.num_outs : count;
+        uint64_t next = 0;
+        while ((next < count) && !(hot_cold.stop))
+        {
+            uint64_t moved = 0, moved_bytes = 0;
+            uint64_t start = nk_sched_get_realtime();
+
+            int consumed = nk_carat_relocate_slice(
+                the_context, 
+                &(hot_cold.relocations[next]), 
+                count - next, 
+                count - next, 
+                &moved, 
+                &moved_bytes
+            );
+
+            uint64_t pause = nk_sched_get_realtime() - start;
+            if (consumed <= 0) { break; }
+
+
+            /*
+             * Attribution is by position --- slices skip stale relocations,
+             * so this is approximate when a slice straddles outs and ins
+             */
+            if (next < num_outs) { hot_cold.stats.moves_out += moved; } 
+            else { hot_cold.stats.moves_in += moved; }
+
+            next += consumed;
+            hot_cold.stats.moved_bytes += moved_bytes;
+            if (pause > hot_cold.stats.pause_max) { hot_cold.stats.pause_max = pause; }
+        }
+
+        hot_cold.stats.passes++;
+    }
+
+    nk_carat_sampling_stop(NULL, &hot_cold);
+    hot_cold.running = 0;
+
+    return;
+}
+
+
+void nk_carat_hot_cold_init(nk_aspace_t *kernel_aspace)
+{
+    hot_cold.target = (nk_aspace_carat_t *) kernel_aspace->state;
+    return;
+}
+
+
+int nk_carat_hot_cold_start(void)
+{
+    if (!(hot_cold.target) || !(__sync_bool_compare_and_swap(&(hot_cold.running), 0, 1))) { return -1; }
+
+    if (nk_carat_sampling_start(NULL, &hot_cold)) { goto out_bad; }
+
+    hot_cold.stop = 0;
+
+    nk_thread_id_t tid;
+    if (nk_thread_start(_hot_cold_daemon, 0, 0, 1, CARAT_HOT_COLD_STACK_SIZE, &tid, CPU_ANY)) 
+    { 
+        nk_carat_sampling_stop(NULL, &hot_cold);
+        goto out_bad; 
+    }
+
+    return 0;
+
+out_bad:
+    hot_cold.running = 0;
+    return -1;
+}
+
+
+void nk_carat_hot_cold_stop(void)
+{
+    hot_cold.stop = 1;
+    return;
+}
+
+
+/*
+ * =================== Shell ===================
+ */
+
+NO_CARAT
+static int handle_carat_hotcold(char *buf, void *priv)
+{
+    char what[32];
+    uint64_t value;
+
+    if (sscanf(buf, "carat_hotcold %31s %lu", what, &value) == 2)
+    {
+        if (!strcmp(what, "period")) { hot_cold.period = value * 1000000UL; }
+        else if (!strcmp(what, "threshold")) { hot_cold.threshold = (value) ? value : 1; }
+        else if (!strcmp(what, "moves")) { hot_cold.max_moves = value; }
+        else if (!strcmp(what, "window")) 
+        { 
+            if (value && !(value & (value - 1)) && !(hot_cold.running)) { hot_cold.window_size = value * 1024; } 
+            else { nk_vc_printf("window must be a power of 2 (KB), set while stopped\n"); }
+        }
+        else { nk_vc_printf("unknown knob %s\n", what); }
+    }
+    else if (sscanf(buf, "carat_hotcold %31s", what) == 1)
+    {
+        if (!strcmp(what, "start")) { 
+            if (nk_carat_hot_cold_start()) { nk_vc_printf("cannot start hot/cold daemon\n"); }
+        } else if (!strcmp(what, "stop")) { 
+            nk_carat_hot_cold_stop(); 
+        } else if (!strcmp(what, "reset") && !(hot_cold.running)) { 
+            hot_cold.hot_start = hot_cold.hot_end = hot_cold.cold_start = hot_cold.cold_end = NULL;
+            memset(&(hot_cold.stats), 0, sizeof(hot_cold.stats));
+        } else {
+            nk_vc_printf("unknown command %s (reset only while stopped)\n", what);
+        }
+    }
+
+    nk_vc_printf(
+        "hot/cold %s: period: %lu ms, hot at heat %lu, window: %lu KB at %p-%p, moves per pause: %lu\n",
+        (hot_cold.running) ? "running" : "stopped",
+        hot_cold.period / 1000000UL,
+        hot_cold.threshold,
+        hot_cold.window_size / 1024,
+        hot_cold.hot_start,
+        hot_cold.hot_end,
+        hot_cold.max_moves
+    );
+
+    nk_vc_printf(
+        "passes: %lu, hot: %lu allocations, %lu bytes on %lu pages\n",
+        hot_cold.stats.passes,
+        hot_cold.stats.hot_objects,
+        hot_cold.stats.hot_bytes,
+        hot_cold.stats.hot_pages
+    );
+
+    nk_vc_printf(
+        "working set density: %lu.%lu%% on %lu pages (baseline %lu.%lu%% on %lu pages)\n",
+        hot_cold.stats.density / 10,
+        hot_cold.stats.density % 10,
+        hot_cold.stats.hot_pages,
+        hot_cold.stats.baseline_density / 10,
+        hot_cold.stats.baseline_density % 10,
+        hot_cold.stats.baseline_hot_pages
+    );
+
+    nk_vc_printf(
+        "moves: %lu in, %lu out (%lu bytes), max pause: %lu ns, max scan pause: %lu ns\n",
+        hot_cold.stats.moves_in,
+        hot_cold.stats.moves_out,
+        hot_cold.stats.moved_bytes,
+        hot_cold.stats.pause_max,
+        hot_cold.stats.scan_pause_max
+    );
+
+    return 0;
+}
+
+
+static struct shell_cmd_impl carat_hotcold_impl = {
+    .cmd = "carat_hotcold",
+    .help_str = "carat_hotcold [start | stop | reset | period <ms> | threshold <heat> | window <KB> | moves <n>]",
+    .handler = handle_carat_hotcold,
+};
+
+nk_register_shell_cmd(carat_hotcold_impl);
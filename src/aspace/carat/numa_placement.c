@@ -0,0 +1,450 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh,
+ * 			Brian Suchy, Peter Dinda
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/numa.h>
+#include <nautilus/mm.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/thread.h>
+#include <nautilus/timer.h>
+#include <nautilus/shell.h>
+#include <aspace/runtime_tables.h>
+#include <aspace/patching.h>
+#include <aspace/sampling.h>
+#include <aspace/numa_placement.h>
+
+
+#define CARAT_NUMA_STACK_SIZE (PAGE_SIZE_4KB * 4)
+
+
+/*
+ * Sampled accesses of one allocation, per domain --- halved on 
+ * every pass, so old accesses fade out
+ */
+typedef struct carat_numa_object_t {
+    void *pointer;
+    uint64_t size;
+    uint32_t counts[CARAT_NUMA_MAX_DOMAINS];
+} carat_numa_object;
+
+
+static struct {
+
+    nk_aspace_carat_t *target;
+    volatile int running;
+    volatile int stop;
+
+    /*
+     * Knobs and stats, read by the shell command
+     */
+    uint64_t period; // ns
+    uint64_t min_samples;
+    uint64_t share; // percent
+    uint64_t max_moves;
+    carat_numa_stats stats;
+
+
+    /*
+     * Topology --- domain of each CPU, and the kmem range each 
+     * domain's allocations are moved into
+     */
+    uint32_t num_domains;
+    uint32_t cpu_domain[NAUT_CONFIG_MAX_CPUS];
+    void *domain_start[CARAT_NUMA_MAX_DOMAINS];
+    void *domain_end[CARAT_NUMA_MAX_DOMAINS];
+
+
+    /*
+     * Open-addressing tables of sampled allocations --- each pass
+     * ages the live one into the other, and swaps
+     */
+    carat_numa_object *objects;
+    carat_numa_object *aged;
+
+    carat_relocation relocations[CARAT_DEFRAG_BATCH];
+
+} placement = {
+    .period = CARAT_NUMA_DEFAULT_PERIOD_MS * 1000000UL,
+    .min_samples = CARAT_NUMA_DEFAULT_MIN_SAMPLES,
+    .share = CARAT_NUMA_DEFAULT_SHARE,
+    .max_moves = CARAT_NUMA_DEFAULT_MAX_MOVES
+};
+
+
+/*
+ * =================== Topology ===================
+ */
+
+NO_CARAT
+static void _discover_topology(void)
+{
+    struct sys_info *sys = &(nk_get_nautilus_info()->sys);
+
+    placement.num_domains = nk_get_num_domains();
+    if (placement.num_domains > CARAT_NUMA_MAX_DOMAINS) { placement.num_domains = CARAT_NUMA_MAX_DOMAINS; }
+
+    for (int d = 0; d < CARAT_NUMA_MAX_DOMAINS; d++) { placement.domain_start[d] = placement.domain_end[d] = NULL; }
+
+    for (int cpu = 0; cpu < nk_get_num_cpus(); cpu++)
+    {
+        uint32_t domain = sys->cpus[cpu]->domain->id;
+        if (domain >= CARAT_NUMA_MAX_DOMAINS) { domain = 0; }
+        placement.cpu_domain[cpu] = domain;
+
+        if (!(placement.domain_end[domain]))
+        {
+            struct mem_region *region = nk_get_base_region_by_cpu(cpu);
+            placement.domain_start[domain] = (void *) region->base_addr;
+            placement.domain_end[domain] = (void *) (region->base_addr + region->len);
+        }
+    }
+
+    return;
+}
+
+
+NO_CARAT
+static int _domain_of(void *address)
+{
+    struct mem_region *region = kmem_get_region_by_addr((ulong_t) address);
+    if (!region || (region->domain_id >= CARAT_NUMA_MAX_DOMAINS)) { return -1; }
+    return region->domain_id;
+}
+
+
+/*
+ * =================== Sample Attribution ===================
+ */
+
+NO_CARAT
+static inline uint64_t _hash(void *pointer)
+{
+    return ((((uint64_t) pointer) * 0x9E3779B97F4A7C15ULL) >> 32) & (CARAT_NUMA_TABLE_SIZE - 1);
+}
+
+
+/*
+ * Slot for @pointer in @table --- NULL when the table is full
+ */
+NO_CARAT
+static carat_numa_object *_lookup(carat_numa_object *table, void *pointer, uint64_t size)
+{
+    uint64_t slot = _hash(pointer);
+
+    for (uint64_t probe = 0; probe < CARAT_NUMA_TABLE_SIZE; probe++)
+    {
+        carat_numa_object *object = &(table[slot]);
+
+        if (object->pointer == pointer) { return object; }
+
+        if (!(object->pointer)) 
+        {
+            object->pointer = pointer;
+            object->size = size;
+            return object;
+        }
+
+        slot = (slot + 1) & (CARAT_NUMA_TABLE_SIZE - 1);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Sample consumer --- counts the sample against the domain of @cpu.
+ * Thread stacks are never placed, so they are not counted
+ */
+NO_CARAT
+static void _numa_sample(allocation_entry *entry, int cpu, void *state)
+{
+    if (entry->is_stack) { return; }
+
+    carat_numa_object *object = _lookup(placement.objects, entry->pointer, entry->size);
+    if (!object) { return; }
+
+    object->counts[placement.cpu_domain[cpu]]++;
+    placement.stats.samples++;
+
+    return;
+}
+
+
+/*
+ * Allocations mostly touched from another domain --- fills 
+ * placement.relocations, returns how many
+ */
+NO_CARAT
+static uint64_t _plan(void)
+{
+    uint64_t count = 0;
+    uint64_t max_moves = (placement.max_moves < CARAT_DEFRAG_BATCH) ? placement.max_moves : CARAT_DEFRAG_BATCH;
+
+    for (uint64_t i = 0; (i < CARAT_NUMA_TABLE_SIZE) && (count < max_moves); i++)
+    {
+        carat_numa_object *object = &(placement.objects[i]);
+        if (!(object->pointer)) { continue; }
+
+        uint64_t total = 0;
+        uint32_t best = 0;
+        for (uint32_t d = 0; d < placement.num_domains; d++)
+        {
+            total += object->counts[d];
+            if (object->counts[d] > object->counts[best]) { best = d; }
+        }
+
+        if (false
+            || (total < placement.min_samples)
+            || ((object->counts[best] * 100) < (placement.share * total))
+            || !(placement.domain_end[best])
+            || (_domain_of(object->pointer) == best)) 
+        { 
+            continue; 
+        }
+
+        carat_relocation *relocation = &(placement.relocations[count++]);
+        relocation->address = object->pointer;
+        relocation->size = object->size;
+        relocation->target_start = placement.domain_start[best];
+        relocation->target_end = placement.domain_end[best];
+
+
+        /*
+         * Start over at the new location, whether or not the move succeeds
+         */
+        memset(object->counts, 0, sizeof(object->counts));
+    }
+
+    return count;
+}
+
+
+/*
+ * Halve all counts, dropping objects that reach zero, into the other table
+ */
+NO_CARAT
+static void _age(void)
+{
+    memset(placement.aged, 0, CARAT_NUMA_TABLE_SIZE * sizeof(carat_numa_object));
+
+    for (uint64_t i = 0; i < CARAT_NUMA_TABLE_SIZE; i++)
+    {
+        carat_numa_object *object = &(placement.objects[i]);
+        if (!(object->pointer)) { continue; }
+
+        uint64_t total = 0;
+        for (uint32_t d = 0; d < placement.num_domains; d++) { total += (object->counts[d] >>= 1); }
+        if (!total) { continue; }
+
+        carat_numa_object *aged = _lookup(placement.aged, object->pointer, object->size);
+        memcpy(aged->counts, object->counts, sizeof(object->counts));
+    }
+
+    carat_numa_object *swap = placement.objects;
+    placement.objects = placement.aged;
+    placement.aged = swap;
+
+    return;
+}
+
+
+/*
+ * =================== Daemon ===================
+ */
+
+NO_CARAT
+static void _numa_daemon(void *in, void **out)
+{
+    if (nk_thread_name(get_cur_thread(), "(carat-numa)")) {
+        CARAT_PRINT("CARAT: failed to name NUMA placement daemon\n");
+    }
+
+    nk_carat_context *the_context = placement.target->context;
+
+    while (!(placement.stop))
+    {
+        nk_sleep(placement.period);
+        if (placement.stop) { break; }
+
+
+        /*
+         * Attribute samples with the world stopped --- bounded by
+         * CARAT_SAMPLES_PER_CPU lookups per CPU
+         */
+        if (!(CARAT_STOP_WORLD(the_context))) { continue; }
+        CARAT_READY_OFF(the_context);
+        nk_carat_sampling_drain(the_context);
+        CARAT_READY_ON(the_context);
+        CARAT_START_WORLD(the_context);
+
+
+        /*
+         * Move what is misplaced, one bounded batch per stop-the-world
+         */
+        uint64_t count = _plan();
+        uint64_t next = 0;
+        while ((next < count) && !(placement.stop))
+        {
+            uint64_t moved = 0, moved_bytes = 0;
+            uint64_t start = nk_sched_get_realtime();
+
+            int consumed = nk_carat_relocate_slice(
+                the_context, 
+                &(placement.relocations[next]), 
+                count - next, 
+                count - next, 
+                &moved, 
+                &moved_bytes
+            );
+
+            uint64_t pause = nk_sched_get_realtime() - start;
+            if (consumed <= 0) { break; }
+            next += consumed;
+
+            placement.stats.moves += moved;
+            placement.stats.moved_bytes += moved_bytes;
+            if (pause > placement.stats.pause_max) { placement.stats.pause_max = pause; }
+        }
+
+        _age();
+        placement.stats.passes++;
+    }
+
+    nk_carat_sampling_stop(_numa_sample, NULL);
+    placement.running = 0;
+
+    return;
+}
+
+
+void nk_carat_numa_init(nk_aspace_t *kernel_aspace)
+{
+    placement.target = (nk_aspace_carat_t *) kernel_aspace->state;
+    return;
+}
+
+
+int nk_carat_numa_start(void)
+{
+    if (!(placement.target) || !(__sync_bool_compare_and_swap(&(placement.running), 0, 1))) { return -1; }
+
+    _discover_topology();
+
+    if (!(placement.objects))
+    {
+        placement.objects = (carat_numa_object *) malloc(CARAT_NUMA_TABLE_SIZE * sizeof(carat_numa_object));
+        placement.aged = (carat_numa_object *) malloc(CARAT_NUMA_TABLE_SIZE * sizeof(carat_numa_object));
+        if (!(placement.objects) || !(placement.aged)) { goto out_bad; }
+        memset(placement.objects, 0, CARAT_NUMA_TABLE_SIZE * sizeof(carat_numa_object));
+    }
+
+    if (nk_carat_sampling_start(_numa_sample, NULL)) { goto out_bad; }
+
+    placement.stop = 0;
+
+    nk_thread_id_t tid;
+    if (nk_thread_start(_numa_daemon, 0, 0, 1, CARAT_NUMA_STACK_SIZE, &tid, CPU_ANY)) 
+    { 
+        nk_carat_sampling_stop(_numa_sample, NULL);
+        goto out_bad; 
+    }
+
+    return 0;
+
+out_bad:
+    placement.running = 0;
+    return -1;
+}
+
+
+void nk_carat_numa_stop(void)
+{
+    placement.stop = 1;
+    return;
+}
+
+
+/*
+ * =================== Shell ===================
+ */
+
+NO_CARAT
+static int handle_carat_numa(char *buf, void *priv)
+{
+    char what[32];
+    uint64_t value;
+
+    if (sscanf(buf, "carat_numa %31s %lu", what, &value) == 2)
+    {
+        if (!strcmp(what, "period")) { placement.period = value * 1000000UL; }
+        else if (!strcmp(what, "min_samples")) { placement.min_samples = value; }
+        else if (!strcmp(what, "share")) { placement.share = value; }
+        else if (!strcmp(what, "moves")) { placement.max_moves = value; }
+        else { nk_vc_printf("unknown knob %s\n", what); }
+    }
+    else if (sscanf(buf, "carat_numa %31s", what) == 1)
+    {
+        if (!strcmp(what, "start")) { 
+            if (nk_carat_numa_start()) { nk_vc_printf("cannot start NUMA placement daemon\n"); }
+        } else if (!strcmp(what, "stop")) { 
+            nk_carat_numa_stop(); 
+        } else {
+            nk_vc_printf("unknown command %s\n", what);
+        }
+    }
+
+    nk_vc_printf(
+        "NUMA placement %s: domains: %u, period: %lu ms, min samples: %lu, share: %lu%%, moves per pause: %lu\n",
+        (placement.running) ? "running" : "stopped",
+        placement.num_domains,
+        placement.period / 1000000UL,
+        placement.min_samples,
+        placement.share,
+        placement.max_moves
+    );
+
+    nk_vc_printf(
+        "passes: %lu, samples: %lu, moves: %lu (%lu bytes), max pause: %lu ns\n",
+        placement.stats.passes,
+        placement.stats.samples,
+        placement.stats.moves,
+        placement.stats.moved_bytes,
+        placement.stats.pause_max
+    );
+
+    return 0;
+}
+
+
+static struct shell_cmd_impl carat_numa_impl = {
+    .cmd = "carat_numa",
+    .help_str = "carat_numa [start | stop | period <ms> | min_samples <n> | share <percent> | moves <n>]",
+    .handler = handle_carat_numa,
+};
+
+nk_register_shell_cmd(carat_numa_impl);
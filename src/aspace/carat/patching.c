@@ -142,6 +142,15 @@ allocation_entry _carat_update_entry(nk_carat_context *the_context, allocation_e
 
   new_entry.escapes_set = old_entry->escapes_set;
   new_entry.contained_escapes = old_entry->contained_escapes;
+  new_entry.heat = old_entry->heat;
+  new_entry.is_stack = old_entry->is_stack;
+
+
+  /*
+   * Save the old key --- the insert below may relocate @old_entry
+   * if the allocation map stores entries by value
+   */
+  void *old_pointer = old_entry->pointer;
 
 
   /*
@@ -156,7 +165,7 @@ allocation_entry _carat_update_entry(nk_carat_context *the_context, allocation_e
    */ 
   REMOVE_ENTRY (
       the_context,
-      (old_entry->pointer),
+      old_pointer,
       "carat_update_entry: REMOVE_ENTRY failed on old_entry->pointer"
       );
 
@@ -186,170 +195,415 @@ static void __carat_print_registers (struct nk_regs * r)
 
 
 /*
- * Search through all registers in a thread and patch 
- * any of them that refer to the allocation being moved
+ * Catches the runtime up before any move happens
+ */
+  NO_CARAT
+static void _carat_cleanup(nk_carat_context *the_context) 
+{
+  /*
+   * Process the remaining escapes in @the_context->escape_window
+   */ 
+  CARAT_PRINT(
+      "CARAT: processing escape window of size %lu\n", 
+      FETCH_TOTAL_ESCAPES(the_context)
+      );
+
+  _carat_process_escape_window(the_context);
+
+  CARAT_PRINT("CARAT: processed escape window\n");
+
+
+  /*
+   * TODO: if we implement batch freeing, process frees here 
+   */
+
+
+  return;
+}
+
+
+/*
+ * Sorting helpers for the batch move engine (heapsort, in place)
+ */ 
+  NO_CARAT
+static void _carat_sift_moves(struct carat_move *a, uint64_t root, uint64_t n)
+{
+  while (((2 * root) + 1) < n)
+  {
+    uint64_t child = (2 * root) + 1;
+    if (((child + 1) < n) && (a[child].allocation_to_move < a[child + 1].allocation_to_move)) { child++; }
+    if (!(a[root].allocation_to_move < a[child].allocation_to_move)) { return; }
+
+    struct carat_move tmp = a[root]; a[root] = a[child]; a[child] = tmp;
+    root = child;
+  }
+}
+
+  NO_CARAT
+static void _carat_sort_moves(struct carat_move *a, uint64_t n)
+{
+  if (n < 2) { return; }
+  for (uint64_t i = n / 2; i-- > 0; ) { _carat_sift_moves(a, i, n); }
+  for (uint64_t end = n - 1; end > 0; end--)
+  {
+    struct carat_move tmp = a[0]; a[0] = a[end]; a[end] = tmp;
+    _carat_sift_moves(a, 0, end);
+  }
+}
+
+  NO_CARAT
+static void _carat_sift_words(uintptr_t *a, uint64_t root, uint64_t n)
+{
+  while (((2 * root) + 1) < n)
+  {
+    uint64_t child = (2 * root) + 1;
+    if (((child + 1) < n) && (a[child] < a[child + 1])) { child++; }
+    if (!(a[root] < a[child])) { return; }
+
+    uintptr_t tmp = a[root]; a[root] = a[child]; a[child] = tmp;
+    root = child;
+  }
+}
+
+  NO_CARAT
+static void _carat_sort_words(uintptr_t *a, uint64_t n)
+{
+  if (n < 2) { return; }
+  for (uint64_t i = n / 2; i-- > 0; ) { _carat_sift_words(a, i, n); }
+  for (uint64_t end = n - 1; end > 0; end--)
+  {
+    uintptr_t tmp = a[0]; a[0] = a[end]; a[end] = tmp;
+    _carat_sift_words(a, 0, end);
+  }
+}
+
+
+/*
+ * Number of moves (in @moves, sorted by source) whose source starts at or before @address
  */ 
   NO_CARAT
-static void _carat_patch_thread_registers(struct nk_thread *t, void *state) 
+static uint64_t _carat_count_moves_before(struct carat_move *moves, uint64_t num_moves, void *address)
 {
+  uint64_t lo = 0, hi = num_moves;
+  while (lo < hi)
+  {
+    uint64_t mid = (lo + hi) >> 1;
+    if (moves[mid].allocation_to_move <= address) { lo = mid + 1; }
+    else { hi = mid; }
+  }
+
+  return lo;
+}
+
+
+/*
+ * Index of the move (in @moves, sorted by source) whose source contains 
+ * @address, or -1 --- this is the old -> new lookup table for patching
+ */ 
+  NO_CARAT
+static sint64_t _carat_find_move(struct carat_move *moves, uint64_t num_moves, void *address)
+{
+  uint64_t lo = _carat_count_moves_before(moves, num_moves, address);
+  if (!lo) { return -1; }
+
+  struct carat_move *move = &(moves[lo - 1]);
+  if (address < (move->allocation_to_move + move->size)) { return lo - 1; }
+
+  return -1;
+}
+
+
+/*
+ * =================== Stack and Register Patching ===================
+ *
+ * Every thread's saved registers and stack are scanned conservatively
+ * against the sorted move table --- any word that points into a source
+ * is redirected to the same offset in its target. A descheduled thread's
+ * registers were pushed onto its stack when it was switched out, and a
+ * thread interrupted by the world stop has its registers in the interrupt
+ * frame on its stack, so scanning from its stack pointer to the top of
+ * its stack covers both. The scans run in parallel on the stopped CPUs:
+ * each one scans the stack of the thread it interrupted, then takes 
+ * descheduled threads from a shared pool
+ */ 
+
+/*
+ * Callee-saved registers of the caller of the public move entry point
+ * (nk_carat_move_*) that stopped the world, as spilled by CARAT_CALL_MOVER
+ * --- the mover's own stack is scanned from here up, so the registers are 
+ * patched before they are restored to the caller, while the runtime's
+ * frames below (which hold the move plan itself) are left alone
+ */ 
+static void *carat_mover_frame;
+
+
+struct carat_thread_scan {
+  struct carat_move *moves;
+  uint64_t num_moves;
+
   /*
-   * Cast to struct move_context
+   * Quick rejection bounds --- [lowest source, end of highest source)
    */ 
-  struct move_context *context = (struct move_context*) state;
+  void *sources_start;
+  void *sources_end;
 
+  /*
+   * Descheduled threads, shared out between the stopped CPUs
+   */ 
+  struct nk_thread **threads;
+  uint64_t num_threads;
+  volatile uint64_t next_thread;
 
   /*
-   * Acquire all registers
+   * Only threads of this aspace are scanned (NULL => all threads)
    */ 
-  struct nk_regs * r = ((struct nk_regs*) ((char*)t->rsp - 128)); // FIX: t->rsp - 128 might be wrong, look at garbage collector
+  struct nk_aspace *scope;
 
+  /*
+   * Threads running when the world stopped (one per CPU, NULL if the 
+   * CPU was left running by a scoped stop)
+   */ 
+  struct nk_thread *running[NAUT_CONFIG_MAX_CPUS];
+  int num_cpus;
+  int mover_cpu;
 
   /*
-   * Debugging, sanity check for t->rsp - 128
-   */  
-  // CARAT_PRINT(t->name); // should be shell
-  // __carat_print_registers(r);
+   * Bounds of every scanned stack, sorted --- [start, end) pairs, as 
+   * the stacks do not overlap
+   */ 
+  uintptr_t *stack_bounds;
+  uint64_t num_stack_bounds;
 
+  volatile uint64_t patched_words;
+};
+
+
+  NO_CARAT
+static void _carat_collect_thread(struct nk_thread *t, void *state)
+{
+  struct carat_thread_scan *scan = (struct carat_thread_scan *) state;
+
+  if (scan->scope && (t->aspace != scan->scope)) { return; }
+
+  for (int i = 0; i < scan->num_cpus; i++) {
+    if (scan->running[i] == t) { return; }
+  }
 
   /*
-   * Determine if the value stored in the register 
-   * aliases @allocation_to_move --- if it does, then
-   * "patch" the value to use @allocation_target at the
-   * correct offset
-   * 
-   * Macro-ized for engineering purposes
+   * @scan->threads is NULL on the counting pass
    */ 
+  if (scan->threads) { scan->threads[scan->num_threads] = t; }
+  scan->num_threads++;
+}
 
-#define REG_PTR(reg) ((void *) (r->reg))
-#define HANDLE_REG(context, reg) \
-  void *ptr_##reg = REG_PTR(reg); \
-  uint64_t offset_##reg = _carat_get_query_offset ( \
-      ptr_##reg, \
-      (context->allocation_to_move), \
-      (context->size) \
-      ); \
-  \
-  if (offset_##reg != -1) { r->reg = (((uint64_t) context->allocation_target) + offset_##reg); }
-
-  HANDLE_REG(context, r15)
-    HANDLE_REG(context, r14)
-    HANDLE_REG(context, r13)
-    HANDLE_REG(context, r12)
-    HANDLE_REG(context, r11)
-    HANDLE_REG(context, r10)
-    HANDLE_REG(context, r9)
-    HANDLE_REG(context, r8)
-    HANDLE_REG(context, rbp)
-    HANDLE_REG(context, rdi)
-    HANDLE_REG(context, rsi)
-    HANDLE_REG(context, rdx)
-    HANDLE_REG(context, rcx)
-    HANDLE_REG(context, rbx)
-    HANDLE_REG(context, rax)
-    // TODO --- handle rip later. rsp is handled by _carat_patch_thread_stack
 
+/*
+ * Patch the words of @t's stack from @from to the top of the stack
+ */ 
+  NO_CARAT
+static void _carat_patch_stack_from(struct carat_thread_scan *scan, struct nk_thread *t, void *from)
+{
+  if (!t || !(t->stack)) { return; }
 
-    return;
+  uint64_t *stack_end = (uint64_t *) (((uint64_t) t->stack) + t->stack_size);
+  uint64_t *stack_addr = (uint64_t *) ((((uint64_t) from) + 7) & ~7UL);
+  if ((((void *) stack_addr) < t->stack) || (stack_addr >= stack_end)) { return; }
+
+  uint64_t patched = 0;
+  for ( ; stack_addr < stack_end; stack_addr++)
+  {
+    void *value = (void *) *stack_addr;
+    if ((value < scan->sources_start) || (value >= scan->sources_end)) { continue; }
+
+    sint64_t m = _carat_find_move(scan->moves, scan->num_moves, value);
+    if (m < 0) { continue; }
+
+    *stack_addr = ((uint64_t) scan->moves[m].allocation_target) + (((uint64_t) value) - ((uint64_t) scan->moves[m].allocation_to_move));
+    patched++;
+  }
+
+  if (patched) { __sync_fetch_and_add(&(scan->patched_words), patched); }
 }
 
 
 /*
- * Search through all addresses in the thread's stack 
- * and patch any of them that refer to the allocation being moved
+ * Runs on every stopped CPU (see nk_sched_run_on_stopped_cpus) --- for
+ * a scoped stop, those are the ones running threads of the scope
  */ 
   NO_CARAT
-static void _carat_patch_thread_stack(struct nk_thread *t, void *state) 
+static void _carat_patch_stopped_cpu(int cpu, void *state)
 {
+  struct carat_thread_scan *scan = (struct carat_thread_scan *) state;
+
+
   /*
-   * Cast to struct move_context
+   * The thread this CPU interrupted --- start above our own frame (or
+   * above the runtime's frames, on the mover's CPU)
    */ 
-  struct move_context *context = (struct move_context*) state;
-
-  uint64_t *stack_start = t->stack;
-  nk_stack_size_t stack_size = t->stack_size;
-  uint64_t *stack_end = stack_start + stack_size;
+  void *from = (cpu == scan->mover_cpu) ? carat_mover_frame : __builtin_frame_address(0);
+  _carat_patch_stack_from(scan, get_cur_thread(), from);
 
-  //nk_vc_printf("Stack Size: %lu \n", stack_size);
-  //nk_vc_printf("Stack Start: %p \n", (void *) stack_start);
-  //nk_vc_printf("Stack End: %p \n", (void *) stack_end);
-  //nk_vc_printf("rsp: %p \n", (void *) t->rsp);
 
   /*
-   * Loop through every address in the stack
+   * Then help with the descheduled threads
    */ 
-  for (uint64_t *stack_addr = (uint64_t *) t->rsp; stack_addr < stack_end; stack_addr += 8) {
-    /*
-     * Determine if the value stored in the stack location 
-     * aliases @allocation_to_move --- if it does, then
-     * "patch" the value to use @allocation_target at the
-     * correct offset
-     */ 
-    uint64_t offset = _carat_get_query_offset((void*) *stack_addr, context->allocation_to_move, context->size);
-    if (offset != -1) {
-      *stack_addr = (((uint64_t) context->allocation_target) + offset);
-    }
+  uint64_t next;
+  while ((next = __sync_fetch_and_add(&(scan->next_thread), 1)) < scan->num_threads)
+  {
+    struct nk_thread *t = scan->threads[next];
+    _carat_patch_stack_from(scan, t, (void *) t->rsp);
   }
 }
 
 
+  NO_CARAT
+static void _carat_add_stack_bounds(struct carat_thread_scan *scan, struct nk_thread *t)
+{
+  if (!t || !(t->stack)) { return; }
+
+  scan->stack_bounds[scan->num_stack_bounds++] = (uintptr_t) t->stack;
+  scan->stack_bounds[scan->num_stack_bounds++] = ((uintptr_t) t->stack) + t->stack_size;
+}
+
+
 /*
- * Patch the stack and the registers for a given thread.
- * This function is passed into and called by nk_sched_map_threads
+ * Whether @location lies on one of the scanned stacks --- those words are
+ * owned by the stack scan and must not be patched a second time. With the
+ * bounds sorted, @location is on a stack iff an odd number of them are at
+ * or below it
  */ 
   NO_CARAT
-static void _carat_patch_thread_registers_and_stack(struct nk_thread *t, void *state) 
+static int _carat_on_scanned_stack(struct carat_thread_scan *scan, void *location)
 {
-  _carat_patch_thread_registers(t, state);
-  _carat_patch_thread_stack(t, state);
+  uint64_t lo = 0, hi = scan->num_stack_bounds;
+  while (lo < hi)
+  {
+    uint64_t mid = (lo + hi) >> 1;
+    if (scan->stack_bounds[mid] <= ((uintptr_t) location)) { lo = mid + 1; }
+    else { hi = mid; }
+  }
+
+  return lo & 1;
 }
 
 
 /*
- * Catches the runtime up before any move happens
- */
+ * Scan and patch the registers and stack of every thread that can hold
+ * pointers into @the_context against @moves (sorted by source) --- returns 
+ * -1 if the caller did not stop the world (see CARAT_STOP_WORLD)
+ */ 
   NO_CARAT
-static void _carat_cleanup(nk_carat_context *the_context) 
+static int _carat_patch_threads(nk_carat_context *the_context, struct carat_thread_scan *scan, struct carat_move *moves, uint64_t num_moves)
 {
+  memset(scan, 0, sizeof(struct carat_thread_scan));
+  scan->scope = the_context->stop_scope;
+  scan->moves = moves;
+  scan->num_moves = num_moves;
+  scan->sources_start = (num_moves) ? moves[0].allocation_to_move : NULL;
+  scan->sources_end = (num_moves) ? (moves[num_moves - 1].allocation_to_move + moves[num_moves - 1].size) : NULL;
+  scan->num_cpus = nk_get_num_cpus();
+  scan->mover_cpu = my_cpu_id();
+
+  for (int i = 0; i < scan->num_cpus; i++) {
+    scan->running[i] = nk_sched_get_cur_thread_on_cpu(i);
+    if (scan->scope && (i != scan->mover_cpu) && scan->running[i] && (scan->running[i]->aspace != scan->scope)) { scan->running[i] = NULL; }
+  }
+
+
   /*
-   * Process the remaining escapes in @the_context->escape_window
+   * Count, then collect, the descheduled threads
    */ 
-  CARAT_PRINT(
-      "CARAT: processing escape window of size %lu\n", 
-      the_context->total_escape_entries
-      );
+  nk_sched_map_threads(-1, _carat_collect_thread, scan);
+  scan->threads = (struct nk_thread **) CARAT_MALLOC((scan->num_threads + 1) * sizeof(struct nk_thread *));
+  scan->num_threads = 0;
+  nk_sched_map_threads(-1, _carat_collect_thread, scan);
 
-  _carat_process_escape_window(the_context);
+  scan->stack_bounds = (uintptr_t *) CARAT_MALLOC(((2 * (scan->num_cpus + scan->num_threads)) + 1) * sizeof(uintptr_t));
+  for (int i = 0; i < scan->num_cpus; i++) { _carat_add_stack_bounds(scan, scan->running[i]); }
+  for (uint64_t i = 0; i < scan->num_threads; i++) { _carat_add_stack_bounds(scan, scan->threads[i]); }
+  _carat_sort_words(scan->stack_bounds, scan->num_stack_bounds);
 
-  CARAT_PRINT("CARAT: processed escape window\n");
 
+  if (nk_sched_run_on_stopped_cpus(_carat_patch_stopped_cpu, scan)) 
+  {
+    CARAT_PRINT("PATCH: threads can only be patched by the world stopper\n");
+    free(scan->threads);
+    free(scan->stack_bounds);
+    scan->threads = NULL;
+    scan->stack_bounds = NULL;
+    return -1;
+  }
 
-  /*
-   * TODO: if we implement batch freeing, process frees here 
-   */
+  CARAT_PRINT("PATCH: patched %lu stack/register words\n", scan->patched_words);
 
 
-  return;
+  return 0;
 }
 
 
-  NO_CARAT 
-int _move_allocation(
+/*
+ * Cost model for the handshake, learned from the copies and handshakes
+ * done so far --- ns per KB copied, ns per KB compared, and ns per move
+ * for everything else (escape drain, stack scan, escape patching, map 
+ * updates). The latter is seeded by a calibration stop before the first
+ * migration (see _carat_migration_seed)
+ */ 
+static uint64_t carat_migration_copy_ns_per_kb = 0;
+static uint64_t carat_migration_compare_ns_per_kb = 0;
+static uint64_t carat_migration_ns_per_move = 0;
+static int carat_migration_seeded = 0;
+
+#define CARAT_MIGRATION_LEARN(model, sample) (model) = ((model) ? ((((model) * 3) + (sample)) / 4) : (sample))
+
+
+/*
+ * Move @i of @allocations_to_move was freed (or reallocated with a 
+ * different size) while it was being copied --- report it to the caller,
+ * which still owns its target
+ */ 
+  NO_CARAT
+static void _carat_migration_drop(carat_migration *migration, void **allocations_to_move, uint64_t i)
+{
+  CARAT_PRINT("PATCH: %p was freed during its migration, not moved\n", allocations_to_move[i]);
+
+  allocations_to_move[i] = NULL;
+  migration->num_dropped++;
+  if (CARAT_DO_PROFILE && start_carat_profiles) { CARAT_PROFILE_CPU->migration_dropped_moves++; }
+}
+
+
+/*
+ * The batch move engine --- with a @migration, the objects have already 
+ * been copied while the world was running: moves whose source was freed 
+ * (or reallocated with a different size) in the meantime are dropped and
+ * reported (see _carat_migration_drop), objects written since their copy
+ * are copied again, and the others are checked against their copy
+ */ 
+  NO_CARAT
+static int _carat_move_allocations_internal(
     nk_carat_context *the_context,
-    void *allocation_to_move,
-    void *allocation_target
+    void **allocations_to_move, 
+    void **allocation_targets, 
+    uint64_t num_moves,
+    carat_migration *migration
     ) 
 {
-  /*
-   * 1. Profile
-   */ 
+  if (!num_moves) { return 0; }
+
   start_carat_profiles |= 1;
-  CARAT_PROFILE_INCR(CARAT_DO_PROFILE, move_calls);
   CARAT_PROFILE_INIT_TIMING_VAR(0);
+  if (CARAT_DO_PROFILE && start_carat_profiles) { CARAT_PROFILE_CPU->move_calls += num_moves; }
+
+  struct carat_move *moves = (struct carat_move *) CARAT_MALLOC(num_moves * sizeof(struct carat_move));
+  uintptr_t *locations = NULL;
+  struct carat_thread_scan scan;
+  scan.threads = NULL;
+  scan.stack_bounds = NULL;
+  int status = -1;
 
 
   /*
-   * Perform any leftover/cleanup processing for @the_context 
-   * before moving anything related to @allocation_to_move
+   * 1. Catch the runtime up --- once for the whole batch
    */ 
   CARAT_PRINT("PATCH: 1. _carat_cleanup \n");
 
@@ -358,153 +612,262 @@ int _move_allocation(
   CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, cleanup_time, 0);
 
 
-
   /*
-   * Find the entry for the @allocation_to_move addr in the 
-   * allocation_map --- if not found, return -1
-   */
-  CARAT_PRINT("PATCH: 2. finding entry \n");
+   * 2. Build the move plan from the allocation map, sorted by source
+   */ 
+  CARAT_PRINT("PATCH: 2. building the move plan \n");
 
   CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
-  allocation_entry *entry = 
-    _carat_find_allocation_entry(
-        the_context,
-        allocation_to_move
-        );
-  CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, find_entry_time, 0);
+  uint64_t num_escapes = 0;
+  uint64_t num_planned = 0;
+  for (uint64_t i = 0; i < num_moves; i++)
+  {
+    allocation_entry *entry = _carat_find_allocation_entry(the_context, allocations_to_move[i]);
+    if (!entry || (entry->pointer != allocations_to_move[i])) 
+    {
+      if (migration) 
+      { 
+        _carat_migration_drop(migration, allocations_to_move, i);
+        continue; 
+      }
 
+      CARAT_PRINT("PATCH: Cannot find entry for %p!\n", allocations_to_move[i]);
+      goto out;
+    }
 
-  if (!entry) 
-  {
-    CARAT_PRINT("PATCH: Cannot find entry!\n");
-    goto out_bad;
+    if (migration)
+    {
+      sint64_t m = _carat_find_move(migration->moves, migration->num_moves, entry->pointer);
+      if ((m < 0) || (migration->moves[m].size != entry->size)) 
+      { 
+        _carat_migration_drop(migration, allocations_to_move, i);
+        continue; 
+      }
+    }
+
+    moves[num_planned].allocation_to_move = entry->pointer;
+    moves[num_planned].allocation_target = allocation_targets[i];
+    moves[num_planned].size = entry->size;
+    moves[num_planned].escapes_set = entry->escapes_set;
+    moves[num_planned].contained_escapes = entry->contained_escapes;
+    moves[num_planned].heat = entry->heat;
+    moves[num_planned].is_stack = entry->is_stack;
+    num_planned++;
+
+    if (entry->escapes_set) { num_escapes += CARAT_ESCAPE_SET_SIZE(entry->escapes_set); }
   }
 
-  CARAT_PRINT("PATCH: 3. patching escapes \n");
-  /*
-   * Patch all of @allocation_to_move’s escapes (in @allocation_to_moves->escapes_set)
-   * to use the address of @allocation_target
-   */
+  num_moves = num_planned;
+  if (!num_moves) 
+  { 
+    status = 0;
+    goto out; 
+  }
 
-  CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
-  if (!_carat_patch_escapes(entry, allocation_target)) 
+  _carat_sort_moves(moves, num_moves);
+
+
+  /*
+   * Copies happen in ascending source order, so a target may only overlap
+   * sources that have already been copied (e.g. sliding a region down)
+   */ 
+  for (uint64_t i = 0; i < num_moves; i++)
   {
-    CARAT_PRINT("PATCH: The patch is toast --- can't patch escapes!\n");
-    goto out_bad;
-  }
-  CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, patch_escapes_time, 0);
+    if ((i + 1 < num_moves) && ((moves[i].allocation_to_move + moves[i].size) > moves[i + 1].allocation_to_move))
+    {
+      CARAT_PRINT("PATCH: Overlapping sources %p, %p\n", moves[i].allocation_to_move, moves[i + 1].allocation_to_move);
+      goto out;
+    }
 
+    sint64_t last = ((sint64_t) _carat_count_moves_before(moves, num_moves, moves[i].allocation_target + moves[i].size - 1)) - 1;
+    for (sint64_t j = last; (j > (sint64_t) i) && ((moves[j].allocation_to_move + moves[j].size) > moves[i].allocation_target); j--)
+    {
+      CARAT_PRINT("PATCH: Target %p clobbers a later source %p\n", moves[i].allocation_target, moves[j].allocation_to_move);
+      goto out;
+    }
+  }
+  CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, find_entry_time, 0);
 
 
   /*
-   * For each thread, patch the registers and stack addresses
-   * that currently contain references to @allocation_target. 
-   * In order to patch each thread, all necessary info is packaged into a move_context struct
-   */
+   * 3. Patch the registers and stacks of every thread, in parallel
+   */ 
+  CARAT_PRINT("PATCH: 3. patching registers and stacks \n");
+
+  CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
+  if (_carat_patch_threads(the_context, &scan, moves, num_moves)) { goto out; }
+  CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, patch_stack_regs_time, 0);
+
 
   /*
-   * HACK - we will simulate patching the stack and registers with the ability to make O(1) lookups *once* in a batch of moves
-   */
-  //CARAT_PRINT("PATCH: 4. patching registers and stack \n");
+   * 4. Patch every escape of every moved allocation in one sweep --- escape
+   * locations are gathered and deduplicated first (a stale location can sit
+   * in more than one set, and must not be patched twice), then each one is 
+   * redirected through the sorted move table. Locations on thread stacks 
+   * were already handled by the stack scan
+   */ 
+  CARAT_PRINT("PATCH: 4. patching escapes \n");
 
+  CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
+  locations = (uintptr_t *) CARAT_MALLOC((num_escapes + 1) * sizeof(uintptr_t));
+  uint64_t num_locations = 0;
+  for (uint64_t i = 0; i < num_moves; i++)
+  {
+    if (!(moves[i].escapes_set)) { continue; }
 
-  // CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
-  // struct move_context package = { allocation_to_move, allocation_target, entry->size, 0 };
-  // nk_sched_map_threads(-1, _carat_patch_thread_registers_and_stack, &package);
-  // if (package.failed) 
-  // {
-  //     CARAT_PRINT("PATCH: Unable to patch threads\n");
-  //     goto out_bad;
-  // }
-  // CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, patch_stack_regs_time, 0);
+    CARAT_ESCAPES_SET_ITERATE((moves[i].escapes_set))
+    {
+      locations[num_locations++] = (uintptr_t) FETCH_ESCAPE_FROM_ITERATOR;
+    }
+  }
 
+  _carat_sort_words(locations, num_locations);
 
+  for (uint64_t i = 0; i < num_locations; i++)
+  {
+    if (i && (locations[i] == locations[i - 1])) { continue; }
 
-  /*
-   * Update the allocation entry
-   */
-  CARAT_PRINT("PATCH: 5. updating allocation entry \n");
+    void **curr_escape = (void **) locations[i];
+    if (_carat_on_scanned_stack(&scan, curr_escape)) { continue; }
 
+    sint64_t m = _carat_find_move(moves, num_moves, *curr_escape);
+    if (m < 0) { continue; }
 
-  CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
-  allocation_entry new_entry = _carat_update_entry(the_context, entry, allocation_target);
-  CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, update_entry_time, 0);
+    *curr_escape = moves[m].allocation_target + (((uint64_t) *curr_escape) - ((uint64_t) moves[m].allocation_to_move));
+  }
+  CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, patch_escapes_time, 0);
 
 
   /*
-   * Move the contents pointed to by @allocation_to_move to the 
-   * location @allocation_target (this is the "actual" move)
-   */
-  CARAT_PRINT("PATCH: 6. moving memory from %p to %p of size %lu (old size) %lu (new size) \n", allocation_to_move, allocation_target, entry->size, new_entry.size);
+   * 5. The copies, back to back --- patched escapes stored inside moved 
+   * allocations travel with them
+   */ 
+  CARAT_PRINT("PATCH: 5. moving memory \n");
+
   CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
-  memmove(allocation_target, allocation_to_move, new_entry.size);
+  uint64_t copies_start = nk_sched_get_realtime();
+  uint64_t compared = 0, recopied = 0;
+  for (uint64_t i = 0; i < num_moves; i++) 
+  {
+    if (migration)
+    {
+      /*
+       * The barrier only sees guarded writes, and fires before the store
+       * (which can land after a precopy cleared the dirty bit) --- so 
+       * compare the clean copies, now that nothing is running, and redo
+       * the ones a missed write made stale
+       */
+      sint64_t m = _carat_find_move(migration->moves, migration->num_moves, moves[i].allocation_to_move);
+      if (!(migration->dirty[m])) 
+      { 
+        compared += moves[i].size;
+        if (!memcmp(moves[i].allocation_target, moves[i].allocation_to_move, moves[i].size)) { continue; }
+
+        if (CARAT_DO_PROFILE && start_carat_profiles) { CARAT_PROFILE_CPU->migration_unbarriered_recopies++; }
+      }
+
+      recopied += moves[i].size;
+      if (CARAT_DO_PROFILE && start_carat_profiles) { CARAT_PROFILE_CPU->migration_recopied_bytes += moves[i].size; }
+    }
+
+    memmove(moves[i].allocation_target, moves[i].allocation_to_move, moves[i].size);
+  }
   CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, memmove_time, 0);
 
+  if (migration && (compared >= 1024)) 
+  {
+    uint64_t elapsed = nk_sched_get_realtime() - copies_start;
+    uint64_t copy_estimate = (recopied * carat_migration_copy_ns_per_kb) / 1024;
+    CARAT_MIGRATION_LEARN(carat_migration_compare_ns_per_kb, ((elapsed > copy_estimate) ? (elapsed - copy_estimate) : 0) / (compared / 1024));
+  }
+
 
   /*
-   * all of the escapes contained in our entry need to be resintrumented, 
-   * as they are now new escapes
-   */
-  CARAT_PRINT("PATCH: 7. reinstrumenting contained escapes \n");
+   * 6. Update the allocation map --- all removals before all insertions,
+   * since a target may reuse the address of an earlier source
+   */ 
+  CARAT_PRINT("PATCH: 6. updating allocation entries \n");
 
   CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
-  _reinstrument_contained_escapes(&new_entry);
-  CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, reinstrument_contained_time, 0);
+  for (uint64_t i = 0; i < num_moves; i++)
+  {
+    REMOVE_ENTRY (
+        the_context,
+        moves[i].allocation_to_move,
+        "_carat_move_allocations: REMOVE_ENTRY failed on"
+        );
+  }
+
+  uint64_t num_contained = 0;
+  for (uint64_t i = 0; i < num_moves; i++)
+  {
+    allocation_entry new_entry = _carat_create_allocation_entry(moves[i].allocation_target, moves[i].size);
+    new_entry.escapes_set = moves[i].escapes_set;
+    new_entry.contained_escapes = moves[i].contained_escapes;
+    new_entry.heat = moves[i].heat;
+    new_entry.is_stack = moves[i].is_stack;
+    CARAT_ALLOCATION_MAP_INSERT(the_context, &new_entry);
+
+    if (moves[i].contained_escapes) { num_contained += CARAT_ESCAPE_SET_SIZE(moves[i].contained_escapes); }
+  }
+  CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, update_entry_time, 0);
 
 
   /*
-   * We need to process those resinstrumented escapes before we continue
-   */
-  CARAT_PRINT("PATCH: 8. patching escape window again \n");
+   * 7. Escapes stored inside the moved allocations now live at new 
+   * locations --- register them with the allocations they point to, 
+   * as a single batch
+   */ 
+  CARAT_PRINT("PATCH: 7. reinstrumenting contained escapes \n");
 
   CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
-  _carat_process_escape_window(the_context);
-  CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, process_window_2_time, 0);
+  void ***contained = (void ***) CARAT_MALLOC((num_contained + 1) * sizeof(void **));
+  uint64_t next = 0;
+  for (uint64_t i = 0; i < num_moves; i++)
+  {
+    if (!(moves[i].contained_escapes)) { continue; }
 
-  CARAT_PRINT("PATCH: 9. successful patch \n");
-  return 0;
+    CARAT_ESCAPES_SET_ITERATE((moves[i].contained_escapes))
+    {
+      uint64_t offset = ((uint64_t) FETCH_ESCAPE_FROM_ITERATOR); /* HACK */
+      contained[next++] = (void **) (((uint64_t) moves[i].allocation_target) + offset);
+    }
+  }
 
+  _carat_process_escapes(the_context, contained, next, NULL);
+  free(contained);
+  CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, reinstrument_contained_time, 0);
+
+
+  CARAT_PRINT("PATCH: 8. successful patch \n");
+  status = 0;
 
-out_bad:
-  CARAT_PRINT(
-      "_move_allocation: failed. allocation to move: %p, allocation target: %p\n", 
-      allocation_to_move, 
-      allocation_target
-      );
-  return -1;
 
+out:
+  if (locations) { free(locations); }
+  if (scan.threads) { free(scan.threads); }
+  if (scan.stack_bounds) { free(scan.stack_bounds); }
+  free(moves);
+
+  return status;
 }
 
 
-NO_CARAT
+  NO_CARAT
 int _carat_move_allocations(
     nk_carat_context *the_context,
     void **allocations_to_move, 
     void **allocation_targets, 
     uint64_t num_moves
-    ) {
-  /*
-   * Perform a series of moves
-   */ 
-  for (int i = 0; i < num_moves; i++) 
-  {
-    int next_move_status =
-      _move_allocation(
-          the_context,
-          allocations_to_move[i],
-          allocation_targets[i]
-          );
-
-    if (next_move_status) { return -1; }
-  }
-
-  return 0;
-
+    ) 
+{
+  return _carat_move_allocations_internal(the_context, allocations_to_move, allocation_targets, num_moves, NULL);
 }
 
 
   NO_CARAT
-int nk_carat_move_allocation(
+static int _carat_mover_move_allocation(
+    void *saved_registers,
     nk_carat_context *the_context,
     void *allocation_to_move, 
     void *allocation_target
@@ -513,7 +876,7 @@ int nk_carat_move_allocation(
   /*
    * Pauses all execution so we can perform a move
    */
-  if (!(nk_sched_stop_world())) 
+  if (!(CARAT_STOP_WORLD(the_context))) 
   {
     CARAT_PRINT("CARAT: nk_sched_stop_world failed\n");
     goto out_bad;
@@ -529,21 +892,28 @@ int nk_carat_move_allocation(
   /*
    * Perform the move
    */ 
+  carat_mover_frame = saved_registers;
   int move_status = 
-    _move_allocation(
+    _carat_move_allocations(
         the_context,
-        allocation_to_move,
-        allocation_target
+        &allocation_to_move,
+        &allocation_target,
+        1
         );
 
-  if (move_status) { goto out_bad; }
+  if (move_status) 
+  { 
+    CARAT_READY_ON(the_context);
+    CARAT_START_WORLD(the_context);
+    goto out_bad; 
+  }
 
 
   /*
    * Turn everything back on
    */ 
   CARAT_READY_ON(the_context);
-  nk_sched_start_world();
+  CARAT_START_WORLD(the_context);
 
 
   CARAT_PRINT("CARAT: Move succeeded.\n");
@@ -562,17 +932,30 @@ out_bad:
 
 
   NO_CARAT
-int nk_carat_move_allocations(
+int nk_carat_move_allocation(
+    nk_carat_context *the_context,
+    void *allocation_to_move, 
+    void *allocation_target
+    )
+{
+  return (int) CARAT_CALL_MOVER(_carat_mover_move_allocation, the_context, allocation_to_move, allocation_target, 0, 0, 0);
+}
+
+
+  NO_CARAT
+static int _carat_mover_move_allocations(
+    void *saved_registers,
     nk_carat_context *the_context,
     void **allocations_to_move, 
     void **allocation_targets, 
     uint64_t num_moves
     ) 
 {
+
   /*
    * Pauses all execution so we can perform a series of move
    */
-  if (!(nk_sched_stop_world())) 
+  if (!(CARAT_STOP_WORLD(the_context))) 
   {
     CARAT_PRINT("CARAT: nk_sched_stop_world failed\n");
     goto out_bad;
@@ -585,89 +968,434 @@ int nk_carat_move_allocations(
   CARAT_READY_OFF(the_context);
 
 
-  _carat_move_allocations(the_context, allocations_to_move, allocation_targets, num_moves);
+  carat_mover_frame = saved_registers;
+  if (_carat_move_allocations(the_context, allocations_to_move, allocation_targets, num_moves)) { goto out_bad_restart; }
+
+  /*
+   * Turn everything back on
+   */ 
+  CARAT_READY_ON(the_context);
+  CARAT_START_WORLD(the_context);
+
+
+  CARAT_PRINT("CARAT: Moves succeeded.\n");
+  return 0;
+
+
+out_bad_restart:
+  CARAT_READY_ON(the_context);
+  CARAT_START_WORLD(the_context);
+
+out_bad:
+  CARAT_PRINT("nk_carat_move_allocations: failed to move");
+  return -1;
+}
+
+
+  NO_CARAT
+int nk_carat_move_allocations(
+    nk_carat_context *the_context,
+    void **allocations_to_move, 
+    void **allocation_targets, 
+    uint64_t num_moves
+    ) 
+{
+  if (the_context->migration_mode == CARAT_MIGRATION_CONCURRENT) {
+    return nk_carat_move_allocations_concurrent(the_context, allocations_to_move, allocation_targets, num_moves);
+  }
+
+  return (int) CARAT_CALL_MOVER(_carat_mover_move_allocations, the_context, allocations_to_move, allocation_targets, num_moves, 0, 0);
+}
+
+
+/*
+ * =================== Concurrent Migration ===================  
+ */ 
+
+  NO_CARAT_NO_INLINE
+void _carat_migration_write_barrier(nk_carat_context *the_context, void *address)
+{
+  /*
+   * The migration may be unpublished at any time --- announce ourselves 
+   * before loading it, so that it is not freed under us
+   */ 
+  __sync_fetch_and_add(&(the_context->migration_barrier_users), 1);
+
+  carat_migration *migration = (carat_migration *) the_context->migration;
+  if (migration) 
+  {
+    sint64_t m = _carat_find_move(migration->moves, migration->num_moves, address);
+    if ((m >= 0) && !(migration->dirty[m])) { migration->dirty[m] = 1; }
+  }
+
+  __sync_fetch_and_sub(&(the_context->migration_barrier_users), 1);
+}
+
+
+  NO_CARAT_NO_INLINE
+void _carat_migration_write_barrier_range(nk_carat_context *the_context, void *start, void *end)
+{
+  __sync_fetch_and_add(&(the_context->migration_barrier_users), 1);
+
+  carat_migration *migration = (carat_migration *) the_context->migration;
+  if (migration) 
+  {
+    /*
+     * From the move that may contain @start up to the last one starting before @end
+     */ 
+    uint64_t first = _carat_count_moves_before(migration->moves, migration->num_moves, start);
+    uint64_t last = _carat_count_moves_before(migration->moves, migration->num_moves, end - 1);
+    if (first) { first--; }
+
+    for (uint64_t m = first; m < last; m++)
+    {
+      struct carat_move *move = &(migration->moves[m]);
+      if ((move->allocation_to_move + move->size) <= start) { continue; }
+      if (!(migration->dirty[m])) { migration->dirty[m] = 1; }
+    }
+  }
+
+  __sync_fetch_and_sub(&(the_context->migration_barrier_users), 1);
+}
+
+
+/*
+ * Copies every dirty object of @migration with the world running, clearing
+ * its dirty bit first so that writes racing with the copy dirty it again.
+ * Returns the number of bytes copied
+ */ 
+  NO_CARAT
+static uint64_t _carat_migration_precopy(carat_migration *migration)
+{
+  uint64_t copied = 0;
+  uint64_t start = nk_sched_get_realtime();
+
+  for (uint64_t i = 0; i < migration->num_moves; i++)
+  {
+    if (!__sync_lock_test_and_set(&(migration->dirty[i]), 0)) { continue; }
+
+    memcpy(migration->moves[i].allocation_target, migration->moves[i].allocation_to_move, migration->moves[i].size);
+    copied += migration->moves[i].size;
+  }
+
+  if (copied >= 1024) {
+    CARAT_MIGRATION_LEARN(carat_migration_copy_ns_per_kb, (nk_sched_get_realtime() - start) / (copied / 1024));
+  }
+
+  return copied;
+}
+
+
+/*
+ * Time (ns) to copy @dirty_bytes and compare the rest of @migration at 
+ * the handshake --- comparing is charged like copying until it has been 
+ * measured
+ */ 
+  NO_CARAT
+static uint64_t _carat_migration_bytes_cost(carat_migration *migration, uint64_t dirty_bytes)
+{
+  uint64_t compare_ns_per_kb = (carat_migration_compare_ns_per_kb) ? carat_migration_compare_ns_per_kb : carat_migration_copy_ns_per_kb;
+
+  return ((dirty_bytes * carat_migration_copy_ns_per_kb) + ((migration->bytes - dirty_bytes) * compare_ns_per_kb)) / 1024;
+}
+
+
+/*
+ * Predicted handshake pause (ns) if the world were stopped now 
+ */ 
+  NO_CARAT
+static uint64_t _carat_migration_predict(carat_migration *migration, uint64_t *dirty_bytes)
+{
+  uint64_t bytes = 0;
+  for (uint64_t i = 0; i < migration->num_moves; i++) {
+    if (migration->dirty[i]) { bytes += migration->moves[i].size; }
+  }
+
+  *dirty_bytes = bytes;
+  return (migration->num_moves * carat_migration_ns_per_move) + _carat_migration_bytes_cost(migration, bytes);
+}
+
+
+/*
+ * Seeds the per-move cost before the first migration, which would otherwise
+ * be predicted to be free --- stops the world and does what every handshake
+ * does regardless of the objects (drain the escape window, scan every stack,
+ * here without patching anything), charging it to the @num_moves of this 
+ * migration. Returns -1 if the world could not be stopped
+ */ 
+  NO_CARAT
+static int _carat_migration_seed(nk_carat_context *the_context, void *saved_registers, uint64_t num_moves)
+{
+  uint64_t start = nk_sched_get_realtime();
+  if (!(CARAT_STOP_WORLD(the_context))) { return -1; }
+
+  CARAT_READY_OFF(the_context);
+
+  _carat_cleanup(the_context);
+
+  struct carat_thread_scan scan;
+  carat_mover_frame = saved_registers;
+  int status = _carat_patch_threads(the_context, &scan, NULL, 0);
+  if (scan.threads) { free(scan.threads); }
+  if (scan.stack_bounds) { free(scan.stack_bounds); }
+
+  CARAT_READY_ON(the_context);
+  CARAT_START_WORLD(the_context);
+
+  if (status) { return -1; }
+
+  uint64_t per_move = (nk_sched_get_realtime() - start) / num_moves;
+  carat_migration_ns_per_move = (per_move) ? per_move : 1;
+  carat_migration_seeded = 1;
+
+  return 0;
+}
+
+
+/*
+ * Unpublishing --- the range goes first, so the barrier's inline check 
+ * stops matching, then the migration itself. Freeing must wait for 
+ * barriers that loaded the migration before it was unpublished, and so
+ * must happen with the world running
+ */ 
+  NO_CARAT
+static void _carat_migration_unpublish(nk_carat_context *the_context)
+{
+  the_context->migration_start = the_context->migration_end = NULL;
+  __sync_synchronize();
+  the_context->migration = NULL;
+  __sync_synchronize();
+}
+
+
+  NO_CARAT
+static void _carat_migration_destroy(nk_carat_context *the_context, carat_migration *migration)
+{
+  while (the_context->migration_barrier_users) { nk_yield(); }
+
+  free(migration->moves);
+  free((void *) migration->dirty);
+  free(migration);
+}
+
+
+  NO_CARAT
+static int _carat_mover_move_allocations_concurrent(
+    void *saved_registers,
+    nk_carat_context *the_context,
+    void **allocations_to_move, 
+    void **allocation_targets, 
+    uint64_t num_moves
+    ) 
+{
+  if (!num_moves) { return 0; }
+
+  /*
+   * One migration at a time --- claim the slot (the barrier does not look
+   * at it until the range is published)
+   */ 
+  if (!__sync_bool_compare_and_swap(&(the_context->migration), NULL, (struct carat_migration_t *) 1)) 
+  {
+    CARAT_PRINT("nk_carat_move_allocations_concurrent: a migration is already in flight\n");
+    return -1;
+  }
+
+  carat_migration *migration = (carat_migration *) CARAT_MALLOC(sizeof(carat_migration));
+  migration->moves = (struct carat_move *) CARAT_MALLOC(num_moves * sizeof(struct carat_move));
+  migration->dirty = (volatile uint8_t *) CARAT_MALLOC(num_moves * sizeof(uint8_t));
+  migration->num_moves = num_moves;
+  migration->bytes = migration->num_dropped = 0;
+
+
+  /*
+   * 1. Build the plan --- the same lookups the guards do while the world 
+   * runs, serialized against escape window drains. Only the source and 
+   * size are needed here, the escapes are picked up at the handshake
+   */ 
+  CARAT_MAP_LOCK_CONF;
+  CARAT_MAP_LOCK(the_context);
+
+  for (uint64_t i = 0; i < num_moves; i++)
+  {
+    allocation_entry *entry = _carat_find_allocation_entry(the_context, allocations_to_move[i]);
+    if (!entry || (entry->pointer != allocations_to_move[i])) 
+    {
+      CARAT_MAP_UNLOCK(the_context);
+      CARAT_PRINT("nk_carat_move_allocations_concurrent: Cannot find entry for %p!\n", allocations_to_move[i]);
+      goto out_bad;
+    }
+
+    migration->moves[i].allocation_to_move = entry->pointer;
+    migration->moves[i].allocation_target = allocation_targets[i];
+    migration->moves[i].size = entry->size;
+    migration->moves[i].escapes_set = migration->moves[i].contained_escapes = NULL;
+    migration->dirty[i] = 1;
+    migration->bytes += entry->size;
+  }
+
+  CARAT_MAP_UNLOCK(the_context);
+
+  _carat_sort_moves(migration->moves, num_moves);
+
+
+  /*
+   * Sources are live while they are copied, so no target may overlap any
+   * source (unlike a stop-the-world batch, which can slide a region down)
+   */ 
+  for (uint64_t i = 0; i < num_moves; i++)
+  {
+    struct carat_move *move = &(migration->moves[i]);
+
+    if ((i + 1 < num_moves) && ((move->allocation_to_move + move->size) > migration->moves[i + 1].allocation_to_move))
+    {
+      CARAT_PRINT("nk_carat_move_allocations_concurrent: Overlapping sources %p, %p\n", move->allocation_to_move, migration->moves[i + 1].allocation_to_move);
+      goto out_bad;
+    }
+
+    sint64_t last = ((sint64_t) _carat_count_moves_before(migration->moves, num_moves, move->allocation_target + move->size - 1)) - 1;
+    if ((last >= 0) && ((migration->moves[last].allocation_to_move + migration->moves[last].size) > move->allocation_target))
+    {
+      CARAT_PRINT("nk_carat_move_allocations_concurrent: Target %p overlaps source %p\n", move->allocation_target, migration->moves[last].allocation_to_move);
+      goto out_bad;
+    }
+  }
+
+
+  if (!carat_migration_seeded && _carat_migration_seed(the_context, saved_registers, num_moves)) 
+  {
+    CARAT_PRINT("nk_carat_move_allocations_concurrent: could not seed the cost model\n");
+    goto out_bad;
+  }
+
+
+  /*
+   * 2. Publish --- from here on, guarded writes to the sources dirty them
+   */ 
+  the_context->migration = migration;
+  __sync_synchronize();
+  the_context->migration_start = migration->moves[0].allocation_to_move;
+  the_context->migration_end = migration->moves[num_moves - 1].allocation_to_move + migration->moves[num_moves - 1].size;
+  __sync_synchronize();
+
+
+  /*
+   * 3. Copy with the world running, until what is left to re-copy at the
+   * handshake fits in the pause budget (or we give up trying)
+   */ 
+  uint64_t dirty_bytes = 0;
+  uint64_t predicted = 0;
+  for (int round = 0; round < CARAT_MIGRATION_PRECOPY_ROUNDS; round++)
+  {
+    uint64_t copied = _carat_migration_precopy(migration);
+    if (CARAT_DO_PROFILE && start_carat_profiles) { CARAT_PROFILE_CPU->migration_precopied_bytes += copied; }
+
+    predicted = _carat_migration_predict(migration, &dirty_bytes);
+    if (predicted <= the_context->migration_pause_budget) { break; }
+  }
+
+  if (predicted > the_context->migration_pause_budget) 
+  {
+    CARAT_PRINT("nk_carat_move_allocations_concurrent: %lu dirty bytes would need a %lu ns pause\n", dirty_bytes, predicted);
+    _carat_migration_unpublish(the_context);
+    goto out_abort;
+  }
+
+
+  /*
+   * 4. The handshake --- the scheduler cannot pause only the threads that
+   * touch the moving objects, so this is a (short) stop of every thread
+   * in the context's aspace (of the world, for the kernel's)
+   */ 
+  uint64_t pause_start = nk_sched_get_realtime();
+  if (!(CARAT_STOP_WORLD(the_context))) 
+  {
+    CARAT_PRINT("CARAT: nk_sched_stop_world failed\n");
+    _carat_migration_unpublish(the_context);
+    goto out_abort;
+  }
+
+  CARAT_READY_OFF(the_context);
+
 
   /*
-   * Turn everything back on
+   * Writes may have happened since the prediction, so check again now 
+   * that nothing else can
    */ 
-  CARAT_READY_ON(the_context);
-  nk_sched_start_world();
-
-
-  CARAT_PRINT("CARAT: Moves succeeded.\n");
-  return 0;
+  predicted = _carat_migration_predict(migration, &dirty_bytes);
+  if (predicted > the_context->migration_pause_budget) 
+  {
+    _carat_migration_unpublish(the_context);
+    CARAT_READY_ON(the_context);
+    CARAT_START_WORLD(the_context);
+    goto out_abort;
+  }
 
+  carat_mover_frame = saved_registers;
+  int move_status = _carat_move_allocations_internal(the_context, allocations_to_move, allocation_targets, num_moves, migration);
 
-out_bad:
-  CARAT_PRINT("nk_carat_move_allocations: failed to move");
+  _carat_migration_unpublish(the_context);
   CARAT_READY_ON(the_context);
-  nk_sched_start_world();
-  return -1;
-}
+  CARAT_START_WORLD(the_context);
 
-  NO_CARAT
-static void _carat_patch_curr_stack(void *state) 
-{
-  /*
-   * Cast to struct move_context
-   */ 
-  struct move_context *context = (struct move_context*) state;
-  uint64_t *rsp_end = (uint64_t *) _carat_get_rsp();
-  // uint64_t *stack_start = t->stack;
-  // nk_stack_size_t stack_size = t->stack_size;
-  // uint64_t *stack_end = stack_start + stack_size;
+  uint64_t pause = nk_sched_get_realtime() - pause_start;
 
-  // nk_vc_printf("Stack Size: %lu \n", stack_size);
-  // nk_vc_printf("Stack Start: %p \n", (void *) stack_start);
-  // nk_vc_printf("Stack End: %p \n", (void *) stack_end);
-  // nk_vc_printf("rsp: %p \n", (void *) t->rsp);
 
   /*
-   * Loop through every address in the stack
+   * Learn the handshake overhead, and account for the pause
    */ 
-  for (uint64_t *stack_addr = rsp_end; stack_addr < rsp_start; stack_addr += 8) {
-    /*
-     * Determine if the value stored in the stack location 
-     * aliases @allocation_to_move --- if it does, then
-     * "patch" the value to use @allocation_target at the
-     * correct offset
-     */ 
-    uint64_t offset = _carat_get_query_offset((void*) *stack_addr, context->allocation_to_move, context->size);
-    if (offset != -1) {
-      *stack_addr = (((uint64_t) context->allocation_target) + offset);
-    }
-  }
-}
+  uint64_t bytes_estimate = _carat_migration_bytes_cost(migration, dirty_bytes);
+  CARAT_MIGRATION_LEARN(carat_migration_ns_per_move, ((pause > bytes_estimate) ? (pause - bytes_estimate) : 0) / num_moves);
 
-NO_CARAT
-int _pretend_to_patch_stack_regs_for_region(
-    void *allocation_to_move,
-    void *allocation_target,
-    uint64_t entry_size
-    ) { 
-
-  //Patch all registers and stack
-  // CARAT_PRINT("PATCH: 4. patching registers and stack \n");
+  if (CARAT_DO_PROFILE && start_carat_profiles) 
+  {
+    carat_profile *profile = CARAT_PROFILE_CPU;
+    profile->concurrent_migrations++;
+    profile->migration_pause_time += pause;
+    if (pause > profile->migration_pause_max) { profile->migration_pause_max = pause; }
+    if (pause > the_context->migration_pause_budget) { profile->migration_pause_overruns++; }
+  }
 
+  _carat_migration_destroy(the_context, migration);
 
-  // CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
-  struct move_context package = { allocation_to_move, allocation_target, entry_size, 0 };
-  nk_sched_map_threads(-1, _carat_patch_thread_registers, &package);
-  if (package.failed) 
+  if (move_status) 
   {
-    CARAT_PRINT("PATCH: Unable to patch threads\n");
+    CARAT_PRINT("nk_carat_move_allocations_concurrent: handshake failed to move\n");
     return -1;
   }
 
-  _carat_patch_curr_stack(&package);
-  //CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, patch_stack_regs_time, 0);
-
+  CARAT_PRINT("CARAT: Concurrent moves succeeded, paused for %lu ns.\n", pause);
   return 0;
 
+
+out_abort:
+  if (CARAT_DO_PROFILE && start_carat_profiles) { CARAT_PROFILE_CPU->concurrent_migration_aborts++; }
+  _carat_migration_destroy(the_context, migration);
+  return -1;
+
+out_bad:
+  free(migration->moves);
+  free((void *) migration->dirty);
+  free(migration);
+  the_context->migration = NULL;
+  return -1;
+}
+
+
+  NO_CARAT
+int nk_carat_move_allocations_concurrent(
+    nk_carat_context *the_context,
+    void **allocations_to_move, 
+    void **allocation_targets, 
+    uint64_t num_moves
+    ) 
+{
+  return (int) CARAT_CALL_MOVER(_carat_mover_move_allocations_concurrent, the_context, allocations_to_move, allocation_targets, num_moves, 0, 0);
 }
 
+
   NO_CARAT
-int nk_carat_move_region(
+static int _carat_mover_move_region(
+    void *saved_registers,
     nk_carat_context *the_context,
     void *region_start, 
     void *new_region_start, 
@@ -680,85 +1408,84 @@ int nk_carat_move_region(
    */ 
   CARAT_PRINT("CARAT: move_region (%p,%lu) -> %p\n", region_start, region_length, new_region_start);
 
-  /*
-   * create an array to hold all the addresses we want to move and their destinations
-   * Note - this will most likely end up being larger than it needs to be, as we only want 
-   * to move a subset of the allocations in the map, but this conservative solution will work
-   */
-  uint64_t size_of_map = CARAT_ALLOCATION_MAP_SIZE(the_context);
-  void *old_addresses[size_of_map];
-  void *new_addresses[size_of_map];
-  uint64_t old_lengths[size_of_map];
-
   /*
    * Pauses all execution so we can perform a series of move
    */
-  if (!(nk_sched_stop_world())) 
+  if (!(CARAT_STOP_WORLD(the_context))) 
   {
     nk_vc_printf("CARAT: nk_sched_stop_world failed\n");
-    goto out_bad;
+    return -1;
   }
 
   CARAT_READY_OFF(the_context);
 
 
   /*
-   * Iterate through the allocation map, searching for allocations within the region
+   * Build the move plan from the allocations within the region only ---
+   * one range pass to size it, one to fill it. The plan lives on the 
+   * heap, so large regions cannot overflow the stack
    */ 
-
-  void *current_destination = new_region_start;
   uint64_t count = 0;
-  uint64_t first_size; // hack
-  CARAT_ALLOCATION_MAP_ITERATE(the_context) 
-  {  
-    /*
-     * Fetch [key : val]
-     */ 
-    allocation_entry *the_entry = FETCH_ALLOCATION_ENTRY_FROM_ITERATOR;
-    void *the_address = the_entry->pointer;
+  {
+    CARAT_ALLOCATION_MAP_ITERATE_RANGE(the_context, region_start, region_length) { count++; }
+  }
 
+  void **old_addresses = (void **) CARAT_MALLOC(((2 * count) + 1) * sizeof(void *));
+  void **new_addresses = old_addresses + count;
 
-    /*
-     * If the current allocation is within the old region, 
-     * move it to the next available spot in the new region  
-     */ 
-    if (true
-        && (the_address >= region_start) 
-        && (the_address < (region_start + region_length))) 
-    {
-      old_addresses[count] = the_address;
-      new_addresses[count] = current_destination;
+  void *current_destination = new_region_start;
+  uint64_t planned = 0;
+  {
+    CARAT_ALLOCATION_MAP_ITERATE_RANGE(the_context, region_start, region_length) 
+    {  
+      /*
+       * Move each allocation to the next available spot in the new region  
+       */ 
+      allocation_entry *the_entry = FETCH_ALLOCATION_ENTRY_FROM_ITERATOR;
 
-      current_destination += the_entry->size;
-      if(count == 0) { // hack
-        first_size = the_entry->size;
-      }
-      count++;
+      old_addresses[planned] = the_entry->pointer;
+      new_addresses[planned] = current_destination;
 
+      current_destination += the_entry->size;
+      planned++;
     }
   }
 
-  _pretend_to_patch_stack_regs_for_region(old_addresses[0], old_addresses[0], first_size);
+  /*
+   * Concurrent migration can only be used if the regions are disjoint, 
+   * as the sources stay live while they are copied
+   */ 
+  if (true
+      && (the_context->migration_mode == CARAT_MIGRATION_CONCURRENT)
+      && (((new_region_start + region_length) <= region_start) || (new_region_start >= (region_start + region_length))))
+  {
+    CARAT_READY_ON(the_context);
+    CARAT_START_WORLD(the_context);
+
+    int failed = _carat_mover_move_allocations_concurrent(saved_registers, the_context, old_addresses, new_addresses, count);
+    free(old_addresses);
 
-  _carat_move_allocations(the_context, old_addresses, new_addresses, count);
+    if (failed) 
+    {
+      nk_vc_printf("nk_carat_move_region: failed to move\n");
+      return -1;
+    }
 
+    *free_start = current_destination;
+    return 0;
+  }
 
+  carat_mover_frame = saved_registers;
+  if (_carat_move_allocations(the_context, old_addresses, new_addresses, count)) { goto out_bad; }
 
-  // void *current_destination = new_region_start;
-  // for (uint64_t i = 0; i < count; i++) {
-  //     if (_move_allocation(the_context, old_addresses[i], current_destination)) {
-  //         goto out_bad;
-  //     };
-  //     //free(old_addresses[i]); TODO maybe do this
-  //     current_destination += old_lengths[i];
-  // }
+  free(old_addresses);
 
 
   /*
    * We did the damn thing, turn everything on
    */ 
   CARAT_READY_ON(the_context);
-  nk_sched_start_world();
+  CARAT_START_WORLD(the_context);
   CARAT_PRINT("CARAT: Region move succeeded.\n");
 
 
@@ -771,32 +1498,39 @@ int nk_carat_move_region(
 
 
 out_bad:
+  free(old_addresses);
   CARAT_READY_ON(the_context);
-  nk_sched_start_world();
+  CARAT_START_WORLD(the_context);
   nk_vc_printf("nk_carat_move_region: failed to move\n");
   return -1;
 }
 
+
   NO_CARAT
-int nk_carat_defrag_allocation_table(nk_carat_context *the_context) 
+int nk_carat_move_region(
+    nk_carat_context *the_context,
+    void *region_start, 
+    void *new_region_start, 
+    uint64_t region_length, 
+    void **free_start
+    ) 
+{ 
+  return (int) CARAT_CALL_MOVER(_carat_mover_move_region, the_context, region_start, new_region_start, region_length, free_start, 0);
+}
+
+
+  NO_CARAT
+static int _carat_mover_defrag_allocation_table(void *saved_registers, nk_carat_context *the_context) 
 { 
   /*
    * Debugging
    */ 
   CARAT_PRINT("CARAT: defrag_allocation_table\n");
 
-  /*
-   * create an array to hold all the addresses we want to move
-   */
-  uint64_t size_of_map = CARAT_ALLOCATION_MAP_SIZE(the_context);
-  void* old_addresses[size_of_map];
-  uint64_t old_lengths[size_of_map];
-
-
   /*
    * Pauses all execution so we can perform a series of moves
    */
-  if (!(nk_sched_stop_world())) 
+  if (!(CARAT_STOP_WORLD(the_context))) 
   {
     CARAT_PRINT("CARAT: nk_sched_stop_world failed\n");
     goto out_bad;
@@ -805,6 +1539,15 @@ int nk_carat_defrag_allocation_table(nk_carat_context *the_context)
   CARAT_READY_OFF(the_context);
 
 
+  /*
+   * The plan (every allocation) lives on the heap --- the map is 
+   * stable with the world stopped, so its size is exact
+   */
+  uint64_t size_of_map = CARAT_ALLOCATION_MAP_SIZE(the_context);
+  void **old_addresses = (void **) CARAT_MALLOC((size_of_map + 1) * sizeof(void *));
+  uint64_t *old_lengths = (uint64_t *) CARAT_MALLOC((size_of_map + 1) * sizeof(uint64_t));
+
+
   /*
    * Iterate through the allocation map, searching for all allocations 
    */ 
@@ -822,18 +1565,44 @@ int nk_carat_defrag_allocation_table(nk_carat_context *the_context)
     count++;
   }
 
-  for (uint64_t i = 0; i < size_of_map; i++) {
+  /*
+   * Move in batches --- each batch drains and patches once, and the 
+   * batch size bounds how much memory is held twice at any point
+   */ 
+  void *new_locations[CARAT_DEFRAG_BATCH];
+  carat_mover_frame = saved_registers;
+  for (uint64_t first = 0; first < count; first += CARAT_DEFRAG_BATCH) 
+  {
+    uint64_t batch = ((count - first) < CARAT_DEFRAG_BATCH) ? (count - first) : CARAT_DEFRAG_BATCH;
+
     // NOTE - CARAT is off
-    void* new_location = malloc(old_lengths[i]);
-    _move_allocation(the_context, old_addresses[i], new_location);
-    free(old_addresses[i]);
+    for (uint64_t i = 0; i < batch; i++) {
+      new_locations[i] = malloc(old_lengths[first + i]);
+    }
+
+    if (_carat_move_allocations(the_context, &(old_addresses[first]), new_locations, batch))
+    {
+      for (uint64_t i = 0; i < batch; i++) { free(new_locations[i]); }
+      free(old_addresses);
+      free(old_lengths);
+      CARAT_READY_ON(the_context);
+      CARAT_START_WORLD(the_context);
+      goto out_bad;
+    }
+
+    for (uint64_t i = 0; i < batch; i++) {
+      free(old_addresses[first + i]);
+    }
   }
 
+  free(old_addresses);
+  free(old_lengths);
+
   /*
    * We did the damn thing, turn everything on
    */ 
   CARAT_READY_ON(the_context);
-  nk_sched_start_world();
+  CARAT_START_WORLD(the_context);
   CARAT_PRINT("CARAT: Region move succeeded.\n");
 
   return 0;
@@ -845,6 +1614,274 @@ out_bad:
 }
 
 
+  NO_CARAT
+int nk_carat_defrag_allocation_table(nk_carat_context *the_context) 
+{ 
+  return (int) CARAT_CALL_MOVER(_carat_mover_defrag_allocation_table, the_context, 0, 0, 0, 0, 0);
+}
+
+
+  NO_CARAT
+static int _carat_mover_relocate_slice(
+    void *saved_registers,
+    nk_carat_context *the_context,
+    carat_relocation *relocations,
+    uint64_t num_relocations,
+    uint64_t max_moves,
+    uint64_t *moved,
+    uint64_t *moved_bytes
+    )
+{
+  void *sources[CARAT_DEFRAG_BATCH];
+  void *targets[CARAT_DEFRAG_BATCH];
+
+  if (max_moves > CARAT_DEFRAG_BATCH) { max_moves = CARAT_DEFRAG_BATCH; }
+
+  *moved = *moved_bytes = 0;
+
+
+  /*
+   * Relocations were planned while the world was running --- look
+   * at most a few times as many as we may move, so skipping stale
+   * ones does not stretch the pause
+   */
+  uint64_t max_consumed = max_moves * 4;
+  if (max_consumed > num_relocations) { max_consumed = num_relocations; }
+
+  if (!(CARAT_STOP_WORLD(the_context))) 
+  {
+    CARAT_PRINT("CARAT: nk_sched_stop_world failed\n");
+    return -1;
+  }
+
+  CARAT_READY_OFF(the_context);
+
+
+  uint64_t consumed = 0, count = 0;
+  while ((consumed < max_consumed) && (count < max_moves))
+  {
+    carat_relocation *relocation = &(relocations[consumed++]);
+
+
+    /*
+     * Still tracked as the same allocation, not a thread stack, and a
+     * whole kmem block (otherwise the kernel cannot reallocate it)
+     */
+    allocation_entry *the_entry = CARAT_ALLOCATION_MAP_BETTER_LOWER_BOUND(the_context, relocation->address);
+    if (!the_entry || (the_entry->pointer != relocation->address) || (the_entry->size != relocation->size)) { continue; }
+    if (the_entry->is_stack) { continue; }
+
+    void *block;
+    uint64_t block_size, flags;
+    if (kmem_find_block(relocation->address, &block, &block_size, &flags) || (block != relocation->address)) { continue; }
+
+    void *target = kmem_sys_malloc_restrict(relocation->size, (addr_t) relocation->target_start, (addr_t) relocation->target_end);
+    if (!target) { continue; }
+
+    sources[count] = relocation->address;
+    targets[count] = target;
+    *moved_bytes += relocation->size;
+    count++;
+  }
+
+
+  if (count)
+  {
+    carat_mover_frame = saved_registers;
+    if (_carat_move_allocations(the_context, sources, targets, count)) 
+    {
+      for (uint64_t i = 0; i < count; i++) { kmem_sys_free(targets[i]); }
+      CARAT_READY_ON(the_context);
+      CARAT_START_WORLD(the_context);
+      *moved_bytes = 0;
+      return -1;
+    }
+
+    for (uint64_t i = 0; i < count; i++) { free(sources[i]); }
+  }
+
+  *moved = count;
+
+  CARAT_READY_ON(the_context);
+  CARAT_START_WORLD(the_context);
+
+  return consumed;
+}
+
+
+  NO_CARAT
+int nk_carat_relocate_slice(
+    nk_carat_context *the_context,
+    carat_relocation *relocations,
+    uint64_t num_relocations,
+    uint64_t max_moves,
+    uint64_t *moved,
+    uint64_t *moved_bytes
+    )
+{
+  return (int) CARAT_CALL_MOVER(_carat_mover_relocate_slice, the_context, relocations, num_relocations, max_moves, moved, moved_bytes);
+}
+
+
+/*
+ * Stack growth --- room left below the new frame, for the guard itself
+ * and for interrupts taken on the stack
+ */ 
+#define CARAT_STACK_GROWTH_SLACK 4096
+
+/*
+ * State handed from _carat_grow_stack to _carat_grow_stack_done --- 
+ * only one stop can be in progress, so one copy suffices
+ */ 
+static nk_carat_context *carat_grown_context;
+static void *carat_grown_stack;
+
+
+  NO_CARAT_NO_INLINE
+uint64_t _carat_grow_stack(uint64_t stack_frame_size, void *saved_registers)
+{
+  nk_thread_t *thread = FETCH_THREAD;
+
+
+  /*
+   * Stopping the world needs a thread that can take part in someone
+   * else's stop while it waits for its own
+   */ 
+  if (!karat_ready || in_interrupt_context() || !irqs_enabled()) { return 0; }
+
+  nk_carat_context *the_context = FETCH_CARAT_CONTEXT;
+  if (!(the_context->carat_ready)) { return 0; }
+
+
+  /*
+   * Double until the frame fits, and place the old contents at the top
+   * of the new block --- the stack grows down, so everything above 
+   * %rsp keeps its distance from the top
+   */ 
+  void *old_stack = thread->stack;
+  uint64_t old_size = thread->stack_size;
+  uint64_t used = (((uint64_t) old_stack) + old_size) - ((uint64_t) saved_registers);
+  uint64_t new_size = old_size;
+  while ((new_size - used) < (stack_frame_size + CARAT_STACK_GROWTH_SLACK)) { new_size *= 2; }
+
+  void *new_stack = malloc(new_size);
+  if (!new_stack) { return 0; }
+
+  void *target = new_stack + (new_size - old_size);
+  uint64_t delta = ((uint64_t) target) - ((uint64_t) old_stack);
+  if (delta & 0xf) 
+  {
+    free(new_stack);
+    return 0;
+  }
+
+
+  if (!(CARAT_STOP_WORLD(the_context))) 
+  {
+    free(new_stack);
+    return 0;
+  }
+
+  CARAT_READY_OFF(the_context);
+
+
+  /*
+   * Only stacks tracked as stacks are grown --- those nk_thread_create
+   * allocated (see nk_carat_track_thread_stack) and those we grew, whose
+   * escapes have all been recorded, so the old block can be freed once 
+   * the thread is off it. Stacks carved out of something else, such as
+   * the giga_blob under the main thread of a process, are left alone
+   */ 
+  allocation_entry *entry = _carat_find_allocation_entry(the_context, old_stack);
+  if (!entry || !(entry->is_stack) || (entry->pointer != old_stack) || (entry->size != old_size)) 
+  {
+    CARAT_PRINT("CARAT: stack %p of thread %lu is not tracked as a stack\n", old_stack, thread->tid);
+    goto out_bad;
+  }
+
+
+  /*
+   * Everything from the saved registers up is patched along with the 
+   * stack --- the runtime's frames below them are left alone, and are
+   * abandoned when the trampoline switches stacks
+   */ 
+  carat_mover_frame = saved_registers;
+  if (_carat_move_allocations(the_context, &old_stack, &target, 1)) { goto out_bad; }
+
+
+  /*
+   * The entry now covers the old contents at @target --- widen it to the
+   * whole block, rebasing the offsets of the escapes it contains. Work 
+   * on a copy, since the map may store entries by value and the remove
+   * and insert below relocate them
+   */ 
+  allocation_entry *moved = _carat_find_allocation_entry(the_context, target);
+  if (!moved || (moved->pointer != target)) 
+  {
+    panic("_carat_grow_stack: lost the entry for the stack at %p\n", target);
+  }
+
+  allocation_entry grown = *moved;
+  REMOVE_ENTRY(the_context, target, "_carat_grow_stack: REMOVE_ENTRY failed on");
+
+  if (grown.contained_escapes)
+  {
+    nk_carat_escape_set *rebased = CARAT_ESCAPE_SET_BUILD(the_context);
+    CARAT_ESCAPE_SET_SETUP(rebased);
+
+    CARAT_ESCAPES_SET_ITERATE((grown.contained_escapes))
+    {
+      uint64_t offset = ((uint64_t) FETCH_ESCAPE_FROM_ITERATOR); /* HACK */
+      CARAT_ESCAPE_SET_ADD(the_context, rebased, ((void **) (offset + (new_size - old_size))));
+    }
+
+    CARAT_ESCAPE_SET_DESTROY(the_context, grown.contained_escapes);
+    grown.contained_escapes = rebased;
+  }
+
+  grown.pointer = new_stack;
+  grown.size = new_size;
+  grown.is_stack = 1;
+  CARAT_ALLOCATION_MAP_INSERT(the_context, &grown);
+
+
+  thread->stack = new_stack;
+  thread->stack_size = new_size;
+
+  CARAT_PROFILE_INCR(CARAT_DO_PROFILE, stack_growths);
+  CARAT_PRINT("CARAT: grew stack of thread %lu from (%p, %lu) to (%p, %lu)\n", thread->tid, old_stack, old_size, new_stack, new_size);
+
+
+  /*
+   * The world stays stopped until the trampoline is off the old stack
+   */ 
+  carat_grown_context = the_context;
+  carat_grown_stack = old_stack;
+
+  return delta;
+
+
+out_bad:
+  CARAT_READY_ON(the_context);
+  CARAT_START_WORLD(the_context);
+  free(new_stack);
+  return 0;
+}
+
+
+  NO_CARAT_NO_INLINE
+void _carat_grow_stack_done(void)
+{
+  nk_carat_context *the_context = carat_grown_context;
+  void *old_stack = carat_grown_stack;
+
+  CARAT_READY_ON(the_context);
+  CARAT_START_WORLD(the_context);
+
+  free(old_stack);
+}
+
+
 
 /* ---------- ALLOCATION MAP DEBUGGING ---------- */
 
@@ -863,16 +1900,21 @@ static void _print_table(nk_carat_context *the_context)
   /*
    * Loop through @the_context's allocation map
    */ 
+  uint64_t escape_set_bytes = 0;
   CARAT_ALLOCATION_MAP_ITERATE(the_context)
   {        
     allocation_entry *the_entry = FETCH_ALLOCATION_ENTRY_FROM_ITERATOR;
     uint64_t num_escapes = 0;
     if (the_entry->escapes_set != NULL) {
       num_escapes = CARAT_ESCAPE_SET_SIZE(the_entry->escapes_set);
+      escape_set_bytes += carat_escape_set_bytes(the_entry->escapes_set);
+    }
+    if (the_entry->contained_escapes != NULL) {
+      escape_set_bytes += carat_escape_set_bytes(the_entry->contained_escapes);
     }
     nk_vc_printf(
         "%p : (%p : %p --- (ptr: %p, len: %lu), es : %d)\n", 
-        iterator, 
+        (void *) the_entry, 
         the_entry->pointer, 
         the_entry, 
         the_entry->pointer, 
@@ -886,6 +1928,11 @@ static void _print_table(nk_carat_context *the_context)
       FETCH_TOTAL_ESCAPES(the_context)
       );
 
+  nk_vc_printf(
+      "Bytes held by escape sets: %lu\n", 
+      escape_set_bytes
+      );
+
 
   return;
 }
@@ -1323,11 +2370,16 @@ static int handle_get_pointer_density(char *buf, void *priv)
   uint64_t totalAllocations = 0;
   nk_carat_context *the_context = FETCH_CARAT_CONTEXT;
   CARAT_READY_OFF(the_context);
-  _carat_cleanup(the_context); 
 //BRIAN RETURN HERE	
-      if (!(nk_sched_stop_world())){
+      if (!(CARAT_STOP_WORLD(the_context))){
+      	CARAT_READY_ON(the_context);
       	return -1;	
       } 
+
+  /*
+   * Merging the per-CPU escape buffers requires the world to be stopped
+   */
+  _carat_cleanup(the_context); 
  
       CARAT_ALLOCATION_MAP_ITERATE(the_context)
   {        
@@ -1368,7 +2420,7 @@ CARAT_ESCAPES_SET_ITERATE((the_entry->escapes_set))
     }
   } 
       
-      nk_sched_start_world();
+      CARAT_START_WORLD(the_context);
 	
       nk_vc_printf("Density Info:\nAllocs: %lu\n Allocs Bytes: %lu\n Escapes: %lu\n Ratio: %ld\n", escapes, totalAllocations, totalAllocationSize, ((double)totalAllocationSize/(double)escapes));
 
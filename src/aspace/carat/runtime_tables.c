@@ -27,6 +27,12 @@
  */
 
 #include <aspace/runtime_tables.h>
+#include <nautilus/fs.h>
+#include <aspace/compaction.h>
+#include <aspace/numa_placement.h>
+#include <aspace/sampling.h>
+#include <aspace/hot_cold.h>
+#include <aspace/patching.h>
 
 
 
@@ -44,27 +50,14 @@
 uint64_t num_mi = 0;
 uint64_t total_mi_time = 0;
 
-carat_profile global_carat_profile  = {
-    
-    .num_rb_mallocs = 0,
-    .num_rb_frees = 0,
-    .rb_malloc_time = 0,
-    .rb_free_time = 0,
-    .guard_address_calls = 0,
-    .guard_address_time = 0,
-    .guard_stack_calls = 0,
-    .guard_stack_time = 0,
-    .move_calls = 0,
-    .cleanup_time = 0,
-    .find_entry_time = 0,
-    .patch_escapes_time = 0,
-    .patch_stack_regs_time = 0,
-    .update_entry_time = 0,
-    .memmove_time = 0,
-    .reinstrument_contained_time = 0,
-    .process_window_2_time = 0
-
-} ;
+/*
+ * Zeroed at boot --- see carat.h
+ */
+carat_profile global_carat_profile[NAUT_CONFIG_MAX_CPUS];
+
+carat_profile_histograms global_carat_histograms[NAUT_CONFIG_MAX_CPUS];
+
+carat_escape_profile global_carat_escape_profile[NAUT_CONFIG_MAX_CPUS];
 
 int start_carat_profiles = 0;
 
@@ -85,6 +78,12 @@ int karat_ready = 0;
 void *non_canonical = ((void *) 0x22DEADBEEF22);
 
 
+/*
+ * Escape window merging, for every context --- set with carat_drain_mode
+ */ 
+int carat_escape_drain_mode = CARAT_ESCAPE_DRAIN_SERIAL;
+
+
 /*
  * =================== Utility Analysis and Builder Methods ===================
  */ 
@@ -106,7 +105,9 @@ allocation_entry _carat_create_allocation_entry(void *address, uint64_t allocati
         .pointer = address,
         .size = allocation_size,
         .escapes_set = NULL,
-        .contained_escapes = NULL
+        .contained_escapes = NULL,
+        .heat = 0,
+        .is_stack = 0
     };
 
 
@@ -290,12 +291,17 @@ void nk_carat_instrument_global(void *address, uint64_t allocation_size, uint64_
 	/*
 	 * Create an entry and add the mapping to the allocation_map
 	 */ 
+    CARAT_MAP_LOCK_CONF;
+    CARAT_MAP_LOCK(the_context);
+
 	CREATE_ENTRY_AND_ADD (
         the_context,
 		address, 
 		allocation_size
 	);
 
+    CARAT_MAP_UNLOCK(the_context);
+
 
     /*
      * Turn on CARAT upon exit
@@ -309,6 +315,153 @@ void nk_carat_instrument_global(void *address, uint64_t allocation_size, uint64_
     return;
 }
 
+
+/*
+ * Heapsort for the bulk load (in place, by pointer)
+ */ 
+NO_CARAT
+static void _carat_sift_entries(allocation_entry *a, uint64_t root, uint64_t n)
+{
+    while (((2 * root) + 1) < n)
+    {
+        uint64_t child = (2 * root) + 1;
+        if (((child + 1) < n) && (a[child].pointer < a[child + 1].pointer)) { child++; }
+        if (!(a[root].pointer < a[child].pointer)) { return; }
+
+        allocation_entry tmp = a[root]; a[root] = a[child]; a[child] = tmp;
+        root = child;
+    }
+}
+
+NO_CARAT
+static void _carat_sort_entries(allocation_entry *a, uint64_t n)
+{
+    if (n < 2) { return; }
+    for (uint64_t i = n / 2; i-- > 0; ) { _carat_sift_entries(a, i, n); }
+    for (uint64_t end = n - 1; end > 0; end--)
+    {
+        allocation_entry tmp = a[0]; a[0] = a[end]; a[end] = tmp;
+        _carat_sift_entries(a, 0, end);
+    }
+}
+
+
+NO_CARAT_NO_INLINE
+void nk_carat_instrument_globals(carat_global_record *globals, uint64_t num_globals)
+{
+    /*
+     * TOP --- Bulk version of nk_carat_instrument_global --- one call
+     * for every global in the module, which are added to the allocation
+     * map with a single sorted build instead of one insert apiece
+     */ 
+
+    CARAT_PROFILE_INCR(CARAT_DO_PROFILE, tracking_calls);
+    CARAT_PROFILE_INIT_TIMING_VAR(0);
+    CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
+
+    
+    /*
+     * Fetch the current thread's carat context 
+     */
+    CHECK_CARAT_BOOTSTRAP_FLAG; 
+    nk_carat_context *the_context = FETCH_CARAT_CONTEXT;
+	CHECK_CARAT_READY(the_context);
+    CARAT_READY_OFF(the_context);
+
+
+    /*
+     * The map is only rebuilt if it is not much bigger than the table
+     * (startup allocations that were tracked before us) --- otherwise,
+     * the globals are inserted one at a time
+     */ 
+    uint64_t num_tracked = CARAT_ALLOCATION_MAP_SIZE(the_context);
+    uint64_t rebuild = (num_tracked <= num_globals);
+    uint64_t capacity = num_globals + ((rebuild) ? num_tracked : 0);
+    allocation_entry *entries = ((allocation_entry *) CARAT_MALLOC((capacity + 1) * sizeof(allocation_entry)));
+    uint64_t num_entries = 0;
+    int sorted = 1;
+
+
+    /*
+     * Addresses are only fixed at link time, so the compiler emits the
+     * table in module order --- usually, but not always, address order
+     */ 
+    for (uint64_t i = 0; i < num_globals; i++)
+    {
+        if (!(globals[i].size)) { continue; }
+
+        entries[num_entries] = _carat_create_allocation_entry(globals[i].address, globals[i].size);
+        if (num_entries && (entries[num_entries].pointer < entries[num_entries - 1].pointer)) { sorted = 0; }
+        num_entries++;
+    }
+
+    CARAT_MAP_LOCK_CONF;
+    CARAT_MAP_LOCK(the_context);
+
+    if (rebuild && num_tracked)
+    {
+        CARAT_ALLOCATION_MAP_ITERATE(the_context)
+        {
+            entries[num_entries++] = *(FETCH_ALLOCATION_ENTRY_FROM_ITERATOR);
+        }
+
+        sorted = 0;
+    }
+
+    if (!sorted) { _carat_sort_entries(entries, num_entries); }
+
+
+    /*
+     * Drop duplicates (a global may appear twice, or already be tracked
+     * --- keep the copy that has escapes recorded)
+     */ 
+    uint64_t num_unique = 0;
+    for (uint64_t i = 0; i < num_entries; i++)
+    {
+        if (num_unique && (entries[i].pointer == entries[num_unique - 1].pointer)) 
+        { 
+            if (entries[i].escapes_set || entries[i].contained_escapes) { entries[num_unique - 1] = entries[i]; }
+            continue; 
+        }
+
+        entries[num_unique++] = entries[i];
+    }
+
+
+    if (rebuild)
+    {
+        /*
+         * Entries are copied out with their escape sets, so rebuilding 
+         * the map keeps them
+         */ 
+        if (num_tracked)
+        {
+            CARAT_ALLOCATION_MAP_DESTROY(the_context->allocation_map);
+            the_context->allocation_map = CARAT_ALLOCATION_MAP_BUILD;
+            CARAT_ALLOCATION_MAP_SETUP(the_context->allocation_map);
+        }
+
+        CARAT_ALLOCATION_MAP_BULK_LOAD(the_context, entries, num_unique);
+    }
+    else
+    {
+        for (uint64_t i = 0; i < num_unique; i++) {
+            CARAT_ALLOCATION_MAP_INSERT(the_context, &(entries[i]));
+        }
+    }
+
+    CARAT_MAP_UNLOCK(the_context);
+
+    free(entries);
+
+
+    CARAT_READY_ON(the_context);
+    CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, tracking_call_time, 0);
+
+
+    return;
+}
+
 #if 0
 thread 1:
 malloc --- successful
@@ -363,12 +516,17 @@ void nk_carat_instrument_malloc(void *address, uint64_t allocation_size)
 	/*
 	 * Create an entry and add the mapping to the allocation_map
 	 */ 
+    CARAT_MAP_LOCK_CONF;
+    CARAT_MAP_LOCK(the_context);
+
 	CREATE_ENTRY_AND_ADD (
         the_context,
 		address, 
 		allocation_size
 	);
 
+    CARAT_MAP_UNLOCK(the_context);
+
 
     /*
      * Turn on CARAT upon exit
@@ -411,12 +569,17 @@ void nk_carat_instrument_calloc(void *address, uint64_t size_of_element, uint64_
 	 * are @num_elements, and @size_of_element
 	 */ 
 	uint64_t allocation_size = num_elements * size_of_element;
+    CARAT_MAP_LOCK_CONF;
+    CARAT_MAP_LOCK(the_context);
+
 	CREATE_ENTRY_AND_ADD (
         the_context,
 		address, 
 		allocation_size
 	);
 
+    CARAT_MAP_UNLOCK(the_context);
+
 
     CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, tracking_call_time, 0);
 
@@ -425,6 +588,25 @@ void nk_carat_instrument_calloc(void *address, uint64_t size_of_element, uint64_
 }
 
 
+/*
+ * Release the escape sets of the allocation at @address --- the
+ * allocation is about to leave the allocation map
+ */ 
+NO_CARAT
+static void _carat_release_escape_sets(nk_carat_context *the_context, void *address)
+{
+    allocation_entry *entry = CARAT_ALLOCATION_MAP_BETTER_LOWER_BOUND(the_context, address);
+    if (!entry || (entry->pointer != address)) { return; }
+
+    if (entry->escapes_set) { CARAT_ESCAPE_SET_DESTROY(the_context, entry->escapes_set); }
+    if (entry->contained_escapes) { CARAT_ESCAPE_SET_DESTROY(the_context, entry->contained_escapes); }
+    entry->escapes_set = entry->contained_escapes = NULL;
+
+
+    return;
+}
+
+
 NO_CARAT_NO_INLINE
 void nk_carat_instrument_realloc(void *new_address, uint64_t allocation_size, void *old_address)
 {
@@ -450,6 +632,10 @@ void nk_carat_instrument_realloc(void *new_address, uint64_t allocation_size, vo
 	 * Remove @old_address from the allocation map --- need to remove the 
 	 * corresponding allocation_entry object because of realloc's resizing
 	 */ 
+    CARAT_MAP_LOCK_CONF;
+    CARAT_MAP_LOCK(the_context);
+
+    _carat_release_escape_sets(the_context, old_address);
 	REMOVE_ENTRY (
         the_context,
 		old_address,
@@ -466,6 +652,8 @@ void nk_carat_instrument_realloc(void *new_address, uint64_t allocation_size, vo
 		allocation_size
 	);
 
+    CARAT_MAP_UNLOCK(the_context);
+
 	
     CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, tracking_call_time, 0);
 
@@ -511,11 +699,17 @@ void nk_carat_instrument_free(void *address)
 	DS("\n");
 #endif
 	
+    CARAT_MAP_LOCK_CONF;
+    CARAT_MAP_LOCK(the_context);
+
+    _carat_release_escape_sets(the_context, address);
 	REMOVE_ENTRY_SILENT (
     	the_context,
 		address
 	);
 
+    CARAT_MAP_UNLOCK(the_context);
+
 
     /*
      * Turn on CARAT upon exit
@@ -530,6 +724,78 @@ void nk_carat_instrument_free(void *address)
 }
 
 
+NO_CARAT_NO_INLINE
+void nk_carat_track_thread_stack(nk_thread_t *thread)
+{
+    CHECK_CARAT_BOOTSTRAP_FLAG;
+    if (!(thread->aspace) || !(thread->stack)) { return; }
+
+    nk_carat_context *the_context = ((nk_aspace_carat_t *) thread->aspace->state)->context;
+    CHECK_CARAT_READY(the_context);
+    CARAT_READY_OFF(the_context);
+
+    CARAT_MAP_LOCK_CONF;
+    CARAT_MAP_LOCK(the_context);
+
+
+    /*
+     * A reanimated thread brings its (still tracked) stack along, and an
+     * instrumented allocation of the stack is already tracked --- either
+     * way, escapes recorded before now belong to an earlier life
+     */
+    allocation_entry *entry = CARAT_ALLOCATION_MAP_BETTER_LOWER_BOUND(the_context, thread->stack);
+    if (entry && (entry->pointer == thread->stack))
+    {
+        _carat_release_escape_sets(the_context, thread->stack);
+        entry->size = thread->stack_size;
+        entry->is_stack = 1;
+    }
+    else
+    {
+        allocation_entry new_entry = _carat_create_allocation_entry(thread->stack, thread->stack_size);
+        new_entry.is_stack = 1;
+        CARAT_ALLOCATION_MAP_INSERT(the_context, &new_entry);
+    }
+
+    CARAT_MAP_UNLOCK(the_context);
+    CARAT_READY_ON(the_context);
+
+    return;
+}
+
+
+NO_CARAT_NO_INLINE
+void nk_carat_untrack_thread_stack(nk_thread_t *thread)
+{
+    CHECK_CARAT_BOOTSTRAP_FLAG;
+    if (!(thread->aspace) || !(thread->stack)) { return; }
+
+    nk_carat_context *the_context = ((nk_aspace_carat_t *) thread->aspace->state)->context;
+    CHECK_CARAT_READY(the_context);
+    CARAT_READY_OFF(the_context);
+
+    CARAT_MAP_LOCK_CONF;
+    CARAT_MAP_LOCK(the_context);
+
+
+    /*
+     * Only a stack we track as one --- an instrumented free of it 
+     * would find nothing left to remove
+     */
+    allocation_entry *entry = CARAT_ALLOCATION_MAP_BETTER_LOWER_BOUND(the_context, thread->stack);
+    if (entry && (entry->pointer == thread->stack) && (entry->is_stack))
+    {
+        _carat_release_escape_sets(the_context, thread->stack);
+        REMOVE_ENTRY_SILENT(the_context, thread->stack);
+    }
+
+    CARAT_MAP_UNLOCK(the_context);
+    CARAT_READY_ON(the_context);
+
+    return;
+}
+
+
 /*
  * =================== Escapes Handling Methods ===================
  */ 
@@ -568,21 +834,19 @@ void nk_carat_instrument_escapes(void *new_destination_of_escaping_address)
 
 
 	/*
-	 * Escapes are processed using batch processing --- if the escapeWindow
-	 * is completely filled --- we need to process it first
-	 */ 
-	// todo: disable CARAT before and after this call --- suspicious
-	if (FETCH_TOTAL_ESCAPES(the_context) >= ESCAPE_WINDOW_SIZE) { _carat_process_escape_window(the_context); }
-
-
-	/*
-	 * Add the escape to the end of the escapeWindow --- this will be
-	 * processed at some point in batch, update the counter
+	 * Add the escape to the end of this CPU's escape buffer --- this will 
+     * be processed at some point in batch
 	 */ 
-    ADD_ESCAPE_TO_WINDOW (
+    _carat_append_escape(
         the_context,
-        new_destination_of_escaping_address
+        ((void **) new_destination_of_escaping_address)
     );
+
+
+    /*
+     * Turn on CARAT upon exit
+     */ 
+    CARAT_READY_ON(the_context);
 	
 
     /*
@@ -590,15 +854,9 @@ void nk_carat_instrument_escapes(void *new_destination_of_escaping_address)
      */ 
 #if 0
     DS("ES: ");
-	DHQ((global_carat_context.total_escape_entries));
+	DHQ((FETCH_TOTAL_ESCAPES(the_context)));
 	DS("\n");
 #endif
-   
-
-    /*
-     * Turn on CARAT upon exit
-     */ 
-    CARAT_READY_ON(the_context);
 
 
     CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, escape_call_time, 0);
@@ -608,117 +866,994 @@ void nk_carat_instrument_escapes(void *new_destination_of_escaping_address)
 }
 
 
-NO_CARAT_NO_INLINE
-void _carat_process_escape_window(nk_carat_context *the_context)
-{	
-	/*
-	 * TOP --- perform batch processing of escapes in the escape window
-	 */ 
-	CARAT_PRINT("CARAT: pew\n");
-	uint64_t num_entries = FETCH_TOTAL_ESCAPES(the_context);
-	void ***the_escape_window = FETCH_ESCAPE_WINDOW(the_context);
-
-
-	// /*
-	//  * Build a set of escapes that are already processed --- if we encounter
-	//  * another escape that is part of this set, the batch processing will
-	//  * ignore it
-	//  */  
-	// nk_carat_escape_set *processed_escapes = CARAT_ESCAPE_SET_BUILD;
-    // CARAT_ESCAPE_SET_SETUP(processed_escapes);
+/*
+ * =================== Per-Thread Escape Logs ===================
+ *
+ * Entries are NULL until written, so an entry reserved by code that was
+ * interrupted (or stopped) before writing it is skipped, and written 
+ * later. For the same reason, only the owning thread --- outside of an
+ * interrupt handler and with interrupts off --- resets its log. A stopped
+ * world only processes and clears the entries written so far
+ */ 
+NO_CARAT
+static inline uint64_t _carat_escape_log_count(struct nk_thread *t)
+{
+    nk_carat_escape_log *log = &(t->carat_escapes);
+    if (!(log->limit)) { return 0; }
 
+    uint64_t next = (log->next < log->limit) ? log->next : log->limit;
+    return (next - ((uint64_t) t->carat_escape_entries)) / sizeof(void **);
+}
 
-	/*
-	 * Iterate through each escape, process it
-	 */ 
-	uint64_t missed_escapes_counter = 0;
-	for (uint64_t i = 0; i < num_entries; i++)
-	{
-		/*
-		 * Get the next escape
-		 */ 
-		void **escape_address = the_escape_window[i];
 
+/*
+ * Move @t's logged escapes to the current CPU's escape buffer and shut
+ * the log. Called by @t with interrupts off
+ */ 
+NO_CARAT
+static void _carat_escape_log_flush(struct nk_thread *t)
+{
+    nk_carat_escape_log *log = &(t->carat_escapes);
+    nk_carat_context *owner = (nk_carat_context *) log->context;
+    uint64_t count = _carat_escape_log_count(t);
+    uint64_t handed = 0;
 
-		/*
-		 * Perform conditions checks on the escape:
-		 * 1. Check if it's a valid pointer
-		 * 2. Check if it's already been processed
-		 * 3. Check if it points to an allocation (allocation_entry object)
-		 * 
-		 * TRUE == mark as processed, continue
-		 * FALSE == process fully, continue
-		 * 
-		 * NOTE --- Condition 2 and "marking as processed" can be completed 
-		 * in the same step because of the design of nk_slist_add --- which
-		 * returns a status flag if an addition to the skiplist has actually 
-		 * occurred
-		 */ 
-		allocation_entry *corresponding_entry = NULL;
+    log->limit = 0;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        void **escape = t->carat_escape_entries[i];
+        if (!escape) { continue; }
 
-		if (false 
-			|| (!escape_address) /* Condition 1 */
-			//|| (!(CARAT_ESCAPE_SET_ADD(processed_escapes, escape_address))) /* Condition 2, marking */
-			|| (!(corresponding_entry = _carat_find_allocation_entry(the_context, *escape_address)))) /* Condition 3 */
+        t->carat_escape_entries[i] = NULL;
+        if (owner) 
         { 
-            missed_escapes_counter++;
-            continue; 
+            _carat_append_escape(owner, escape); 
+            handed++;
         }
+    }
 
-		
-		/*
-		 * At this point --- we have found a corresponding entry where the 
-		 * current escape should be recorded --- save this state to the 
-		 * corresponding entry and continue
-		 */  
-		
-		if (!(corresponding_entry->escapes_set)) {
-			corresponding_entry->escapes_set = CARAT_ESCAPE_SET_BUILD;
-            CARAT_ESCAPE_SET_SETUP((corresponding_entry->escapes_set));
-		}
-
-		CARAT_ESCAPE_SET_ADD((corresponding_entry->escapes_set), escape_address);
-
+    log->next = 0;
+    log->context = NULL;
 
-		/*
-		 * We have processed the escape, but now we need to find the allocation 
-		 * where that escape is stored (if it exists), and add the offset to that allocation's 
-		 * "contained escapes" set.
-		 */ 
-		allocation_entry *container_for_escape = _carat_find_allocation_entry(the_context, escape_address);
+    if (CARAT_PROFILE_ACTIVE) { global_carat_escape_profile[my_cpu_id()].log_entries += handed; }
 
-		if (container_for_escape) {
 
-			uint64_t offset = ((uint64_t) escape_address) - ((uint64_t) container_for_escape->pointer);
-			
-			if (!(container_for_escape->contained_escapes)) {
-				container_for_escape->contained_escapes = CARAT_ESCAPE_SET_BUILD;
-                CARAT_ESCAPE_SET_SETUP((container_for_escape->contained_escapes));
-			}
-			
-			CARAT_ESCAPE_SET_ADD((container_for_escape->contained_escapes), (void**) offset);
-		}
+    return;
+}
 
-	}
 
+NO_CARAT_NO_INLINE
+void nk_carat_escape_log_full(void *new_destination_of_escaping_address)
+{
+    CARAT_PROFILE_INCR(CARAT_DO_PROFILE, escape_calls);
+    CARAT_PROFILE_INIT_TIMING_VAR(0);
+    CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
 
     /*
-     * Debugging
-     */
-#if 0
-	DS("me: ");
-	DHQ(missed_escapes_counter);
-	DS("\n");
-#endif
+     * Fetch the current thread's carat context 
+     */ 
+    CHECK_CARAT_BOOTSTRAP_FLAG; 
+    nk_carat_context *the_context = FETCH_CARAT_CONTEXT;
 
 
 	/*
-	 * Reset the escapes counter for @the_context
-	 */ 
-    RESET_ESCAPE_WINDOW(the_context);
+	 * Only proceed if CARAT is ready (from context init) --- NOTE --- the
+     * log is only set up once it is, until then escapes are not tracked
+	 */
+	CHECK_CARAT_READY(the_context);
+    CARAT_READY_OFF(the_context);
+
+
+    /*
+     * The code an interrupt handler interrupted may hold a reserved entry
+     * --- leave the log alone, and take the regular path
+     */ 
+    if (in_interrupt_context()) 
+    {
+        _carat_append_escape(the_context, ((void **) new_destination_of_escaping_address));
+        CARAT_READY_ON(the_context);
+        CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, escape_call_time, 0);
+        return;
+    }
+
+
+    /*
+     * Hand over the full log, then set it up again, empty, for the
+     * current context. The limit is published last
+     */ 
+    uint8_t iflag = irqs_enabled();
+    if (iflag) { disable_irqs(); }
+
+    struct nk_thread *t = FETCH_THREAD;
+    nk_carat_escape_log *log = &(t->carat_escapes);
+
+    _carat_escape_log_flush(t);
+    _carat_append_escape(the_context, ((void **) new_destination_of_escaping_address));
+
+    log->context = the_context;
+    log->next = (uint64_t) &(t->carat_escape_entries[0]);
+    __asm__ __volatile__ ("" ::: "memory");
+    log->limit = (uint64_t) &(t->carat_escape_entries[NK_CARAT_ESCAPE_LOG_ENTRIES]);
+
+    if (iflag) { enable_irqs(); }
+
+    CARAT_READY_ON(the_context);
+
+
+    CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, escape_call_time, 0);
+
+
+	return;
+}
+
+
+NO_CARAT_NO_INLINE
+void nk_carat_escape_log_release(struct nk_thread *t)
+{
+    uint8_t iflag = irqs_enabled();
+    if (iflag) { disable_irqs(); }
+
+    _carat_escape_log_flush(t);
+
+    if (iflag) { enable_irqs(); }
+
+
+    return;
+}
+
+
+/*
+ * Process the escapes @t has logged for @state (a context) so far, 
+ * with the world stopped (see nk_sched_map_threads)
+ */ 
+NO_CARAT
+static void _carat_process_escape_log(struct nk_thread *t, void *state)
+{
+    nk_carat_context *the_context = (nk_carat_context *) state;
+    if (t->carat_escapes.context != the_context) { return; }
+
+    uint64_t count = _carat_escape_log_count(t);
+    if (!count) { return; }
+
+    _carat_process_escapes(the_context, t->carat_escape_entries, count, NULL);
+    memset(t->carat_escape_entries, 0, count * sizeof(void **));
+
+    if (CARAT_PROFILE_ACTIVE) { global_carat_escape_profile[my_cpu_id()].log_entries += count; }
+
+
+    return;
+}
+
+
+/*
+ * =================== Escape Buffers ===================
+ *
+ * The flat format stores raw escape locations. The compressed format
+ * (NAUT_CONFIG_CARAT_COMPRESSED_ESCAPE_LOG) stores, per block of 
+ * ESCAPE_LOG_BLOCK escapes, the zigzag varint of each escape's distance
+ * from the previous one --- escapes recorded together are mostly close
+ * together, so most take one or two bytes instead of eight
+ */ 
+
+#ifdef NAUT_CONFIG_CARAT_COMPRESSED_ESCAPE_LOG
+
+NO_CARAT
+static inline uint8_t *_carat_varint_encode(uint8_t *p, uint64_t value)
+{
+    while (value >= 0x80) 
+    {
+        *(p++) = ((uint8_t) value) | 0x80;
+        value >>= 7;
+    }
+
+    *(p++) = (uint8_t) value;
+
+    return p;
+}
+
+
+/*
+ * Decode one varint a word at a time --- the terminating byte is found 
+ * from the continuation bits of 8 bytes at once, and the 7-bit groups are
+ * packed together with three shift/mask steps instead of a byte loop. 
+ * Reads 8 bytes at @p (the log has ESCAPE_LOG_SLACK bytes of slack)
+ */ 
+NO_CARAT
+static inline uint8_t *_carat_varint_decode(uint8_t *p, uint64_t *value)
+{
+    uint64_t word;
+    memcpy(&word, p, sizeof(uint64_t));
+
+    uint64_t stops = ~word & 0x8080808080808080ULL;
+    if (!stops)
+    {
+        /*
+         * 9 or 10 bytes --- only for distances of 2^56 and up
+         */ 
+        uint64_t result = 0;
+        for (int shift = 0; ; shift += 7) 
+        {
+            uint8_t byte = *(p++);
+            result |= ((uint64_t) (byte & 0x7f)) << shift;
+            if (!(byte & 0x80)) { break; }
+        }
+
+        *value = result;
+        return p;
+    }
+
+    uint64_t length = (__builtin_ctzl(stops) >> 3) + 1;
+    if (length < 8) { word &= (1ULL << (length * 8)) - 1; }
+
+    word &= 0x7f7f7f7f7f7f7f7fULL;
+    word = ((word & 0x7f007f007f007f00ULL) >> 1) | (word & 0x007f007f007f007fULL);
+    word = ((word & 0x3fff00003fff0000ULL) >> 2) | (word & 0x00003fff00003fffULL);
+    word = ((word & 0x0fffffff00000000ULL) >> 4) | (word & 0x000000000fffffffULL);
+
+    *value = word;
+    return p + length;
+}
+
+
+NO_CARAT
+static inline int _carat_escape_buffer_full(carat_escape_buffer *buffer)
+{
+    return (buffer->log_bytes + ESCAPE_LOG_MAX_RECORD) > buffer->capacity;
+}
+
+
+NO_CARAT
+static inline void _carat_escape_buffer_push(carat_escape_buffer *buffer, void **escape)
+{
+    if (!(buffer->total_escape_entries % ESCAPE_LOG_BLOCK)) 
+    {
+        buffer->blocks[buffer->total_escape_entries / ESCAPE_LOG_BLOCK] = buffer->log_bytes;
+        buffer->last_escape = 0;
+    }
+
+    sint64_t delta = (sint64_t) (((uintptr_t) escape) - buffer->last_escape);
+    uint64_t zigzag = (((uint64_t) delta) << 1) ^ ((uint64_t) (delta >> 63));
+
+    uint8_t *end = _carat_varint_encode(buffer->log + buffer->log_bytes, zigzag);
+    buffer->log_bytes = end - buffer->log;
+    buffer->last_escape = (uintptr_t) escape;
+    buffer->total_escape_entries++;
+
+    return;
+}
+
+
+/*
+ * Decode whole blocks [*@block, @last_block) of @buffer into @out, at
+ * most ESCAPE_LOG_DECODE_CHUNK escapes --- advances *@block, returns
+ * the number of escapes decoded
+ */ 
+NO_CARAT
+static uint64_t _carat_escape_buffer_decode(
+    carat_escape_buffer *buffer,
+    uint64_t *block,
+    uint64_t last_block,
+    void ***out
+)
+{
+    uint64_t count = 0;
+
+    for (; (*block < last_block) && ((count + ESCAPE_LOG_BLOCK) <= ESCAPE_LOG_DECODE_CHUNK); (*block)++)
+    {
+        uint64_t first = *block * ESCAPE_LOG_BLOCK;
+        uint64_t num = buffer->total_escape_entries - first;
+        if (num > ESCAPE_LOG_BLOCK) { num = ESCAPE_LOG_BLOCK; }
+
+        uint8_t *p = buffer->log + buffer->blocks[*block];
+        uintptr_t escape = 0;
+
+        for (uint64_t i = 0; i < num; i++)
+        {
+            uint64_t zigzag;
+            p = _carat_varint_decode(p, &zigzag);
+            escape += (uintptr_t) ((zigzag >> 1) ^ -(zigzag & 1));
+            out[count++] = (void **) escape;
+        }
+    }
+
+    return count;
+}
+
+
+NO_CARAT
+static inline uint64_t _carat_escape_buffer_bytes(carat_escape_buffer *buffer)
+{
+    return buffer->log_bytes;
+}
+
+
+NO_CARAT
+static inline uint64_t _carat_escape_buffer_num_blocks(carat_escape_buffer *buffer)
+{
+    return (buffer->total_escape_entries + ESCAPE_LOG_BLOCK - 1) / ESCAPE_LOG_BLOCK;
+}
+
+
+/*
+ * Process every escape in @buffer --- returns the number filtered
+ */ 
+NO_CARAT
+static uint64_t _carat_process_escape_buffer(nk_carat_context *the_context, carat_escape_buffer *buffer)
+{
+    uint64_t filtered = 0;
+    uint64_t block = 0, last_block = _carat_escape_buffer_num_blocks(buffer);
+
+    while (block < last_block)
+    {
+        uint64_t count = _carat_escape_buffer_decode(buffer, &block, last_block, buffer->decoded);
+        filtered += _carat_process_escapes(the_context, buffer->decoded, count, buffer->filter);
+    }
+
+    return filtered;
+}
+
+#else
+
+NO_CARAT
+static inline int _carat_escape_buffer_full(carat_escape_buffer *buffer)
+{
+    return buffer->total_escape_entries >= buffer->capacity;
+}
+
+
+NO_CARAT
+static inline void _carat_escape_buffer_push(carat_escape_buffer *buffer, void **escape)
+{
+    buffer->escapes[buffer->total_escape_entries] = escape;
+    buffer->total_escape_entries++;
+    return;
+}
+
+
+NO_CARAT
+static inline uint64_t _carat_escape_buffer_bytes(carat_escape_buffer *buffer)
+{
+    return buffer->total_escape_entries * sizeof(void **);
+}
+
+
+NO_CARAT
+static uint64_t _carat_process_escape_buffer(nk_carat_context *the_context, carat_escape_buffer *buffer)
+{
+    return _carat_process_escapes(the_context, buffer->escapes, buffer->total_escape_entries, buffer->filter);
+}
+
+#endif
+
+
+/*
+ * Drain @buffer (owned by the current CPU) into the allocation map. 
+ * Interrupts must be off --- this keeps other threads on this CPU 
+ * from appending while the buffer is processed
+ */ 
+NO_CARAT
+static void _carat_drain_escape_buffer(
+    nk_carat_context *the_context,
+    carat_escape_buffer *buffer
+)
+{
+    carat_escape_profile *profile = &(global_carat_escape_profile[my_cpu_id()]);
+    uint64_t start = (CARAT_PROFILE_ACTIVE) ? rdtsc() : 0;
+
+
+    /*
+     * Buffer-full drains from different CPUs insert into the
+     * same allocation map --- serialize them 
+     */ 
+    spin_lock(&(the_context->escape_lock));
+    buffer->draining = 1;
+
+    uint64_t num_entries = buffer->total_escape_entries;
+    uint64_t num_bytes = _carat_escape_buffer_bytes(buffer);
+    uint64_t filtered = _carat_process_escape_buffer(the_context, buffer);
+    RESET_ESCAPE_BUFFER(buffer);
+
+    buffer->draining = 0;
+    spin_unlock(&(the_context->escape_lock));
+
+
+    if (CARAT_PROFILE_ACTIVE) 
+    {
+        profile->drain_calls++;
+        profile->drained_entries += num_entries;
+        profile->drained_bytes += num_bytes;
+        profile->filtered_entries += filtered;
+        profile->drain_time += rdtsc() - start;
+    }
+
+
+    return;
+}
+
+
+NO_CARAT_NO_INLINE
+void _carat_append_escape(nk_carat_context *the_context, void **escape)
+{
+    /*
+     * The buffer belongs to this CPU --- keep the append atomic 
+     * with respect to this CPU by turning interrupts off, no 
+     * atomic instructions needed
+     */ 
+    uint8_t iflag = irqs_enabled();
+    if (iflag) { disable_irqs(); }
+
+    uint64_t start = (CARAT_PROFILE_ACTIVE) ? rdtsc() : 0;
+    int cpu = my_cpu_id();
+    carat_escape_buffer *buffer = FETCH_ESCAPE_BUFFER(the_context, cpu);
+
+
+    /*
+     * Escapes produced by the runtime while it drains this buffer
+     * (e.g. by the allocator) are not tracked
+     */ 
+    if (!(buffer->draining))
+    {
+        /*
+         * Escapes are processed using batch processing --- if the buffer
+         * is completely filled --- we need to process it first
+         */ 
+        if (_carat_escape_buffer_full(buffer)) { 
+            _carat_drain_escape_buffer(the_context, buffer); 
+        }
+
+        _carat_escape_buffer_push(buffer, escape);
+    }
+
+
+    if (CARAT_PROFILE_ACTIVE) 
+    {
+        carat_escape_profile *profile = &(global_carat_escape_profile[cpu]);
+        profile->append_calls++;
+        profile->append_time += rdtsc() - start;
+    }
+
+    if (iflag) { enable_irqs(); }
+
+
+    return;
+}
+
+
+NO_CARAT
+uint64_t _carat_count_escapes(nk_carat_context *the_context)
+{
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < the_context->num_escape_buffers; i++) {
+        total += FETCH_ESCAPE_BUFFER(the_context, i)->total_escape_entries;
+    }
+
+    return total;
+}
+
+
+/*
+ * State shared by the stopped CPUs during a parallel drain
+ */ 
+typedef struct carat_parallel_drain_t {
+    nk_carat_context *the_context;
+    uint64_t num_workers;
+    uint64_t total_entries;
+} carat_parallel_drain;
+
+
+NO_CARAT
+static inline uint64_t _carat_escape_shard_of(allocation_entry *entry, uint64_t num_workers)
+{
+    return (((uint64_t) entry) >> 5) % num_workers;
+}
+
+
+/*
+ * Never grows @worker --- the stopper sized it for the worst case, two
+ * records per escape in the worker's slice
+ */ 
+NO_CARAT
+static inline void _carat_drain_worker_push(
+    carat_drain_worker *worker,
+    uint64_t num_workers,
+    allocation_entry *entry,
+    uintptr_t key,
+    int contained
+)
+{
+    carat_escape_record *record = &(worker->records[worker->count++]);
+    record->entry = entry;
+    record->key = key;
+    record->contained = contained;
+    record->shard = _carat_escape_shard_of(entry, num_workers);
+
+
+    return;
+}
+
+
+/*
+ * Group the records of @worker by shard --- a counting sort from
+ * @records into @sorted
+ */ 
+NO_CARAT
+static void _carat_drain_worker_sort(carat_drain_worker *worker, uint64_t num_workers)
+{
+    uint64_t *start = worker->shard_start;
+    memset(start, 0, (num_workers + 1) * sizeof(uint64_t));
+
+    for (uint64_t i = 0; i < worker->count; i++) { start[worker->records[i].shard + 1]++; }
+    for (uint64_t s = 0; s < num_workers; s++) { start[s + 1] += start[s]; }
+
+    /*
+     * Scattering leaves start[s] at the end of shard s --- shift back
+     */ 
+    for (uint64_t i = 0; i < worker->count; i++) { 
+        worker->sorted[start[worker->records[i].shard]++] = worker->records[i]; 
+    }
+    for (uint64_t s = num_workers; s > 0; s--) { start[s] = start[s - 1]; }
+    start[0] = 0;
+
+
+    return;
+}
+
+
+/*
+ * Make room for @capacity records per worker --- called by the stopper
+ * before handing out work. Returns -1 (the drain then falls back to the 
+ * serial merge) if memory is short
+ */ 
+NO_CARAT
+static int _carat_drain_workers_reserve(nk_carat_context *the_context, uint64_t capacity)
+{
+    uint64_t num_workers = the_context->num_escape_buffers;
+
+    for (uint64_t w = 0; w < num_workers; w++)
+    {
+        carat_drain_worker *worker = &(the_context->drain_workers[w]);
+
+        if (!(worker->shard_start)) 
+        {
+            worker->shard_start = (uint64_t *) malloc((num_workers + 1) * sizeof(uint64_t));
+            if (!(worker->shard_start)) { return -1; }
+        }
+
+        if (worker->capacity >= capacity) { continue; }
+
+        uint64_t new_capacity = (capacity > (worker->capacity * 2)) ? capacity : (worker->capacity * 2);
+        free(worker->records);
+        free(worker->sorted);
+        worker->capacity = 0;
+
+        worker->records = (carat_escape_record *) malloc(new_capacity * sizeof(carat_escape_record));
+        worker->sorted = (carat_escape_record *) malloc(new_capacity * sizeof(carat_escape_record));
+        if (!(worker->records) || !(worker->sorted)) 
+        {
+            free(worker->records);
+            free(worker->sorted);
+            worker->records = worker->sorted = NULL;
+            return -1;
+        }
+
+        worker->capacity = new_capacity;
+    }
+
+
+    return 0;
+}
+
+
+/*
+ * Lookups for one escape --- records the resulting insertions, tagged
+ * by shard. Returns 1 if the escape was dropped by @filter
+ */ 
+NO_CARAT
+static inline int _carat_parallel_drain_lookup_one(
+    nk_carat_context *the_context,
+    carat_drain_worker *worker,
+    uint64_t num_workers,
+    void ***filter,
+    void **escape_address
+)
+{
+    if (!escape_address) { return 0; }
+
+    uint64_t slot = (((uint64_t) escape_address) >> 3) & (ESCAPE_FILTER_SLOTS - 1);
+    if (filter[slot] == escape_address) { return 1; }
+    filter[slot] = escape_address;
+
+    allocation_entry *corresponding_entry = _carat_find_allocation_entry(the_context, *escape_address);
+    if (!corresponding_entry) { return 0; }
+
+    _carat_drain_worker_push(
+        worker,
+        num_workers,
+        corresponding_entry,
+        (uintptr_t) escape_address,
+        0
+    );
+
+    allocation_entry *container_for_escape = _carat_find_allocation_entry(the_context, escape_address);
+    if (!container_for_escape) { return 0; }
+
+    _carat_drain_worker_push(
+        worker,
+        num_workers,
+        container_for_escape,
+        ((uintptr_t) escape_address) - ((uintptr_t) container_for_escape->pointer),
+        1
+    );
+
+    return 0;
+}
+
+
+/*
+ * Phase 1 --- each worker takes an equal slice of all escapes (across
+ * every CPU's buffer, so one busy CPU does not leave the others idle),
+ * does the allocation map lookups, and groups the resulting insertions
+ * by shard. The map is only read in this phase. With the compressed log,
+ * slices are rounded to whole blocks, which still covers every escape 
+ * exactly once since neighbouring workers round the same boundary
+ */ 
+NO_CARAT
+static void _carat_parallel_drain_lookup(int cpu, void *state)
+{
+    carat_parallel_drain *drain = (carat_parallel_drain *) state;
+    nk_carat_context *the_context = drain->the_context;
+    uint64_t num_workers = drain->num_workers;
+    if (cpu >= num_workers) { return; }
+
+    uint64_t lo = (drain->total_entries * cpu) / num_workers;
+    uint64_t hi = (drain->total_entries * (cpu + 1)) / num_workers;
+    carat_drain_worker *worker = &(the_context->drain_workers[cpu]);
+    worker->count = 0;
+
+    void ***filter = FETCH_ESCAPE_BUFFER(the_context, cpu)->filter;
+    memset(filter, 0, ESCAPE_FILTER_SLOTS * sizeof(void **));
+    uint64_t filtered = 0;
+
+
+    uint64_t base = 0;
+    for (uint64_t b = 0; (b < the_context->num_escape_buffers) && (base < hi); b++)
+    {
+        carat_escape_buffer *buffer = FETCH_ESCAPE_BUFFER(the_context, b);
+        uint64_t count = buffer->total_escape_entries;
+
+        uint64_t first = (lo > base) ? (lo - base) : 0;
+        uint64_t last = ((hi - base) < count) ? (hi - base) : count;
+
+#ifdef NAUT_CONFIG_CARAT_COMPRESSED_ESCAPE_LOG
+        void ***decoded = FETCH_ESCAPE_BUFFER(the_context, cpu)->decoded;
+        uint64_t block = (first + ESCAPE_LOG_BLOCK - 1) / ESCAPE_LOG_BLOCK;
+        uint64_t last_block = (last + ESCAPE_LOG_BLOCK - 1) / ESCAPE_LOG_BLOCK;
+
+        while (block < last_block)
+        {
+            uint64_t num_decoded = _carat_escape_buffer_decode(buffer, &block, last_block, decoded);
+            for (uint64_t i = 0; i < num_decoded; i++) {
+                filtered += _carat_parallel_drain_lookup_one(the_context, worker, num_workers, filter, decoded[i]);
+            }
+        }
+#else
+        for (uint64_t i = first; i < last; i++) {
+            filtered += _carat_parallel_drain_lookup_one(the_context, worker, num_workers, filter, buffer->escapes[i]);
+        }
+#endif
+
+        base += count;
+    }
+
+    _carat_drain_worker_sort(worker, num_workers);
+
+
+    if (CARAT_PROFILE_ACTIVE) { global_carat_escape_profile[cpu].filtered_entries += filtered; }
+
+
+    return;
+}
+
+
+/*
+ * Phase 2 --- each worker owns one shard of the allocation entries and
+ * applies every record produced for it, so no two workers ever touch
+ * the same escape set
+ */ 
+NO_CARAT
+static void _carat_parallel_drain_insert(int cpu, void *state)
+{
+    carat_parallel_drain *drain = (carat_parallel_drain *) state;
+    nk_carat_context *the_context = drain->the_context;
+    uint64_t num_workers = drain->num_workers;
+    if (cpu >= num_workers) { return; }
+
+    for (uint64_t w = 0; w < num_workers; w++)
+    {
+        carat_drain_worker *worker = &(the_context->drain_workers[w]);
+        uint64_t end = worker->shard_start[cpu + 1];
+
+        for (uint64_t i = worker->shard_start[cpu]; i < end; i++)
+        {
+            carat_escape_record *record = &(worker->sorted[i]);
+            nk_carat_escape_set **set = 
+                (record->contained) ?
+                &(record->entry->contained_escapes) :
+                &(record->entry->escapes_set) ;
+
+            if (!(*set)) {
+                *set = CARAT_ESCAPE_SET_BUILD(the_context);
+                CARAT_ESCAPE_SET_SETUP((*set));
+            }
+
+            CARAT_ESCAPE_SET_ADD(the_context, (*set), record->key);
+        }
+    }
 
 
-	return;
+    return;
+}
+
+
+/*
+ * Merge all buffers using every stopped CPU --- returns -1 (having
+ * done nothing) if the caller is not the world stopper
+ */ 
+NO_CARAT
+static int _carat_process_escape_window_parallel(nk_carat_context *the_context, uint64_t total_entries)
+{
+    carat_parallel_drain drain = {
+        .the_context = the_context,
+        .num_workers = the_context->num_escape_buffers,
+        .total_entries = total_entries
+    };
+
+
+    /*
+     * A worker's slice is at most ceil(total / workers) escapes (plus a
+     * partial block per buffer with the compressed log), and each escape
+     * yields at most two records
+     */ 
+    uint64_t slice = (total_entries + drain.num_workers - 1) / drain.num_workers;
+#ifdef NAUT_CONFIG_CARAT_COMPRESSED_ESCAPE_LOG
+    slice += the_context->num_escape_buffers * ESCAPE_LOG_BLOCK;
+#endif
+    if (_carat_drain_workers_reserve(the_context, 2 * slice)) { return -1; }
+
+    /*
+     * Escapes produced by the runtime itself while the workers run 
+     * (e.g. by the allocator) are not recorded, as in a serial drain
+     */ 
+    for (uint64_t i = 0; i < the_context->num_escape_buffers; i++) {
+        FETCH_ESCAPE_BUFFER(the_context, i)->draining = 1;
+    }
+
+    uint64_t start = (CARAT_PROFILE_ACTIVE) ? rdtsc() : 0;
+    if (nk_sched_run_on_stopped_cpus(_carat_parallel_drain_lookup, &drain)) 
+    { 
+        for (uint64_t i = 0; i < the_context->num_escape_buffers; i++) {
+            FETCH_ESCAPE_BUFFER(the_context, i)->draining = 0;
+        }
+
+        return -1; 
+    }
+    uint64_t lookup_done = (CARAT_PROFILE_ACTIVE) ? rdtsc() : 0;
+
+    /*
+     * Cannot fail --- we were the stopper a moment ago
+     */ 
+    nk_sched_run_on_stopped_cpus(_carat_parallel_drain_insert, &drain);
+
+
+    for (uint64_t i = 0; i < the_context->num_escape_buffers; i++) 
+    {
+        carat_escape_buffer *buffer = FETCH_ESCAPE_BUFFER(the_context, i);
+        RESET_ESCAPE_BUFFER(buffer);
+        buffer->draining = 0;
+    }
+
+    if (CARAT_PROFILE_ACTIVE) 
+    {
+        CARAT_PROFILE_CPU->parallel_drain_calls++;
+        CARAT_PROFILE_CPU->parallel_drain_entries += total_entries;
+        CARAT_PROFILE_CPU->parallel_lookup_time += lookup_done - start;
+        CARAT_PROFILE_CPU->parallel_insert_time += rdtsc() - lookup_done;
+    }
+
+
+    return 0;
+}
+
+
+NO_CARAT_NO_INLINE
+void _carat_process_escape_window(nk_carat_context *the_context)
+{	
+	/*
+	 * TOP --- merge the escape buffers of every CPU into the allocation
+     * map. The world is stopped (moves, defrag), so no CPU is appending
+     * or draining, and escape_lock is not needed
+	 */ 
+	CARAT_PRINT("CARAT: pew\n");
+
+
+    /*
+     * Escapes still sitting in the logs of this context's threads first
+     */ 
+    nk_sched_map_threads(-1, _carat_process_escape_log, the_context);
+
+
+    /*
+     * Hand the merge to all stopped CPUs if asked to, and if there is
+     * enough work to pay for it --- falls back to the serial merge if 
+     * we did not stop the world ourselves
+     */ 
+    uint64_t total_entries = _carat_count_escapes(the_context);
+    if (true
+        && (carat_escape_drain_mode == CARAT_ESCAPE_DRAIN_PARALLEL)
+        && !(the_context->stop_scope) // Workers are indexed by CPU, so all must be stopped
+        && (the_context->num_escape_buffers > 1)
+        && (total_entries >= ESCAPE_PARALLEL_DRAIN_MIN)
+        && !(_carat_process_escape_window_parallel(the_context, total_entries))) 
+    {
+        return;
+    }
+
+
+    for (uint64_t i = 0; i < the_context->num_escape_buffers; i++)
+    {
+        carat_escape_buffer *buffer = FETCH_ESCAPE_BUFFER(the_context, i);
+        if (!(buffer->total_escape_entries)) { continue; }
+
+        uint64_t start = (CARAT_PROFILE_ACTIVE) ? rdtsc() : 0;
+        uint64_t num_entries = buffer->total_escape_entries;
+        uint64_t num_bytes = _carat_escape_buffer_bytes(buffer);
+
+        buffer->draining = 1;
+        uint64_t filtered = _carat_process_escape_buffer(the_context, buffer);
+        RESET_ESCAPE_BUFFER(buffer);
+        buffer->draining = 0;
+
+        /*
+         * Charge the merge to the CPU that owned the escapes
+         */ 
+        if (CARAT_PROFILE_ACTIVE) 
+        {
+            carat_escape_profile *profile = &(global_carat_escape_profile[i]);
+            profile->drain_calls++;
+            profile->drained_entries += num_entries;
+            profile->drained_bytes += num_bytes;
+            profile->filtered_entries += filtered;
+            profile->drain_time += rdtsc() - start;
+        }
+    }
+
+
+    return;
+}
+
+
+NO_CARAT_NO_INLINE
+uint64_t _carat_process_escapes(
+    nk_carat_context *the_context,
+    void ***the_escape_window,
+    uint64_t num_entries,
+    void ***filter
+)
+{	
+	/*
+	 * TOP --- perform batch processing of escapes in the escape window
+	 */ 
+
+
+	/*
+	 * Escapes already processed in this batch --- a lossy, direct-mapped 
+     * filter rather than a full set. A repeated escape reads the same 
+     * (current) value at the same location, so dropping it changes nothing.
+     * Repeats that collide in the filter still reach the escape sets, 
+     * which deduplicate on their own
+	 */  
+    if (filter) { memset(filter, 0, ESCAPE_FILTER_SLOTS * sizeof(void **)); }
+
+
+	/*
+	 * Iterate through each escape, process it
+	 */ 
+	uint64_t missed_escapes_counter = 0;
+	uint64_t filtered_escapes_counter = 0;
+	for (uint64_t i = 0; i < num_entries; i++)
+	{
+		/*
+		 * Get the next escape
+		 */ 
+		void **escape_address = the_escape_window[i];
+
+
+		/*
+		 * Perform conditions checks on the escape:
+		 * 1. Check if it's a valid pointer
+		 * 2. Check if it's already been processed
+		 * 3. Check if it points to an allocation (allocation_entry object)
+		 * 
+		 * TRUE == mark as processed, continue
+		 * FALSE == process fully, continue
+		 * 
+		 * NOTE --- Condition 2 and "marking as processed" are completed 
+		 * in the same step --- the filter slot is claimed on a miss
+		 */ 
+		allocation_entry *corresponding_entry = NULL;
+
+		if (!escape_address) /* Condition 1 */
+        { 
+            missed_escapes_counter++;
+            continue; 
+        }
+
+        if (filter) /* Condition 2, marking */
+        {
+            uint64_t slot = (((uint64_t) escape_address) >> 3) & (ESCAPE_FILTER_SLOTS - 1);
+            if (filter[slot] == escape_address) 
+            {
+                filtered_escapes_counter++;
+                continue;
+            }
+
+            filter[slot] = escape_address;
+        }
+
+		if (!(corresponding_entry = _carat_find_allocation_entry(the_context, *escape_address))) /* Condition 3 */
+        { 
+            missed_escapes_counter++;
+            continue; 
+        }
+
+		
+		/*
+		 * At this point --- we have found a corresponding entry where the 
+		 * current escape should be recorded --- save this state to the 
+		 * corresponding entry and continue
+		 */  
+		
+		if (!(corresponding_entry->escapes_set)) {
+			corresponding_entry->escapes_set = CARAT_ESCAPE_SET_BUILD(the_context);
+            CARAT_ESCAPE_SET_SETUP((corresponding_entry->escapes_set));
+		}
+
+		CARAT_ESCAPE_SET_ADD(the_context, (corresponding_entry->escapes_set), escape_address);
+
+
+		/*
+		 * We have processed the escape, but now we need to find the allocation 
+		 * where that escape is stored (if it exists), and add the offset to that allocation's 
+		 * "contained escapes" set.
+		 */ 
+		allocation_entry *container_for_escape = _carat_find_allocation_entry(the_context, escape_address);
+
+		if (container_for_escape) {
+
+			uint64_t offset = ((uint64_t) escape_address) - ((uint64_t) container_for_escape->pointer);
+			
+			if (!(container_for_escape->contained_escapes)) {
+				container_for_escape->contained_escapes = CARAT_ESCAPE_SET_BUILD(the_context);
+                CARAT_ESCAPE_SET_SETUP((container_for_escape->contained_escapes));
+			}
+			
+			CARAT_ESCAPE_SET_ADD(the_context, (container_for_escape->contained_escapes), (void**) offset);
+		}
+
+	}
+
+
+    /*
+     * Debugging
+     */
+#if 0
+	DS("me: ");
+	DHQ(missed_escapes_counter);
+	DS("\n");
+#endif
+
+
+	return filtered_escapes_counter;
 }
 
 /*
@@ -757,64 +1892,193 @@ void nk_carat_guard_address(void *address, int is_write, void* aspace) {
      */ 
 
 
-	/*
- 	 * Check to see if the requested memory access is valid. 
-	 * Also, the requested_permissions field of the region associated with @memory_address is updated to include this access.
-	 */
-    CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
-    int res = nk_aspace_request_permission((nk_aspace_t *) aspace, address, is_write);
-    CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, request_permission_time, 0);
+	/*
+ 	 * Check to see if the requested memory access is valid. 
+	 * Also, the requested_permissions field of the region associated with @memory_address is updated to include this access.
+	 */
+    CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
+    int res = nk_aspace_request_permission((nk_aspace_t *) aspace, address, is_write);
+    CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, request_permission_time, 0);
+
+
+    /*
+     * Handle failure
+     */ 
+    if (res) {
+        panic("Tried to make an illegal memory access with %p! \n", address);
+	}
+
+
+    /*
+     * Concurrent migration --- writes dirty the object being copied
+     */ 
+    if (is_write) {
+        nk_carat_context *the_context = ((nk_aspace_carat_t *) ((nk_aspace_t *) aspace)->state)->context;
+        CARAT_MIGRATION_BARRIER(the_context, address);
+    }
+
+
+    /*
+     * Access sampling --- which CPU touches what (NUMA placement, hot/cold)
+     */ 
+    CARAT_SAMPLE(address);
+
+
+	return;
+}
+
+#else
+
+NO_CARAT_NO_INLINE
+void nk_carat_guard_address(void *address, int is_write) {
+    
+    /*
+     * 1. Profile
+     */ 
+    CARAT_PROFILE_INCR(CARAT_DO_PROFILE, guard_address_calls);
+    CARAT_PROFILE_INIT_TIMING_VAR(0);
+    CARAT_PROFILE_INIT_TIMING_VAR(1);
+    CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
+
+
+    /*
+     * 2. Fetch the current aspace
+     */ 
+    nk_aspace_t *aspace = FETCH_THREAD->aspace;
+    
+
+    /*
+ 	 * 3. Check to see if the requested memory access is valid. 
+	 * Also, the requested_permissions field of the region associated with @memory_address is updated to include this access.
+	 */
+    CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 1);
+    int res = nk_aspace_request_permission(aspace, address, is_write);
+    CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, request_permission_time, 1);
+
+
+    /*
+     * Handle failure
+     */ 
+    if (res) {
+        panic("Tried to make an illegal memory access with %p! \n", address);
+	}
+
+
+    /*
+     * 4. Concurrent migration --- writes dirty the object being copied
+     */ 
+    if (is_write) {
+        nk_carat_context *the_context = ((nk_aspace_carat_t *) aspace->state)->context;
+        CARAT_MIGRATION_BARRIER(the_context, address);
+    }
+
+
+    /*
+     * 5. Access sampling --- which CPU touches what (NUMA placement, hot/cold)
+     */ 
+    CARAT_SAMPLE(address);
+
+    CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, guard_address_time, 0);
+	return;
+}
+
+
+#endif
+
+
+/*
+ * Instrumentation for loops --- check [@base, @base + @len) once, one
+ * region at a time. Each region is checked (and its requested_permissions
+ * updated) by the regular permission request for its first address in 
+ * the range, so a range that runs off the end of a region must continue
+ * in an adjacent region that also allows the access
+ */
+NO_CARAT
+static inline void _carat_guard_range(nk_aspace_t *aspace, void *base, uint64_t len, int is_write)
+{
+    nk_aspace_carat_t *carat = (nk_aspace_carat_t *) aspace->state;
+    void *end = base + len;
+
+    if (end < base) {
+        panic("Tried to make an illegal memory access with %p (range wraps around)! \n", base);
+    }
+
+
+    /*
+     * Walk the regions that cover the range
+     */ 
+    void *address = base;
+    while (address < end)
+    {
+        int res = nk_aspace_request_permission(aspace, address, is_write);
+        if (res) {
+            panic("Tried to make an illegal memory access with %p (range %p - %p)! \n", address, base, end);
+        }
+
+        nk_aspace_region_t *region = mm_find_reg_at_addr(carat->mm, (addr_t) address);
+        if (!region) {
+            panic("Tried to make an illegal memory access with %p (range %p - %p)! \n", address, base, end);
+        }
+
+        address = region->va_start + region->len_bytes;
+    }
+
+
+    /*
+     * Concurrent migration --- writes dirty every object being copied 
+     * in the range. NOTE --- like any hoisted guard, this only sees the
+     * migrations that are already running when the loop is entered
+     */ 
+    if (is_write) {
+        CARAT_MIGRATION_BARRIER_RANGE(carat->context, base, end);
+    }
 
 
     /*
-     * Handle failure
+     * Access sampling --- attributed to the start of the range
      */ 
-    if (res) {
-        panic("Tried to make an illegal memory access with %p! \n", address);
-	}
+    CARAT_SAMPLE(base);
 
+    if (CARAT_DO_PROFILE && start_carat_profiles) { CARAT_PROFILE_CPU->guard_range_bytes += len; }
 
-	return;
+    return;
 }
 
-#else
+
+#if USER_REGION_CHECK
 
 NO_CARAT_NO_INLINE
-void nk_carat_guard_address(void *address, int is_write) {
-    
-    /*
-     * 1. Profile
-     */ 
-    CARAT_PROFILE_INCR(CARAT_DO_PROFILE, guard_address_calls);
+void nk_carat_guard_range(void *base, uint64_t len, int is_write, void* aspace) {
+
+    CARAT_PROFILE_INCR(CARAT_DO_PROFILE, guard_range_calls);
     CARAT_PROFILE_INIT_TIMING_VAR(0);
     CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
 
+    if (len) {
+        _carat_guard_range((nk_aspace_t *) aspace, base, len, is_write);
+    }
 
-    /*
-     * 2. Fetch the current aspace
-     */ 
-    nk_aspace_t *aspace = FETCH_THREAD->aspace;
-    
+    CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, guard_range_time, 0);
+	return;
+}
 
-    /*
- 	 * 3. Check to see if the requested memory access is valid. 
-	 * Also, the requested_permissions field of the region associated with @memory_address is updated to include this access.
-	 */
-    int res = nk_aspace_request_permission(aspace, address, is_write);
+#else
 
+NO_CARAT_NO_INLINE
+void nk_carat_guard_range(void *base, uint64_t len, int is_write) {
 
-    /*
-     * Handle failure
-     */ 
-    if (res) {
-        panic("Tried to make an illegal memory access with %p! \n", address);
-	}
+    CARAT_PROFILE_INCR(CARAT_DO_PROFILE, guard_range_calls);
+    CARAT_PROFILE_INIT_TIMING_VAR(0);
+    CARAT_PROFILE_START_TIMING(CARAT_DO_PROFILE, 0);
 
-    CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, guard_address_time, 0);
+    if (len) {
+        _carat_guard_range(FETCH_THREAD->aspace, base, len, is_write);
+    }
+
+    CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, guard_range_time, 0);
 	return;
 }
 
-
 #endif
 
 
@@ -835,8 +2099,13 @@ void nk_carat_guard_callee_stack(uint64_t stack_frame_size) {
 	nk_thread_t *thread = FETCH_THREAD;
 	int stack_too_large = new_rsp < thread->stack;
 	if (stack_too_large) {
-		// TODO: expand stack instead of panicking 
-		panic("Stack has grown outside of valid memory! \n");
+		// grow it --- we come back on the moved stack (see _carat_grow_stack)
+		_carat_grow_stack_trampoline(stack_frame_size);
+
+		new_rsp = (void *) (_carat_get_rsp() - stack_frame_size);
+		if (new_rsp < thread->stack) {
+			panic("Stack has grown outside of valid memory! \n");
+		}
 	}
 
     CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, guard_stack_time, 0);
@@ -1036,6 +2305,13 @@ void nk_carat_init(void)
     );
 
 
+    /*
+     * Every thread runs in the kernel's aspace, so moves in its 
+     * context must stop the whole world
+     */
+    ((nk_aspace_carat_t *) the_aspace->state)->context->stop_scope = NULL;
+
+
     /*
      * KARAT is good to go --- turn on bootstrapping flag (Note
      * that this flag is different than the ready flag belonging
@@ -1046,6 +2322,15 @@ void nk_carat_init(void)
     CARAT_HACK_PRINT("CARAT: karat_ready is on!\n");
 
 
+    /*
+     * The compaction, NUMA placement and hot/cold daemons (if configured) are started later, once
+     * the scheduler is up --- see init()
+     */
+    nk_carat_compaction_init(the_aspace);
+    nk_carat_numa_init(the_aspace);
+    nk_carat_hot_cold_init(the_aspace);
+
+
     /*
      * Invoke wrapper housing compiler-injected global allocation tracking
      */
@@ -1076,6 +2361,8 @@ nk_carat_context * initialize_new_carat_context(void)
 	 */ 
 	new_context->allocation_map = CARAT_ALLOCATION_MAP_BUILD;
     CARAT_ALLOCATION_MAP_SETUP(new_context->allocation_map);
+    new_context->escape_set_pool = carat_escape_set_pool_create();
+    new_context->stop_scope = NULL; // Set by the owning aspace
 
 
 #if 0
@@ -1099,10 +2386,46 @@ nk_carat_context * initialize_new_carat_context(void)
 
 
 	/*
-	 * Set of escape window and its corresponding statistics/counters
+	 * Set up the escape window --- one buffer per CPU, splitting 
+     * ESCAPE_WINDOW_BYTES between them (with a floor, so that many-core
+     * machines do not end up draining constantly)
 	 */ 
-    RESET_ESCAPE_WINDOW(new_context);
-    new_context->escape_window = ((void ***) CARAT_MALLOC(ESCAPE_WINDOW_SIZE * sizeof(void *)));
+    uint64_t num_cpus = nk_get_num_cpus();
+    uint64_t buffer_capacity = ESCAPE_WINDOW_SIZE / num_cpus;
+    if (buffer_capacity < ESCAPE_BUFFER_MIN_SIZE) { buffer_capacity = ESCAPE_BUFFER_MIN_SIZE; }
+#ifdef NAUT_CONFIG_CARAT_COMPRESSED_ESCAPE_LOG
+    buffer_capacity *= sizeof(void *); // Same memory, in bytes of log
+#endif
+
+    new_context->num_escape_buffers = num_cpus;
+    new_context->escape_buffers = ((carat_escape_buffer *) CARAT_MALLOC(num_cpus * sizeof(carat_escape_buffer)));
+    memset(new_context->escape_buffers, 0, num_cpus * sizeof(carat_escape_buffer));
+
+    for (uint64_t i = 0; i < num_cpus; i++)
+    {
+        carat_escape_buffer *buffer = FETCH_ESCAPE_BUFFER(new_context, i);
+        buffer->capacity = buffer_capacity;
+#ifdef NAUT_CONFIG_CARAT_COMPRESSED_ESCAPE_LOG
+        buffer->log = ((uint8_t *) CARAT_MALLOC(buffer_capacity + ESCAPE_LOG_SLACK));
+        buffer->blocks = ((uint32_t *) CARAT_MALLOC(((buffer_capacity / ESCAPE_LOG_BLOCK) + 1) * sizeof(uint32_t)));
+        buffer->decoded = ((void ***) CARAT_MALLOC(ESCAPE_LOG_DECODE_CHUNK * sizeof(void *)));
+        memset(buffer->log, 0, buffer_capacity + ESCAPE_LOG_SLACK);
+#else
+        buffer->escapes = ((void ***) CARAT_MALLOC(buffer_capacity * sizeof(void *)));
+#endif
+        buffer->filter = ((void ***) CARAT_MALLOC(ESCAPE_FILTER_SLOTS * sizeof(void *)));
+        RESET_ESCAPE_BUFFER(buffer);
+    }
+
+    spinlock_init(&(new_context->escape_lock));
+
+    new_context->migration_mode = CARAT_MIGRATION_STOP_WORLD;
+    new_context->migration_pause_budget = NAUT_CONFIG_CARAT_MIGRATION_PAUSE_BUDGET_US * 1000UL;
+    new_context->migration = NULL;
+    new_context->migration_start = new_context->migration_end = NULL;
+    new_context->migration_barrier_users = 0;
+    new_context->drain_workers = ((carat_drain_worker *) CARAT_MALLOC(num_cpus * sizeof(carat_drain_worker)));
+    memset(new_context->drain_workers, 0, num_cpus * sizeof(carat_drain_worker));
 
 
 	/*
@@ -1115,6 +2438,53 @@ nk_carat_context * initialize_new_carat_context(void)
 }
 
 
+NO_CARAT
+void destroy_carat_context(nk_carat_context *the_context)
+{
+    CARAT_READY_OFF(the_context);
+
+
+    /*
+     * Allocation entries, map nodes, and escape sets all live in slabs
+     * and arenas, so this is proportional to the number of slabs, not
+     * to the number of tracked allocations
+     */
+    CARAT_ALLOCATION_MAP_DESTROY(the_context->allocation_map);
+    carat_escape_set_pool_destroy(the_context->escape_set_pool);
+
+
+    for (uint64_t i = 0; i < the_context->num_escape_buffers; i++)
+    {
+        carat_escape_buffer *buffer = FETCH_ESCAPE_BUFFER(the_context, i);
+#ifdef NAUT_CONFIG_CARAT_COMPRESSED_ESCAPE_LOG
+        free(buffer->log);
+        free(buffer->blocks);
+        free(buffer->decoded);
+#else
+        free(buffer->escapes);
+#endif
+        free(buffer->filter);
+    }
+
+    free(the_context->escape_buffers);
+
+
+    for (uint64_t i = 0; i < the_context->num_escape_buffers; i++) 
+    {
+        carat_drain_worker *worker = &(the_context->drain_workers[i]);
+        free(worker->records);
+        free(worker->sorted);
+        free(worker->shard_start);
+    }
+
+    free(the_context->drain_workers);
+
+    free(the_context);
+
+    return;
+}
+
+
 /*
  * ---------- Profiling ----------
  */ 
@@ -1126,116 +2496,391 @@ void _results(void)
 }
 
 
+/*
+ * Names of the latency histograms, for output
+ */
+#define CARAT_HISTOGRAM_NAME(field) { #field, offsetof(carat_profile_histograms, field) }
+
+static struct {
+    char *name;
+    uint64_t offset;
+} carat_histogram_names[] = {
+    CARAT_HISTOGRAM_NAME(rb_malloc_time),
+    CARAT_HISTOGRAM_NAME(rb_free_time),
+    CARAT_HISTOGRAM_NAME(guard_address_time),
+    CARAT_HISTOGRAM_NAME(request_permission_time),
+    CARAT_HISTOGRAM_NAME(guard_stack_time),
+    CARAT_HISTOGRAM_NAME(guard_range_time),
+    CARAT_HISTOGRAM_NAME(tracking_call_time),
+    CARAT_HISTOGRAM_NAME(escape_call_time),
+    CARAT_HISTOGRAM_NAME(cleanup_time),
+    CARAT_HISTOGRAM_NAME(find_entry_time),
+    CARAT_HISTOGRAM_NAME(patch_escapes_time),
+    CARAT_HISTOGRAM_NAME(patch_stack_regs_time),
+    CARAT_HISTOGRAM_NAME(update_entry_time),
+    CARAT_HISTOGRAM_NAME(memmove_time),
+    CARAT_HISTOGRAM_NAME(reinstrument_contained_time),
+};
+
+#define CARAT_NUM_HISTOGRAMS (sizeof(carat_histogram_names) / sizeof(carat_histogram_names[0]))
+
+#define CARAT_FETCH_HISTOGRAM(histograms, index) \
+    ((carat_latency_histogram *) (((void *) (histograms)) + carat_histogram_names[index].offset))
+
+
+/*
+ * Sum of the per-CPU profiles --- every field is a counter except
+ * migration_pause_max
+ */
+NO_CARAT
+static void _carat_profile_aggregate(carat_profile *total)
+{
+    memset(total, 0, sizeof(carat_profile));
+
+    for (int cpu = 0; cpu < nk_get_num_cpus(); cpu++)
+    {
+        uint64_t *from = (uint64_t *) &(global_carat_profile[cpu]);
+        uint64_t *to = (uint64_t *) total;
+        for (int i = 0; i < (sizeof(carat_profile) / sizeof(uint64_t)); i++) { to[i] += from[i]; }
+    }
+
+    total->migration_pause_max = 0;
+    for (int cpu = 0; cpu < nk_get_num_cpus(); cpu++) {
+        if (global_carat_profile[cpu].migration_pause_max > total->migration_pause_max) {
+            total->migration_pause_max = global_carat_profile[cpu].migration_pause_max;
+        }
+    }
+
+    return;
+}
+
+
+NO_CARAT
+static void _carat_histogram_aggregate(int index, carat_latency_histogram *total)
+{
+    memset(total, 0, sizeof(carat_latency_histogram));
+
+    for (int cpu = 0; cpu < nk_get_num_cpus(); cpu++)
+    {
+        carat_latency_histogram *histogram = CARAT_FETCH_HISTOGRAM(&(global_carat_histograms[cpu]), index);
+        for (int b = 0; b < CARAT_PROFILE_HISTOGRAM_BUCKETS; b++) { total->buckets[b] += histogram->buckets[b]; }
+    }
+
+    return;
+}
+
+
+/*
+ * Upper bound (in cycles) of the bucket holding the @percent-th percentile
+ */
+NO_CARAT
+static uint64_t _carat_histogram_percentile(carat_latency_histogram *histogram, uint64_t count, uint64_t percent)
+{
+    uint64_t target = ((count * percent) + 99) / 100;
+    uint64_t seen = 0;
+
+    for (int b = 0; b < CARAT_PROFILE_HISTOGRAM_BUCKETS; b++)
+    {
+        seen += histogram->buckets[b];
+        if (seen >= target) { return (1UL << b); }
+    }
+
+    return (1UL << (CARAT_PROFILE_HISTOGRAM_BUCKETS - 1));
+}
+
+
+NO_CARAT
+static void _carat_print_histograms(void)
+{
+    nk_vc_printf("---latency histograms (cycles, log2 buckets)---\n");
+
+    for (int i = 0; i < CARAT_NUM_HISTOGRAMS; i++)
+    {
+        carat_latency_histogram total;
+        _carat_histogram_aggregate(i, &total);
+
+        uint64_t count = 0;
+        for (int b = 0; b < CARAT_PROFILE_HISTOGRAM_BUCKETS; b++) { count += total.buckets[b]; }
+        if (!count) { continue; }
+
+        nk_vc_printf(
+            "%s: count: %lu, p50 < %lu, p90 < %lu, p99 < %lu, max < %lu\n",
+            carat_histogram_names[i].name,
+            count,
+            _carat_histogram_percentile(&total, count, 50),
+            _carat_histogram_percentile(&total, count, 90),
+            _carat_histogram_percentile(&total, count, 99),
+            _carat_histogram_percentile(&total, count, 100)
+        );
+    }
+
+    return;
+}
+
+
+/*
+ * Writes every non-empty histogram bucket of every CPU to @path as CSV:
+ * histogram,cpu,bucket,min_cycles,max_cycles,count --- an interval falls
+ * in [min_cycles, max_cycles), except in the last bucket, which is open
+ */
+NO_CARAT
+static int _carat_dump_histograms(char *path)
+{
+    nk_fs_fd_t fd = nk_fs_open(path, O_CREAT | O_WRONLY | O_TRUNC, 0);
+    if (FS_FD_ERR(fd)) 
+    {
+        nk_vc_printf("Could not open %s\n", path);
+        return -1;
+    }
+
+    char line[128];
+    int len = snprintf(line, sizeof(line), "histogram,cpu,bucket,min_cycles,max_cycles,count\n");
+    nk_fs_write(fd, line, len);
+
+    for (int i = 0; i < CARAT_NUM_HISTOGRAMS; i++)
+    {
+        for (int cpu = 0; cpu < nk_get_num_cpus(); cpu++)
+        {
+            carat_latency_histogram *histogram = CARAT_FETCH_HISTOGRAM(&(global_carat_histograms[cpu]), i);
+
+            for (int b = 0; b < CARAT_PROFILE_HISTOGRAM_BUCKETS; b++)
+            {
+                if (!(histogram->buckets[b])) { continue; }
+
+                len = snprintf(
+                    line, sizeof(line), "%s,%d,%d,%lu,%lu,%lu\n",
+                    carat_histogram_names[i].name, cpu, b,
+                    (b) ? (1UL << (b - 1)) : 0,
+                    (1UL << b),
+                    histogram->buckets[b]
+                );
+
+                nk_fs_write(fd, line, len);
+            }
+        }
+    }
+
+    nk_fs_close(fd);
+
+    nk_vc_printf("Wrote CARAT latency histograms to %s\n", path);
+
+    return 0;
+}
+
+
 /* 
  * Shell command handler
  */
 NO_CARAT
 static int handle_protections_profile(char *buf, void *priv)
 {
-    nk_vc_printf("---carat profile---\n");
+    char path[256];
+    if (sscanf(buf, "profile dump %255s", path) == 1) { return _carat_dump_histograms(path); }
+
+    if (!strncmp(buf, "profile reset", 13))
+    {
+        memset(global_carat_profile, 0, sizeof(global_carat_profile));
+        memset(global_carat_histograms, 0, sizeof(global_carat_histograms));
+        memset(global_carat_escape_profile, 0, sizeof(global_carat_escape_profile));
+        nk_vc_printf("CARAT profile reset\n");
+        return 0;
+    }
 
-    nk_vc_printf("num_rb_mallocs: %lu\n", global_carat_profile.num_rb_mallocs);
-    nk_vc_printf("num_rb_frees: %lu\n", global_carat_profile.num_rb_frees);
-    nk_vc_printf("guard_address_calls: %lu\n", global_carat_profile.guard_address_calls);
-    nk_vc_printf("guard_stack_calls: %lu\n", global_carat_profile.guard_stack_calls);
-    nk_vc_printf("tracking_calls: %lu\n", global_carat_profile.tracking_calls);
-    nk_vc_printf("escape_calls: %lu\n", global_carat_profile.escape_calls);
-    nk_vc_printf("move_calls: %lu\n", global_carat_profile.move_calls);
 
-    if (global_carat_profile.num_rb_mallocs)
+    carat_profile profile;
+    _carat_profile_aggregate(&profile);
+
+    nk_vc_printf("---carat profile---\n");
+
+    nk_vc_printf("num_rb_mallocs: %lu\n", profile.num_rb_mallocs);
+    nk_vc_printf("num_rb_frees: %lu\n", profile.num_rb_frees);
+    nk_vc_printf("guard_address_calls: %lu\n", profile.guard_address_calls);
+    nk_vc_printf("guard_stack_calls: %lu\n", profile.guard_stack_calls);
+    nk_vc_printf("stack_growths: %lu\n", profile.stack_growths);
+    nk_vc_printf("guard_range_calls: %lu\n", profile.guard_range_calls);
+    nk_vc_printf("guard_range_bytes: %lu\n", profile.guard_range_bytes);
+    nk_vc_printf("tracking_calls: %lu\n", profile.tracking_calls);
+    nk_vc_printf("escape_calls: %lu\n", profile.escape_calls);
+    nk_vc_printf("move_calls: %lu\n", profile.move_calls);
+
+    if (profile.num_rb_mallocs)
     {
         nk_vc_printf(
             "average rb_malloc_time: %lu\n", 
-            global_carat_profile.rb_malloc_time / global_carat_profile.num_rb_mallocs
+            profile.rb_malloc_time / profile.num_rb_mallocs
         );
     }
 
-    if (global_carat_profile.num_rb_frees)
+    if (profile.num_rb_frees)
     {
         nk_vc_printf(
             "average rb_free_time: %lu\n", 
-            global_carat_profile.rb_free_time / global_carat_profile.num_rb_frees
+            profile.rb_free_time / profile.num_rb_frees
         );
     }
 
-    if (global_carat_profile.guard_address_calls)
+    if (profile.guard_address_calls)
     {
         nk_vc_printf(
             "average guard_address_time: %lu\n", 
-            global_carat_profile.guard_address_time / global_carat_profile.guard_address_calls
+            profile.guard_address_time / profile.guard_address_calls
+        );
+
+        nk_vc_printf(
+            "average request_permission_time: %lu\n", 
+            profile.request_permission_time / profile.guard_address_calls
         );
     }
 
-    if (global_carat_profile.guard_stack_calls)
+    if (profile.guard_stack_calls)
     {
         nk_vc_printf(
             "average guard_stack_time: %lu\n", 
-            global_carat_profile.guard_stack_time / global_carat_profile.guard_stack_calls
+            profile.guard_stack_time / profile.guard_stack_calls
+        );
+    }
+
+    if (profile.guard_range_calls)
+    {
+        nk_vc_printf(
+            "average guard_range_time: %lu\n", 
+            profile.guard_range_time / profile.guard_range_calls
         );
     }
 
 
-    if (global_carat_profile.tracking_calls)
+    if (profile.tracking_calls)
     {
         nk_vc_printf(
             "average tracking_call_time: %lu\n", 
-            global_carat_profile.tracking_call_time / global_carat_profile.tracking_calls
+            profile.tracking_call_time / profile.tracking_calls
         );
     }
 
-    if (global_carat_profile.escape_calls)
+    if (profile.escape_calls)
     {
         nk_vc_printf(
             "average escape_call_time: %lu\n", 
-            global_carat_profile.escape_call_time / global_carat_profile.escape_calls
+            profile.escape_call_time / profile.escape_calls
         );
     }
 
-    if (global_carat_profile.move_calls)
+    if (profile.move_calls)
     {
 
         nk_vc_printf(
             "average cleanup_time: %lu\n", 
-            global_carat_profile.cleanup_time / global_carat_profile.move_calls
+            profile.cleanup_time / profile.move_calls
         );
 
         nk_vc_printf(
             "average find_entry_time: %lu\n", 
-            global_carat_profile.find_entry_time / global_carat_profile.move_calls
+            profile.find_entry_time / profile.move_calls
         );
 
         nk_vc_printf(
             "average patch_escapes_time: %lu\n", 
-            global_carat_profile.patch_escapes_time / global_carat_profile.move_calls
+            profile.patch_escapes_time / profile.move_calls
         );
 
         nk_vc_printf(
             "average patch_stack_regs_time: %lu\n", 
-            global_carat_profile.patch_stack_regs_time / global_carat_profile.move_calls
+            profile.patch_stack_regs_time / profile.move_calls
         );
 
         nk_vc_printf(
             "average update_entry_time: %lu\n", 
-            global_carat_profile.update_entry_time / global_carat_profile.move_calls
+            profile.update_entry_time / profile.move_calls
         );
 
         nk_vc_printf(
             "average memmove_time: %lu\n", 
-            global_carat_profile.memmove_time / global_carat_profile.move_calls
+            profile.memmove_time / profile.move_calls
         );
 
         nk_vc_printf(
             "average reinstrument_contained_time: %lu\n", 
-            global_carat_profile.reinstrument_contained_time / global_carat_profile.move_calls
+            profile.reinstrument_contained_time / profile.move_calls
         );
 
         nk_vc_printf(
             "average process_window_2_time: %lu\n", 
-            global_carat_profile.process_window_2_time / global_carat_profile.move_calls
+            profile.process_window_2_time / profile.move_calls
+        );
+
+    }
+
+
+    nk_vc_printf("parallel_drain_calls: %lu\n", profile.parallel_drain_calls);
+
+    if (profile.parallel_drain_calls)
+    {
+        nk_vc_printf("parallel_drain_entries: %lu\n", profile.parallel_drain_entries);
+
+        nk_vc_printf(
+            "average parallel_lookup_time: %lu\n", 
+            profile.parallel_lookup_time / profile.parallel_drain_calls
+        );
+
+        nk_vc_printf(
+            "average parallel_insert_time: %lu\n", 
+            profile.parallel_insert_time / profile.parallel_drain_calls
+        );
+    }
+
+
+    nk_vc_printf("permission_cache_hits: %lu\n", profile.permission_cache_hits);
+    nk_vc_printf("permission_cache_misses: %lu\n", profile.permission_cache_misses);
+    nk_vc_printf(
+        "requested_permission_updates: %lu (of %lu guard_address_calls)\n", 
+        profile.requested_permission_updates, 
+        profile.guard_address_calls
+    );
+    nk_vc_printf("metadata_slabs: %lu\n", profile.metadata_slabs);
+
+    nk_vc_printf("concurrent_migrations: %lu\n", profile.concurrent_migrations);
+    nk_vc_printf("concurrent_migration_aborts: %lu\n", profile.concurrent_migration_aborts);
+
+    if (profile.concurrent_migrations)
+    {
+        nk_vc_printf("migration_precopied_bytes: %lu\n", profile.migration_precopied_bytes);
+        nk_vc_printf("migration_recopied_bytes: %lu\n", profile.migration_recopied_bytes);
+        nk_vc_printf("migration_unbarriered_recopies: %lu\n", profile.migration_unbarriered_recopies);
+        nk_vc_printf("migration_dropped_moves: %lu\n", profile.migration_dropped_moves);
+
+        nk_vc_printf(
+            "average migration_pause_time (ns): %lu\n", 
+            profile.migration_pause_time / profile.concurrent_migrations
         );
 
+        nk_vc_printf("migration_pause_max (ns): %lu\n", profile.migration_pause_max);
+        nk_vc_printf("migration_pause_overruns: %lu\n", profile.migration_pause_overruns);
+    }
+
+
+    nk_vc_printf("---per-cpu escape window---\n");
+    for (int i = 0; i < nk_get_num_cpus(); i++)
+    {
+        carat_escape_profile *profile = &(global_carat_escape_profile[i]);
+        if (!(profile->append_calls) && !(profile->drain_calls) && !(profile->log_entries)) { continue; }
+
+        nk_vc_printf(
+            "cpu %d: appends: %lu, average append_time: %lu, drains: %lu, drained_entries: %lu, bytes per entry (x10): %lu, filtered_entries: %lu, average drain_time: %lu, log_entries: %lu\n",
+            i,
+            profile->append_calls,
+            (profile->append_calls) ? (profile->append_time / profile->append_calls) : 0,
+            profile->drain_calls,
+            profile->drained_entries,
+            (profile->drained_entries) ? ((profile->drained_bytes * 10) / profile->drained_entries) : 0,
+            profile->filtered_entries,
+            (profile->drain_calls) ? (profile->drain_time / profile->drain_calls) : 0,
+            profile->log_entries
+        );
     }
 
+
+    _carat_print_histograms();
+
   
 #if 0
 
@@ -1293,8 +2938,84 @@ static int handle_protections_profile(char *buf, void *priv)
 
 static struct shell_cmd_impl handle_protections_profile_impl = {
     .cmd = "profile",
-    .help_str = "profile carat",
+    .help_str = "profile [reset | dump <path>] (carat)",
     .handler = handle_protections_profile,
 };
 
 nk_register_shell_cmd(handle_protections_profile_impl);
+
+
+NO_CARAT
+static int handle_drain_mode(char *buf, void *priv)
+{
+    char mode[32];
+    if (sscanf(buf, "carat_drain_mode %31s", mode) == 1)
+    {
+        if (!strcmp(mode, "serial")) { 
+            carat_escape_drain_mode = CARAT_ESCAPE_DRAIN_SERIAL; 
+        } else if (!strcmp(mode, "parallel")) { 
+            carat_escape_drain_mode = CARAT_ESCAPE_DRAIN_PARALLEL; 
+        } else {
+            nk_vc_printf("carat_drain_mode: unknown mode %s\n", mode);
+            return 0;
+        }
+    }
+
+    nk_vc_printf(
+        "carat_drain_mode: %s\n", 
+        (carat_escape_drain_mode == CARAT_ESCAPE_DRAIN_PARALLEL) ? "parallel" : "serial"
+    );
+
+    return 0;
+}
+
+static struct shell_cmd_impl handle_drain_mode_impl = {
+    .cmd = "carat_drain_mode",
+    .help_str = "carat_drain_mode [serial|parallel]",
+    .handler = handle_drain_mode,
+};
+
+nk_register_shell_cmd(handle_drain_mode_impl);
+
+
+NO_CARAT
+static int handle_migration_mode(char *buf, void *priv)
+{
+    /*
+     * Fetch the current context --- a HACK
+     */
+    nk_carat_context *the_context = FETCH_CARAT_CONTEXT;
+
+    char mode[32];
+    uint64_t budget_us;
+    int args = sscanf(buf, "carat_migration %31s %lu", mode, &budget_us);
+    if (args >= 1)
+    {
+        if (!strcmp(mode, "stw")) { 
+            the_context->migration_mode = CARAT_MIGRATION_STOP_WORLD; 
+        } else if (!strcmp(mode, "concurrent")) { 
+            the_context->migration_mode = CARAT_MIGRATION_CONCURRENT; 
+        } else {
+            nk_vc_printf("carat_migration: unknown mode %s\n", mode);
+            return 0;
+        }
+    }
+
+    if (args == 2) { the_context->migration_pause_budget = budget_us * 1000UL; }
+
+    nk_vc_printf(
+        "carat_migration: %s, pause budget %lu us\n", 
+        (the_context->migration_mode == CARAT_MIGRATION_CONCURRENT) ? "concurrent" : "stw",
+        the_context->migration_pause_budget / 1000UL
+    );
+
+    return 0;
+}
+
+static struct shell_cmd_impl handle_migration_mode_impl = {
+    .cmd = "carat_migration",
+    .help_str = "carat_migration [stw|concurrent] [pause budget (us)]",
+    .handler = handle_migration_mode,
+};
+
+nk_register_shell_cmd(handle_migration_mode_impl);
@@ -0,0 +1,203 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh,
+ * 			Brian Suchy, Peter Dinda
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/spinlock.h>
+#include <nautilus/shell.h>
+#include <aspace/runtime_tables.h>
+#include <aspace/sampling.h>
+
+
+volatile int carat_sampling = 0;
+uint64_t carat_sample_period = CARAT_SAMPLE_DEFAULT_PERIOD;
+carat_sampler carat_samplers[NAUT_CONFIG_MAX_CPUS];
+
+
+static struct {
+    spinlock_t lock;
+    struct {
+        carat_sample_consumer consumer;
+        void *state;
+        int active;
+    } consumers[CARAT_SAMPLE_MAX_CONSUMERS];
+    int num_active;
+    int allocated;
+    carat_sampling_stats stats;
+} sampling;
+
+
+NO_CARAT
+static int _allocate_rings(void)
+{
+    if (sampling.allocated) { return 0; }
+
+    for (int cpu = 0; cpu < nk_get_num_cpus(); cpu++) 
+    {
+        carat_sampler *sampler = &(carat_samplers[cpu]);
+        sampler->samples = (void **) malloc(CARAT_SAMPLES_PER_CPU * sizeof(void *));
+        if (!(sampler->samples)) { return -1; }
+        sampler->countdown = carat_sample_period;
+        sampler->head = sampler->tail = 0;
+    }
+
+    sampling.allocated = 1;
+
+    return 0;
+}
+
+
+int nk_carat_sampling_start(carat_sample_consumer consumer, void *state)
+{
+    int rc = -1;
+
+    spin_lock(&(sampling.lock));
+
+    if (_allocate_rings()) { goto out; }
+
+    for (int i = 0; i < CARAT_SAMPLE_MAX_CONSUMERS; i++)
+    {
+        if (sampling.consumers[i].active) { continue; }
+
+        sampling.consumers[i].consumer = consumer;
+        sampling.consumers[i].state = state;
+        sampling.consumers[i].active = 1;
+        sampling.num_active++;
+        carat_sampling = 1;
+        rc = 0;
+        break;
+    }
+
+out:
+    spin_unlock(&(sampling.lock));
+    return rc;
+}
+
+
+void nk_carat_sampling_stop(carat_sample_consumer consumer, void *state)
+{
+    spin_lock(&(sampling.lock));
+
+    for (int i = 0; i < CARAT_SAMPLE_MAX_CONSUMERS; i++)
+    {
+        if (!(sampling.consumers[i].active)
+            || (sampling.consumers[i].consumer != consumer)
+            || (sampling.consumers[i].state != state)) 
+        { 
+            continue; 
+        }
+
+        sampling.consumers[i].active = 0;
+        if (!(--(sampling.num_active))) { carat_sampling = 0; }
+        break;
+    }
+
+    spin_unlock(&(sampling.lock));
+    return;
+}
+
+
+void nk_carat_sampling_drain(nk_carat_context *the_context)
+{
+    if (!(sampling.allocated)) { return; }
+
+    sampling.stats.drains++;
+
+    for (int cpu = 0; cpu < nk_get_num_cpus(); cpu++)
+    {
+        carat_sampler *sampler = &(carat_samplers[cpu]);
+
+        /*
+         * The ring is lossy --- only the newest samples survive
+         */
+        uint64_t head = sampler->head;
+        uint64_t tail = sampler->tail;
+        if ((head - tail) > CARAT_SAMPLES_PER_CPU) { tail = head - CARAT_SAMPLES_PER_CPU; }
+
+        for (; tail < head; tail++)
+        {
+            void *address = sampler->samples[tail % CARAT_SAMPLES_PER_CPU];
+            sampling.stats.samples++;
+
+            allocation_entry *the_entry = _carat_find_allocation_entry(the_context, address);
+            if (!the_entry) 
+            {
+                sampling.stats.unattributed_samples++;
+                continue;
+            }
+
+            if (the_entry->heat < CARAT_HEAT_MAX) { the_entry->heat++; }
+
+            for (int i = 0; i < CARAT_SAMPLE_MAX_CONSUMERS; i++)
+            {
+                if (sampling.consumers[i].active && sampling.consumers[i].consumer) {
+                    sampling.consumers[i].consumer(the_entry, cpu, sampling.consumers[i].state);
+                }
+            }
+        }
+
+        sampler->tail = head;
+    }
+
+    return;
+}
+
+
+/*
+ * =================== Shell ===================
+ */
+
+NO_CARAT
+static int handle_carat_sampling(char *buf, void *priv)
+{
+    uint64_t period;
+
+    if (sscanf(buf, "carat_sampling period %lu", &period) == 1) {
+        carat_sample_period = (period) ? period : 1;
+    }
+
+    nk_vc_printf(
+        "CARAT sampling %s: every %lu guards, consumers: %d, drains: %lu, samples: %lu (unattributed %lu)\n",
+        (carat_sampling) ? "on" : "off",
+        carat_sample_period,
+        sampling.num_active,
+        sampling.stats.drains,
+        sampling.stats.samples,
+        sampling.stats.unattributed_samples
+    );
+
+    return 0;
+}
+
+
+static struct shell_cmd_impl carat_sampling_impl = {
+    .cmd = "carat_sampling",
+    .help_str = "carat_sampling [period <guards per sample>]",
+    .handler = handle_carat_sampling,
+};
+
+nk_register_shell_cmd(carat_sampling_impl);
@@ -0,0 +1,243 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh,
+ * 			Brian Suchy, Peter Dinda
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/list.h>
+#include <aspace/carat.h>
+#include <aspace/slab.h>
+
+
+/*
+ * =================== Slab caches ===================
+ */
+
+NO_CARAT
+carat_slab_cache *carat_slab_cache_create(uint64_t object_size)
+{
+    carat_slab_cache *cache = (carat_slab_cache *) CARAT_MALLOC(sizeof(carat_slab_cache));
+
+    object_size = (object_size + CARAT_SLAB_ALIGN - 1) & ~((uint64_t) (CARAT_SLAB_ALIGN - 1));
+    if (object_size < sizeof(void *)) { object_size = CARAT_SLAB_ALIGN; }
+
+    uint64_t slab_bytes = CARAT_SLAB_HEADER + (CARAT_SLAB_MIN_OBJECTS * object_size);
+    if (slab_bytes < CARAT_SLAB_MIN_BYTES) { slab_bytes = CARAT_SLAB_MIN_BYTES; }
+
+    cache->object_size = object_size;
+    cache->objects_per_slab = (slab_bytes - CARAT_SLAB_HEADER) / object_size;
+    cache->slab_bytes = slab_bytes;
+
+    spinlock_init(&(cache->lock));
+    cache->slabs = NULL;
+    cache->num_slabs = 0;
+
+    cache->num_cpus = nk_get_num_cpus();
+    cache->cpus = (carat_slab_cpu *) CARAT_MALLOC(cache->num_cpus * sizeof(carat_slab_cpu));
+    memset(cache->cpus, 0, cache->num_cpus * sizeof(carat_slab_cpu));
+
+    return cache;
+}
+
+
+/*
+ * Releases every slab at once --- outstanding objects die with them
+ */
+NO_CARAT
+void carat_slab_cache_destroy(carat_slab_cache *cache)
+{
+    void *slab = cache->slabs;
+    while (slab)
+    {
+        void *next = *((void **) slab);
+        free(slab);
+        slab = next;
+    }
+
+    free(cache->cpus);
+    free(cache);
+
+    return;
+}
+
+
+/*
+ * Add a new slab to @cache and hand all of its objects to @cpu --- 
+ * interrupts must be off
+ */
+NO_CARAT
+static void _carat_slab_grow(carat_slab_cache *cache, carat_slab_cpu *cpu)
+{
+    void *slab = CARAT_MALLOC(cache->slab_bytes);
+
+    spin_lock(&(cache->lock));
+    *((void **) slab) = cache->slabs;
+    cache->slabs = slab;
+    cache->num_slabs++;
+    spin_unlock(&(cache->lock));
+
+    CARAT_PROFILE_INCR(CARAT_DO_PROFILE, metadata_slabs);
+
+    /*
+     * Chain the objects in address order, so consecutive allocations 
+     * are contiguous
+     */
+    void *first = slab + CARAT_SLAB_HEADER;
+    for (uint64_t i = 0; i < cache->objects_per_slab; i++)
+    {
+        void *object = first + (i * cache->object_size);
+        *((void **) object) = (i + 1 < cache->objects_per_slab) ? (object + cache->object_size) : cpu->free;
+    }
+
+    cpu->free = first;
+
+    return;
+}
+
+
+NO_CARAT
+void *carat_slab_alloc(carat_slab_cache *cache)
+{
+    uint8_t flags = irq_disable_save();
+
+    carat_slab_cpu *cpu = &(cache->cpus[my_cpu_id()]);
+    if (!(cpu->free)) { _carat_slab_grow(cache, cpu); }
+
+    void *object = cpu->free;
+    cpu->free = *((void **) object);
+
+    irq_enable_restore(flags);
+
+    return object;
+}
+
+
+NO_CARAT
+void carat_slab_free(carat_slab_cache *cache, void *object)
+{
+    uint8_t flags = irq_disable_save();
+
+    carat_slab_cpu *cpu = &(cache->cpus[my_cpu_id()]);
+    *((void **) object) = cpu->free;
+    cpu->free = object;
+
+    irq_enable_restore(flags);
+
+    return;
+}
+
+
+/*
+ * =================== Arenas ===================
+ */
+
+/*
+ * Header of an object above the largest class
+ */
+typedef struct carat_arena_large_t {
+    struct list_head node;
+} __attribute__((aligned(CARAT_SLAB_ALIGN))) carat_arena_large;
+
+
+NO_CARAT
+static inline int _carat_arena_class(uint64_t size)
+{
+    int shift = CARAT_ARENA_MIN_SHIFT;
+    while ((shift <= CARAT_ARENA_MAX_SHIFT) && ((1UL << shift) < size)) { shift++; }
+    return shift - CARAT_ARENA_MIN_SHIFT;
+}
+
+
+NO_CARAT
+carat_arena *carat_arena_create(void)
+{
+    carat_arena *arena = (carat_arena *) CARAT_MALLOC(sizeof(carat_arena));
+
+    for (int i = 0; i < CARAT_ARENA_CLASSES; i++) {
+        arena->classes[i] = carat_slab_cache_create(1UL << (i + CARAT_ARENA_MIN_SHIFT));
+    }
+
+    spinlock_init(&(arena->lock));
+    INIT_LIST_HEAD(&(arena->large));
+
+    return arena;
+}
+
+
+NO_CARAT
+void carat_arena_destroy(carat_arena *arena)
+{
+    for (int i = 0; i < CARAT_ARENA_CLASSES; i++) {
+        carat_slab_cache_destroy(arena->classes[i]);
+    }
+
+    struct list_head *cur, *next;
+    list_for_each_safe(cur, next, &(arena->large)) {
+        free(list_entry(cur, carat_arena_large, node));
+    }
+
+    free(arena);
+
+    return;
+}
+
+
+NO_CARAT
+void *carat_arena_alloc(carat_arena *arena, uint64_t size)
+{
+    int index = _carat_arena_class(size);
+    if (index < CARAT_ARENA_CLASSES) { return carat_slab_alloc(arena->classes[index]); }
+
+    carat_arena_large *large = (carat_arena_large *) CARAT_MALLOC(sizeof(carat_arena_large) + size);
+
+    uint8_t flags = spin_lock_irq_save(&(arena->lock));
+    list_add(&(large->node), &(arena->large));
+    spin_unlock_irq_restore(&(arena->lock), flags);
+
+    return (void *) (large + 1);
+}
+
+
+NO_CARAT
+void carat_arena_free(carat_arena *arena, void *object, uint64_t size)
+{
+    int index = _carat_arena_class(size);
+    if (index < CARAT_ARENA_CLASSES) 
+    { 
+        carat_slab_free(arena->classes[index], object); 
+        return;
+    }
+
+    carat_arena_large *large = ((carat_arena_large *) object) - 1;
+
+    uint8_t flags = spin_lock_irq_save(&(arena->lock));
+    list_del(&(large->node));
+    spin_unlock_irq_restore(&(arena->lock), flags);
+
+    free(large);
+
+    return;
+}
@@ -34,6 +34,21 @@
     CARAT_PROFILE_STOP_COMMIT_RESET(CARAT_DO_PROFILE, rb_free_time, 0); \
 })
 
+/*
+ * Nodes of a tree with a node slab (the CARAT allocation map) come
+ * from the slab, and are released all at once when the tree is destroyed
+ */
+#define RB_NODE_MALLOC(tree) \
+    ((tree)->node_slab ? \
+     (mm_rb_node_t *) carat_slab_alloc((tree)->node_slab) : \
+     (mm_rb_node_t *) MALLOC_RB(sizeof(mm_rb_node_t)))
+
+#define RB_NODE_FREE(tree, __ptr) \
+({ \
+    if ((tree)->node_slab) { carat_slab_free((tree)->node_slab, (__ptr)); } \
+    else { RB_FREE(__ptr); } \
+})
+
 
 
 #define NUM2COLOR(n) (((n) == BLACK) ? 'B' : 'R')
@@ -45,6 +60,7 @@
 
 // HACK for carat integration
 #include <aspace/carat.h>
+#include <aspace/slab.h>
 
 /*
          |                    |   
@@ -173,7 +189,7 @@ int rb_tree_insert(mm_struct_t * self, nk_aspace_region_t * region) {
     mm_rb_node_t * curr = tree->root;
     mm_rb_node_t * parent = tree->NIL;
 
-    mm_rb_node_t * wrapper = (mm_rb_node_t *) MALLOC_RB(sizeof(mm_rb_node_t));
+    mm_rb_node_t * wrapper = RB_NODE_MALLOC(tree);
     
     wrapper->region = *region;
     
@@ -434,7 +450,7 @@ void rb_tree_delete_node(mm_rb_tree_t * tree, mm_rb_node_t * z) {
     // If y is originally a black one, we need to call the fixup function to fix the extra blackness. 
     // printf("try to fixup\n");
     if (original_color == BLACK) rb_tree_delete_fixup(tree, x);
-    RB_FREE(z);
+    RB_NODE_FREE(tree, z);
 
     tree->super.size = tree->super.size - 1;
 }
@@ -1050,7 +1066,11 @@ int mm_rb_tree_destroy(mm_struct_t * self) {
     DEBUG_RB("Try to destroy rb tree at %p\n", self);
     mm_rb_tree_t * tree = (mm_rb_tree_t *) self;
 
-    mm_rb_node_destroy(tree, tree->root);
+    if (tree->node_slab) {
+        carat_slab_cache_destroy(tree->node_slab);
+    } else {
+        mm_rb_node_destroy(tree, tree->root);
+    }
     RB_FREE(tree->NIL);
 
     RB_FREE(tree);
@@ -1097,6 +1117,7 @@ mm_struct_t * mm_rb_tree_create() {
 
     rbtree->NIL = create_rb_NIL();
     rbtree->root = rbtree->NIL;
+    rbtree->node_slab = NULL;
     rbtree->compf = &rb_comp_region;
 
     return &rbtree->super;
@@ -1129,6 +1150,7 @@ mm_rb_tree_t * mm_rb_tree_create_actual_rb_tree() {
 
     rbtree->NIL = create_rb_NIL();
     rbtree->root = rbtree->NIL;
+    rbtree->node_slab = NULL;
     // rbtree->compf = &rb_comp_region;
 
     return rbtree;
@@ -1256,3 +1278,62 @@ nk_aspace_region_t * rb_tree_find_allocation_entry_from_addr(mm_struct_t * self,
     return NULL;
     
 }
+
+
+/*
+ * Node of the allocation with the lowest address >= @address,
+ * tree->NIL if there is none --- start of a range iteration
+ */ 
+mm_rb_node_t * rb_tree_first_allocation_entry_from_addr(mm_rb_tree_t * tree, addr_t address) {
+    mm_rb_node_t node;
+    allocation_entry fake_entry = {
+        .pointer = (void *) address
+    } ;
+   
+    node.region = *((nk_aspace_region_t *) &fake_entry);
+
+    return rb_tree_LUB(tree, &node);
+}
+
+
+static mm_rb_node_t * rb_tree_build_sorted_subtree(mm_rb_tree_t * tree, allocation_entry * entries, uint64_t lo, uint64_t hi, int depth, int red_depth, mm_rb_node_t * parent) {
+    if (lo >= hi) {
+        return tree->NIL;
+    }
+
+    uint64_t mid = lo + ((hi - lo) / 2);
+    mm_rb_node_t * node = RB_NODE_MALLOC(tree);
+
+    node->region = *((nk_aspace_region_t *) &(entries[mid]));
+    node->parent = parent;
+    node->color = (depth && (depth == red_depth)) ? RED : BLACK;
+    node->left = rb_tree_build_sorted_subtree(tree, entries, lo, mid, depth + 1, red_depth, node);
+    node->right = rb_tree_build_sorted_subtree(tree, entries, mid + 1, hi, depth + 1, red_depth, node);
+
+    return node;
+}
+
+/*
+ * Build an empty allocation tree from @num_entries entries sorted by 
+ * (distinct) address, without a comparison or rotation per entry --- 
+ * halving keeps every level but the deepest full, so coloring only the 
+ * deepest level red keeps the black height equal on every path
+ *
+ * Returns -1 (and does nothing) if the tree is not empty
+ */ 
+int rb_tree_build_from_sorted_allocations(mm_rb_tree_t * tree, allocation_entry * entries, uint64_t num_entries) {
+    if (tree->root != tree->NIL) {
+        return -1;
+    }
+
+    if (!num_entries) {
+        return 0;
+    }
+
+    int red_depth = 63 - __builtin_clzl(num_entries);
+
+    tree->root = rb_tree_build_sorted_subtree(tree, entries, 0, num_entries, 0, red_depth, tree->NIL);
+    tree->super.size = num_entries;
+
+    return 0;
+}
@@ -197,7 +197,7 @@ struct CAT : public ModulePass
         /*
          * Escapes tracking
          */ 
-        EscapesHandler EH = EscapesHandler(&M);
+        EscapesHandler EH = EscapesHandler(&M, &AH);
         EH.Inject();
 
 
@@ -69,6 +69,12 @@ public:
     );
 
 
+    /*
+     * Queries
+     */ 
+    bool IsTrackedGlobal(const GlobalValue *Global);
+
+
 private:
     
     /*
@@ -108,5 +114,12 @@ private:
 
     void _getAllGlobals(void);
 
+    void _promoteHeapToStack(void);
+
+    CallInst *_getOnlyLocalFree(
+        Instruction *Allocation,
+        AllocID FreeTypeID
+    );
+
     bool _isGlobalInstrumentable(GlobalValue &Global);
 };
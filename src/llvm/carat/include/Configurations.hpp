@@ -43,14 +43,23 @@
 #include "llvm/IR/Mangler.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Dominators.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Analysis/PostDominators.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/IR/InstVisitor.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/Transforms/Utils/LoopUtils.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/ADT/SCCIterator.h"
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
 #include "llvm/Analysis/AssumptionCache.h"
 #include "llvm/IR/DataLayout.h"
 
@@ -59,7 +68,9 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <set>
+#include <tuple>
 #include <cassert>
+#include <algorithm>
 
 #include "autoconf.h"
 
@@ -101,11 +112,14 @@ const std::string CARAT_MALLOC,
                   CARAT_CALLOC,
                   CARAT_REMOVE_ALLOC,
                   CARAT_ESCAPE,
+                  CARAT_ESCAPE_LOG_FULL,
                   CARAT_INIT,
                   CARAT_GLOBAL_MALLOC,
+                  CARAT_GLOBALS_BULK,
                   CARAT_GLOBALS_TARGET,
                   CARAT_STACK_GUARD,
                   CARAT_PROTECT,
+                  CARAT_GUARD_RANGE,
                   CARAT_PIN_DIRECT,
                   USER_STATS,
                   KERNEL_MALLOC,
@@ -120,6 +134,29 @@ const std::string CARAT_MALLOC,
                   NOCARAT;
 
 
+/*
+ * Layout of the per-thread guard descriptor that inlined guards check
+ * --- must match include/aspace/permission_cache.h. The current thread
+ * is found at %gs:0 (address space 256)
+ */ 
+#define CARAT_CURRENT_THREAD_ADDRESS_SPACE 256
+#define CARAT_GUARD_DESCRIPTOR_OFFSET 40
+#define CARAT_GUARD_BASE_OFFSET 0
+#define CARAT_GUARD_LIMIT_OFFSET 8
+#define CARAT_GUARD_PERMISSIONS_OFFSET 16
+#define CARAT_GUARD_READ 1
+#define CARAT_GUARD_WRITE 2
+
+
+/*
+ * Layout of the per-thread escape log that inlined escapes append to
+ * --- must match include/aspace/permission_cache.h
+ */ 
+#define CARAT_ESCAPE_LOG_OFFSET 64
+#define CARAT_ESCAPE_LOG_NEXT_OFFSET 0
+#define CARAT_ESCAPE_LOG_LIMIT_OFFSET 8
+
+
 /*
  * Important/necessary methods/method names to track
  */ 
@@ -165,10 +202,20 @@ extern cl::opt<bool> NoMallocs;
 
 extern cl::opt<bool> NoFrees;
 
+extern cl::opt<unsigned> HeapToStackLimit;
+
 extern cl::opt<bool> NoEscapes;
 
+extern cl::opt<bool> InlineEscapes;
+
 extern cl::opt<bool> NoProtections;
 
+extern cl::opt<bool> InlineGuards;
+
+extern cl::opt<bool> NoInterproceduralGuards;
+
+extern cl::opt<unsigned> GuardSpecializationLimit;
+
 extern cl::opt<bool> NoRestrictions;
 
 extern cl::opt<bool> NoVerify;
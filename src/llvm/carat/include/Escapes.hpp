@@ -40,7 +40,10 @@ public:
     /*
      * Constructors
      */ 
-    EscapesHandler(Module *M);
+    EscapesHandler(
+        Module *M,
+        AllocationHandler *AH
+    );
 
 
     /*
@@ -55,6 +58,7 @@ private:
      * Passed state
      */ 
     Module *M;
+    AllocationHandler *AH;
 
 
     /*
@@ -62,6 +66,8 @@ private:
      */ 
     std::unordered_set<Instruction *> MemUses;
 
+    std::unordered_map<const Value *, bool> CapturedAllocas;
+
     std::unordered_map<
         Instruction *, /* Target instruction */
         CallInst * /* Instrumentation method injected */
@@ -73,4 +79,13 @@ private:
      */ 
     void _getAllNecessaryInstructions(void);
 
+    bool _isNonEscapingLocal(Value *Pointer);
+
+    bool _cannotPointToTrackedAllocation(Value *V);
+
+    void _injectInlineEscape(
+        Instruction *InsertionPoint,
+        Value *Escape
+    );
+
 };
@@ -32,6 +32,7 @@
 #if NAUT_CONFIG_USE_NOELLE
 
 #include "ProtectionsInjector.hpp"
+#include "ProtectionsSummaries.hpp"
 
 using namespace llvm;
 
@@ -40,6 +40,31 @@
 #define LOAD_GUARD 1
 
 
+class ProtectionsSummary
+{
+
+    /*
+     * TOP --- Interprocedural facts about a function's pointer arguments 
+     * (by argument number), see ProtectionsSummaries
+     */
+
+public:
+
+    /*
+     * Checked on every path to every return of the function --- 
+     * known to be guarded in the caller after a call
+     */
+    std::set<unsigned> GuardedArgs;
+
+    /*
+     * Checked by every caller before the call --- known to be
+     * guarded at the entry of the function
+     */
+    std::set<unsigned> AssumedArgs;
+
+};
+
+
 class ProtectionsDFA
 {
 
@@ -50,7 +75,8 @@ public:
      */ 
     ProtectionsDFA(
         Function *F,
-        Noelle *N
+        Noelle *N,
+        std::unordered_map<Function *, ProtectionsSummary> *Summaries = nullptr
     );
 
 
@@ -68,12 +94,14 @@ private:
      */ 
     Function *F;
     Noelle *N;
+    std::unordered_map<Function *, ProtectionsSummary> *Summaries;
 
 
     /*
      * New analysis state
      */     
     std::set<Value *> TheUniverse;
+    std::set<Value *> TheAssumed;
     BasicBlock *Entry;
     Instruction *First;
     DataFlowResult *TheResult;
@@ -73,6 +73,13 @@ public:
     const std::string MDTypeString, MDLiteral;
     unsigned NumInjections;
 
+    /*
+     * Range guards only --- the lowest and highest addresses accessed
+     * (as SCEVs expandable at @InjectionLocation), and the access size
+     */
+    const SCEV *RangeLow = nullptr, *RangeHigh = nullptr;
+    uint64_t AccessSize = 0;
+
 };
 
 
@@ -138,6 +145,8 @@ private:
 
     Instruction *First;
 
+    DominatorTree *DT = nullptr;
+
     bool AllocaOutsideEntry=false;
     bool InjectedCallGuardAtFirst=false;
 
@@ -156,6 +165,7 @@ private:
     uint64_t redundantGuard = 0;
     uint64_t loopInvariantGuard = 0;
     uint64_t scalarEvolutionGuard = 0;
+    uint64_t rangeGuard = 0;
     uint64_t nonOptimizedGuard = 0;
     uint64_t callGuardOpt = 0;
 
@@ -171,8 +181,15 @@ private:
 
     std::vector<Value *> _buildGenericProtectionArgs(GuardInfo *GI);
 
+    std::vector<Value *> _buildRangeGuardArgs(GuardInfo *GI);
+
     void _doTheInject(void);
 
+    void _injectInlineGuard(
+        GuardInfo *GI,
+        std::vector<Value *> &CallArgs
+    );
+
     bool _optimizeForLoopInvariance(
         LoopDependenceInfo *NestedLoop,
         Instruction *I, 
@@ -194,6 +211,25 @@ private:
         bool IsWrite
     );
 
+    bool _optimizeForRangeGuard(
+        LoopDependenceInfo *NestedLoop,
+        Instruction *I, 
+        Value *PointerOfMemoryInstruction, 
+        bool IsWrite
+    );
+
+    bool _computeSCEVRange(
+        const SCEV *S,
+        const Loop *OuterLoop,
+        const SCEV *&Low,
+        const SCEV *&High
+    );
+
+    bool _executesEveryIteration(
+        Instruction *I,
+        const Loop *OuterLoop
+    );
+
     bool _isAPointerReturnedByAllocator(Value *V);
 
     Value *_fetchBitCastOperand(Value *Pointer);
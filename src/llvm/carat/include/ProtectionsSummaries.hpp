@@ -0,0 +1,112 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the 
+ * United States National  Science Foundation and the Department of Energy.  
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national 
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2021, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2021, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2021, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2021, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2021, The V3VEE Project  <http://www.v3vee.org> 
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Souradip Ghosh, 
+ *          Brian Suchy, Simone Campanoni, Peter Dinda 
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#pragma once
+
+#include "autoconf.h"
+
+#if NAUT_CONFIG_USE_NOELLE
+
+#include "ProtectionsDFA.hpp"
+
+
+class ProtectionsSummaries
+{
+
+    /*
+     * TOP --- Module level summaries of the pointer arguments that each 
+     * function checks (for its callers) and can assume checked (by its
+     * callers), so that guards are not repeated across direct calls. The
+     * DFA of every instrumentable function is computed here, with the 
+     * summaries applied
+     */
+
+public:
+
+    /*
+     * Constructors
+     */ 
+    ProtectionsSummaries(
+        Module *M,
+        Noelle *N
+    );
+
+
+    /*
+     * Drivers
+     */ 
+    void Compute(void);
+    DataFlowResult *FetchResult(Function *F);
+
+
+private:
+
+    /*
+     * Passed state
+     */ 
+    Module *M;
+    Noelle *N;
+
+
+    /*
+     * New analysis state
+     */     
+    std::unordered_map<Function *, ProtectionsSummary> Summaries;
+    std::unordered_map<Function *, DataFlowResult *> Results;
+    std::vector<Function *> BottomUp; /* Callees before callers */
+
+
+    /*
+     * Counters/Statistics
+     */     
+    uint64_t guardedArgs = 0;
+    uint64_t assumedArgs = 0;
+    uint64_t specializations = 0;
+
+
+    /*
+     * Private methods
+     */     
+    DataFlowResult *_computeDFA(Function *F);
+
+    void _computeGuardedArgs(Function *F);
+
+    void _computeAssumedArgs(Function *F);
+
+    std::set<unsigned> _fetchCheckedArgsAtCall(CallInst *Call);
+
+    std::set<unsigned> _fetchAccessedArgs(Function *F);
+
+    Function *_specialize(
+        Function *F,
+        std::vector<CallInst *> &Calls,
+        std::set<unsigned> &AssumedArgs
+    );
+
+};
+
+#endif
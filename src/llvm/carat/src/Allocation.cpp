@@ -54,6 +54,13 @@ void AllocationHandler::Inject()
      * (malloc) and memory deallocations (frees)
      */ 
 
+    /*
+     * Move short-lived, fixed-size allocations to the stack 
+     * first --- what is promoted is never instrumented
+     */ 
+    if (HeapToStackLimit) _promoteHeapToStack();
+
+
     /*
      * Instrument globals
      */ 
@@ -253,6 +260,276 @@ void AllocationHandler::_getAllNecessaryInstructions()
 }
 
 
+void AllocationHandler::_promoteHeapToStack()
+{
+    /*
+     * TOP --- Replace "malloc"s of a constant size whose pointer never 
+     * leaves the function and is freed exactly once (on every path) 
+     * with a stack slot, and drop the matching "free". The slot lives 
+     * in the thread's stack, which the runtime already tracks and 
+     * can move, so nothing about the buffer has to be registered. 
+     * Promotion is bounded by HeapToStackLimit bytes per function
+     * to keep stack frames (kernel stacks especially) small
+     */ 
+
+    /*
+     * Set up allocation/free pairs to consider --- {malloc ID, 
+     * free ID, size operand no, zero the slot (calloc)}
+     */ 
+    std::vector<std::tuple<AllocID, AllocID, unsigned, bool>> Kinds = 
+        (InstrumentingUserCode) ?
+        std::vector<std::tuple<AllocID, AllocID, unsigned, bool>>{
+            { AllocID::UserMalloc, AllocID::UserFree, 0, false },
+            { AllocID::UserCalloc, AllocID::UserFree, 1, true }
+        } :
+        std::vector<std::tuple<AllocID, AllocID, unsigned, bool>>{
+            { AllocID::SysMalloc, AllocID::SysFree, 0, false }
+        } ;
+
+
+    /*
+     * Gather candidates per function
+     */ 
+    std::unordered_map<
+        Function *,
+        std::vector<std::tuple<Instruction *, AllocID, AllocID, uint64_t, bool>>
+    > Candidates;
+
+    uint64_t Tracked = 0;
+    for (auto const &[AllocTypeID, FreeTypeID, SizeOperandNo, Zero] : Kinds)
+    {
+        for (auto NextAlloc : InstructionsToInstrument[AllocTypeID])
+        {
+            /*
+             * The size must be known at compile time --- for 
+             * "calloc", both the count and the element size
+             */ 
+            auto Size = dyn_cast<ConstantInt>(NextAlloc->getOperand(SizeOperandNo));
+            auto Count = 
+                (Zero) ?
+                (dyn_cast<ConstantInt>(NextAlloc->getOperand(0))) :
+                (nullptr) ;
+
+            if (false
+                || !Size
+                || (Zero && !Count))
+            {
+                Tracked++;
+                continue;
+            }
+
+            uint64_t Bytes = Size->getZExtValue() * ((Zero) ? Count->getZExtValue() : 1);
+            if (false 
+                || (Bytes == 0)
+                || (Bytes > HeapToStackLimit))
+            {
+                Tracked++;
+                continue;
+            }
+
+            Candidates[NextAlloc->getFunction()].push_back(
+                { NextAlloc, AllocTypeID, FreeTypeID, Bytes, Zero }
+            );
+        }
+    }
+
+
+    /*
+     * Promote
+     */ 
+    uint64_t Promoted = 0, PromotedBytes = 0;
+    for (auto &[F, FunctionCandidates] : Candidates)
+    {
+        /*
+         * Promotion happens at most once per invocation, so 
+         * neither the allocation nor the free can sit in a loop
+         */ 
+        DominatorTree DT(*F);
+        PostDominatorTree PDT(*F);
+        LoopInfo LI(DT);
+
+        uint64_t Budget = HeapToStackLimit;
+        for (auto const &[NextAlloc, AllocTypeID, FreeTypeID, Bytes, Zero] : FunctionCandidates)
+        {
+            CallInst *Free = _getOnlyLocalFree(NextAlloc, FreeTypeID);
+            if (false
+                || (Bytes > Budget)
+                || !Free
+                || LI.getLoopFor(NextAlloc->getParent())
+                || LI.getLoopFor(Free->getParent())
+                || !(PDT.dominates(Free->getParent(), NextAlloc->getParent())))
+            {
+                Tracked++;
+                continue;
+            }
+
+
+            /*
+             * Build the stack slot in the entry block
+             */ 
+            IRBuilder<> EntryBuilder = 
+                Utils::GetBuilder(
+                    F, 
+                    &*(F->getEntryBlock().getFirstInsertionPt())
+                );
+
+            AllocaInst *Slot = 
+                EntryBuilder.CreateAlloca(
+                    EntryBuilder.getInt8Ty(),
+                    EntryBuilder.getInt64(Bytes),
+                    "carat.promoted"
+                );
+
+            Slot->setAlignment(Align(16)); /* Matches the allocators */
+
+
+            /*
+             * Replace the allocation, zeroing for "calloc"
+             */ 
+            IRBuilder<> Builder = 
+                Utils::GetBuilder(
+                    F, 
+                    NextAlloc
+                );
+
+            if (Zero) Builder.CreateMemSet(Slot, Builder.getInt8(0), Bytes, Align(16));
+
+            NextAlloc->replaceAllUsesWith(
+                Builder.CreatePointerCast(
+                    Slot,
+                    NextAlloc->getType()
+                )
+            );
+
+
+            /*
+             * Remove the pair from the instrumentation sets and the IR
+             */ 
+            InstructionsToInstrument[AllocTypeID].erase(NextAlloc);
+            InstructionsToInstrument[FreeTypeID].erase(Free);
+            NextAlloc->eraseFromParent();
+            Free->eraseFromParent();
+
+            Budget -= Bytes;
+            PromotedBytes += Bytes;
+            Promoted++;
+        }
+    }
+
+
+    /*
+     * Report
+     */ 
+    errs() << "HEAP-TO-STACK: " << M->getName()
+           << ": Promoted: " << Promoted << " (" << PromotedBytes << " bytes)"
+           << ", Tracked: " << Tracked << "\n";
+
+
+    return;
+}
+
+
+CallInst *AllocationHandler::_getOnlyLocalFree(
+    Instruction *Allocation,
+    AllocID FreeTypeID
+)
+{
+    /*
+     * TOP --- Walk every use of the pointer returned by @Allocation 
+     * (through casts and GEPs). Return the single "free" of type 
+     * @FreeTypeID that releases it if the pointer is only otherwise
+     * loaded from, stored to, compared, or handed to CARAT methods
+     * and memory intrinsics --- i.e. it cannot leave the function.
+     * Return nullptr otherwise
+     */ 
+    std::unordered_map<Function *, AllocID> MapToUse = 
+        (InstrumentingUserCode) ?
+        (UserAllocMethodsToIDs) :
+        (KernelAllocMethodsToIDs) ;
+
+    CallInst *Free = nullptr;
+    std::vector<Value *> Worklist = { Allocation };
+    std::unordered_set<Value *> Visited = { Allocation };
+    while (!(Worklist.empty()))
+    {
+        Value *Pointer = Worklist.back();
+        Worklist.pop_back();
+
+        for (auto &U : Pointer->uses())
+        {
+            User *NextUser = U.getUser();
+
+
+            /*
+             * Derived pointers --- follow them
+             */ 
+            if (false
+                || isa<BitCastInst>(NextUser)
+                || isa<AddrSpaceCastInst>(NextUser)
+                || isa<GetElementPtrInst>(NextUser))
+            {
+                if (Visited.insert(NextUser).second) Worklist.push_back(NextUser);
+                continue;
+            }
+
+
+            /*
+             * Accesses to the buffer itself --- a store is fine as 
+             * long as the pointer is the address, not the value
+             */ 
+            if (false
+                || isa<LoadInst>(NextUser)
+                || isa<ICmpInst>(NextUser)) continue;
+
+            if (auto Store = dyn_cast<StoreInst>(NextUser)) {
+                if (U.getOperandNo() == Store->getPointerOperandIndex()) continue;
+                return nullptr;
+            }
+
+
+            /*
+             * Calls --- only memory intrinsics, lifetime markers, CARAT
+             * methods (i.e. protection checks) and the matching "free"
+             */ 
+            auto Call = dyn_cast<CallInst>(NextUser);
+            if (!Call) return nullptr;
+
+            if (false
+                || isa<MemIntrinsic>(Call)
+                || isa<DbgInfoIntrinsic>(Call)
+                || Call->isLifetimeStartOrEnd()) continue;
+
+            Function *Callee = Call->getCalledFunction();
+            if (CARATMethods.find(Callee) != CARATMethods.end()) continue;
+
+            auto Kind = MapToUse.find(Callee);
+            if (false
+                || (Kind == MapToUse.end())
+                || (Kind->second != FreeTypeID)
+                || !(Call->isArgOperand(&U))
+                || Free) return nullptr;
+
+            Free = Call;
+        }
+    }
+
+
+    return Free;
+}
+
+
+bool AllocationHandler::IsTrackedGlobal(const GlobalValue *Global)
+{
+    /*
+     * TOP --- @Global is registered with the runtime as an
+     * allocation (i.e. pointers to it must be tracked)
+     */ 
+    if (NoGlobals) return false;
+
+    return (Globals.find(const_cast<GlobalValue *>(Global)) != Globals.end());
+}
+
+
 bool AllocationHandler::_isGlobalInstrumentable(GlobalValue &Global)
 {
     /*
@@ -410,8 +687,10 @@ void AllocationHandler::_getAllGlobals()
 void AllocationHandler::InstrumentGlobals()
 {
     /*
-     * TOP --- Instrument each global variable --- inject
-     * instrumentation into "_nk_carat_globals_compiler_target"
+     * TOP --- Instrument all global variables at once --- emit
+     * a read-only table of {address, size, ID} records and inject
+     * a single call that registers the whole table into 
+     * "_nk_carat_globals_compiler_target"
      */ 
 
     /*
@@ -436,22 +715,36 @@ void AllocationHandler::InstrumentGlobals()
 
 
     /*
-     * Set up for injections
+     * Set up for injections --- the record layout must match
+     * carat_global_record in include/aspace/runtime_tables.h
      */ 
     Type *VoidPointerType = TargetBuilder.getInt8PtrTy();
-    Function *CARATGlobalMalloc = CARATNamesToMethods[CARAT_GLOBAL_MALLOC];
+    Type *Int64Type = TargetBuilder.getInt64Ty();
+    Function *CARATGlobalsBulk = CARATNamesToMethods[CARAT_GLOBALS_BULK];
+    StructType *RecordType = 
+        StructType::get(
+            M->getContext(),
+            { VoidPointerType, Int64Type, Int64Type }
+        );
 
 
     /*
-     * Iterate through all globals to be intrumented
+     * Emit the records in ID (module) order, so the table comes
+     * out the same on every run --- the runtime sorts by address,
+     * which is only known at link time
      */
-    for (auto const &[GV, Info] : Globals)
+    std::vector<std::pair<uint64_t, GlobalValue *>> Ordered;
+    for (auto const &[GV, Info] : Globals) {
+        Ordered.push_back({ Info.second, GV });
+    }
+
+    std::sort(Ordered.begin(), Ordered.end());
+
+
+    std::vector<Constant *> Records;
+    for (auto const &[ID, GV] : Ordered)
     {
-        /*
-         * Deconstruct the "Info" pair
-         */  
-        uint64_t Length = Info.first,
-                 ID = Info.second;
+        uint64_t Length = Globals[GV].first;
 
 
         /*
@@ -467,40 +760,66 @@ void AllocationHandler::InstrumentGlobals()
 
 
         /*
-         * Build void pointer cast for current global --- necessary
-         * to process in the CARAT runtime
+         * Build the record --- the address is a void pointer 
+         * cast of the global, resolved by the linker
          */ 
-        Value *PointerCast = 
-            TargetBuilder.CreatePointerCast(
-                GV, VoidPointerType
-            );
+        Records.push_back(
+            ConstantStruct::get(
+                RecordType,
+                { 
+                    ConstantExpr::getPointerCast(GV, VoidPointerType),
+                    ConstantInt::get(Int64Type, Length),
+                    ConstantInt::get(Int64Type, ID)
+                }
+            )
+        );
+    }
 
+    if (Records.empty()) return;
 
-        /*
-         * Set up call parameters
-         */ 
-        ArrayRef<Value *> CallArgs = {
-            PointerCast,
-            TargetBuilder.getInt64(Length),
-            TargetBuilder.getInt64(ID)
-        };
 
+    /*
+     * Emit the table --- it is created after the globals were
+     * gathered, so it is not itself tracked
+     */ 
+    ArrayType *TableType = ArrayType::get(RecordType, Records.size());
+    GlobalVariable *Table = 
+        new GlobalVariable(
+            *M,
+            TableType,
+            true, /* isConstant */
+            GlobalValue::PrivateLinkage,
+            ConstantArray::get(TableType, Records),
+            "__carat_globals_table"
+        );
 
-        /*
-         * Inject
-         */ 
-        CallInst *Instrumentation = 
-            TargetBuilder.CreateCall(
-                CARATGlobalMalloc, 
-                CallArgs
-            );
 
+    /*
+     * Set up call parameters
+     */ 
+    ArrayRef<Value *> CallArgs = {
+        TargetBuilder.CreatePointerCast(
+            Table, 
+            CARATGlobalsBulk->getFunctionType()->getParamType(0)
+        ),
+        TargetBuilder.getInt64(Records.size())
+    };
 
-        /*
-         * Add metadata to injection
-         */
-        Utils::SetBaseInstrumentationMetadata(Instrumentation);
-    }
+
+    /*
+     * Inject
+     */ 
+    CallInst *Instrumentation = 
+        TargetBuilder.CreateCall(
+            CARATGlobalsBulk, 
+            CallArgs
+        );
+
+
+    /*
+     * Add metadata to injection
+     */
+    Utils::SetBaseInstrumentationMetadata(Instrumentation);
 
 
     return;
@@ -36,11 +36,14 @@ const std::string CARAT_MALLOC = "nk_carat_instrument_malloc",
                   CARAT_CALLOC = "nk_carat_instrument_calloc",
                   CARAT_REMOVE_ALLOC = "nk_carat_instrument_free",
                   CARAT_ESCAPE = "nk_carat_instrument_escapes",
+                  CARAT_ESCAPE_LOG_FULL = "nk_carat_escape_log_full",
                   CARAT_INIT = "nk_carat_init",
                   CARAT_GLOBAL_MALLOC = "nk_carat_instrument_global",
+                  CARAT_GLOBALS_BULK = "nk_carat_instrument_globals",
                   CARAT_GLOBALS_TARGET = "_nk_carat_globals_compiler_target",
                   CARAT_STACK_GUARD = "nk_carat_guard_callee_stack",
                   CARAT_PROTECT = "nk_carat_guard_address",
+                  CARAT_GUARD_RANGE = "nk_carat_guard_range",
                   CARAT_PIN_DIRECT = "nk_carat_pin_pointer",
                   USER_STATS = "_results",
                   KERNEL_MALLOC = "_kmem_sys_malloc",
@@ -64,10 +67,13 @@ std::unordered_set<std::string> CARATNames = {
     CARAT_CALLOC,
     CARAT_REMOVE_ALLOC, 
     CARAT_ESCAPE,
+    CARAT_ESCAPE_LOG_FULL,
     CARAT_GLOBAL_MALLOC,
+    CARAT_GLOBALS_BULK,
     CARAT_GLOBALS_TARGET,
     CARAT_STACK_GUARD,
     CARAT_PROTECT,
+    CARAT_GUARD_RANGE,
     CARAT_PIN_DIRECT,
     USER_STATS
 };
@@ -128,18 +134,48 @@ cl::opt<bool> NoFrees(
     cl::desc("No instrumentation of 'frees'")
 );
 
+cl::opt<unsigned> HeapToStackLimit(
+    "heap-to-stack-limit",
+    cl::init(0),
+    cl::desc("Promote fixed-size, function-local 'malloc's to the stack, up to this many bytes per function (0, the default, disables promotion)")
+);
+
 cl::opt<bool> NoEscapes(
     "fno-escapes",
     cl::init(false),
     cl::desc("No instrumentation of escapes")
 );
 
+cl::opt<bool> InlineEscapes(
+    "finline-escapes",
+    cl::init(false),
+    cl::desc("Append escapes inline to the thread's escape log, calling the runtime only when it is full")
+);
+
 cl::opt<bool> NoProtections(
     "fno-protections",
     cl::init(false),
     cl::desc("No protection check instrumentation")
 );
 
+cl::opt<bool> InlineGuards(
+    "finline-guards",
+    cl::init(false),
+    cl::desc("Inline protection checks against the thread's guard descriptor, calling the runtime only on a miss")
+);
+
+cl::opt<bool> NoInterproceduralGuards(
+    "fno-interprocedural-guards",
+    cl::init(false),
+    cl::desc("No elimination of protection checks across direct calls")
+);
+
+cl::opt<unsigned> GuardSpecializationLimit(
+    "guard-specialization-limit",
+    cl::init(64),
+    cl::desc("Largest function (in instructions) cloned for the callers that checked its arguments, 0 disables cloning")
+);
+
 cl::opt<bool> NoRestrictions(
     "fno-restrictions",
     cl::init(false),
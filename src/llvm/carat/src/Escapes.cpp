@@ -32,7 +32,10 @@
 /*
  * ----------- Constructors ----------- 
  */ 
-EscapesHandler::EscapesHandler(Module *M) : M(M)
+EscapesHandler::EscapesHandler(
+    Module *M,
+    AllocationHandler *AH
+) : M(M), AH(AH)
 {
     /*
      * Perform initial processing
@@ -109,6 +112,16 @@ void EscapesHandler::Inject()
             );
 
 
+        /*
+         * Append to the thread's escape log instead, if requested
+         */ 
+        if (InlineEscapes)
+        {
+            _injectInlineEscape(InsertionPoint, PointerOperandCast);
+            continue;
+        }
+
+
         /*
          * Set up call parameters
          */ 
@@ -162,6 +175,7 @@ void EscapesHandler::_getAllNecessaryInstructions()
         /*
          * Iterate --- search for stores
          */ 
+        uint64_t Instrumented = 0, LocalDestinations = 0, UntrackedValues = 0;
         for (auto &B : F)
         {
             for (auto &I : B)
@@ -176,14 +190,239 @@ void EscapesHandler::_getAllNecessaryInstructions()
                  * Have a store --- check to see if the value
                  * operand (i.e. the value being store) is a
                  * pointer --- if so, we've caught an escape
-                 * --- stash the store instruction in question
                  */ 
                 StoreInst *NextStore = cast<StoreInst>(&I);
-                if (NextStore->getValueOperand()->getType()->isPointerTy())
-                    MemUses.insert(NextStore);  
+                if (!(NextStore->getValueOperand()->getType()->isPointerTy())) { continue; }
+
+
+                /*
+                 * Skip escapes that the runtime does not need to know 
+                 * about --- the store is into a stack slot that never 
+                 * leaves @F (the runtime scans the stack of every thread
+                 * when it moves allocations), or the value stored can
+                 * only point to memory that is not tracked
+                 */ 
+                if (_isNonEscapingLocal(NextStore->getPointerOperand()))
+                {
+                    LocalDestinations++;
+                    continue;
+                }
+
+                if (_cannotPointToTrackedAllocation(NextStore->getValueOperand()))
+                {
+                    UntrackedValues++;
+                    continue;
+                }
+
+
+                /*
+                 * Stash the store instruction in question
+                 */ 
+                MemUses.insert(NextStore);  
+                Instrumented++;
             }
         }
+
+
+        /*
+         * Report
+         */ 
+        if (Instrumented || LocalDestinations || UntrackedValues)
+        {
+            errs() << "ESCAPES: " << F.getName() 
+                   << ": Instrumented: " << Instrumented
+                   << ", Eliminated: " << (LocalDestinations + UntrackedValues)
+                   << " (Local Destinations: " << LocalDestinations 
+                   << ", Untracked Values: " << UntrackedValues << ")\n";
+        }
     }
 
     return;
 }
+
+
+void EscapesHandler::_injectInlineEscape(
+    Instruction *InsertionPoint,
+    Value *Escape
+)
+{
+    /*
+     * TOP --- Append @Escape to the current thread's escape log (see 
+     * include/aspace/permission_cache.h) before @InsertionPoint, and 
+     * only call the runtime if the log is full (or not set up yet):
+     *
+     *   slot = next; next += 8;
+     *   if (slot < limit) *slot = escape; else nk_carat_escape_log_full(escape);
+     *
+     * The reservation is a single read-modify-write, so an interrupt 
+     * handler that escapes in between cannot take the same entry
+     */ 
+
+    /*
+     * Set up builder
+     */ 
+    IRBuilder<> Builder = 
+        Utils::GetBuilder(
+            InsertionPoint->getFunction(),
+            InsertionPoint
+        );
+
+    Type *Int64Type = Builder.getInt64Ty();
+
+
+    /*
+     * Fetch the current thread from %gs:0, and the log fields
+     */ 
+    Value *CurrentThreadSlot = 
+        ConstantPointerNull::get(
+            PointerType::get(Int64Type, CARAT_CURRENT_THREAD_ADDRESS_SPACE)
+        );
+
+    Value *CurrentThread = 
+        Builder.CreateLoad(
+            Int64Type, 
+            CurrentThreadSlot, 
+            "carat.escape.thread"
+        );
+
+    auto LogField = [&](uint64_t Offset) -> Value * {
+        return 
+            Builder.CreateIntToPtr(
+                Builder.CreateAdd(CurrentThread, Builder.getInt64(CARAT_ESCAPE_LOG_OFFSET + Offset)),
+                PointerType::getUnqual(Int64Type)
+            );
+    };
+
+
+    /*
+     * Reserve an entry --- only this CPU ever touches the log 
+     * while the thread runs, hence the single thread scope
+     */ 
+    Value *Slot = 
+        Builder.CreateAtomicRMW(
+            AtomicRMWInst::Add,
+            LogField(CARAT_ESCAPE_LOG_NEXT_OFFSET),
+            Builder.getInt64(sizeof(void *)),
+            MaybeAlign(8),
+            AtomicOrdering::Monotonic,
+            SyncScope::SingleThread
+        );
+
+    Value *Limit = 
+        Builder.CreateLoad(
+            Int64Type, 
+            LogField(CARAT_ESCAPE_LOG_LIMIT_OFFSET), 
+            "carat.escape.limit"
+        );
+
+    Value *Full = Builder.CreateICmpUGE(Slot, Limit, "carat.escape.full");
+
+
+    /*
+     * Write the entry, or call the runtime, which should be rare
+     */ 
+    Instruction *FullTerminator = nullptr, *AppendTerminator = nullptr;
+    MDBuilder Weights(M->getContext());
+    SplitBlockAndInsertIfThenElse(
+        Full,
+        InsertionPoint,
+        &FullTerminator,
+        &AppendTerminator,
+        Weights.createBranchWeights(1, 1000)
+    );
+
+    IRBuilder<> AppendBuilder{AppendTerminator};
+    StoreInst *Append = 
+        AppendBuilder.CreateStore(
+            Escape,
+            AppendBuilder.CreateIntToPtr(
+                Slot, 
+                PointerType::getUnqual(Escape->getType())
+            )
+        );
+
+    Utils::SetBaseInstrumentationMetadata(Append);
+
+    IRBuilder<> FullBuilder{FullTerminator};
+    CallInst *InstrumentEscape = 
+        FullBuilder.CreateCall(
+            CARATNamesToMethods[CARAT_ESCAPE_LOG_FULL], 
+            { Escape }
+        );
+
+    Utils::SetBaseInstrumentationMetadata(InstrumentEscape);
+
+
+    return;
+}
+
+
+bool EscapesHandler::_isNonEscapingLocal(Value *Pointer)
+{
+    /*
+     * TOP --- @Pointer can only point into allocas of its
+     * function whose addresses are never captured
+     */ 
+    SmallVector<const Value *, 4> Objects;
+    getUnderlyingObjects(Pointer, Objects);
+
+    for (auto Object : Objects)
+    {
+        if (!(isa<AllocaInst>(Object))) return false;
+
+
+        /*
+         * Check (once) whether the alloca's address can escape
+         */ 
+        auto Cached = CapturedAllocas.find(Object);
+        if (Cached == CapturedAllocas.end())
+        {
+            bool Captured = 
+                PointerMayBeCaptured(
+                    Object, 
+                    true /* ReturnCaptures */, 
+                    true /* StoreCaptures */
+                );
+
+            Cached = CapturedAllocas.insert({Object, Captured}).first;
+        }
+
+        if (Cached->second) return false;
+    }
+
+
+    return !(Objects.empty());
+}
+
+
+bool EscapesHandler::_cannotPointToTrackedAllocation(Value *V)
+{
+    /*
+     * TOP --- every underlying object of @V is either not memory 
+     * (null, undef, a constant address) or memory that the runtime 
+     * does not track as an allocation (code, untracked globals)
+     */ 
+    SmallVector<const Value *, 4> Objects;
+    getUnderlyingObjects(V, Objects);
+
+    for (auto Object : Objects)
+    {
+        if (false
+            || isa<ConstantPointerNull>(Object)
+            || isa<UndefValue>(Object)
+            || isa<Function>(Object)) continue;
+
+        if (auto Expression = dyn_cast<ConstantExpr>(Object)) {
+            if (Expression->getOpcode() == Instruction::IntToPtr) continue;
+        }
+
+        if (auto Global = dyn_cast<GlobalValue>(Object)) {
+            if (AH && !(AH->IsTrackedGlobal(Global))) continue;
+        }
+
+        return false;
+    }
+
+
+    return !(Objects.empty());
+}
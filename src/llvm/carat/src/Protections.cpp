@@ -59,8 +59,21 @@ void ProtectionsHandler::Protect(void)
 
 
     /*
-     * Iterate over all functions in @this->M, compute the DFA 
-     * and calls to the runtime protections method if possible
+     * Compute the DFA of every function in @this->M, with what 
+     * is known across direct calls --- this may add specialized
+     * clones of small functions to @this->M
+     */ 
+    ProtectionsSummaries *PS = new ProtectionsSummaries(
+        M,
+        N /* Noelle */
+    );
+
+    PS->Compute();
+
+
+    /*
+     * Iterate over all functions in @this->M, and inject
+     * calls to the runtime protections method if possible
      */ 
     for (auto &F : *M)
     {
@@ -71,14 +84,19 @@ void ProtectionsHandler::Protect(void)
 
 
         /*
-         * Compute the DFA for the current function 
+         * Fetch the DFA for the current function 
          */ 
-        ProtectionsDFA *PD = new ProtectionsDFA(
-            &F, 
-            N /* Noelle */
-        );
+        DataFlowResult *DFR = PS->FetchResult(&F);
+        if (!DFR)
+        {
+            ProtectionsDFA *PD = new ProtectionsDFA(
+                &F, 
+                N /* Noelle */
+            );
 
-        PD->Compute();
+            PD->Compute();
+            DFR = PD->FetchResult();
+        }
 
 
         /*
@@ -89,7 +107,7 @@ void ProtectionsHandler::Protect(void)
         ProtectionsInjector *PI = new ProtectionsInjector(
             &F,
             FetchSELambda,
-            PD->FetchResult(),
+            DFR,
             NonCanonical,
             N /* Noelle */,
             nullptr /* ProtectionsMethod */
@@ -35,8 +35,9 @@
  */
 ProtectionsDFA::ProtectionsDFA(
     Function *F,
-    Noelle *N
-    ) : F(F), N(N) {}
+    Noelle *N,
+    std::unordered_map<Function *, ProtectionsSummary> *Summaries
+    ) : F(F), N(N), Summaries(Summaries) {}
 
 
 /*
@@ -81,9 +82,31 @@ DataFlowResult *ProtectionsDFA::FetchResult(void)
 std::function<void (Instruction *I, DataFlowResult *Result)> ProtectionsDFA::_computeGEN(void)
 {
   auto DFAGen = 
-    []
+    [this]
     (Instruction *I, DataFlowResult *Result) -> void {
 
+      /*
+       * Handle direct calls --- the arguments that the callee 
+       * checks on every path are checked after the call
+       */
+      CallInst *Call = dyn_cast<CallInst>(I);
+      if (Call)
+      {
+        Function *Callee = Call->getCalledFunction();
+        if (false
+            || !Summaries
+            || !Callee
+            || (Summaries->find(Callee) == Summaries->end())) return;
+
+        auto &InstGen = Result->GEN(I);
+        for (auto ArgNo : (*Summaries)[Callee].GuardedArgs) {
+          if (ArgNo < Call->arg_size()) InstGen.insert(Call->getArgOperand(ArgNo));
+        }
+
+        return;
+      }
+
+
       /*
        * Handle memory instructions (stores and loads)
        */
@@ -225,6 +248,19 @@ void ProtectionsDFA::_initializeUniverse(void)
   for (auto &Arg : F->args()) TheUniverse.insert(&Arg);
 
 
+  /*
+   * Arguments that all callers have checked are known at the entry
+   */
+  if (true
+      && Summaries
+      && (Summaries->find(F) != Summaries->end()))
+  {
+    for (auto ArgNo : (*Summaries)[F].AssumedArgs) {
+      if (ArgNo < F->arg_size()) TheAssumed.insert(F->getArg(ArgNo));
+    }
+  }
+
+
   /*
    * Set state needed for analysis
    */ 
@@ -240,12 +276,16 @@ std::function<void (Instruction *inst, std::set<Value *> &IN)> ProtectionsDFA::_
 {
   /*
    * TOP --- initialize the IN set to the universe of 
-   * values available in @this->F
+   * values available in @this->F, except at the entry
+   * where only the assumed arguments are known
    */ 
   auto InitIn = 
     [this] 
     (Instruction *I, std::set<Value *> &IN) -> void {
-      if (I == First) { return; }
+      if (I == First) { 
+        IN = TheAssumed;
+        return; 
+      }
       IN = TheUniverse;
       return;
     };
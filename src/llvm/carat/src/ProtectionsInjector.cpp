@@ -85,6 +85,13 @@ void ProtectionsInjector::Inject(void)
   _doTheInject();
 
 
+  /*
+   * Done with the analysis state
+   */ 
+  delete DT;
+  DT = nullptr;
+
+
   /*
    * Verify the transformations
    */
@@ -342,13 +349,93 @@ std::vector<Value *> ProtectionsInjector::_buildGenericProtectionArgs(GuardInfo
 }
 
 
+std::vector<Value *> ProtectionsInjector::_buildRangeGuardArgs(GuardInfo *GI)
+{
+  /*
+   * TOP --- Build the function arguments for the call injection
+   * for the method "nk_carat_guard_range" --- the range guarded is
+   * [@GI->RangeLow, @GI->RangeHigh + @GI->AccessSize), expanded at
+   * the injection location (the preheader)
+   */
+
+  /*
+   * Expand the bounds
+   */
+  const DataLayout &DL = F->getParent()->getDataLayout();
+  SCEVExpander Expander(*(FetchSELambda(F)), DL, "carat.range");
+
+  Value *Low = Expander.expandCodeFor(GI->RangeLow, nullptr, GI->InjectionLocation);
+  Value *High = Expander.expandCodeFor(GI->RangeHigh, nullptr, GI->InjectionLocation);
+
+
+  /*
+   * Set up builder
+   */
+  llvm::IRBuilder<> Builder = 
+    Utils::GetBuilder(
+        GI->InjectionLocation->getFunction(),
+        GI->InjectionLocation
+        );
+
+
+  /*
+   * Compute the length of the range
+   */
+  auto AsInteger = [&Builder](Value *V) -> Value * {
+    return (V->getType()->isPointerTy()) ?
+      Builder.CreatePtrToInt(V, Builder.getInt64Ty()) :
+      Builder.CreateZExtOrTrunc(V, Builder.getInt64Ty());
+  };
+
+  Value *Length = 
+    Builder.CreateAdd(
+        Builder.CreateSub(AsInteger(High), AsInteger(Low)),
+        Builder.getInt64(GI->AccessSize)
+        );
+
+  Value *Base = 
+    (Low->getType()->isPointerTy()) ?
+    Builder.CreatePointerCast(Low, Builder.getInt8PtrTy()) :
+    Builder.CreateIntToPtr(Low, Builder.getInt8PtrTy());
+
+  errs () << "THE RANGE INJECTION: " << *Base << ", " << *Length << "\n";
+
+
+  /*
+   * Build the call args
+   */
+  std::vector<Value *> CallArgs = {
+    Base,
+    Length,
+    Builder.getInt32(GI->IsWrite)
+  };
+
+
+  return CallArgs;
+}
+
+
 void ProtectionsInjector::_doTheInject(void)
 {
+  /*
+   * Range guards already injected --- accesses of the same 
+   * array in the same loop nest share one
+   */
+  std::set<std::tuple<Instruction *, const SCEV *, const SCEV *, uint64_t, bool>> RangeGuards;
+
+
   /*
    * Do the inject
    */ 
   for (auto const &[InstToGuard, GI] : InjectionLocations) 
   {
+    Function *FTI = GI->FunctionToInject;
+    if (FTI == CARATNamesToMethods[CARAT_GUARD_RANGE])
+    {
+      auto Range = std::make_tuple(GI->InjectionLocation, GI->RangeLow, GI->RangeHigh, GI->AccessSize, GI->IsWrite);
+      if (!(RangeGuards.insert(Range).second)) { continue; }
+    }
+
     /*
      * Set up builder
      */
@@ -362,19 +449,27 @@ void ProtectionsInjector::_doTheInject(void)
     /*
      * Set up arguments based on the "GI->FunctionToInject" field
      */ 
-    Function *FTI = GI->FunctionToInject;
     std::vector<Value *> CallArgs = 
       (FTI == CARATNamesToMethods[CARAT_STACK_GUARD]) ?
       (_buildStackGuardArgs(GI)) :
+      (FTI == CARATNamesToMethods[CARAT_GUARD_RANGE]) ?
+      (_buildRangeGuardArgs(GI)) :
       (_buildGenericProtectionArgs(GI));
 
 
     /*
      * Inject the call instruction(s) based on the selected
-     * args and set specialized metadata for each call
+     * args and set specialized metadata for each call --- 
+     * address guards are inlined if requested
      */
     for (auto N = 0 ; N < GI->NumInjections ; N++)
     {
+      if (InlineGuards && (FTI == CARATNamesToMethods[CARAT_PROTECT]))
+      {
+        _injectInlineGuard(GI, CallArgs);
+        continue;
+      }
+
       CallInst *Instrumentation = 
         Builder.CreateCall(
             FTI, 
@@ -395,6 +490,112 @@ void ProtectionsInjector::_doTheInject(void)
 }
 
 
+void ProtectionsInjector::_injectInlineGuard(
+    GuardInfo *GI,
+    std::vector<Value *> &CallArgs
+    )
+{
+  /*
+   * TOP --- Inject an inline check of @GI->PointerToGuard against the
+   * current thread's guard descriptor (the region of its last successful
+   * guard, published by the runtime), and only call the runtime guard 
+   * (@GI->FunctionToInject with @CallArgs) if the check misses:
+   *
+   *   hit = (base <= address) && (address < limit) && ((permissions & needed) == needed)
+   */
+
+  /*
+   * Set up builder
+   */
+  llvm::IRBuilder<> Builder = 
+    Utils::GetBuilder(
+        GI->InjectionLocation->getFunction(),
+        GI->InjectionLocation
+        );
+
+  Type *Int64Type = Builder.getInt64Ty();
+
+
+  /*
+   * Fetch the current thread from %gs:0, and the descriptor fields
+   */
+  Value *CurrentThreadSlot = 
+    ConstantPointerNull::get(
+        PointerType::get(Int64Type, CARAT_CURRENT_THREAD_ADDRESS_SPACE)
+        );
+
+  Value *CurrentThread = 
+    Builder.CreateLoad(
+        Int64Type, 
+        CurrentThreadSlot, 
+        "carat.guard.thread"
+        );
+
+  auto LoadDescriptorField = [&](uint64_t Offset, const char *Name) -> Value * {
+    Value *FieldAddress = 
+      Builder.CreateIntToPtr(
+          Builder.CreateAdd(CurrentThread, Builder.getInt64(CARAT_GUARD_DESCRIPTOR_OFFSET + Offset)),
+          PointerType::getUnqual(Int64Type)
+          );
+
+    return Builder.CreateLoad(Int64Type, FieldAddress, Name);
+  };
+
+  Value *Base = LoadDescriptorField(CARAT_GUARD_BASE_OFFSET, "carat.guard.base");
+  Value *Limit = LoadDescriptorField(CARAT_GUARD_LIMIT_OFFSET, "carat.guard.limit");
+  Value *Permissions = LoadDescriptorField(CARAT_GUARD_PERMISSIONS_OFFSET, "carat.guard.permissions");
+
+
+  /*
+   * Build the check --- an empty descriptor has a limit of 0, so it never hits
+   */
+  Value *Address = Builder.CreatePtrToInt(CallArgs[0], Int64Type);
+  Value *Needed = Builder.getInt64(GI->IsWrite ? CARAT_GUARD_WRITE : CARAT_GUARD_READ);
+
+  Value *Hit = 
+    Builder.CreateAnd(
+        Builder.CreateAnd(
+            Builder.CreateICmpUGE(Address, Base),
+            Builder.CreateICmpULT(Address, Limit)
+            ),
+        Builder.CreateICmpEQ(
+            Builder.CreateAnd(Permissions, Needed), 
+            Needed
+            ),
+        "carat.guard.hit"
+        );
+
+
+  /*
+   * Call the runtime only on a miss, which should be rare
+   */
+  MDBuilder Weights(F->getContext());
+  Instruction *MissTerminator = 
+    SplitBlockAndInsertIfThen(
+        Builder.CreateNot(Hit),
+        GI->InjectionLocation,
+        false, /* Unreachable */
+        Weights.createBranchWeights(1, 1000)
+        );
+
+  llvm::IRBuilder<> MissBuilder{MissTerminator};
+  CallInst *Instrumentation = 
+    MissBuilder.CreateCall(
+        GI->FunctionToInject, 
+        ArrayRef<Value *>(CallArgs)
+        );  
+
+  Utils::SetInstrumentationMetadata(
+      Instrumentation,
+      GI->MDTypeString,
+      GI->MDLiteral
+      );
+
+
+  return;
+}
+
+
 bool ProtectionsInjector::_optimizeForLoopInvariance(
     LoopDependenceInfo *NestedLoop,
     Instruction *I, 
@@ -685,6 +886,293 @@ bool ProtectionsInjector::_isValidSCEV(const llvm::SCEV* scevPtr){
 }
 
 
+bool ProtectionsInjector::_optimizeForRangeGuard(
+    LoopDependenceInfo *NestedLoop,
+    Instruction *I, 
+    Value *PointerOfMemoryInstruction, 
+    bool IsWrite
+    )
+{
+  /*
+   * TOP --- Replace the guard of @I in every iteration of its loop nest
+   * with one "nk_carat_guard_range" in the preheader of the nest, covering
+   * every address @I accesses. This requires the bounds of 
+   * @PointerOfMemoryInstruction over the nest to be computable (SCEV),
+   * and @I to execute in every iteration (so that the range guarded is
+   * exactly the range accessed). The outermost loop is tried first
+   */
+  Function *RangeGuard = CARATNamesToMethods[CARAT_GUARD_RANGE];
+  if (false
+      || !NestedLoop
+      || !RangeGuard) {
+    return false;
+  }
+
+
+  /*
+   * Fetch the size of the access
+   */
+  Type *AccessedType = nullptr;
+  if (auto *Load = dyn_cast<LoadInst>(I)) { 
+    AccessedType = Load->getType(); 
+  }
+  else if (auto *Store = dyn_cast<StoreInst>(I)) { 
+    AccessedType = Store->getValueOperand()->getType(); 
+  }
+  else { 
+    return false; 
+  }
+
+  const DataLayout &DL = F->getParent()->getDataLayout();
+  uint64_t AccessSize = DL.getTypeStoreSize(AccessedType).getFixedSize();
+
+
+  /*
+   * Map the headers of the loops the address recurs in (and of their 
+   * parents) to SCEV's loops --- there's nothing to do without any
+   */
+  auto SE = FetchSELambda(F);
+  const SCEV *PointerSCEV = SE->getSCEV(PointerOfMemoryInstruction);
+  std::unordered_map<BasicBlock *, const Loop *> HeaderToLoop;
+  SCEVExprContains(
+      PointerSCEV,
+      [&HeaderToLoop](const SCEV *S) {
+        if (auto AR = dyn_cast<SCEVAddRecExpr>(S)) {
+          for (const Loop *L = AR->getLoop() ; L ; L = L->getParentLoop()) {
+            HeaderToLoop[L->getHeader()] = L;
+          }
+        }
+        return false;
+      }
+      );
+
+  if (HeaderToLoop.empty()) { 
+    errs() << "\trangeCondition: no recurrence in " << *PointerSCEV << "\n";
+    return false; 
+  }
+
+  if (!DT) { DT = new DominatorTree(*F); }
+
+
+  /*
+   * Collect the loop nest of @I, innermost first
+   */
+  std::vector<LoopDependenceInfo *> Nest;
+  auto NextLoop = NestedLoop;
+  while (NextLoop)
+  {
+    Nest.push_back(NextLoop);
+
+    BasicBlock *PreHeader = NextLoop->getLoopStructure()->getPreHeader();
+    if (!PreHeader) { break; }
+
+    LoopDependenceInfo *ParentLoop = BasicBlockToLoopMap[PreHeader];
+    assert (ParentLoop != NextLoop);
+
+    NextLoop = ParentLoop;
+  }
+
+
+  /*
+   * Find the outermost loop that the range can be hoisted out of
+   */
+  for (auto Candidate = Nest.rbegin() ; Candidate != Nest.rend() ; ++Candidate)
+  {
+    LoopStructure *CandidateStructure = (*Candidate)->getLoopStructure();
+    BasicBlock *PreHeader = CandidateStructure->getPreHeader();
+    if (!PreHeader) { continue; }
+
+    auto OuterLoopIt = HeaderToLoop.find(CandidateStructure->getHeader());
+    if (OuterLoopIt == HeaderToLoop.end()) { continue; }
+    const Loop *OuterLoop = OuterLoopIt->second;
+
+    const SCEV *Low = nullptr, *High = nullptr;
+    if (false
+        || !_computeSCEVRange(PointerSCEV, OuterLoop, Low, High)
+        || !_executesEveryIteration(I, OuterLoop)) {
+      continue;
+    }
+
+    Instruction *InjectionLocation = PreHeader->getTerminator();
+    if (false
+        || !isSafeToExpandAt(Low, InjectionLocation, *SE)
+        || !isSafeToExpandAt(High, InjectionLocation, *SE)) {
+      continue;
+    }
+
+    errs() << "\tTHE RANGE: [" << *Low << ", " << *High << "] + " << AccessSize << "\n";
+
+    GuardInfo *GI = 
+      new GuardInfo(
+          InjectionLocation,
+          PointerOfMemoryInstruction,
+          IsWrite,
+          RangeGuard,
+          "protect", /* Metadata type */
+          "iv.scev.range.guard" /* Metadata attached to injection */
+          );
+
+    GI->RangeLow = Low;
+    GI->RangeHigh = High;
+    GI->AccessSize = AccessSize;
+
+    InjectionLocations[I] = GI;
+    rangeGuard++;
+
+    return true;
+  }
+
+
+  return false;
+}
+
+
+bool ProtectionsInjector::_computeSCEVRange(
+    const SCEV *S,
+    const Loop *OuterLoop,
+    const SCEV *&Low,
+    const SCEV *&High
+    )
+{
+  /*
+   * TOP --- Compute the lowest and highest values that @S takes over
+   * all iterations of @OuterLoop, as SCEVs invariant in @OuterLoop. 
+   * Handles sums of affine recurrences with computable trip counts
+   * (i.e. array walks, nested ones included)
+   */
+  auto SE = FetchSELambda(F);
+
+  if (SE->isLoopInvariant(S, OuterLoop)) 
+  {
+    Low = High = S;
+    return true;
+  }
+
+
+  /*
+   * {Start,+,Step}<L> --- spans Step * (backedge-taken count of L) from 
+   * wherever Start is, in the direction of Step
+   */
+  if (auto AR = dyn_cast<SCEVAddRecExpr>(S))
+  {
+    const Loop *L = AR->getLoop();
+    if (false
+        || !(AR->isAffine())
+        || !(OuterLoop->contains(L))) {
+      return false;
+    }
+
+    const SCEV *BackedgeTakenCount = SE->getBackedgeTakenCount(L);
+    const SCEV *Step = AR->getStepRecurrence(*SE);
+    if (false
+        || isa<SCEVCouldNotCompute>(BackedgeTakenCount)
+        || !(SE->isLoopInvariant(BackedgeTakenCount, OuterLoop))
+        || !(SE->isLoopInvariant(Step, OuterLoop))) {
+      return false;
+    }
+
+    bool Ascending = SE->isKnownNonNegative(Step);
+    if (!Ascending && !(SE->isKnownNonPositive(Step))) { return false; }
+
+    const SCEV *StartLow = nullptr, *StartHigh = nullptr;
+    if (!_computeSCEVRange(AR->getStart(), OuterLoop, StartLow, StartHigh)) { return false; }
+
+    const SCEV *Span = 
+      SE->getMulExpr(
+          Step, 
+          SE->getTruncateOrZeroExtend(BackedgeTakenCount, Step->getType())
+          );
+
+    Low = (Ascending) ? StartLow : SE->getAddExpr(StartLow, Span);
+    High = (Ascending) ? SE->getAddExpr(StartHigh, Span) : StartHigh;
+
+    return true;
+  }
+
+
+  /*
+   * A sum --- bounded by the sums of the bounds of its operands
+   */
+  if (auto Add = dyn_cast<SCEVAddExpr>(S))
+  {
+    SmallVector<const SCEV *, 4> Lows, Highs;
+    for (auto Operand : Add->operands())
+    {
+      const SCEV *OperandLow = nullptr, *OperandHigh = nullptr;
+      if (!_computeSCEVRange(Operand, OuterLoop, OperandLow, OperandHigh)) { return false; }
+
+      Lows.push_back(OperandLow);
+      Highs.push_back(OperandHigh);
+    }
+
+    Low = SE->getAddExpr(Lows);
+    High = SE->getAddExpr(Highs);
+
+    return true;
+  }
+
+
+  return false;
+}
+
+
+bool ProtectionsInjector::_executesEveryIteration(
+    Instruction *I,
+    const Loop *OuterLoop
+    )
+{
+  /*
+   * TOP --- Check that @I executes in every iteration of every loop
+   * from its innermost one out to @OuterLoop, before the iteration can
+   * leave the loop --- so a guard in the preheader of @OuterLoop, 
+   * which always enters the loop, checks nothing @I does not access
+   */
+  BasicBlock *Block = I->getParent();
+
+
+  /*
+   * Find the innermost loop of @I inside @OuterLoop
+   */
+  const Loop *L = OuterLoop;
+  bool Descended = true;
+  while (Descended)
+  {
+    Descended = false;
+    for (auto SubLoop : L->getSubLoops())
+    {
+      if (SubLoop->contains(Block))
+      {
+        L = SubLoop;
+        Descended = true;
+        break;
+      }
+    }
+  }
+
+
+  /*
+   * @Block must dominate the latch and every exit of each loop
+   */
+  while (true)
+  {
+    BasicBlock *Latch = L->getLoopLatch();
+    if (!Latch || !(DT->dominates(Block, Latch))) { return false; }
+
+    SmallVector<BasicBlock *, 8> ExitingBlocks;
+    L->getExitingBlocks(ExitingBlocks);
+    for (auto Exiting : ExitingBlocks) {
+      if (!(DT->dominates(Block, Exiting))) { return false; }
+    }
+
+    if (L == OuterLoop) { break; }
+    L = L->getParentLoop();
+  }
+
+
+  return true;
+}
+
+
 bool ProtectionsInjector::_optimizeForSCEVAnalysis(
     LoopDependenceInfo *NestedLoop,
     Instruction *I, 
@@ -1980,7 +2468,25 @@ bool ProtectionsInjector::_optimizeForSCEVAnalysis(
           }
 LOOP INVARIANCE END*/
           /*
-           * <Step 2b.>
+           * <Step 2b.> Range guard for the whole loop nest
+           */
+          if (!Guarded)
+          {
+            Guarded |= 
+              _optimizeForRangeGuard(
+                  NestedLoop,
+                  inst,
+                  PointerOfMemoryInstruction,
+                  isWrite
+                  );
+
+            if (Guarded) {
+              errs() << "Success range! " << F->getName() << "\n";
+            }
+          }
+
+          /*
+           * <Step 2c.>
            */
           if (!Guarded)
           {
@@ -2105,8 +2611,9 @@ No_Loop:
       errs() << "GUARDS: Redundant Optimized Guards:\t" << redundantGuard << "\n"; 
       errs() << "GUARDS: Loop Invariant Hoisted Guards:\t" << loopInvariantGuard << "\n"; 
       errs() << "GUARDS: Scalar Evolution Combined Guards:\t" << scalarEvolutionGuard << "\n"; 
+      errs() << "GUARDS: Range Guards:\t" << rangeGuard << "\n"; 
       errs() << "GUARDS: Hoisted Call Guards\t" << callGuardOpt << "\n"; 
-      errs() << "GUARDS: Total Guards:\t" << nonOptimizedGuard + loopInvariantGuard + scalarEvolutionGuard << "\n"; 
+      errs() << "GUARDS: Total Guards:\t" << nonOptimizedGuard + loopInvariantGuard + scalarEvolutionGuard + rangeGuard << "\n"; 
 
 
       return;
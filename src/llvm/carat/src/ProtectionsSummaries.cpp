@@ -0,0 +1,402 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the 
+ * United States National  Science Foundation and the Department of Energy.  
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national 
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2021, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2021, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2021, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2021, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2021, The V3VEE Project  <http://www.v3vee.org> 
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Souradip Ghosh, 
+ *          Brian Suchy, Simone Campanoni, Peter Dinda 
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include "autoconf.h"
+
+#if NAUT_CONFIG_USE_NOELLE
+
+#include "../include/ProtectionsSummaries.hpp"
+
+/*
+ * ---------- Constructors ----------
+ */
+ProtectionsSummaries::ProtectionsSummaries(
+    Module *M,
+    Noelle *N
+    ) : M(M), N(N) {}
+
+
+/*
+ * ---------- Drivers ----------
+ */
+void ProtectionsSummaries::Compute(void)
+{
+  /*
+   * Order the instrumentable functions bottom-up in the call 
+   * graph (mutually recursive functions in any order)
+   */
+  CallGraph CG(*M);
+  for (auto SCC = scc_begin(&CG) ; !SCC.isAtEnd() ; ++SCC)
+  {
+    for (auto Node : *SCC)
+    {
+      Function *F = Node->getFunction();
+      if (false
+          || !F
+          || !(Utils::IsInstrumentable(*F))) continue;
+
+      BottomUp.push_back(F);
+    }
+  }
+
+
+  /*
+   * Bottom-up --- compute the DFA of each function with the summaries
+   * of its callees (callees in the same SCC have none yet, so they are
+   * taken to check nothing), then what the function checks for its callers
+   */
+  for (auto F : BottomUp)
+  {
+    Results[F] = _computeDFA(F);
+    if (NoInterproceduralGuards) continue;
+
+    _computeGuardedArgs(F);
+  }
+
+  if (NoInterproceduralGuards) return;
+
+
+  /*
+   * Top-down --- what each function can assume its callers checked,
+   * from the final DFAs of its callers (callers in the same SCC only 
+   * have their bottom-up DFA, which is still sound)
+   */
+  for (auto F = BottomUp.rbegin() ; F != BottomUp.rend() ; ++F) {
+    _computeAssumedArgs(*F);
+  }
+
+
+  /*
+   * Print statistics
+   */
+  errs() << "GUARDS: Interprocedural Summaries\n";
+  errs() << "GUARDS: Arguments Checked For Callers:\t" << guardedArgs << "\n"; 
+  errs() << "GUARDS: Arguments Checked By Callers:\t" << assumedArgs << "\n"; 
+  errs() << "GUARDS: Specializations:\t" << specializations << "\n"; 
+
+
+  return;
+}
+
+
+DataFlowResult *ProtectionsSummaries::FetchResult(Function *F)
+{
+  auto Result = Results.find(F);
+  if (Result == Results.end()) return nullptr;
+
+  return Result->second;
+}
+
+
+/*
+ * ---------- Private methods ----------
+ */
+DataFlowResult *ProtectionsSummaries::_computeDFA(Function *F)
+{
+  ProtectionsDFA *PD = new ProtectionsDFA(
+      F, 
+      N /* Noelle */,
+      (NoInterproceduralGuards) ? nullptr : &Summaries
+      );
+
+  PD->Compute();
+
+
+  return PD->FetchResult();
+}
+
+
+void ProtectionsSummaries::_computeGuardedArgs(Function *F)
+{
+  /*
+   * TOP --- The pointer arguments of @F that are in the OUT
+   * set of every return instruction of @F
+   */
+  DataFlowResult *Result = Results[F];
+  std::set<unsigned> Guarded;
+  bool FoundReturn = false;
+
+  for (auto &B : *F)
+  {
+    ReturnInst *Return = dyn_cast_or_null<ReturnInst>(B.getTerminator());
+    if (!Return) continue;
+
+    auto &OUT = Result->OUT(Return);
+    std::set<unsigned> GuardedHere;
+    for (auto &Arg : F->args())
+    {
+      if (true
+          && Arg.getType()->isPointerTy()
+          && (OUT.find(&Arg) != OUT.end())) {
+        GuardedHere.insert(Arg.getArgNo());
+      }
+    }
+
+    if (!FoundReturn) 
+    {
+      Guarded = GuardedHere;
+      FoundReturn = true;
+      continue;
+    }
+
+    std::set<unsigned> Both;
+    std::set_intersection(
+        Guarded.begin(), 
+        Guarded.end(), 
+        GuardedHere.begin(), 
+        GuardedHere.end(),  
+        std::inserter(Both, Both.begin())
+        );
+
+    Guarded = Both;
+  }
+
+  Summaries[F].GuardedArgs = Guarded;
+  guardedArgs += Guarded.size();
+
+
+  return;
+}
+
+
+void ProtectionsSummaries::_computeAssumedArgs(Function *F)
+{
+  /*
+   * TOP --- If all calls of @F are known, the pointer arguments that 
+   * every call has checked can be assumed checked in @F. Otherwise (or 
+   * for the arguments left), a small @F is cloned for the calls that 
+   * have checked every argument it accesses
+   */
+
+  /*
+   * Collect the direct calls of @F --- any other use of @F, or 
+   * a call from a function without a DFA, is an unknown caller
+   */
+  std::vector<CallInst *> Calls;
+  bool AllCallsKnown = F->hasLocalLinkage();
+  for (auto User : F->users())
+  {
+    CallInst *Call = dyn_cast<CallInst>(User);
+    if (true
+        && Call
+        && (Call->getCalledFunction() == F)
+        && (Results.find(Call->getFunction()) != Results.end())) 
+    {
+      Calls.push_back(Call);
+      continue;
+    }
+
+    AllCallsKnown = false;
+  }
+
+  if (Calls.empty()) return;
+
+
+  /*
+   * Fetch the arguments checked at each call
+   */
+  std::vector<std::set<unsigned>> Checked;
+  std::set<unsigned> CheckedByAll;
+  for (auto Call : Calls)
+  {
+    Checked.push_back(_fetchCheckedArgsAtCall(Call));
+    if (Checked.size() == 1) 
+    {
+      CheckedByAll = Checked.back();
+      continue;
+    }
+
+    std::set<unsigned> Both;
+    std::set_intersection(
+        CheckedByAll.begin(), 
+        CheckedByAll.end(), 
+        Checked.back().begin(), 
+        Checked.back().end(),  
+        std::inserter(Both, Both.begin())
+        );
+
+    CheckedByAll = Both;
+  }
+
+
+  /*
+   * All callers are known --- recompute the DFA of @F with 
+   * the arguments that they all checked
+   */
+  if (true
+      && AllCallsKnown
+      && !(CheckedByAll.empty()))
+  {
+    Summaries[F].AssumedArgs = CheckedByAll;
+    Results[F] = _computeDFA(F);
+    assumedArgs += CheckedByAll.size();
+  }
+
+
+  /*
+   * Specialize --- only for small functions that still guard 
+   * an argument, and only for the calls that checked all of them
+   */
+  if (false
+      || !GuardSpecializationLimit
+      || (F->getInstructionCount() > GuardSpecializationLimit)) return;
+
+  std::set<unsigned> Accessed = _fetchAccessedArgs(F);
+  for (auto ArgNo : Summaries[F].AssumedArgs) Accessed.erase(ArgNo);
+  if (Accessed.empty()) return;
+
+  std::vector<CallInst *> SpecializedCalls;
+  std::set<unsigned> SpecializedArgs;
+  for (uint64_t Index = 0 ; Index < Calls.size() ; Index++)
+  {
+    if (!std::includes(
+          Checked[Index].begin(), 
+          Checked[Index].end(), 
+          Accessed.begin(), 
+          Accessed.end())) continue;
+
+    SpecializedCalls.push_back(Calls[Index]);
+    if (SpecializedCalls.size() == 1)
+    {
+      SpecializedArgs = Checked[Index];
+      continue;
+    }
+
+    std::set<unsigned> Both;
+    std::set_intersection(
+        SpecializedArgs.begin(), 
+        SpecializedArgs.end(), 
+        Checked[Index].begin(), 
+        Checked[Index].end(),  
+        std::inserter(Both, Both.begin())
+        );
+
+    SpecializedArgs = Both;
+  }
+
+  if (SpecializedCalls.empty()) return;
+
+  _specialize(F, SpecializedCalls, SpecializedArgs);
+
+
+  return;
+}
+
+
+std::set<unsigned> ProtectionsSummaries::_fetchCheckedArgsAtCall(CallInst *Call)
+{
+  /*
+   * TOP --- The pointer arguments of @Call that are in its IN set 
+   * (directly or through casts), or are stack or global locations
+   * (which are never guarded, see ProtectionsInjector)
+   */
+  std::set<unsigned> Checked;
+  auto &IN = Results[Call->getFunction()]->IN(Call);
+
+  for (unsigned ArgNo = 0 ; ArgNo < Call->arg_size() ; ArgNo++)
+  {
+    Value *Arg = Call->getArgOperand(ArgNo);
+    if (!(Arg->getType()->isPointerTy())) continue;
+
+    Value *Stripped = Arg->stripPointerCasts();
+    if (false
+        || (IN.find(Arg) != IN.end())
+        || (IN.find(Stripped) != IN.end())
+        || isa<AllocaInst>(Stripped)
+        || isa<GlobalVariable>(Stripped)) {
+      Checked.insert(ArgNo);
+    }
+  }
+
+
+  return Checked;
+}
+
+
+std::set<unsigned> ProtectionsSummaries::_fetchAccessedArgs(Function *F)
+{
+  /*
+   * TOP --- The arguments of @F that a load or store of @F 
+   * accesses, i.e. that are in the GEN set of a memory access
+   */
+  std::set<unsigned> Accessed;
+  DataFlowResult *Result = Results[F];
+
+  for (auto &I : instructions(F))
+  {
+    if (true
+        && !isa<LoadInst>(&I)
+        && !isa<StoreInst>(&I)) continue;
+
+    auto &GEN = Result->GEN(&I);
+    for (auto &Arg : F->args()) {
+      if (GEN.find(&Arg) != GEN.end()) Accessed.insert(Arg.getArgNo());
+    }
+  }
+
+
+  return Accessed;
+}
+
+
+Function *ProtectionsSummaries::_specialize(
+    Function *F,
+    std::vector<CallInst *> &Calls,
+    std::set<unsigned> &AssumedArgs
+    )
+{
+  /*
+   * TOP --- Clone @F for @Calls, which all checked @AssumedArgs. The
+   * clone is private to the module, so @Calls are all of its callers
+   */
+  ValueToValueMapTy VMap;
+  Function *Clone = CloneFunction(F, VMap);
+  Clone->setName(F->getName() + ".carat.checked");
+  Clone->setLinkage(GlobalValue::InternalLinkage);
+  Clone->setVisibility(GlobalValue::DefaultVisibility);
+  Clone->setComdat(nullptr);
+
+  for (auto Call : Calls) Call->setCalledFunction(Clone);
+
+
+  /*
+   * Summarize and analyze the clone
+   */
+  Summaries[Clone].GuardedArgs = Summaries[F].GuardedArgs;
+  Summaries[Clone].AssumedArgs = AssumedArgs;
+  Results[Clone] = _computeDFA(Clone);
+
+  specializations++;
+  assumedArgs += AssumedArgs.size();
+
+  errs() << "Specialized " << F->getName() << " for " << Calls.size() << " checked calls\n";
+
+
+  return Clone;
+}
+
+#endif
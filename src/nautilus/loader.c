@@ -521,6 +521,7 @@ struct nk_exec *nk_load_exec(char *path)
 static void * (*__nk_func_table[])() = {
     [NK_VC_PRINTF] = (void * (*)()) nk_vc_printf,
     [NK_CARAT_INSTRUMENT_GLOBAL] = (void * (*)()) nk_carat_instrument_global,
+    [NK_CARAT_INSTRUMENT_GLOBALS] = (void * (*)()) nk_carat_instrument_globals,
     [NK_CARAT_INSTRUMENT_MALLOC] = (void * (*)()) nk_carat_instrument_malloc,
     [NK_CARAT_INSTRUMENT_CALLOC] = (void * (*)()) nk_carat_instrument_calloc,
     [NK_CARAT_INSTRUMENT_REALLOC] = (void * (*)()) nk_carat_instrument_realloc,
@@ -528,6 +529,8 @@ static void * (*__nk_func_table[])() = {
     [NK_CARAT_INSTRUMENT_ESCAPE] = (void * (*)()) nk_carat_instrument_escapes,
     [NK_CARAT_GENERIC_PROTECT] = (void * (*)()) nk_carat_guard_address,
     [NK_CARAT_STACK_PROTECT] = (void * (*)()) nk_carat_guard_callee_stack,
+    [NK_CARAT_RANGE_PROTECT] = (void * (*)()) nk_carat_guard_range,
+    [NK_CARAT_ESCAPE_LOG_FULL] = (void * (*)()) nk_carat_escape_log_full,
     [NK_CARAT_PIN_DIRECT] = (void * (*)()) nk_carat_pin_pointer,
     [NK_CARAT_PIN_ESCAPE] = (void * (*)()) nk_carat_pin_escaped_pointer,
     [NK_MALLOC] = (void * (*)()) kmem_malloc,
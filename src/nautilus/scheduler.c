@@ -184,15 +184,35 @@ static volatile uint64_t sync_count=0;
 static volatile uint64_t tsc_start=-1ULL;
 
 // only one core can do a world stop at a time
-// this lock is also used to signal that we are starting
-// or ending a world stop
+// the stopper first takes stop_lock, sets up the stop,
+// and then publishes it through stopping, which is also
+// used to signal that we are starting or ending a world stop
 // 0 => not stopping / no stopper
 // k => stopping / stopper = k-1
+static volatile uint64_t     stop_lock;
 static volatile uint64_t     stopping;
+// scoped stops (nk_sched_stop_aspace) only hold the cores
+// that are running threads of stop_aspace - the others check
+// in once per stop (via stop_gen) and keep running what they
+// were running, and may switch threads, but never to a thread
+// of stop_aspace, until it is over
+// stop_aspace==0 => whole world stop
+static struct nk_aspace     *stop_aspace;
+static volatile uint64_t     stop_gen;
+static volatile uint64_t     stop_arrived;  // cores that have checked in
+static volatile uint64_t     stop_workers;  // cores running stop_aspace threads
+static volatile uint64_t     stop_held;     // cores currently spinning
 // all stopping cores synchronize via this barrier
 static nk_counting_barrier_t stop_barrier;
 // flags storage for the the core initiating the world stop
 static volatile uint8_t      stop_flags;
+// work handed to the stopped cores by the world stopper
+// a new generation number signals new work, and each
+// stopped core bumps done when it finishes
+static void               (*stopped_work_func)(int cpu, void *state);
+static void                 *stopped_work_state;
+static volatile uint64_t     stopped_work_gen;
+static volatile uint64_t     stopped_work_done;
 
 
 static struct nk_sched_global_state global_sched_state;
@@ -322,6 +342,8 @@ typedef struct nk_sched_percpu_state {
 
   uint64_t reinject_count;  // how many timer/kick interrupts I've had to reinject
 
+  uint64_t stop_gen_seen;   // last scoped stop this core checked in to
+
 #if INSTRUMENT
   uint64_t resched_fast_num;
   uint64_t resched_fast_sum;
@@ -786,7 +808,10 @@ int nk_sched_stop_world()
   preempt_disable();
   // wait until we are the sole world stopper
   // perhaps participating in other world stops along the way
-  PAUSE_WHILE(!__sync_bool_compare_and_swap(&stopping,0,stopper));
+  PAUSE_WHILE(!__sync_bool_compare_and_swap(&stop_lock,0,stopper));
+  stop_aspace = 0;
+  __sync_fetch_and_add(&stop_gen,1);
+  __sync_fetch_and_or(&stopping,stopper);
 
   // Now we want to make sure nothing can interrupt us
   // and we might as well reset the scheduler now as well
@@ -821,6 +846,8 @@ int nk_sched_start_world()
   // wait for them to notice 
   nk_counting_barrier(&stop_barrier);
 
+  __sync_fetch_and_and(&stop_lock,0);
+
   // now allow interrupts again locally
   // so the scheduler can preempt us
   irq_enable_restore(stop_flags);
@@ -828,6 +855,91 @@ int nk_sched_start_world()
   return 1;	
 }
 
+int nk_sched_stop_aspace(struct nk_aspace *aspace)
+{
+  if (!scheduler_ready) {
+    return 0;
+  }
+
+  if (!aspace) {
+    return nk_sched_stop_world();
+  }
+
+  uint64_t num_cpus = nk_get_num_cpus();
+  uint64_t stopper = my_cpu_id()+1;
+
+  // same dance as nk_sched_stop_world
+  preempt_disable();
+  PAUSE_WHILE(!__sync_bool_compare_and_swap(&stop_lock,0,stopper));
+  stop_flags = irq_disable_save();
+  preempt_enable();
+
+  // set up the scope before anyone can see the stop
+  stop_aspace = aspace;
+  stop_arrived = 0;
+  stop_workers = 0;
+  __sync_fetch_and_add(&stop_gen,1);
+  __sync_fetch_and_or(&stopping,stopper);
+
+  apic_bcast_ipi (per_cpu_get(apic), APIC_NULL_KICK_VEC);
+
+  // wait for everyone to check in - after this, every core
+  // running a thread of the aspace is held, and no other core
+  // will switch to one until we restart
+  PAUSE_WHILE(stop_arrived!=(num_cpus-1));
+
+  return 1;
+}
+
+int nk_sched_start_aspace(struct nk_aspace *aspace)
+{
+  if (!scheduler_ready) {
+    return 0;
+  }
+
+  if (!aspace) {
+    return nk_sched_start_world();
+  }
+
+  __sync_fetch_and_and(&stopping,0);
+
+  // wait for the held cores to notice before
+  // anyone else can start a new stop
+  PAUSE_WHILE(stop_held);
+
+  stop_aspace = 0;
+  __sync_fetch_and_and(&stop_lock,0);
+
+  irq_enable_restore(stop_flags);
+
+  return 1;
+}
+
+int nk_sched_run_on_stopped_cpus(void (*func)(int cpu, void *state), void *state)
+{
+  uint64_t num_cpus = nk_get_num_cpus();
+  int my_cpu = my_cpu_id();
+
+  if (!scheduler_ready || stopping!=(my_cpu+1)) {
+    return -1;
+  }
+
+  stopped_work_func = func;
+  stopped_work_state = state;
+  stopped_work_done = 0;
+  // publish - the stopped cores are spinning on the generation
+  __sync_fetch_and_add(&stopped_work_gen,1);
+
+  func(my_cpu,state);
+
+  PAUSE_WHILE(stopped_work_done!=(stop_aspace ? stop_workers : num_cpus-1));
+
+  stopped_work_func = 0;
+  stopped_work_state = 0;
+
+  return 0;
+}
+
 
 struct thread_query {
   uint64_t     tid;
@@ -2008,6 +2120,129 @@ static int pump_sized_tasks(rt_scheduler *scheduler, rt_thread *next)
 //
 
 #define INTERRUPT __attribute__((target("no-sse")))
+
+//
+// Handle a scoped stop (nk_sched_stop_aspace) on a core that
+// is not the stopper.   A core running a thread of the stopped
+// aspace is held (and runs stopped work) until the stop ends.
+// Any other core keeps running its current thread, unless it
+// must reschedule (the thread is sleeping, exiting, ...), in
+// which case the scheduling pass skips stopped threads (see
+// _sched_scoped_stop_filter)
+//
+// Returns 1 if the caller should return without a scheduling pass
+//
+INTERRUPT static int _sched_scoped_stop(int force_resched)
+{
+  rt_scheduler *s = per_cpu_get(system)->cpus[my_cpu_id()]->sched_state;
+  struct apic_dev *a = per_cpu_get(system)->cpus[my_cpu_id()]->apic;
+
+  // count ourselves held before looking at the stop - the
+  // stopper cannot end it (and another cannot begin) until
+  // we let go, so what we read below is one consistent stop
+  __sync_fetch_and_add(&stop_held,1);
+
+  if (!stopping || !stop_aspace) {
+    // the stop we were kicked for ended before we got
+    // here (or a world stop replaced it, which will kick us)
+    __sync_fetch_and_sub(&stop_held,1);
+    return 0;
+  }
+
+  uint64_t gen = stop_gen;
+  // as with a world stop, this generation cannot be ours yet
+  uint64_t work_gen = stopped_work_gen;
+  int worker = get_cur_thread()->aspace == stop_aspace;
+
+  if (s->stop_gen_seen != gen) {
+    s->stop_gen_seen = gen;
+    if (worker) {
+      __sync_fetch_and_add(&stop_workers,1);
+    }
+    __sync_fetch_and_add(&stop_arrived,1);
+  }
+
+  if (worker) {
+    DEBUG("Scoped stop - holding\n");
+    while (stopping && stop_gen==gen) {
+      if (stopped_work_gen!=work_gen) {
+        work_gen = stopped_work_gen;
+        stopped_work_func(my_cpu_id(),stopped_work_state);
+        __sync_fetch_and_add(&stopped_work_done,1);
+      }
+      __asm__ __volatile__ ("pause");
+    }
+    __sync_fetch_and_sub(&stop_held,1);
+    return !force_resched && !a->in_timer_interrupt;
+  }
+
+  __sync_fetch_and_sub(&stop_held,1);
+
+  if (force_resched) {
+    DEBUG("Scoped stop - not affected, rescheduling around stopped threads\n");
+    return 0;
+  }
+
+  DEBUG("Scoped stop - not affected, staying with current thread\n");
+  if (a->in_timer_interrupt || a->in_kick_interrupt) {
+    apic_update_oneshot_timer(a,
+        apic_realtime_to_ticks(a, NAUT_CONFIG_INTERRUPT_REINJECTION_DELAY_NS),
+        IF_EARLIER);
+    s->reinject_count++;
+  }
+  return 1;
+}
+
+//
+// Called at the end of a scheduling pass, with the local
+// scheduler lock held.   If a scoped stop is in progress and the
+// pass picked a thread of the stopped aspace, put that thread
+// back on its run queue and run the idle thread instead - the
+// next pass after the stop ends will pick it up again
+//
+// Returns the thread to run
+//
+INTERRUPT static rt_thread *_sched_scoped_stop_filter(rt_scheduler *scheduler, rt_thread *rt_c, rt_thread *rt_n)
+{
+  struct nk_aspace *aspace = stopping ? stop_aspace : 0;
+  uint64_t i;
+
+  if (!aspace || rt_n==rt_c || rt_n->thread->aspace!=aspace) {
+    return rt_n;
+  }
+
+  // the idle thread is aperiodic and always runnable, so
+  // unless it is current it is on the aperiodic run queue -
+  // and if it is current and not special, the pass has
+  // already put it back there
+  for (i=0;i<SIZE_APERIODIC(scheduler);i++) {
+    rt_thread *rt_i = PEEK_APERIODIC(scheduler,i);
+    if (rt_i && rt_i->thread->is_idle) {
+      break;
+    }
+  }
+
+  if (i==SIZE_APERIODIC(scheduler)) {
+    ERROR("Scoped stop - no idle thread to run instead of stopped thread %llu\n",rt_n->thread->tid);
+    return rt_n;
+  }
+
+  rt_thread *rt_idle = REMOVE_APERIODIC(scheduler,PEEK_APERIODIC(scheduler,i));
+
+  // rt_n was taken off the RT run queue or the aperiodic
+  // run queue, and is still marked suspended from when it
+  // was put there
+  if ((rt_n->constraints.type==APERIODIC ?
+       PUT_APERIODIC(scheduler,rt_n) :
+       PUT_RT(scheduler,rt_n))) {
+    panic("Scoped stop - cannot requeue stopped thread %llu\n",rt_n->thread->tid);
+  }
+
+  DEBUG("Scoped stop - running idle instead of stopped thread %llu\n",rt_n->thread->tid);
+
+  return rt_idle;
+}
+
 INTERRUPT struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
 {
   LOCAL_LOCK_CONF;
@@ -2023,14 +2258,30 @@ INTERRUPT struct nk_thread *_sched_need_resched(int have_lock, int force_resched
       DEBUG("Stopping self interrupted - resuming\n");
       NK_GPIO_OUTPUT_MASK(~0x4,GPIO_AND);
       return 0;
+    } else if (stop_aspace) {
+      if (_sched_scoped_stop(force_resched)) {
+        NK_GPIO_OUTPUT_MASK(~0x4,GPIO_AND);
+        return 0;
+      }
     } else {
       uint64_t num_cpus = nk_get_num_cpus();
+      // the stopper cannot hand out work until we pass
+      // the barrier, so this generation is not yet ours
+      uint64_t work_gen = stopped_work_gen;
       DEBUG("World stop signalled\n");
       // We now wait for everyone else to stop
       nk_counting_barrier(&stop_barrier);
       // everyone's stopped... we are now waiting for
-      // the world stopper to restart us all
-      PAUSE_WHILE(stopping);
+      // the world stopper to restart us all, running
+      // any work it hands us in the meantime
+      while (stopping) {
+        if (stopped_work_gen!=work_gen) {
+          work_gen = stopped_work_gen;
+          stopped_work_func(my_cpu_id(),stopped_work_state);
+          __sync_fetch_and_add(&stopped_work_done,1);
+        }
+        __asm__ __volatile__ ("pause");
+      }
       // we've been restarted - we'll now wait for everyone
       nk_counting_barrier(&stop_barrier);
       // everyone's now restarted
@@ -2570,6 +2821,8 @@ if (yielding) {
   //DEBUG("Thread %llu yield complete\n", rt_c->thread->tid);
 }
 
+rt_n = _sched_scoped_stop_filter(scheduler,rt_c,rt_n);
+
 scheduler->current = rt_n;
 
 // set timer according to nature of thread
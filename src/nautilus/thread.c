@@ -42,6 +42,10 @@
 #include <gc/bdwgc/bdwgc.h>
 #endif
 
+#ifdef NAUT_CONFIG_ASPACE_CARAT
+#include <aspace/runtime_tables.h>
+#endif
+
 extern uint8_t malloc_cpus_ready;
 
 
@@ -366,6 +370,11 @@ nk_thread_create (nk_thread_fun_t fun,
 
     // a thread joins its creator's address space 
     t->aspace = get_cur_thread()->aspace;
+
+#ifdef NAUT_CONFIG_ASPACE_CARAT
+    // CARAT tracks the stack so it can grow it (and free the old one)
+    nk_carat_track_thread_stack(t);
+#endif
     
     t->signal_state = 0;
 
@@ -416,6 +425,10 @@ out_err:
 
     // note that VC is not assigned on thread creation
     // so we do not need to clean it up
+
+#ifdef NAUT_CONFIG_ASPACE_CARAT
+    nk_carat_untrack_thread_stack(t);
+#endif
     
     free(t->stack);
     free(t);
@@ -580,6 +593,11 @@ void nk_thread_exit (void * retval)
 
     THREAD_DEBUG("TLS exit complete\n");
 
+#ifdef NAUT_CONFIG_ASPACE_CARAT
+    // hand escapes still in our escape log to CARAT before we go away
+    nk_carat_escape_log_release(me);
+#endif
+
     // lock out anyone else looking at my wait queue
     // we need to do this before we change our own state
     // so we can avoid racing with someone who is attempting
@@ -670,6 +688,12 @@ nk_thread_destroy (nk_thread_id_t t)
     nk_gc_bdwgc_thread_state_deinit(thethread);
 #endif
 
+#ifdef NAUT_CONFIG_ASPACE_CARAT
+    // the stack may have been grown (and so allocated) by CARAT,
+    // which must stop tracking it before the memory is reused
+    nk_carat_untrack_thread_stack(thethread);
+#endif
+
     free(thethread->stack);
     free(thethread);
     
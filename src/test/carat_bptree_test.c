@@ -0,0 +1,401 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh,
+ * 			Brian Suchy, Peter Dinda
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/shell.h>
+#include <nautilus/vc.h>
+#include <nautilus/libccompat.h>
+#include <aspace/bptree.h>
+
+
+/*
+ * Random inserts, removes and lookups on a CARAT allocation map B+ tree,
+ * checked against a reference (a presence bit per key), with the tree's
+ * invariants checked after every mutation
+ */
+
+#define BPTREE_TEST_KEYS 2048 /* key space, enough for a tree of height 2 */
+#define BPTREE_TEST_OPS 20000
+#define BPTREE_TEST_STRIDE 16 /* keys look like allocation addresses */
+#define BPTREE_TEST_BASE 0x100000UL
+
+#define KEY(i) (BPTREE_TEST_BASE + (((uintptr_t) (i)) * BPTREE_TEST_STRIDE))
+
+static uint8_t present[BPTREE_TEST_KEYS];
+static uint64_t num_present;
+
+
+/*
+ * =================== Invariants ===================
+ */
+
+static carat_bptree_leaf *next_leaf; // expected next leaf in the chain
+static uint64_t keys_seen;
+
+/*
+ * Check the subtree at @node, @depth levels below the root, whose keys
+ * must all lie in [@low, @high) --- returns 0 if it is well formed
+ */
+static int check_node(carat_bptree *tree, void *node, uint32_t depth, uintptr_t low, uintptr_t high)
+{
+    if (depth == tree->height)
+    {
+        carat_bptree_leaf *leaf = (carat_bptree_leaf *) node;
+
+        if (leaf != next_leaf) {
+            nk_vc_printf("leaf %p is out of chain order (expected %p)\n", leaf, next_leaf);
+            return -1;
+        }
+
+        if ((leaf->num_keys > CARAT_BPTREE_LEAF_SLOTS) || (!(leaf->num_keys) && tree->height)) {
+            nk_vc_printf("leaf %p has %u keys\n", leaf, leaf->num_keys);
+            return -1;
+        }
+
+        if (leaf->next && (leaf->next->prev != leaf)) {
+            nk_vc_printf("leaf %p: next->prev is %p\n", leaf, leaf->next->prev);
+            return -1;
+        }
+
+        for (uint32_t i = 0; i < leaf->num_keys; i++)
+        {
+            if ((leaf->keys[i] < low) || (leaf->keys[i] >= high) || (i && (leaf->keys[i] <= leaf->keys[i - 1]))) {
+                nk_vc_printf("leaf %p: key %u (%p) is out of order or outside [%p, %p)\n",
+                             leaf, i, (void *) leaf->keys[i], (void *) low, (void *) high);
+                return -1;
+            }
+
+            if (leaf->keys[i] != ((uintptr_t) leaf->entries[i].pointer)) {
+                nk_vc_printf("leaf %p: key %u (%p) does not match its entry (%p)\n",
+                             leaf, i, (void *) leaf->keys[i], leaf->entries[i].pointer);
+                return -1;
+            }
+        }
+
+        keys_seen += leaf->num_keys;
+        next_leaf = leaf->next;
+
+        return 0;
+    }
+
+
+    carat_bptree_inner *inner = (carat_bptree_inner *) node;
+    uint32_t min_children = (depth) ? 1 : 2;
+
+    if ((inner->num_children < min_children) || (inner->num_children > CARAT_BPTREE_FANOUT)) {
+        nk_vc_printf("inner %p at depth %u has %u children\n", inner, depth, inner->num_children);
+        return -1;
+    }
+
+    for (uint32_t c = 0; c < inner->num_children; c++)
+    {
+        /*
+         * children[c] holds keys in [keys[c - 1], keys[c]) --- separators
+         * may be stale lower bounds once the smallest key of a child is
+         * removed, which only narrows what the child actually holds
+         */
+        uintptr_t child_low = (c) ? inner->keys[c - 1] : low;
+        uintptr_t child_high = (c < (inner->num_children - 1)) ? inner->keys[c] : high;
+
+        if ((child_low < low) || (child_high > high) || (child_low > child_high)) {
+            nk_vc_printf("inner %p: separators around child %u are out of order\n", inner, c);
+            return -1;
+        }
+
+        if (check_node(tree, inner->children[c], depth + 1, child_low, child_high)) { return -1; }
+    }
+
+    return 0;
+}
+
+
+static int check_tree(carat_bptree *tree)
+{
+    next_leaf = tree->first;
+    keys_seen = 0;
+
+    if (tree->height >= CARAT_BPTREE_MAX_HEIGHT) {
+        nk_vc_printf("tree is %u levels tall\n", tree->height);
+        return -1;
+    }
+
+    if (tree->first && tree->first->prev) {
+        nk_vc_printf("first leaf has a predecessor\n");
+        return -1;
+    }
+
+    if (check_node(tree, tree->root, 0, 0, ~((uintptr_t) 0))) { return -1; }
+
+    if (next_leaf) {
+        nk_vc_printf("leaf chain continues past the last leaf (%p)\n", next_leaf);
+        return -1;
+    }
+
+    if ((keys_seen != tree->size) || (tree->size != num_present)) {
+        nk_vc_printf("size is %lu, leaves hold %lu keys, reference holds %lu\n", tree->size, keys_seen, num_present);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * =================== Operations ===================
+ */
+
+static int check_lookup(carat_bptree *tree, uint64_t i)
+{
+    /*
+     * Lower bound of a key between i and i + 1 --- the reference answer
+     * is the greatest present key <= i
+     */
+    uintptr_t query = KEY(i) + (lrand48() % BPTREE_TEST_STRIDE);
+    allocation_entry *entry = carat_bptree_lower_bound(tree, query);
+
+    sint64_t expected = (sint64_t) i;
+    while ((expected >= 0) && !(present[expected])) { expected--; }
+
+    if (expected < 0)
+    {
+        if (entry) {
+            nk_vc_printf("lower bound of %p: found %p, expected nothing\n", (void *) query, entry->pointer);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (!entry || (((uintptr_t) entry->pointer) != KEY(expected)) || (entry->size != BPTREE_TEST_STRIDE)) {
+        nk_vc_printf("lower bound of %p: found %p, expected %p\n",
+                     (void *) query, (entry) ? entry->pointer : NULL, (void *) KEY(expected));
+        return -1;
+    }
+
+
+    /*
+     * Containment --- each entry covers exactly its stride, so only
+     * the key the query falls into can contain it
+     */
+    allocation_entry *found = carat_bptree_find(tree, query);
+    allocation_entry *containing = (expected == (sint64_t) i) ? entry : NULL;
+    if (found != containing)
+    {
+        nk_vc_printf("find %p: found %p, expected %p\n", (void *) query, 
+                     (found) ? found->pointer : NULL, (containing) ? containing->pointer : NULL);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int check_range(carat_bptree *tree)
+{
+    uint64_t start = lrand48() % BPTREE_TEST_KEYS;
+    uint64_t len = lrand48() % (BPTREE_TEST_KEYS / 4);
+    uint64_t i = start;
+
+    carat_bptree_iter it;
+    for (carat_bptree_iter_seek(tree, KEY(start), &it); carat_bptree_iter_valid(&it); carat_bptree_iter_next(&it))
+    {
+        uintptr_t key = (uintptr_t) carat_bptree_iter_entry(&it)->pointer;
+        if (key >= KEY(start + len)) { break; }
+
+        while ((i < BPTREE_TEST_KEYS) && !(present[i])) { i++; }
+        if ((i >= BPTREE_TEST_KEYS) || (key != KEY(i))) {
+            nk_vc_printf("range [%lu, %lu): iterated to %p, expected %p\n",
+                         start, start + len, (void *) key, (i < BPTREE_TEST_KEYS) ? (void *) KEY(i) : NULL);
+            return -1;
+        }
+        i++;
+    }
+
+    while ((i < (start + len)) && (i < BPTREE_TEST_KEYS) && !(present[i])) { i++; }
+    if ((i < (start + len)) && (i < BPTREE_TEST_KEYS)) {
+        nk_vc_printf("range [%lu, %lu): iteration stopped before %p\n", start, start + len, (void *) KEY(i));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int mutate(carat_bptree *tree, uint64_t i)
+{
+    if (present[i])
+    {
+        if (carat_bptree_remove(tree, KEY(i))) {
+            nk_vc_printf("remove %p failed\n", (void *) KEY(i));
+            return -1;
+        }
+
+        present[i] = 0;
+        num_present--;
+    }
+    else
+    {
+        allocation_entry entry = { .pointer = (void *) KEY(i), .size = BPTREE_TEST_STRIDE };
+        if (carat_bptree_insert(tree, &entry)) {
+            nk_vc_printf("insert %p failed\n", (void *) KEY(i));
+            return -1;
+        }
+
+        present[i] = 1;
+        num_present++;
+
+
+        /*
+         * Inserting again replaces the entry
+         */
+        if ((lrand48() % 8) == 0)
+        {
+            if (carat_bptree_insert(tree, &entry)) {
+                nk_vc_printf("insert %p again failed\n", (void *) KEY(i));
+                return -1;
+            }
+        }
+    }
+
+    return check_tree(tree);
+}
+
+
+/*
+ * Random operations, skewed towards removal for the second half of the
+ * run so the tree grows tall and then collapses
+ */
+static int run(carat_bptree *tree, uint64_t ops)
+{
+    for (uint64_t op = 0; op < ops; op++)
+    {
+        uint64_t i = lrand48() % BPTREE_TEST_KEYS;
+        uint64_t what = lrand48() % 8;
+        int shrinking = op >= (ops / 2);
+
+        if (what < 4)
+        {
+            /*
+             * Mutate --- only towards the current phase's direction
+             */
+            if (present[i] == shrinking) {
+                if (mutate(tree, i)) { return -1; }
+            }
+        }
+        else if (what < 7)
+        {
+            if (check_lookup(tree, i)) { return -1; }
+        }
+        else
+        {
+            if (check_range(tree)) { return -1; }
+        }
+
+        /*
+         * Keys inside an allocation are not keys of the map
+         */
+        if (((lrand48() % 16) == 0) && (carat_bptree_remove(tree, KEY(i) + 1) != -1)) {
+            nk_vc_printf("removing the absent key %p succeeded\n", (void *) (KEY(i) + 1));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int test_random(void)
+{
+    carat_bptree *tree = carat_bptree_create();
+    memset(present, 0, sizeof(present));
+    num_present = 0;
+
+    int rc = check_tree(tree) || run(tree, BPTREE_TEST_OPS);
+    nk_vc_printf("random inserts/removes: %s (%lu keys left, height %u)\n", (rc) ? "FAILED" : "passed", tree->size, tree->height);
+
+    carat_bptree_destroy(tree);
+
+    return rc;
+}
+
+
+static int test_bulk_load(void)
+{
+    carat_bptree *tree = carat_bptree_create();
+    memset(present, 0, sizeof(present));
+    num_present = 0;
+
+    allocation_entry *entries = (allocation_entry *) malloc(BPTREE_TEST_KEYS * sizeof(allocation_entry));
+    if (!entries) {
+        carat_bptree_destroy(tree);
+        return -1;
+    }
+
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < BPTREE_TEST_KEYS; i++)
+    {
+        if (lrand48() % 2) { continue; }
+        memset(&(entries[count]), 0, sizeof(allocation_entry));
+        entries[count].pointer = (void *) KEY(i);
+        entries[count].size = BPTREE_TEST_STRIDE;
+        count++;
+        present[i] = 1;
+        num_present++;
+    }
+
+    int rc = carat_bptree_bulk_load(tree, entries, count) || check_tree(tree) || run(tree, BPTREE_TEST_OPS / 2);
+    nk_vc_printf("bulk load of %lu keys, then random inserts/removes: %s\n", count, (rc) ? "FAILED" : "passed");
+
+    free(entries);
+    carat_bptree_destroy(tree);
+
+    return rc;
+}
+
+
+static int
+handle_carat_bptree_test (char * buf, void * priv)
+{
+    uint64_t seed;
+    if (sscanf(buf, "carat_bptree_test %lu", &seed) != 1) { seed = rdtsc(); }
+
+    nk_vc_printf("carat bptree test (seed %lu) ...\n", seed);
+    srand48(seed);
+
+    int rc = test_random() || test_bulk_load();
+    nk_vc_printf("carat bptree test %s\n", (rc) ? "FAILED" : "passed");
+
+    return 0;
+}
+
+static struct shell_cmd_impl carat_bptree_test_impl = {
+    .cmd      = "carat_bptree_test",
+    .help_str = "carat_bptree_test [seed]",
+    .handler  = handle_carat_bptree_test
+};
+
+nk_register_shell_cmd(carat_bptree_test_impl);
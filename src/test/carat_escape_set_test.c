@@ -0,0 +1,299 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh,
+ * 			Brian Suchy, Peter Dinda
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/shell.h>
+#include <nautilus/vc.h>
+#include <nautilus/libccompat.h>
+#include <nautilus/list.h>
+#include <aspace/escape_set.h>
+
+
+/*
+ * Escape set adds, iteration and teardown, checked against a reference
+ * (a presence bit per key) --- covers the move from the inline slots
+ * to the hash table, duplicate adds, iteration across resizes, and that
+ * destroying a set hands its memory back to the pool
+ */
+
+#define ESCAPE_SET_TEST_KEYS 512 /* key space --- tables stay within the arena classes */
+#define ESCAPE_SET_TEST_SETS 64
+#define ESCAPE_SET_TEST_OPS 50000
+
+/*
+ * Keys look like escape locations --- 8-byte aligned, and 0 is a
+ * valid key (an escape at offset 0 of its container)
+ */
+#define KEY(i) (((uintptr_t) (i)) * sizeof(void *))
+
+static uint8_t present[ESCAPE_SET_TEST_SETS][ESCAPE_SET_TEST_KEYS];
+static uint32_t num_present[ESCAPE_SET_TEST_SETS];
+static uint8_t seen[ESCAPE_SET_TEST_KEYS];
+
+
+/*
+ * Capacity a set of @size keys must have --- inline up to
+ * CARAT_ESCAPE_SET_INLINE_SLOTS keys, then the smallest doubling of
+ * CARAT_ESCAPE_SET_INITIAL_TABLE that stays at most 3/4 full
+ */
+static uint32_t expected_capacity(uint32_t size)
+{
+    if (size <= CARAT_ESCAPE_SET_INLINE_SLOTS) { return 0; }
+
+    uint32_t capacity = CARAT_ESCAPE_SET_INITIAL_TABLE;
+    while ((size * 4) > (capacity * 3)) { capacity *= 2; }
+
+    return capacity;
+}
+
+
+/*
+ * Check @set against the reference of set @s --- size, capacity, and
+ * that iteration visits every key exactly once
+ */
+static int check_set(carat_escape_set *set, uint32_t s)
+{
+    if (set->size != num_present[s]) {
+        nk_vc_printf("set %u: size %u, expected %u\n", s, set->size, num_present[s]);
+        return -1;
+    }
+
+    if (set->capacity != expected_capacity(set->size)) {
+        nk_vc_printf("set %u: capacity %u with %u keys, expected %u\n", s, set->capacity, set->size, expected_capacity(set->size));
+        return -1;
+    }
+
+    memset(seen, 0, sizeof(seen));
+
+    uint32_t visited = 0;
+    carat_escape_set_iter it;
+    for (carat_escape_set_iter_begin(set, &it); carat_escape_set_iter_valid(&it); carat_escape_set_iter_next(&it))
+    {
+        uintptr_t key = carat_escape_set_iter_key(&it);
+        uintptr_t i = key / sizeof(void *);
+
+        if ((key % sizeof(void *)) || (i >= ESCAPE_SET_TEST_KEYS) || !(present[s][i])) {
+            nk_vc_printf("set %u: iterated to %p, which was never added\n", s, (void *) key);
+            return -1;
+        }
+
+        if (seen[i]) {
+            nk_vc_printf("set %u: iterated to %p twice\n", s, (void *) key);
+            return -1;
+        }
+
+        seen[i] = 1;
+        visited++;
+    }
+
+    if (visited != num_present[s]) {
+        nk_vc_printf("set %u: iteration visited %u keys, expected %u\n", s, visited, num_present[s]);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Add key @i to @set (set @s of the reference) and check the set
+ */
+static int add(carat_escape_set_pool *pool, carat_escape_set *set, uint32_t s, uint64_t i)
+{
+    int expected = !(present[s][i]);
+    int added = carat_escape_set_add(pool, set, KEY(i));
+
+    if (added != expected) {
+        nk_vc_printf("set %u: adding %p returned %d, expected %d\n", s, (void *) KEY(i), added, expected);
+        return -1;
+    }
+
+    if (added)
+    {
+        present[s][i] = 1;
+        num_present[s]++;
+    }
+
+    return check_set(set, s);
+}
+
+
+static void reset(uint32_t s)
+{
+    memset(present[s], 0, sizeof(present[s]));
+    num_present[s] = 0;
+}
+
+
+/*
+ * Objects of @cache on the per-CPU free lists --- once every object
+ * has been freed, this is every object of every slab
+ */
+static uint64_t count_free(carat_slab_cache *cache)
+{
+    uint64_t count = 0;
+    for (uint64_t c = 0; c < cache->num_cpus; c++) {
+        for (void *object = cache->cpus[c].free; object; object = *((void **) object)) { count++; }
+    }
+
+    return count;
+}
+
+
+static int check_returned(carat_slab_cache *cache, char *what)
+{
+    uint64_t count = count_free(cache);
+    if (count != (cache->num_slabs * cache->objects_per_slab)) {
+        nk_vc_printf("%s: %lu of %lu objects were returned\n", what, count, cache->num_slabs * cache->objects_per_slab);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Keys in order, one set, through every resize up to the whole key
+ * space --- then every key again, which must all be duplicates
+ */
+static int test_grow(carat_escape_set_pool *pool)
+{
+    carat_escape_set *set = carat_escape_set_create(pool);
+    reset(0);
+
+    int rc = check_set(set, 0);
+    for (uint64_t i = 0; !rc && (i < ESCAPE_SET_TEST_KEYS); i++) {
+        rc = add(pool, set, 0, i);
+    }
+
+    for (uint64_t i = 0; !rc && (i < ESCAPE_SET_TEST_KEYS); i++) {
+        rc = add(pool, set, 0, i);
+    }
+
+    nk_vc_printf("grow through every resize to %u keys: %s (capacity %u)\n", set->size, (rc) ? "FAILED" : "passed", set->capacity);
+
+    carat_escape_set_destroy(pool, set);
+
+    return rc;
+}
+
+
+/*
+ * Random adds across many sets from a small key space, so duplicates
+ * are common both inline and in the table --- sets are now and then
+ * destroyed and rebuilt empty
+ */
+static int test_random(carat_escape_set_pool *pool)
+{
+    carat_escape_set *sets[ESCAPE_SET_TEST_SETS];
+    for (uint32_t s = 0; s < ESCAPE_SET_TEST_SETS; s++) {
+        sets[s] = carat_escape_set_create(pool);
+        reset(s);
+    }
+
+    int rc = 0;
+    for (uint64_t op = 0; !rc && (op < ESCAPE_SET_TEST_OPS); op++)
+    {
+        uint32_t s = lrand48() % ESCAPE_SET_TEST_SETS;
+
+        /*
+         * Skew sets towards a few keys --- most escape sets stay inline
+         */
+        uint64_t i = (s % 4) ? (lrand48() % (2 * CARAT_ESCAPE_SET_INLINE_SLOTS)) : (lrand48() % ESCAPE_SET_TEST_KEYS);
+
+        if ((lrand48() % 256) == 0)
+        {
+            carat_escape_set_destroy(pool, sets[s]);
+            sets[s] = carat_escape_set_create(pool);
+            reset(s);
+            rc = check_set(sets[s], s);
+        }
+        else
+        {
+            rc = add(pool, sets[s], s, i);
+        }
+    }
+
+    nk_vc_printf("random adds to %u sets: %s\n", ESCAPE_SET_TEST_SETS, (rc) ? "FAILED" : "passed");
+
+
+    /*
+     * Destroying every set must hand every set and table back
+     */
+    for (uint32_t s = 0; s < ESCAPE_SET_TEST_SETS; s++) {
+        carat_escape_set_destroy(pool, sets[s]);
+    }
+
+    return rc;
+}
+
+
+static int test_destroy(carat_escape_set_pool *pool)
+{
+    int rc = check_returned(pool->sets, "sets");
+    for (int c = 0; !rc && (c < CARAT_ARENA_CLASSES); c++) {
+        rc = check_returned(pool->tables->classes[c], "tables");
+    }
+
+    if (!rc && !list_empty(&(pool->tables->large))) {
+        nk_vc_printf("tables: large tables were not returned\n");
+        rc = -1;
+    }
+
+    nk_vc_printf("destroy returns sets and tables to the pool: %s\n", (rc) ? "FAILED" : "passed");
+
+    return rc;
+}
+
+
+static int
+handle_carat_escape_set_test (char * buf, void * priv)
+{
+    uint64_t seed;
+    if (sscanf(buf, "carat_escape_set_test %lu", &seed) != 1) { seed = rdtsc(); }
+
+    nk_vc_printf("carat escape set test (seed %lu) ...\n", seed);
+    srand48(seed);
+
+    carat_escape_set_pool *pool = carat_escape_set_pool_create();
+
+    int rc = test_grow(pool) || test_random(pool) || test_destroy(pool);
+    nk_vc_printf("carat escape set test %s\n", (rc) ? "FAILED" : "passed");
+
+    carat_escape_set_pool_destroy(pool);
+
+    return 0;
+}
+
+static struct shell_cmd_impl carat_escape_set_test_impl = {
+    .cmd      = "carat_escape_set_test",
+    .help_str = "carat_escape_set_test [seed]",
+    .handler  = handle_carat_escape_set_test
+};
+
+nk_register_shell_cmd(carat_escape_set_test_impl);
@@ -0,0 +1,396 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, Drew Kersnar <drewkersnar2021@u.northwestern.edu>
+ * Copyright (c) 2020, Gaurav Chaudhary <gauravchaudhary2021@u.northwestern.edu>
+ * Copyright (c) 2020, Souradip Ghosh <sgh@u.northwestern.edu>
+ * Copyright (c) 2020, Brian Suchy <briansuchy2022@u.northwestern.edu>
+ * Copyright (c) 2020, Peter Dinda <pdinda@northwestern.edu>
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * Authors: Drew Kersnar, Gaurav Chaudhary, Souradip Ghosh,
+ * 			Brian Suchy, Peter Dinda
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/shell.h>
+#include <nautilus/vc.h>
+#include <nautilus/thread.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/list.h>
+#include <nautilus/mm.h>
+#include <aspace/slab.h>
+
+
+/*
+ * Slab caches and arenas used from every CPU --- each CPU allocates a 
+ * batch of objects, the next CPU frees them and churns on its own, and 
+ * then the cache and arena are destroyed, checking with kmem stats that 
+ * every slab went back to kmem
+ */
+
+#define SLAB_TEST_OBJECT_SIZE 48
+#define SLAB_TEST_OBJECTS 4096 /* per CPU, from the cache */
+#define SLAB_TEST_ARENA_OBJECTS 256 /* per CPU, from the arena */
+#define SLAB_TEST_ARENA_MAX_SHIFT (CARAT_ARENA_MAX_SHIFT + 1) /* some objects above the largest class */
+#define SLAB_TEST_CHURN 16384
+
+typedef struct slab_test_batch_t {
+    void *objects[SLAB_TEST_OBJECTS];
+    void *arena_objects[SLAB_TEST_ARENA_OBJECTS];
+    uint64_t arena_sizes[SLAB_TEST_ARENA_OBJECTS];
+} slab_test_batch;
+
+typedef struct slab_test_worker_t {
+    carat_slab_cache *cache;
+    carat_arena *arena;
+    slab_test_batch *batches;
+    uint64_t num_cpus;
+    uint64_t cpu;
+    uint64_t random;
+    nk_thread_id_t tid;
+    int rc;
+} slab_test_worker;
+
+
+/*
+ * Per worker --- lrand48 is not safe to share between CPUs
+ */
+static uint64_t next_random(slab_test_worker *w)
+{
+    w->random ^= w->random << 13;
+    w->random ^= w->random >> 7;
+    w->random ^= w->random << 17;
+    return w->random;
+}
+
+
+/*
+ * Objects are filled with a tag naming their owner, so objects handed 
+ * out twice or overlapping show up as a wrong tag
+ */
+static uint64_t tag(uint64_t cpu, uint64_t index)
+{
+    return (cpu << 32) | index;
+}
+
+static void fill(void *object, uint64_t size, uint64_t t)
+{
+    for (uint64_t i = 0; i < (size / sizeof(uint64_t)); i++) { ((uint64_t *) object)[i] = t; }
+}
+
+static int check_fill(void *object, uint64_t size, uint64_t t)
+{
+    for (uint64_t i = 0; i < (size / sizeof(uint64_t)); i++)
+    {
+        if (((uint64_t *) object)[i] != t) {
+            nk_vc_printf("object %p (%lu bytes) was overwritten: %lx, expected %lx\n", object, size, ((uint64_t *) object)[i], t);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static uint64_t arena_size(slab_test_worker *w)
+{
+    uint64_t shift = 4 + (next_random(w) % (SLAB_TEST_ARENA_MAX_SHIFT - 3));
+    return (1UL << shift) - ((next_random(w) % 2) ? 8 : 0); /* exact and in-between sizes */
+}
+
+
+/*
+ * Fill this CPU's batch
+ */
+static void alloc_batch(void *in, void **out)
+{
+    slab_test_worker *w = (slab_test_worker *) in;
+    slab_test_batch *b = &(w->batches[w->cpu]);
+
+    for (uint64_t i = 0; i < SLAB_TEST_OBJECTS; i++)
+    {
+        b->objects[i] = carat_slab_alloc(w->cache);
+        fill(b->objects[i], SLAB_TEST_OBJECT_SIZE, tag(w->cpu, i));
+    }
+
+    for (uint64_t i = 0; i < SLAB_TEST_ARENA_OBJECTS; i++)
+    {
+        b->arena_sizes[i] = arena_size(w);
+        b->arena_objects[i] = carat_arena_alloc(w->arena, b->arena_sizes[i]);
+        fill(b->arena_objects[i], b->arena_sizes[i], tag(w->cpu, SLAB_TEST_OBJECTS + i));
+    }
+
+    w->rc = 0;
+
+    return;
+}
+
+
+/*
+ * Free the previous CPU's batch from this CPU, then allocate and free 
+ * at random, returning everything allocated here
+ */
+static void free_batch(void *in, void **out)
+{
+    slab_test_worker *w = (slab_test_worker *) in;
+    uint64_t owner = (w->cpu + w->num_cpus - 1) % w->num_cpus;
+    slab_test_batch *b = &(w->batches[owner]);
+
+    w->rc = 0;
+
+    for (uint64_t i = 0; i < SLAB_TEST_OBJECTS; i++)
+    {
+        w->rc |= check_fill(b->objects[i], SLAB_TEST_OBJECT_SIZE, tag(owner, i));
+        carat_slab_free(w->cache, b->objects[i]);
+        b->objects[i] = NULL;
+    }
+
+    for (uint64_t i = 0; i < SLAB_TEST_ARENA_OBJECTS; i++)
+    {
+        w->rc |= check_fill(b->arena_objects[i], b->arena_sizes[i], tag(owner, SLAB_TEST_OBJECTS + i));
+        carat_arena_free(w->arena, b->arena_objects[i], b->arena_sizes[i]);
+        b->arena_objects[i] = NULL;
+    }
+
+
+    /*
+     * Churn --- the slots of the batch just freed are reused as the 
+     * live set
+     */
+    for (uint64_t op = 0; op < SLAB_TEST_CHURN; op++)
+    {
+        uint64_t i = next_random(w) % SLAB_TEST_OBJECTS;
+        uint64_t t = tag(w->cpu, i) | (1UL << 63);
+
+        if (b->objects[i])
+        {
+            w->rc |= check_fill(b->objects[i], SLAB_TEST_OBJECT_SIZE, t);
+            carat_slab_free(w->cache, b->objects[i]);
+            b->objects[i] = NULL;
+        }
+        else
+        {
+            b->objects[i] = carat_slab_alloc(w->cache);
+            fill(b->objects[i], SLAB_TEST_OBJECT_SIZE, t);
+        }
+    }
+
+    for (uint64_t i = 0; i < SLAB_TEST_OBJECTS; i++)
+    {
+        if (b->objects[i])
+        {
+            w->rc |= check_fill(b->objects[i], SLAB_TEST_OBJECT_SIZE, tag(w->cpu, i) | (1UL << 63));
+            carat_slab_free(w->cache, b->objects[i]);
+        }
+    }
+
+    return;
+}
+
+
+/*
+ * Run @fun on every CPU and wait for all of them
+ */
+static int run_on_all_cpus(nk_thread_fun_t fun, slab_test_worker *workers, uint64_t num_cpus)
+{
+    for (uint64_t c = 0; c < num_cpus; c++)
+    {
+        workers[c].rc = -1;
+        if (nk_thread_start(fun, &(workers[c]), NULL, 0, TSTACK_DEFAULT, &(workers[c].tid), c)) {
+            nk_vc_printf("cannot start a worker on cpu %lu\n", c);
+            for (uint64_t j = 0; j < c; j++) { nk_join(workers[j].tid, NULL); }
+            return -1;
+        }
+    }
+
+    int rc = 0;
+    for (uint64_t c = 0; c < num_cpus; c++)
+    {
+        nk_join(workers[c].tid, NULL);
+        rc |= workers[c].rc;
+    }
+
+    return rc;
+}
+
+
+/*
+ * Objects of @cache on the per-CPU free lists --- once every object
+ * has been freed, this is every object of every slab
+ */
+static int check_all_free(carat_slab_cache *cache, char *what)
+{
+    uint64_t count = 0;
+    for (uint64_t c = 0; c < cache->num_cpus; c++) {
+        for (void *object = cache->cpus[c].free; object; object = *((void **) object)) { count++; }
+    }
+
+    if (count != (cache->num_slabs * cache->objects_per_slab)) {
+        nk_vc_printf("%s: %lu of %lu objects are free\n", what, count, cache->num_slabs * cache->objects_per_slab);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static uint64_t kmem_bytes_free(void)
+{
+    uint64_t num = kmem_num_pools();
+    struct kmem_stats *s = malloc(sizeof(struct kmem_stats) + (num * sizeof(struct buddy_pool_stats)));
+    if (!s) { return 0; }
+
+    s->max_pools = num;
+    kmem_stats(s);
+
+    uint64_t bytes = s->total_bytes_free;
+    free(s);
+
+    return bytes;
+}
+
+
+/*
+ * kmem hands out power-of-2 blocks
+ */
+static uint64_t kmem_block_bytes(uint64_t size)
+{
+    uint64_t block = 1;
+    while (block < size) { block <<= 1; }
+    return block;
+}
+
+
+/*
+ * Destroy @cache and @arena, and check that kmem got at least 
+ * their slabs back --- other threads may free memory at the same time,
+ * but nothing here allocates
+ */
+static int check_destroy(carat_slab_cache *cache, carat_arena *arena)
+{
+    uint64_t slab_bytes = cache->num_slabs * kmem_block_bytes(cache->slab_bytes);
+    for (int c = 0; c < CARAT_ARENA_CLASSES; c++) {
+        slab_bytes += arena->classes[c]->num_slabs * kmem_block_bytes(arena->classes[c]->slab_bytes);
+    }
+
+    uint64_t before = kmem_bytes_free();
+    carat_slab_cache_destroy(cache);
+    carat_arena_destroy(arena);
+    uint64_t after = kmem_bytes_free();
+
+    uint64_t freed = (after > before) ? (after - before) : 0;
+    if (freed < slab_bytes) {
+        nk_vc_printf("destroy returned %lu bytes to kmem, expected at least %lu\n", freed, slab_bytes);
+        return -1;
+    }
+
+    nk_vc_printf("destroy returned %lu bytes to kmem (%lu in slabs)\n", freed, slab_bytes);
+
+    return 0;
+}
+
+
+static int
+handle_carat_slab_test (char * buf, void * priv)
+{
+    uint64_t seed;
+    if (sscanf(buf, "carat_slab_test %lu", &seed) != 1) { seed = rdtsc(); }
+
+    uint64_t num_cpus = nk_get_num_cpus();
+    nk_vc_printf("carat slab test on %lu cpus (seed %lu) ...\n", num_cpus, seed);
+
+    slab_test_batch *batches = (slab_test_batch *) malloc(num_cpus * sizeof(slab_test_batch));
+    slab_test_worker *workers = (slab_test_worker *) malloc(num_cpus * sizeof(slab_test_worker));
+    if (!batches || !workers)
+    {
+        nk_vc_printf("cannot allocate the test state\n");
+        free(batches);
+        free(workers);
+        return 0;
+    }
+
+    carat_slab_cache *cache = carat_slab_cache_create(SLAB_TEST_OBJECT_SIZE);
+    carat_arena *arena = carat_arena_create();
+
+    for (uint64_t c = 0; c < num_cpus; c++)
+    {
+        workers[c].cache = cache;
+        workers[c].arena = arena;
+        workers[c].batches = batches;
+        workers[c].num_cpus = num_cpus;
+        workers[c].cpu = c;
+        workers[c].random = seed + ((c + 1) * 0x9E3779B97F4A7C15ULL);
+        if (!(workers[c].random)) { workers[c].random = 1; }
+    }
+
+    int rc = run_on_all_cpus(alloc_batch, workers, num_cpus);
+    nk_vc_printf("allocate on every cpu: %s (%lu slabs)\n", (rc) ? "FAILED" : "passed", cache->num_slabs);
+
+    if (!rc) {
+        rc = run_on_all_cpus(free_batch, workers, num_cpus);
+        nk_vc_printf("free on the next cpu, then churn: %s\n", (rc) ? "FAILED" : "passed");
+    }
+
+
+    /*
+     * Every object is back on some CPU's free list
+     */
+    if (!rc)
+    {
+        rc = check_all_free(cache, "cache");
+        for (int c = 0; !rc && (c < CARAT_ARENA_CLASSES); c++) {
+            rc = check_all_free(arena->classes[c], "arena");
+        }
+
+        if (!rc && !list_empty(&(arena->large))) {
+            nk_vc_printf("arena: large objects were not freed\n");
+            rc = -1;
+        }
+
+        nk_vc_printf("every object returned to the free lists: %s\n", (rc) ? "FAILED" : "passed");
+    }
+
+    /*
+     * Every worker has been joined, so nothing uses the cache or the
+     * arena anymore --- objects still live after a failure die with them
+     */
+    if (rc)
+    {
+        carat_slab_cache_destroy(cache);
+        carat_arena_destroy(arena);
+    }
+    else
+    {
+        rc = check_destroy(cache, arena);
+    }
+
+    nk_vc_printf("carat slab test %s\n", (rc) ? "FAILED" : "passed");
+
+    free(batches);
+    free(workers);
+
+    return 0;
+}
+
+static struct shell_cmd_impl carat_slab_test_impl = {
+    .cmd      = "carat_slab_test",
+    .help_str = "carat_slab_test [seed]",
+    .handler  = handle_carat_slab_test
+};
+
+nk_register_shell_cmd(carat_slab_test_impl);
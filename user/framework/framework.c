@@ -117,6 +117,13 @@ void nk_carat_instrument_global(void *ptr, uint64_t size, uint64_t global_ID) {
     return;
 }
 
+__attribute__((noinline, used, annotate("nocarat")))
+void nk_carat_instrument_globals(void *globals, uint64_t num_globals) {
+    BACKSTOP;
+    __nk_func_table[NK_CARAT_INSTRUMENT_GLOBALS](globals, num_globals);
+    return;
+}
+
 __attribute__((noinline, used, annotate("nocarat")))
 void nk_carat_instrument_malloc(void *ptr, uint64_t size) {
     BACKSTOP;
@@ -163,6 +170,12 @@ void nk_carat_instrument_escapes(void *ptr) {
 
 }
 
+__attribute__((noinline, used, annotate("nocarat")))
+void nk_carat_escape_log_full(void *ptr) {
+    BACKSTOP;
+    __nk_func_table[NK_CARAT_ESCAPE_LOG_FULL](ptr);
+}
+
 
 // ---
 #if USER_TIMING
@@ -271,6 +284,17 @@ void nk_carat_guard_callee_stack(uint64_t stack_frame_size) {
     __nk_func_table[NK_CARAT_STACK_PROTECT](stack_frame_size);
 }
 
+__attribute__((noinline, used, annotate("nocarat")))
+void nk_carat_guard_range(void *base, uint64_t len, int is_write) {
+    BACKSTOP;
+#if USER_REGION_CHECK
+    nk_aspace_t *aspace = ((nk_aspace_t *) __nk_func_table[NK_ASPACE_PTR]);
+    __nk_func_table[NK_CARAT_RANGE_PROTECT](base, len, is_write, (void *) aspace);
+#else
+    __nk_func_table[NK_CARAT_RANGE_PROTECT](base, len, is_write);
+#endif
+}
+
 __attribute__((noinline, used, annotate("nocarat")))
 void nk_carat_pin_pointer(void *address) {
     __nk_func_table[NK_CARAT_PIN_DIRECT](address);
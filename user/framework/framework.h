@@ -7,13 +7,16 @@
  * Function signatures for instrumentation methods
  */ 
 void nk_carat_instrument_global(void *ptr, uint64_t size, uint64_t global_ID) ;
+void nk_carat_instrument_globals(void *globals, uint64_t num_globals) ;
 void nk_carat_instrument_malloc(void *ptr, uint64_t size) ;
 void nk_carat_instrument_calloc(void *ptr, uint64_t size_of_element, uint64_t num_elements) ;
 void nk_carat_instrument_realloc(void *ptr, uint64_t size, void *old_address) ;
 void nk_carat_instrument_free(void *ptr) ;
 void nk_carat_instrument_escapes(void *ptr) ; 
+void nk_carat_escape_log_full(void *ptr) ;
 void nk_carat_guard_address(void *memory_address, int is_write) ;
 void nk_carat_guard_callee_stack(uint64_t stack_frame_size) ;
+void nk_carat_guard_range(void *base, uint64_t len, int is_write) ;
 void nk_carat_pin_pointer(void *address) ;
 void nk_carat_pin_escaped_pointer(void *escape) ;
 void _nk_carat_globals_compiler_target(void) ;
@@ -58,13 +61,16 @@ void _framework_persist_function_signatures(void)
         test_ptr = realloc(test_ptr, _DUMMY_SIZE);
         free(test_ptr);
         nk_carat_instrument_global(NULL, 0, 0);
+        nk_carat_instrument_globals(NULL, 0);
         nk_carat_instrument_malloc(NULL, 0);
         nk_carat_instrument_calloc(NULL, 0, 0);
         nk_carat_instrument_realloc(NULL, 0, NULL);
         nk_carat_instrument_free(NULL);
         nk_carat_instrument_escapes(NULL);
+        nk_carat_escape_log_full(NULL);
         nk_carat_guard_address(NULL, 0) ;
         nk_carat_guard_callee_stack(0) ;
+        nk_carat_guard_range(NULL, 0, 0) ;
         nk_carat_pin_pointer(NULL) ;
         nk_carat_pin_escaped_pointer(NULL) ;
         _nk_carat_globals_compiler_target();